@@ -40,9 +40,11 @@
 #define IB_METHOD_GET       0x01
 #define IB_METHOD_SET       0x02
 #define IB_METHOD_SEND      0x03
+#define IB_METHOD_REPORT    0x06
 #define IB_METHOD_GET_TABLE 0x12
 #define IB_METHOD_DELETE    0x15
 #define IB_METHOD_RESP      0x80
+#define IB_METHOD_REPORT_RESP (IB_METHOD_RESP | IB_METHOD_REPORT)
 
 #define ACM_MGMT_CLASS   0x2C
 
@@ -187,4 +189,47 @@ struct ib_mc_member_rec {
 	uint8_t       pad[4];
 };
 
+#define IB_SA_ATTR_NOTICE      htobe16(0x0002)
+#define IB_SA_ATTR_INFORM_INFO htobe16(0x0003)
+
+#define IB_TRAP_GID_IN_SERVICE  64
+#define IB_TRAP_GID_OUT_SERVICE 65
+
+#define IB_COMP_MASK_II_LID_RANGE_BEGIN     htobe64(1 << 1)
+#define IB_COMP_MASK_II_IS_GENERIC          htobe64(1 << 4)
+#define IB_COMP_MASK_II_SUBSCRIBE           htobe64(1 << 5)
+#define IB_COMP_MASK_II_TYPE                htobe64(1 << 6)
+#define IB_COMP_MASK_II_TRAP_NUM            htobe64(1 << 7)
+#define IB_COMP_MASK_II_PRODUCER_TYPE       htobe64(1 << 12)
+
+#define IB_NOTICE_TYPE_ALL      0xFFFF
+#define IB_NOTICE_PRODUCER_ALL  0xFFFFFF
+
+struct ib_inform_info {
+	union ibv_gid gid;
+	__be16        lid_range_begin;
+	__be16        lid_range_end;
+	__be16        reserved1;
+	uint8_t       is_generic;
+	uint8_t       subscribe;
+	__be16        type;
+	__be16        trap_num;
+	__be32        qpn_resp_time;
+	__be32        producer_type;
+};
+
+struct ib_notice {
+	uint8_t       generic_type;
+	uint8_t       producer_type[3];
+	__be16        trap_num;
+	__be16        issuer_lid;
+	__be16        toggle_count;
+	uint8_t       details[54];
+	union ibv_gid issuer_gid;
+};
+
+#define IB_NOTICE_GENERIC 0x80
+/* Traps 64 - 67 carry the port or group GID at this offset of details */
+#define ib_notice_gid(notice) ((union ibv_gid *) &(notice)->details[6])
+
 #endif /* ACM_MAD_H */
@@ -108,6 +108,11 @@ struct acm_ep_addr_data {
  * used to communicate with the local ib_acm service.  Message fields
  * in this case are not byte swapped, but note that the acm_ep_info
  * data is in network order.
+ *
+ * A client may send several resolve requests without waiting for the
+ * responses.  The service works on them concurrently and answers each
+ * one as soon as it completes, so responses may arrive in any order.
+ * The tid of a request is returned unchanged in its response.
  */
 struct acm_resolve_msg {
 	struct acm_hdr          hdr;
@@ -122,6 +127,12 @@ enum {
 	ACM_CNTR_ADDR_CACHE,
 	ACM_CNTR_ROUTE_QUERY,
 	ACM_CNTR_ROUTE_CACHE,
+	ACM_CNTR_DEST_CACHE_HIT,
+	ACM_CNTR_DEST_CACHE_MISS,
+	ACM_CNTR_DEST_CACHE_EVICT,
+	ACM_CNTR_DEST_CACHE_NEG,
+	ACM_CNTR_ROUTE_REFRESH,
+	ACM_CNTR_DEST_INVALIDATE,
 	ACM_MAX_COUNTER
 };
 
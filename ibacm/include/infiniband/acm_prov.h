@@ -82,6 +82,9 @@ struct acm_provider {
 	int	(*query)(void *addr_context, struct acm_msg *msg, uint64_t id);
 	int	(*handle_event)(void *port_context, enum ibv_event_type type);
 	void	(*query_perf)(void *ep_context, uint64_t *values, uint8_t *cnt);
+	/* Optional, called for every SA report (trap notice) on the port */
+	void	(*handle_sa_report)(void *port_context,
+			struct umad_sa_packet *report);
 };
 
 int provider_query(struct acm_provider **info, uint32_t *version);
@@ -101,6 +104,11 @@ extern __be64 acm_path_comp_mask(struct ibv_path_record *path);
 
 extern int acm_resolve_response(uint64_t id, struct acm_msg *msg);
 extern int acm_query_response(uint64_t id, struct acm_msg *msg);
+/*
+ * Stop serving resolutions from the client visible cache, providers call
+ * this when an answer they gave earlier may no longer be valid.
+ */
+extern void acm_flush_cache(void);
 
 extern enum ibv_rate acm_get_rate(uint8_t width, uint8_t speed);
 extern enum ibv_mtu acm_convert_mtu(int mtu);
@@ -117,6 +125,13 @@ acm_alloc_sa_mad(const struct acm_endpoint *endpoint, void *context,
 		 void (*handler)(struct acm_sa_mad *));
 extern void acm_free_sa_mad(struct acm_sa_mad *mad);
 extern int acm_send_sa_mad(struct acm_sa_mad *mad);
+/*
+ * Responses that span several MADs, such as the reply to a GetTable, are
+ * reassembled by the kernel.  Returns the complete SA response to a request
+ * and its length; for single MAD responses that is mad->sa_mad.
+ */
+extern struct umad_sa_packet *acm_get_sa_mad_data(struct acm_sa_mad *mad,
+						  size_t *len);
 
 extern const char *acm_get_opts_file(void);
 extern void acm_increment_counter(int type);
@@ -39,7 +39,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/mman.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
 #include <dirent.h>
 #include <infiniband/acm.h>
 #include <infiniband/acm_prov.h>
@@ -49,7 +52,6 @@
 #include <infiniband/umad_sa_mcm.h>
 #include <ifaddrs.h>
 #include <dlfcn.h>
-#include <search.h>
 #include <netdb.h>
 #include <net/if.h>
 #include <sys/ioctl.h>
@@ -58,7 +60,9 @@
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 #include <inttypes.h>
+#include <poll.h>
 #include <ccan/list.h>
+#include <util/util.h>
 #include "acm_util.h"
 #include "acm_mad.h"
 
@@ -67,6 +71,13 @@
 #define MAX_EP_ADDR 4
 #define MAX_EP_MC   2
 
+#define ACMP_DEST_LOCKS       64
+#define ACMP_DEST_MAX_BUCKETS (1 << 20)
+
+/* The timer wheel covers ACMP_WHEEL_SLOTS * ACMP_WHEEL_TICK ms per turn */
+#define ACMP_WHEEL_SLOTS      256
+#define ACMP_WHEEL_TICK       8
+
 enum acmp_state {
 	ACMP_INIT,
 	ACMP_QUERY_ADDR,
@@ -91,7 +102,8 @@ enum acmp_loopback_prot {
 
 enum acmp_route_preload {
 	ACMP_ROUTE_PRELOAD_NONE,
-	ACMP_ROUTE_PRELOAD_OSM_FULL_V1
+	ACMP_ROUTE_PRELOAD_OSM_FULL_V1,
+	ACMP_ROUTE_PRELOAD_SA_PATH_TABLE
 };
 
 enum acmp_addr_preload {
@@ -100,7 +112,8 @@ enum acmp_addr_preload {
 };
 
 /*
- * Nested locking order: dest -> ep, dest -> port
+ * Nested locking order: dest -> ep, dest -> port,
+ * dest cache bucket -> dest cache lru, dest cache bucket -> dest
  */
 struct acmp_ep;
 
@@ -121,10 +134,33 @@ struct acmp_dest {
 	uint64_t	       route_timeout;
 	uint8_t                addr_type;
 	struct acmp_ep         *ep;
+	/* Failed resolutions are answered from the cache until neg_timeout */
+	uint64_t               neg_timeout;
+	uint8_t                neg_status;
+	/* A path query renewing a READY route is in flight */
+	bool                   refreshing;
+	/* Protected by the dest cache bucket lock */
+	struct list_node       hash_entry;
+	bool                   cached;
+	/* Protected by the dest cache lru lock */
+	struct list_node       lru_entry;
+	bool                   on_lru;
+	bool                   referenced;
 };
 
 struct acmp_device;
 
+/*
+ * Requests waiting for a response, hashed by the tick in which they expire.
+ * Requests due in a later turn share the slot and are skipped until then.
+ */
+struct acmp_timer_wheel {
+	struct list_head    slot[ACMP_WHEEL_SLOTS];
+	/* First tick that has not been run */
+	uint64_t            tick;
+	int                 cnt;
+};
+
 struct acmp_port {
 	struct acmp_device  *dev;
 	const struct acm_port *port;
@@ -139,20 +175,44 @@ struct acmp_port {
 	uint16_t            lid;
 	uint16_t            lid_mask;
 	uint8_t             port_num;
+	/* InformInfo for the GID in/out of service traps was sent */
+	bool                subscribed;
+	/* Endpoints waiting to fetch the path table, one at a time */
+	struct list_head    prefetch_wait;
+	bool                prefetching;
+	/* Completions and timeouts of the port's endpoints */
+	struct ibv_comp_channel *channel;
+	pthread_t           comp_thread_id;
+	/* Only used by the completion thread */
+	struct acmp_timer_wheel wheel;
 };
 
 struct acmp_device {
 	struct ibv_context      *verbs;
 	const struct acm_device *device;
-	struct ibv_comp_channel *channel;
 	struct ibv_pd           *pd;
 	__be64                  guid;
 	struct list_node        entry;
-	pthread_t               comp_thread_id;
 	int                     port_cnt;
 	struct acmp_port        port[0];
 };
 
+/*
+ * Resolved destinations, hashed on address type and address.  Lookups only
+ * take the read side of the lock striping their bucket.  Entries that can be
+ * rebuilt from the fabric sit on an lru list and are evicted with a second
+ * chance scan once the cache grows past dest_cache_size; preloaded and
+ * loopback entries are pinned and never evicted.
+ */
+struct acmp_dest_cache {
+	struct list_head      *bucket;
+	uint32_t              mask;
+	pthread_rwlock_t      lock[ACMP_DEST_LOCKS];
+	pthread_mutex_t       lru_lock;
+	struct list_head      lru;
+	int                   lru_cnt;
+};
+
 /* Maintain separate virtual send queues to avoid deadlock */
 struct acmp_send_queue {
 	int                   credits;
@@ -173,8 +233,10 @@ struct acmp_ep {
 	struct ibv_mr         *mr;
 	uint8_t               *recv_bufs;
 	struct list_node      entry;
+	struct list_node      prefetch_entry;
+	uint64_t              prefetch_start;
 	char		      id_string[IBV_SYSFS_NAME_MAX + 11];
-	void                  *dest_map[ACM_ADDRESS_RESERVED - 1];
+	struct acmp_dest_cache dest_cache;
 	struct acmp_dest      mc_dest[MAX_EP_MC];
 	int                   mc_cnt;
 	uint16_t              pkey_index;
@@ -192,6 +254,7 @@ struct acmp_ep {
 
 struct acmp_send_msg {
 	struct list_node     entry;
+	struct list_node     timer_entry;
 	struct acmp_ep       *ep;
 	struct acmp_dest     *dest;
 	struct ibv_ah        *ah;
@@ -229,6 +292,8 @@ static int acmp_resolve(void *addr_context, struct acm_msg *msg, uint64_t id);
 static int acmp_query(void *addr_context, struct acm_msg *msg, uint64_t id);
 static int acmp_handle_event(void *port_context, enum ibv_event_type type);
 static void acmp_query_perf(void *ep_context, uint64_t *values, uint8_t *cnt);
+static void acmp_handle_sa_report(void *port_context,
+				  struct umad_sa_packet *report);
 
 static struct acm_provider def_prov = {
 	.size = sizeof(struct acm_provider),
@@ -246,17 +311,15 @@ static struct acm_provider def_prov = {
 	.query = acmp_query,
 	.handle_event = acmp_handle_event,
 	.query_perf = acmp_query_perf,
+	.handle_sa_report = acmp_handle_sa_report,
 };
 
 static LIST_HEAD(acmp_dev_list);
 static pthread_mutex_t acmp_dev_lock;
 
 static atomic_t g_tid;
-static LIST_HEAD(timeout_list);
-static event_t timeout_event;
-static atomic_t wait_cnt;
-static pthread_t retry_thread_id;
-static int retry_thread_started = 0;
+static pthread_t snapshot_thread_id;
+static int snapshot_thread_started = 0;
 
 static __thread char log_data[ACM_MAX_ADDRESS];
 
@@ -277,16 +340,18 @@ static int send_depth = 1;
 static int recv_depth = 1024;
 static uint8_t min_mtu = IBV_MTU_2048;
 static uint8_t min_rate = IBV_RATE_10_GBPS;
+static int dest_cache_size = 65536;
+static int negative_timeout = 1000;
+static int refresh_ahead = 1;
+static int subscribe_traps = 1;
+static int cache_snapshot = 0;
+static char cache_snapshot_file[128] = IBACM_SNAPSHOT_FILE;
+static int cache_snapshot_interval = 300;
 static enum acmp_route_preload route_preload;
 static enum acmp_addr_preload addr_preload;
 
 static int acmp_initialized = 0;
 
-static int acmp_compare_dest(const void *dest1, const void *dest2)
-{
-	return memcmp(dest1, dest2, ACM_MAX_ADDRESS);
-}
-
 static void
 acmp_set_dest_addr(struct acmp_dest *dest, uint8_t addr_type,
 		   const uint8_t *addr, size_t size)
@@ -325,19 +390,80 @@ acmp_alloc_dest(uint8_t addr_type, const uint8_t *addr)
 	return dest;
 }
 
-/* Caller must hold ep lock. */
+static int acmp_init_dest_cache(struct acmp_dest_cache *cache)
+{
+	uint32_t i, size;
+
+	size = dest_cache_size > 0 ? dest_cache_size / 4 : 0;
+	size = roundup_pow_of_two(max_t(uint32_t, size, ACMP_DEST_LOCKS));
+	size = min_t(uint32_t, size, ACMP_DEST_MAX_BUCKETS);
+
+	cache->bucket = calloc(size, sizeof(*cache->bucket));
+	if (!cache->bucket)
+		return -1;
+
+	cache->mask = size - 1;
+	for (i = 0; i < size; i++)
+		list_head_init(&cache->bucket[i]);
+	for (i = 0; i < ACMP_DEST_LOCKS; i++)
+		pthread_rwlock_init(&cache->lock[i], NULL);
+	pthread_mutex_init(&cache->lru_lock, NULL);
+	list_head_init(&cache->lru);
+	return 0;
+}
+
+static uint32_t acmp_dest_hash(uint8_t addr_type, const uint8_t *addr)
+{
+	uint32_t hash = 2166136261U ^ addr_type;
+	int i;
+
+	/* FNV-1a */
+	for (i = 0; i < ACM_MAX_ADDRESS; i++) {
+		hash ^= addr[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static inline pthread_rwlock_t *
+acmp_dest_lock(struct acmp_dest_cache *cache, uint32_t hash)
+{
+	return &cache->lock[hash & (ACMP_DEST_LOCKS - 1)];
+}
+
+/* Caller must hold the bucket lock. */
+static struct acmp_dest *
+acmp_lookup_dest(struct acmp_dest_cache *cache, uint32_t hash,
+		 uint8_t addr_type, const uint8_t *addr)
+{
+	struct acmp_dest *dest;
+
+	list_for_each(&cache->bucket[hash & cache->mask], dest, hash_entry) {
+		if (dest->addr_type == addr_type &&
+		    !memcmp(dest->address, addr, ACM_MAX_ADDRESS))
+			return dest;
+	}
+	return NULL;
+}
+
 static struct acmp_dest *
 acmp_get_dest(struct acmp_ep *ep, uint8_t addr_type, const uint8_t *addr)
 {
-	struct acmp_dest *dest, **tdest;
+	struct acmp_dest_cache *cache = &ep->dest_cache;
+	uint32_t hash = acmp_dest_hash(addr_type, addr);
+	struct acmp_dest *dest;
 
-	tdest = tfind(addr, &ep->dest_map[addr_type - 1], acmp_compare_dest);
-	if (tdest) {
-		dest = *tdest;
+	pthread_rwlock_rdlock(acmp_dest_lock(cache, hash));
+	dest = acmp_lookup_dest(cache, hash, addr_type, addr);
+	if (dest) {
 		(void) atomic_inc(&dest->refcnt);
+		dest->referenced = true;
+	}
+	pthread_rwlock_unlock(acmp_dest_lock(cache, hash));
+
+	if (dest) {
 		acm_log(2, "%s\n", dest->name);
 	} else {
-		dest = NULL;
 		acm_format_name(2, log_data, sizeof log_data,
 				addr_type, addr, ACM_MAX_ADDRESS);
 		acm_log(2, "%s not found\n", log_data);
@@ -354,16 +480,130 @@ acmp_put_dest(struct acmp_dest *dest)
 	}
 }
 
-/* Caller must hold ep lock. */
+/* Drops the reference held by the cache, the caller keeps its own. */
 static void
 acmp_remove_dest(struct acmp_ep *ep, struct acmp_dest *dest)
 {
+	struct acmp_dest_cache *cache = &ep->dest_cache;
+	uint32_t hash = acmp_dest_hash(dest->addr_type, dest->address);
+	bool removed;
+
 	acm_log(2, "%s\n", dest->name);
-	if (!tdelete(dest->address, &ep->dest_map[dest->addr_type - 1],
-		     acmp_compare_dest))
-		acm_log(0, "ERROR: %s not found!!\n", dest->name);
+	pthread_rwlock_wrlock(acmp_dest_lock(cache, hash));
+	removed = dest->cached;
+	if (removed) {
+		list_del(&dest->hash_entry);
+		dest->cached = false;
+
+		pthread_mutex_lock(&cache->lru_lock);
+		if (dest->on_lru) {
+			list_del(&dest->lru_entry);
+			dest->on_lru = false;
+			cache->lru_cnt--;
+		}
+		pthread_mutex_unlock(&cache->lru_lock);
+	}
+	pthread_rwlock_unlock(acmp_dest_lock(cache, hash));
 
-	acmp_put_dest(dest);
+	if (removed)
+		acmp_put_dest(dest);
+}
+
+/* Keeps a preloaded or local destination from being evicted. */
+static void
+acmp_pin_dest(struct acmp_ep *ep, struct acmp_dest *dest)
+{
+	struct acmp_dest_cache *cache = &ep->dest_cache;
+
+	pthread_mutex_lock(&cache->lru_lock);
+	if (dest->on_lru) {
+		list_del(&dest->lru_entry);
+		dest->on_lru = false;
+		cache->lru_cnt--;
+	}
+	pthread_mutex_unlock(&cache->lru_lock);
+}
+
+static void acmp_evict_dest(struct acmp_ep *ep)
+{
+	struct acmp_dest_cache *cache = &ep->dest_cache;
+	struct acmp_dest *dest, *victim = NULL;
+	int i;
+
+	pthread_mutex_lock(&cache->lru_lock);
+	for (i = 0; i < cache->lru_cnt && cache->lru_cnt > dest_cache_size;
+	     i++) {
+		dest = list_top(&cache->lru, struct acmp_dest, lru_entry);
+
+		/*
+		 * Give recently used entries a second chance and leave those
+		 * with a resolution in flight or held by a caller alone.
+		 */
+		if (dest->referenced || atomic_get(&dest->refcnt) > 1 ||
+		    dest->state == ACMP_QUERY_ADDR ||
+		    dest->state == ACMP_QUERY_ROUTE) {
+			dest->referenced = false;
+			list_del(&dest->lru_entry);
+			list_add_tail(&cache->lru, &dest->lru_entry);
+			continue;
+		}
+
+		victim = dest;
+		(void) atomic_inc(&victim->refcnt);
+		break;
+	}
+	pthread_mutex_unlock(&cache->lru_lock);
+
+	if (!victim)
+		return;
+
+	acm_log(2, "evicting %s\n", victim->name);
+	acm_increment_counter(ACM_CNTR_DEST_CACHE_EVICT);
+	atomic_inc(&ep->counters[ACM_CNTR_DEST_CACHE_EVICT]);
+	acmp_remove_dest(ep, victim);
+	acmp_put_dest(victim);
+	acm_flush_cache();
+}
+
+static struct acmp_dest *
+acmp_insert_dest(struct acmp_ep *ep, uint8_t addr_type, const uint8_t *addr)
+{
+	struct acmp_dest_cache *cache = &ep->dest_cache;
+	uint32_t hash = acmp_dest_hash(addr_type, addr);
+	struct acmp_dest *dest, *new_dest;
+	bool evict = false;
+
+	new_dest = acmp_alloc_dest(addr_type, addr);
+	if (!new_dest)
+		return NULL;
+	new_dest->ep = ep;
+
+	pthread_rwlock_wrlock(acmp_dest_lock(cache, hash));
+	dest = acmp_lookup_dest(cache, hash, addr_type, addr);
+	if (!dest) {
+		/* The cache keeps the initial reference */
+		dest = new_dest;
+		new_dest = NULL;
+		list_add(&cache->bucket[hash & cache->mask], &dest->hash_entry);
+		dest->cached = true;
+
+		pthread_mutex_lock(&cache->lru_lock);
+		list_add_tail(&cache->lru, &dest->lru_entry);
+		dest->on_lru = true;
+		cache->lru_cnt++;
+		evict = dest_cache_size > 0 &&
+			cache->lru_cnt > dest_cache_size;
+		pthread_mutex_unlock(&cache->lru_lock);
+	}
+	(void) atomic_inc(&dest->refcnt);
+	pthread_rwlock_unlock(acmp_dest_lock(cache, hash));
+
+	/* Lost the race against another thread adding the same address */
+	if (new_dest)
+		free(new_dest);
+	if (evict)
+		acmp_evict_dest(ep);
+	return dest;
 }
 
 static struct acmp_dest *
@@ -375,7 +615,6 @@ acmp_acquire_dest(struct acmp_ep *ep, uint8_t addr_type, const uint8_t *addr)
 	acm_format_name(2, log_data, sizeof log_data,
 			addr_type, addr, ACM_MAX_ADDRESS);
 	acm_log(2, "%s\n", log_data);
-	pthread_mutex_lock(&ep->lock);
 	dest = acmp_get_dest(ep, addr_type, addr);
 	if (dest && dest->state == ACMP_READY &&
 	    dest->addr_timeout != (uint64_t)~0ULL) {
@@ -383,22 +622,23 @@ acmp_acquire_dest(struct acmp_ep *ep, uint8_t addr_type, const uint8_t *addr)
 		if (rec_expr_minutes <= 0) {
 			acm_log(2, "Record expired\n");
 			acmp_remove_dest(ep, dest);
+			acmp_put_dest(dest);
+			acm_flush_cache();
 			dest = NULL;
 		} else {
 			acm_log(2, "Record valid for the next %" PRId64 " minute(s)\n",
 				rec_expr_minutes);
 		}
 	}
-	if (!dest) {
-		dest = acmp_alloc_dest(addr_type, addr);
-		if (dest) {
-			dest->ep = ep;
-			tsearch(dest, &ep->dest_map[addr_type - 1], acmp_compare_dest);
-			(void) atomic_inc(&dest->refcnt);
-		}
+	if (dest) {
+		acm_increment_counter(ACM_CNTR_DEST_CACHE_HIT);
+		atomic_inc(&ep->counters[ACM_CNTR_DEST_CACHE_HIT]);
+		return dest;
 	}
-	pthread_mutex_unlock(&ep->lock);
-	return dest;
+
+	acm_increment_counter(ACM_CNTR_DEST_CACHE_MISS);
+	atomic_inc(&ep->counters[ACM_CNTR_DEST_CACHE_MISS]);
+	return acmp_insert_dest(ep, addr_type, addr);
 }
 
 static struct acmp_request *acmp_alloc_req(uint64_t id, struct acm_msg *msg)
@@ -551,6 +791,82 @@ static void acmp_send_available(struct acmp_ep *ep, struct acmp_send_queue *queu
 	}
 }
 
+static void acmp_init_wheel(struct acmp_timer_wheel *wheel)
+{
+	int i;
+
+	for (i = 0; i < ACMP_WHEEL_SLOTS; i++)
+		list_head_init(&wheel->slot[i]);
+	wheel->tick = time_stamp_ms() / ACMP_WHEEL_TICK;
+	wheel->cnt = 0;
+}
+
+static void acmp_wheel_add(struct acmp_timer_wheel *wheel,
+			   struct acmp_send_msg *msg)
+{
+	uint64_t tick;
+
+	/* An idle wheel is not run, catch up with the clock first */
+	if (!wheel->cnt)
+		wheel->tick = time_stamp_ms() / ACMP_WHEEL_TICK;
+
+	tick = max_t(uint64_t, (msg->expires + ACMP_WHEEL_TICK - 1) /
+		     ACMP_WHEEL_TICK, wheel->tick);
+	list_add_tail(&wheel->slot[tick & (ACMP_WHEEL_SLOTS - 1)],
+		      &msg->timer_entry);
+	wheel->cnt++;
+}
+
+static void acmp_wheel_del(struct acmp_timer_wheel *wheel,
+			   struct acmp_send_msg *msg)
+{
+	list_del(&msg->timer_entry);
+	wheel->cnt--;
+}
+
+/* Moves the requests that have expired by now onto the expired list */
+static void acmp_wheel_run(struct acmp_timer_wheel *wheel,
+			   struct list_head *expired)
+{
+	struct acmp_send_msg *msg, *next;
+	uint64_t now, tick, end;
+
+	now = time_stamp_ms();
+	end = now / ACMP_WHEEL_TICK;
+	/* After a long stall one turn visits every slot */
+	tick = end < ACMP_WHEEL_SLOTS ? 0 : end - (ACMP_WHEEL_SLOTS - 1);
+	tick = max(tick, wheel->tick);
+	for (; tick <= end && wheel->cnt; tick++) {
+		list_for_each_safe(&wheel->slot[tick & (ACMP_WHEEL_SLOTS - 1)],
+				   msg, next, timer_entry) {
+			if (msg->expires > now)
+				continue;
+			acmp_wheel_del(wheel, msg);
+			list_add_tail(expired, &msg->timer_entry);
+		}
+	}
+	wheel->tick = end + 1;
+}
+
+/* Milliseconds until the next tick with a request in it, or -1 */
+static int acmp_wheel_timeout(struct acmp_timer_wheel *wheel)
+{
+	uint64_t tick, now;
+
+	if (!wheel->cnt)
+		return -1;
+
+	for (tick = wheel->tick; tick < wheel->tick + ACMP_WHEEL_SLOTS; tick++) {
+		if (!list_empty(&wheel->slot[tick & (ACMP_WHEEL_SLOTS - 1)]))
+			break;
+	}
+
+	now = time_stamp_ms();
+	if (tick * ACMP_WHEEL_TICK <= now)
+		return 0;
+	return min_t(uint64_t, tick * ACMP_WHEEL_TICK - now, INT_MAX);
+}
+
 static void acmp_complete_send(struct acmp_send_msg *msg)
 {
 	struct acmp_ep *ep = msg->ep;
@@ -561,8 +877,7 @@ static void acmp_complete_send(struct acmp_send_msg *msg)
 		acm_log(2, "waiting for response\n");
 		msg->expires = time_stamp_ms() + ep->port->subnet_timeout + timeout;
 		list_add_tail(&ep->wait_queue, &msg->entry);
-		if (atomic_inc(&wait_cnt) == 1)
-			event_signal(&timeout_event);
+		acmp_wheel_add(&ep->port->wheel, msg);
 	} else {
 		acm_log(2, "freeing\n");
 		acmp_send_available(ep, msg->req_queue);
@@ -584,7 +899,7 @@ static struct acmp_send_msg *acmp_get_request(struct acmp_ep *ep, __be64 tid, in
 			acm_log(2, "match found in wait queue\n");
 			req = msg;
 			list_del(&msg->entry);
-			(void) atomic_dec(&wait_cnt);
+			acmp_wheel_del(&ep->port->wheel, msg);
 			acmp_send_available(ep, msg->req_queue);
 			*free = 1;
 			goto unlock;
@@ -786,20 +1101,16 @@ static void acmp_init_path_query(struct ib_sa_mad *mad)
 }
 
 /* Caller must hold dest lock */
-static uint8_t acmp_resolve_path_sa(struct acmp_ep *ep, struct acmp_dest *dest,
+static uint8_t acmp_send_path_query(struct acmp_ep *ep, struct acmp_dest *dest,
 				    void (*handler)(struct acm_sa_mad *))
 {
 	struct ib_sa_mad *mad;
-	uint8_t ret;
 	struct acm_sa_mad *sa_mad;
 
-	acm_log(2, "%s\n", dest->name);
-
 	sa_mad = acm_alloc_sa_mad(ep->endpoint, dest, handler);
 	if (!sa_mad) {
 		acm_log(0, "Error - failed to allocate sa_mad\n");
-		ret = ACM_STATUS_ENOMEM;
-		goto err;
+		return ACM_STATUS_ENOMEM;
 	}
 
 	mad = (struct ib_sa_mad *) &sa_mad->sa_mad;
@@ -808,20 +1119,35 @@ static uint8_t acmp_resolve_path_sa(struct acmp_ep *ep, struct acmp_dest *dest,
 	memcpy(mad->data, &dest->path, sizeof(dest->path));
 	mad->comp_mask = acm_path_comp_mask(&dest->path);
 
-	acm_increment_counter(ACM_CNTR_ROUTE_QUERY);
-	atomic_inc(&ep->counters[ACM_CNTR_ROUTE_QUERY]);
-	dest->state = ACMP_QUERY_ROUTE;
+	/* Released by the response handler */
+	(void) atomic_inc(&dest->refcnt);
 	if (acm_send_sa_mad(sa_mad)) {
 		acm_log(0, "Error - Failed to send sa mad\n");
-		ret = ACM_STATUS_ENODATA;
-		goto free_mad;
+		(void) atomic_dec(&dest->refcnt);
+		acm_free_sa_mad(sa_mad);
+		return ACM_STATUS_ENODATA;
 	}
 	return ACM_STATUS_SUCCESS;
-free_mad:
-	acm_free_sa_mad(sa_mad);
-err:
-	dest->state = ACMP_INIT;
-	return ret;
+}
+
+/* Caller must hold dest lock */
+static uint8_t acmp_resolve_path_sa(struct acmp_ep *ep, struct acmp_dest *dest,
+				    void (*handler)(struct acm_sa_mad *))
+{
+	uint8_t ret;
+
+	acm_log(2, "%s\n", dest->name);
+
+	dest->state = ACMP_QUERY_ROUTE;
+	ret = acmp_send_path_query(ep, dest, handler);
+	if (ret) {
+		dest->state = ACMP_INIT;
+		return ret;
+	}
+
+	acm_increment_counter(ACM_CNTR_ROUTE_QUERY);
+	atomic_inc(&ep->counters[ACM_CNTR_ROUTE_QUERY]);
+	return ACM_STATUS_SUCCESS;
 }
 
 static uint8_t
@@ -962,6 +1288,29 @@ acmp_resolve_response(uint64_t id, struct acm_msg *req_msg,
 	return acm_resolve_response(id, &msg);
 }
 
+/* Caller must hold dest lock. */
+static void acmp_dest_failed(struct acmp_dest *dest, uint8_t status)
+{
+	dest->state = ACMP_INIT;
+	if (negative_timeout > 0) {
+		dest->neg_status = status;
+		dest->neg_timeout = time_stamp_ms() + (unsigned) negative_timeout;
+	}
+}
+
+/* Caller must hold dest lock. */
+static int acmp_dest_negative(struct acmp_dest *dest)
+{
+	if (!dest->neg_timeout)
+		return 0;
+
+	if (time_stamp_ms() < dest->neg_timeout)
+		return 1;
+
+	dest->neg_timeout = 0;
+	return 0;
+}
+
 static void
 acmp_complete_queued_req(struct acmp_dest *dest, uint8_t status)
 {
@@ -1011,13 +1360,90 @@ acmp_dest_sa_resp(struct acm_sa_mad *mad)
 			dest->addr_timeout, dest->route_timeout);
 		dest->state = ACMP_READY;
 	} else {
-		dest->state = ACMP_INIT;
+		acmp_dest_failed(dest, status);
 	}
 	pthread_mutex_unlock(&dest->lock);
 
 	acmp_complete_queued_req(dest, status);
 out:
 	acm_free_sa_mad(mad);
+	acmp_put_dest(dest);
+}
+
+/* Addresses that are part of the path record expire with the route */
+static bool acmp_dest_is_path(struct acmp_dest *dest)
+{
+	return dest->addr_type == ACM_ADDRESS_LID ||
+	       dest->addr_type == ACM_ADDRESS_GID;
+}
+
+static void
+acmp_dest_refresh_resp(struct acm_sa_mad *mad)
+{
+	struct acmp_dest *dest = (struct acmp_dest *) mad->context;
+	struct ib_sa_mad *sa_mad = (struct ib_sa_mad *) &mad->sa_mad;
+	uint8_t status;
+
+	if (!mad->umad.status)
+		status = (uint8_t) (be16toh(sa_mad->status) >> 8);
+	else
+		status = ACM_STATUS_ETIMEDOUT;
+	acm_log(2, "%s status=0x%x\n", dest->name, status);
+
+	/* On failure keep serving the old route until it times out */
+	pthread_mutex_lock(&dest->lock);
+	dest->refreshing = false;
+	if (!status && dest->state == ACMP_READY) {
+		if (memcmp(&dest->path, sa_mad->data, sizeof(dest->path))) {
+			memcpy(&dest->path, sa_mad->data, sizeof(dest->path));
+			acmp_init_path_av(dest->ep->port, dest);
+			/* An address handle still points at the old path */
+			if (dest->ah) {
+				ibv_destroy_ah(dest->ah);
+				dest->ah = ibv_create_ah(dest->ep->port->dev->pd,
+							 &dest->av);
+				if (!dest->ah)
+					acm_log(0, "ERROR - unable to create ah\n");
+			}
+			acm_flush_cache();
+		}
+		dest->route_timeout = time_stamp_min() + (unsigned) route_timeout;
+		if (acmp_dest_is_path(dest))
+			dest->addr_timeout = time_stamp_min() +
+					     (unsigned) addr_timeout;
+	}
+	pthread_mutex_unlock(&dest->lock);
+
+	acm_free_sa_mad(mad);
+	acmp_put_dest(dest);
+}
+
+/*
+ * Renews the route of a destination that is still being used shortly before
+ * it expires, so the request after the timeout does not wait on the SA.
+ * Caller must hold dest lock.
+ */
+static void acmp_refresh_dest(struct acmp_ep *ep, struct acmp_dest *dest)
+{
+	uint64_t expires;
+
+	if (!refresh_ahead || dest->refreshing || route_prot != ACMP_ROUTE_PROT_SA)
+		return;
+
+	expires = dest->route_timeout;
+	if (acmp_dest_is_path(dest))
+		expires = min(expires, dest->addr_timeout);
+	if (expires == (uint64_t) ~0ULL ||
+	    time_stamp_min() + (unsigned) refresh_ahead < expires)
+		return;
+
+	acm_log(2, "%s\n", dest->name);
+	if (acmp_send_path_query(ep, dest, acmp_dest_refresh_resp))
+		return;
+
+	dest->refreshing = true;
+	acm_increment_counter(ACM_CNTR_ROUTE_REFRESH);
+	atomic_inc(&ep->counters[ACM_CNTR_ROUTE_REFRESH]);
 }
 
 static void
@@ -1027,6 +1453,7 @@ acmp_resolve_sa_resp(struct acm_sa_mad *mad)
 	int send_resp;
 
 	acm_log(2, "\n");
+	(void) atomic_inc(&dest->refcnt);
 	acmp_dest_sa_resp(mad);
 
 	pthread_mutex_lock(&dest->lock);
@@ -1035,6 +1462,7 @@ acmp_resolve_sa_resp(struct acm_sa_mad *mad)
 
 	if (send_resp)
 		acmp_send_addr_resp(dest->ep, dest);
+	acmp_put_dest(dest);
 }
 
 static struct acmp_addr *
@@ -1159,7 +1587,7 @@ acmp_process_addr_resp(struct acmp_send_msg *msg, struct ibv_wc *wc, struct acm_
 			}
 		}
 	} else {
-		dest->state = ACMP_INIT;
+		acmp_dest_failed(dest, status);
 	}
 	pthread_mutex_unlock(&dest->lock);
 
@@ -1294,30 +1722,84 @@ static void acmp_process_comp(struct acmp_ep *ep, struct ibv_wc *wc)
 		acmp_complete_send((struct acmp_send_msg *) (uintptr_t) wc->wr_id);
 }
 
+/* Resends the requests that timed out, or fails them when out of tries */
+static void acmp_process_timeouts(struct acmp_port *port)
+{
+	struct acmp_send_msg *msg;
+	struct acm_resolve_rec *rec;
+	struct ibv_send_wr *bad_wr;
+	struct acm_mad *mad;
+	struct acmp_ep *ep;
+	LIST_HEAD(expired);
+
+	acmp_wheel_run(&port->wheel, &expired);
+	while ((msg = list_pop(&expired, struct acmp_send_msg, timer_entry))) {
+		ep = msg->ep;
+		pthread_mutex_lock(&ep->lock);
+		list_del(&msg->entry);
+		if (--msg->tries) {
+			acm_log(1, "notice - retrying request\n");
+			list_add_tail(&ep->active_queue, &msg->entry);
+			ibv_post_send(ep->qp, &msg->wr, &bad_wr);
+			pthread_mutex_unlock(&ep->lock);
+			continue;
+		}
+
+		acm_log(0, "notice - failing request\n");
+		acmp_send_available(ep, msg->req_queue);
+		pthread_mutex_unlock(&ep->lock);
+
+		mad = (struct acm_mad *) &msg->data[0];
+		rec = (struct acm_resolve_rec *) mad->data;
+		acm_format_name(0, log_data, sizeof log_data,
+				rec->dest_type, rec->dest, sizeof rec->dest);
+		acm_log(0, "notice - dest %s\n", log_data);
+
+		msg->resp_handler(msg, NULL, NULL);
+		acmp_free_send(msg);
+	}
+}
+
+/*
+ * One thread per port handles the completions of all its endpoints and
+ * expires their requests, so busy ports do not hold up each other.
+ */
 static void *acmp_comp_handler(void *context)
 {
-	struct acmp_device *dev = (struct acmp_device *) context;
+	struct acmp_port *port = context;
 	struct acmp_ep *ep;
 	struct ibv_cq *cq;
 	struct ibv_wc wc;
-	int cnt;
+	struct pollfd fds;
+	int cnt, ret;
 
-	acm_log(1, "started\n");
+	acm_log(1, "started %s %d\n", port->dev->verbs->device->name,
+		port->port_num);
 
 	if (pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL)) {
 		acm_log(0, "Error: failed to set cancel type for dev %s\n",
-			dev->verbs->device->name);
+			port->dev->verbs->device->name);
 		pthread_exit(NULL);
 	}
 
-	if (pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL)) {
+	/* Only cancelled while waiting, never with a lock held */
+	if (pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL)) {
 		acm_log(0, "Error: failed to set cancel state for dev %s\n",
-			dev->verbs->device->name);
+			port->dev->verbs->device->name);
 		pthread_exit(NULL);
 	}
+
+	fds.fd = port->channel->fd;
+	fds.events = POLLIN;
 	while (1) {
-		pthread_testcancel();
-		ibv_get_cq_event(dev->channel, &cq, (void *) &ep);
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		ret = poll(&fds, 1, acmp_wheel_timeout(&port->wheel));
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+		if (ret <= 0 || ibv_get_cq_event(port->channel, &cq, (void *) &ep)) {
+			acmp_process_timeouts(port);
+			continue;
+		}
 
 		cnt = 0;
 		while (ibv_poll_cq(cq, 1, &wc) > 0) {
@@ -1332,6 +1814,7 @@ static void *acmp_comp_handler(void *context)
 		}
 
 		ibv_ack_cq_events(cq, cnt);
+		acmp_process_timeouts(port);
 	}
 
 	return NULL;
@@ -1420,6 +1903,154 @@ static void acmp_join_group(struct acmp_ep *ep, union ibv_gid *port_gid,
 	}
 }
 
+static void acmp_inform_resp(struct acm_sa_mad *sa_mad)
+{
+	struct acmp_port *port = sa_mad->context;
+	struct ib_sa_mad *mad = (struct ib_sa_mad *) &sa_mad->sa_mad;
+	struct ib_inform_info *info = (struct ib_inform_info *) mad->data;
+
+	if (sa_mad->umad.status || mad->status) {
+		acm_log(0, "notice - %s %d trap %d subscription failed, "
+			"umad status %d SA status 0x%x\n",
+			port->dev->verbs->device->name, port->port_num,
+			be16toh(info->trap_num), sa_mad->umad.status,
+			be16toh(mad->status));
+		pthread_mutex_lock(&port->lock);
+		port->subscribed = false;
+		pthread_mutex_unlock(&port->lock);
+	} else {
+		acm_log(1, "%s %d subscribed to trap %d\n",
+			port->dev->verbs->device->name, port->port_num,
+			be16toh(info->trap_num));
+	}
+	acm_free_sa_mad(sa_mad);
+}
+
+static void acmp_subscribe_trap(struct acmp_ep *ep, uint16_t trap_num)
+{
+	struct ib_inform_info *info;
+	struct acm_sa_mad *sa_mad;
+	struct ib_sa_mad *mad;
+
+	sa_mad = acm_alloc_sa_mad(ep->endpoint, ep->port, acmp_inform_resp);
+	if (!sa_mad) {
+		acm_log(0, "Error - failed to allocate sa_mad\n");
+		return;
+	}
+
+	mad = (struct ib_sa_mad *) &sa_mad->sa_mad;
+	mad->base_version = 1;
+	mad->mgmt_class = IB_MGMT_CLASS_SA;
+	mad->class_version = 2;
+	mad->method = IB_METHOD_SET;
+	mad->tid = htobe64((uint64_t) atomic_inc(&g_tid));
+	mad->attr_id = IB_SA_ATTR_INFORM_INFO;
+	mad->comp_mask = IB_COMP_MASK_II_LID_RANGE_BEGIN |
+		IB_COMP_MASK_II_IS_GENERIC | IB_COMP_MASK_II_SUBSCRIBE |
+		IB_COMP_MASK_II_TYPE | IB_COMP_MASK_II_TRAP_NUM |
+		IB_COMP_MASK_II_PRODUCER_TYPE;
+
+	info = (struct ib_inform_info *) mad->data;
+	info->lid_range_begin = htobe16(0xFFFF);
+	info->is_generic = 1;
+	info->subscribe = 1;
+	info->type = htobe16(IB_NOTICE_TYPE_ALL);
+	info->trap_num = htobe16(trap_num);
+	info->producer_type = htobe32(IB_NOTICE_PRODUCER_ALL);
+
+	if (acm_send_sa_mad(sa_mad)) {
+		acm_log(0, "Error - Failed to send sa mad\n");
+		acm_free_sa_mad(sa_mad);
+	}
+}
+
+/* Asks the SA to report ports coming and going, once per port and SM. */
+static void acmp_port_subscribe(struct acmp_ep *ep)
+{
+	struct acmp_port *port = ep->port;
+	bool subscribed;
+
+	if (!subscribe_traps)
+		return;
+
+	pthread_mutex_lock(&port->lock);
+	subscribed = port->subscribed;
+	port->subscribed = true;
+	pthread_mutex_unlock(&port->lock);
+	if (subscribed)
+		return;
+
+	acmp_subscribe_trap(ep, IB_TRAP_GID_IN_SERVICE);
+	acmp_subscribe_trap(ep, IB_TRAP_GID_OUT_SERVICE);
+}
+
+/*
+ * Drops what was learned about a port the SA reported in or out of service:
+ * its LID and path may have changed, and a failure to reach it is stale.
+ * Preloaded destinations are left alone.
+ */
+static void acmp_invalidate_gid(struct acmp_ep *ep, union ibv_gid *gid)
+{
+	struct acmp_dest_cache *cache = &ep->dest_cache;
+	struct acmp_dest *dest;
+	bool found = false;
+	uint32_t i;
+
+	for (i = 0; i <= cache->mask; i++) {
+		pthread_rwlock_rdlock(acmp_dest_lock(cache, i));
+		list_for_each(&cache->bucket[i], dest, hash_entry) {
+			pthread_mutex_lock(&dest->lock);
+			if (!memcmp(&dest->path.dgid, gid, sizeof(*gid)) &&
+			    dest->route_timeout != (uint64_t) ~0ULL) {
+				acm_log(2, "%s\n", dest->name);
+				if (dest->state == ACMP_READY ||
+				    dest->state == ACMP_ADDR_RESOLVED)
+					dest->state = ACMP_INIT;
+				dest->neg_timeout = 0;
+				found = true;
+				acm_increment_counter(ACM_CNTR_DEST_INVALIDATE);
+				atomic_inc(&ep->counters[ACM_CNTR_DEST_INVALIDATE]);
+			}
+			pthread_mutex_unlock(&dest->lock);
+		}
+		pthread_rwlock_unlock(acmp_dest_lock(cache, i));
+	}
+
+	/* Clients must not keep using the old path from the shared cache */
+	if (found)
+		acm_flush_cache();
+}
+
+static void acmp_handle_sa_report(void *port_context,
+				  struct umad_sa_packet *report)
+{
+	struct acmp_port *port = port_context;
+	struct ib_notice *notice = (struct ib_notice *) report->data;
+	struct acmp_ep *ep;
+	uint16_t trap_num;
+
+	if (report->mad_hdr.attr_id != IB_SA_ATTR_NOTICE ||
+	    !(notice->generic_type & IB_NOTICE_GENERIC))
+		return;
+
+	trap_num = be16toh(notice->trap_num);
+	if (trap_num != IB_TRAP_GID_IN_SERVICE &&
+	    trap_num != IB_TRAP_GID_OUT_SERVICE)
+		return;
+
+	acm_format_name(1, log_data, sizeof log_data, ACM_ADDRESS_GID,
+			ib_notice_gid(notice)->raw, sizeof(union ibv_gid));
+	acm_log(1, "trap %d for %s\n", trap_num, log_data);
+
+	pthread_mutex_lock(&port->lock);
+	list_for_each(&port->ep_list, ep, entry) {
+		pthread_mutex_unlock(&port->lock);
+		acmp_invalidate_gid(ep, ib_notice_gid(notice));
+		pthread_mutex_lock(&port->lock);
+	}
+	pthread_mutex_unlock(&port->lock);
+}
+
 static void acmp_ep_join(struct acmp_ep *ep)
 {
 	struct acmp_port *port;
@@ -1443,6 +2074,7 @@ static void acmp_ep_join(struct acmp_ep *ep)
 	    (port->rate != min_rate || port->mtu != min_mtu))
 		acmp_join_group(ep, &gid, 0, 0, 0, port->rate, port->mtu);
 
+	acmp_port_subscribe(ep);
 	acm_log(1, "join for %s complete\n", ep->id_string);
 }
 
@@ -1469,128 +2101,23 @@ static int acmp_port_join(void *port_context)
 
 static int acmp_handle_event(void *port_context, enum ibv_event_type type)
 {
+	struct acmp_port *port = port_context;
 	int ret = 0;
 
 	acm_log(2, "event %s\n", ibv_event_type_str(type));
 
 	switch (type) {
-	case IBV_EVENT_CLIENT_REREGISTER:
-		ret = acmp_port_join(port_context);
-		break;
-	default:
-		break;
-	}
-	return ret;
-}
-
-static void acmp_process_timeouts(void)
-{
-	struct acmp_send_msg *msg;
-	struct acm_resolve_rec *rec;
-	struct acm_mad *mad;
-
-	while ((msg = list_pop(&timeout_list, struct acmp_send_msg, entry))) {
-		mad = (struct acm_mad *) &msg->data[0];
-		rec = (struct acm_resolve_rec *) mad->data;
-
-		acm_format_name(0, log_data, sizeof log_data,
-				rec->dest_type, rec->dest, sizeof rec->dest);
-		acm_log(0, "notice - dest %s\n", log_data);
-
-		msg->resp_handler(msg, NULL, NULL);
-		acmp_free_send(msg);
-	}
-}
-
-static void acmp_process_wait_queue(struct acmp_ep *ep, uint64_t *next_expire)
-{
-	struct acmp_send_msg *msg, *next;
-	struct ibv_send_wr *bad_wr;
-
-	list_for_each_safe(&ep->wait_queue, msg, next, entry) {
-		if (msg->expires <= time_stamp_ms()) {
-			list_del(&msg->entry);
-			(void) atomic_dec(&wait_cnt);
-			if (--msg->tries) {
-				acm_log(1, "notice - retrying request\n");
-				list_add_tail(&ep->active_queue, &msg->entry);
-				ibv_post_send(ep->qp, &msg->wr, &bad_wr);
-			} else {
-				acm_log(0, "notice - failing request\n");
-				acmp_send_available(ep, msg->req_queue);
-				list_add_tail(&timeout_list, &msg->entry);
-			}
-		} else {
-			*next_expire = min(*next_expire, msg->expires);
-			break;
-		}
-	}
-}
-
-/* While the device/port/ep will not be freed, we need to be careful of
- * their addition while walking the link lists. Therefore, we need to acquire
- * the appropriate locks.
- */
-static void *acmp_retry_handler(void *context)
-{
-	struct acmp_device *dev;
-	struct acmp_port *port;
-	struct acmp_ep *ep;
-	uint64_t next_expire;
-	int i, wait;
-
-	acm_log(0, "started\n");
-	if (pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL)) {
-		acm_log(0, "Error: failed to set cancel type \n");
-		pthread_exit(NULL);
-	}
-	if (pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL)) {
-		acm_log(0, "Error: failed to set cancel state\n");
-		pthread_exit(NULL);
-	}
-	retry_thread_started = 1;
-
-	while (1) {
-		while (!atomic_get(&wait_cnt)) {
-			pthread_testcancel();
-			event_wait(&timeout_event, -1);
-		}
-
-		next_expire = -1;
-		pthread_mutex_lock(&acmp_dev_lock);
-		list_for_each(&acmp_dev_list, dev, entry) {
-			pthread_mutex_unlock(&acmp_dev_lock);
-
-			for (i = 0; i < dev->port_cnt; i++) {
-				port = &dev->port[i];
-
-				pthread_mutex_lock(&port->lock);
-				list_for_each(&port->ep_list, ep, entry) {
-					pthread_mutex_unlock(&port->lock);
-					pthread_mutex_lock(&ep->lock);
-					if (!list_empty(&ep->wait_queue))
-						acmp_process_wait_queue(ep, &next_expire);
-					pthread_mutex_unlock(&ep->lock);
-					pthread_mutex_lock(&port->lock);
-				}
-				pthread_mutex_unlock(&port->lock);
-			}
-			pthread_mutex_lock(&acmp_dev_lock);
-		}
-		pthread_mutex_unlock(&acmp_dev_lock);
-
-		acmp_process_timeouts();
-		if (next_expire != -1) {
-			wait = (int) (next_expire - time_stamp_ms());
-			if (wait > 0 && atomic_get(&wait_cnt)) {
-				pthread_testcancel();
-				event_wait(&timeout_event, wait);
-			}
-		}
+	case IBV_EVENT_CLIENT_REREGISTER:
+		/* A new SM does not know our subscriptions */
+		pthread_mutex_lock(&port->lock);
+		port->subscribed = false;
+		pthread_mutex_unlock(&port->lock);
+		ret = acmp_port_join(port_context);
+		break;
+	default:
+		break;
 	}
-
-	retry_thread_started = 0;
-	return NULL;
+	return ret;
 }
 
 static int
@@ -1720,10 +2247,12 @@ static int acmp_dest_timeout(struct acmp_dest *dest)
 	if (timestamp > dest->addr_timeout) {
 		acm_log(2, "%s address timed out\n", dest->name);
 		dest->state = ACMP_INIT;
+		acm_flush_cache();
 		return 1;
 	} else if (timestamp > dest->route_timeout) {
 		acm_log(2, "%s route timed out\n", dest->name);
 		dest->state = ACMP_ADDR_RESOLVED;
+		acm_flush_cache();
 		return 1;
 	}
 	return 0;
@@ -1827,6 +2356,7 @@ test:
 		acm_log(2, "request satisfied from local cache\n");
 		acm_increment_counter(ACM_CNTR_ROUTE_CACHE);
 		atomic_inc(&ep->counters[ACM_CNTR_ROUTE_CACHE]);
+		acmp_refresh_dest(ep, dest);
 		status = ACM_STATUS_SUCCESS;
 		break;
 	case ACMP_ADDR_RESOLVED:
@@ -1840,6 +2370,13 @@ test:
 		}
 		goto queue;
 	case ACMP_INIT:
+		if (acmp_dest_negative(dest)) {
+			acm_log(2, "request failed recently, not retrying\n");
+			acm_increment_counter(ACM_CNTR_DEST_CACHE_NEG);
+			atomic_inc(&ep->counters[ACM_CNTR_DEST_CACHE_NEG]);
+			status = dest->neg_status;
+			break;
+		}
 		acm_log(2, "sending resolve msg to dest\n");
 		status = acmp_send_resolve(ep, dest, saddr);
 		if (status) {
@@ -1903,9 +2440,17 @@ test:
 		acm_log(2, "request satisfied from local cache\n");
 		acm_increment_counter(ACM_CNTR_ROUTE_CACHE);
 		atomic_inc(&ep->counters[ACM_CNTR_ROUTE_CACHE]);
+		acmp_refresh_dest(ep, dest);
 		status = ACM_STATUS_SUCCESS;
 		break;
 	case ACMP_INIT:
+		if (acmp_dest_negative(dest)) {
+			acm_log(2, "request failed recently, not retrying\n");
+			acm_increment_counter(ACM_CNTR_DEST_CACHE_NEG);
+			atomic_inc(&ep->counters[ACM_CNTR_DEST_CACHE_NEG]);
+			status = dest->neg_status;
+			break;
+		}
 		acm_log(2, "have path, bypassing address resolution\n");
 		acmp_record_path_addr(ep, dest, path);
 		/* fall through */
@@ -1999,6 +2544,8 @@ static enum acmp_route_preload acmp_convert_route_preload(char *param)
 		return ACMP_ROUTE_PRELOAD_NONE;
 	else if (!strcasecmp("opensm_full_v1", param))
 		return ACMP_ROUTE_PRELOAD_OSM_FULL_V1;
+	else if (!strcasecmp("sa_path_table", param))
+		return ACMP_ROUTE_PRELOAD_SA_PATH_TABLE;
 
 	return route_preload;
 }
@@ -2225,8 +2772,9 @@ static int acmp_parse_osm_fullv1_paths(FILE *f, __be64 *lid2guid, struct acmp_ep
 			}
 			dest->remote_qpn = 1;
 			dest->state = ACMP_READY;
-			acmp_put_dest(dest);
+			acmp_pin_dest(ep, dest);
 			acm_log(1, "added cached dest %s\n", dest->name);
+			acmp_put_dest(dest);
 		}
 	}
 	return ret;
@@ -2258,6 +2806,160 @@ err:
 	return ret;
 }
 
+static void acmp_prefetch_resp(struct acm_sa_mad *mad);
+
+static int acmp_send_prefetch(struct acmp_ep *ep)
+{
+	struct ibv_path_record *path;
+	struct acm_sa_mad *sa_mad;
+	struct ib_sa_mad *mad;
+
+	if (!ep->endpoint)
+		return -1;
+
+	sa_mad = acm_alloc_sa_mad(ep->endpoint, ep, acmp_prefetch_resp);
+	if (!sa_mad) {
+		acm_log(0, "Error - failed to allocate sa_mad\n");
+		return -1;
+	}
+
+	/* One reversible path from this port to every port in the partition */
+	mad = (struct ib_sa_mad *) &sa_mad->sa_mad;
+	acmp_init_path_query(mad);
+	mad->method = IB_METHOD_GET_TABLE;
+	mad->comp_mask = IB_COMP_MASK_PR_SGID | IB_COMP_MASK_PR_REVERSIBLE |
+		IB_COMP_MASK_PR_NUM_PATH | IB_COMP_MASK_PR_PKEY;
+
+	path = (struct ibv_path_record *) mad->data;
+	acm_get_gid((struct acm_port *) ep->port->port, 0, &path->sgid);
+	path->reversible_numpath = IBV_PATH_RECORD_REVERSIBLE | 1;
+	path->pkey = htobe16(ep->pkey);
+
+	acm_log(1, "%s\n", ep->id_string);
+	ep->prefetch_start = time_stamp_ms();
+	if (acm_send_sa_mad(sa_mad)) {
+		acm_log(0, "Error - Failed to send sa mad\n");
+		acm_free_sa_mad(sa_mad);
+		return -1;
+	}
+
+	acm_increment_counter(ACM_CNTR_ROUTE_QUERY);
+	atomic_inc(&ep->counters[ACM_CNTR_ROUTE_QUERY]);
+	return 0;
+}
+
+/* Hands the SA over to the next endpoint of the port waiting for its table */
+static void acmp_prefetch_next(struct acmp_port *port)
+{
+	struct acmp_ep *ep;
+
+	pthread_mutex_lock(&port->lock);
+	while ((ep = list_pop(&port->prefetch_wait, struct acmp_ep,
+			      prefetch_entry))) {
+		if (!acmp_send_prefetch(ep))
+			break;
+	}
+	if (!ep)
+		port->prefetching = false;
+	pthread_mutex_unlock(&port->lock);
+}
+
+static void
+acmp_prefetch_path(struct acmp_ep *ep, struct ibv_path_record *path)
+{
+	struct acmp_dest *dest;
+	uint8_t addr[ACM_MAX_ADDRESS];
+	uint8_t addr_type;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		memset(addr, 0, ACM_MAX_ADDRESS);
+		if (i == 0) {
+			addr_type = ACM_ADDRESS_LID;
+			memcpy(addr, &path->dlid, sizeof(path->dlid));
+		} else {
+			addr_type = ACM_ADDRESS_GID;
+			memcpy(addr, &path->dgid, sizeof(path->dgid));
+		}
+		dest = acmp_acquire_dest(ep, addr_type, addr);
+		if (!dest) {
+			acm_log(0, "ERROR - unable to create dest\n");
+			return;
+		}
+
+		/* Leave destinations that clients are already resolving alone */
+		pthread_mutex_lock(&dest->lock);
+		if (dest->state == ACMP_INIT) {
+			dest->path = *path;
+			acmp_init_path_av(ep->port, dest);
+			dest->addr_timeout = time_stamp_min() + (unsigned) addr_timeout;
+			dest->route_timeout = time_stamp_min() + (unsigned) route_timeout;
+			dest->remote_qpn = 1;
+			dest->state = ACMP_READY;
+		}
+		pthread_mutex_unlock(&dest->lock);
+		acmp_put_dest(dest);
+	}
+}
+
+static void acmp_prefetch_resp(struct acm_sa_mad *mad)
+{
+	struct acmp_ep *ep = mad->context;
+	struct umad_sa_packet *resp;
+	size_t len, rec_size;
+	int i, cnt, max_cnt;
+	uint8_t status;
+
+	if (!mad->umad.status)
+		status = (uint8_t) (be16toh(mad->sa_mad.mad_hdr.status) >> 8);
+	else
+		status = ACM_STATUS_ETIMEDOUT;
+
+	resp = acm_get_sa_mad_data(mad, &len);
+	rec_size = be16toh(resp->attr_offset) * 8;
+	if (status || rec_size < sizeof(struct ibv_path_record) ||
+	    len < offsetof(struct umad_sa_packet, data)) {
+		acm_log(0, "%s: path table query failed, status 0x%x\n",
+			ep->id_string, status);
+		cnt = 0;
+		goto out;
+	}
+
+	/*
+	 * Each record fills a LID and a GID entry, keep room for clients.
+	 * A dest_cache_size of 0 means no limit.
+	 */
+	cnt = (len - offsetof(struct umad_sa_packet, data)) / rec_size;
+	max_cnt = dest_cache_size > 0 ? min(cnt, dest_cache_size / 4) : cnt;
+	for (i = 0; i < max_cnt; i++)
+		acmp_prefetch_path(ep, (struct ibv_path_record *)
+				   (resp->data + i * rec_size));
+
+	acm_log(0, "%s: loaded %d of %d path records in %" PRIu64 " ms\n",
+		ep->id_string, max_cnt, cnt,
+		time_stamp_ms() - ep->prefetch_start);
+out:
+	acm_free_sa_mad(mad);
+	acmp_prefetch_next(ep->port);
+}
+
+/*
+ * Warms the cache with one GetTable instead of a query per destination.
+ * Endpoints sharing a port take turns so the SA builds one table at a time.
+ */
+static void acmp_prefetch_paths(struct acmp_ep *ep)
+{
+	struct acmp_port *port = ep->port;
+
+	pthread_mutex_lock(&port->lock);
+	if (port->prefetching) {
+		list_add_tail(&port->prefetch_wait, &ep->prefetch_entry);
+	} else if (!acmp_send_prefetch(ep)) {
+		port->prefetching = true;
+	}
+	pthread_mutex_unlock(&port->lock);
+}
+
 static void acmp_parse_hosts_file(struct acmp_ep *ep)
 {
 	FILE *f;
@@ -2323,6 +3025,7 @@ static void acmp_parse_hosts_file(struct acmp_ep *ep)
 		dest->remote_qpn = 1;
 		dest->addr_timeout = time_stamp_min() + (unsigned) addr_timeout;
 		dest->route_timeout = time_stamp_min() + (unsigned) route_timeout;
+		acmp_pin_dest(ep, dest);
 		acmp_put_dest(dest);
 		acm_log(1, "added host %s address type %d IB GID %s\n",
 			addr, addr_type, gid);
@@ -2331,6 +3034,287 @@ static void acmp_parse_hosts_file(struct acmp_ep *ep)
 	fclose(f);
 }
 
+#define ACMP_SNAPSHOT_MAGIC	0x41434d53	/* "ACMS" */
+#define ACMP_SNAPSHOT_VERSION	1
+
+struct acmp_snapshot_hdr {
+	uint32_t		magic;
+	uint32_t		version;
+	uint32_t		rec_size;
+	uint32_t		ep_cnt;
+};
+
+/* The records of one endpoint, followed by rec_cnt acmp_snapshot_rec */
+struct acmp_snapshot_ep {
+	union ibv_gid		sgid;
+	uint16_t		lid;
+	uint16_t		pkey;
+	uint32_t		rec_cnt;
+};
+
+/* Timeouts are in wall clock minutes, the monotonic clock may restart */
+struct acmp_snapshot_rec {
+	uint8_t			address[ACM_MAX_ADDRESS];
+	struct ibv_path_record	path;
+	uint64_t		addr_timeout;
+	uint64_t		route_timeout;
+	uint32_t		remote_qpn;
+	uint8_t			addr_type;
+	uint8_t			reserved[3];
+};
+
+static int acmp_snapshot_ep(FILE *f, struct acmp_ep *ep)
+{
+	struct acmp_dest_cache *cache = &ep->dest_cache;
+	uint64_t now = time_stamp_min(), wall = time(NULL) / 60;
+	struct acmp_snapshot_ep ep_hdr;
+	struct acmp_snapshot_rec rec;
+	struct acmp_dest *dest;
+	long pos, end;
+	uint32_t i;
+	bool save;
+
+	memset(&ep_hdr, 0, sizeof(ep_hdr));
+	acm_get_gid((struct acm_port *) ep->port->port, 0, &ep_hdr.sgid);
+	ep_hdr.lid = ep->port->lid;
+	ep_hdr.pkey = ep->pkey;
+
+	pos = ftell(f);
+	if (pos < 0 || fseek(f, sizeof(ep_hdr), SEEK_CUR))
+		return -1;
+
+	memset(&rec, 0, sizeof(rec));
+	for (i = 0; i <= cache->mask; i++) {
+		pthread_rwlock_rdlock(acmp_dest_lock(cache, i));
+		list_for_each(&cache->bucket[i], dest, hash_entry) {
+			pthread_mutex_lock(&dest->lock);
+			/* Local addresses are added again when ibacm starts */
+			save = dest->state == ACMP_READY &&
+			       dest->addr_timeout > now && dest->route_timeout > now &&
+			       (dest->addr_timeout != (uint64_t) ~0ULL ||
+				dest->route_timeout != (uint64_t) ~0ULL);
+			if (save) {
+				memcpy(rec.address, dest->address, ACM_MAX_ADDRESS);
+				rec.path = dest->path;
+				rec.addr_timeout = dest->addr_timeout == (uint64_t) ~0ULL ?
+					(uint64_t) ~0ULL : wall + dest->addr_timeout - now;
+				rec.route_timeout = dest->route_timeout == (uint64_t) ~0ULL ?
+					(uint64_t) ~0ULL : wall + dest->route_timeout - now;
+				rec.remote_qpn = dest->remote_qpn;
+				rec.addr_type = dest->addr_type;
+			}
+			pthread_mutex_unlock(&dest->lock);
+
+			if (save && fwrite(&rec, sizeof(rec), 1, f) == 1)
+				ep_hdr.rec_cnt++;
+		}
+		pthread_rwlock_unlock(acmp_dest_lock(cache, i));
+	}
+
+	end = ftell(f);
+	if (end < 0 || fseek(f, pos, SEEK_SET) ||
+	    fwrite(&ep_hdr, sizeof(ep_hdr), 1, f) != 1 ||
+	    fseek(f, end, SEEK_SET))
+		return -1;
+	return ep_hdr.rec_cnt;
+}
+
+/*
+ * Writes the READY destinations of all endpoints aside and renames the file
+ * into place, so a crash while saving leaves the previous snapshot intact.
+ */
+static void acmp_save_snapshot(void)
+{
+	char tmp[PATH_MAX];
+	struct acmp_snapshot_hdr hdr;
+	struct acmp_device *dev;
+	struct acmp_port *port;
+	struct acmp_ep *ep;
+	uint64_t start = time_stamp_ms();
+	int i, fd, len, ret = 0, cnt = 0;
+	FILE *f;
+
+	len = snprintf(tmp, sizeof(tmp), "%s.XXXXXX", cache_snapshot_file);
+	if (len < 0 || len >= sizeof(tmp)) {
+		acm_log(0, "ERROR - %s is too long\n", cache_snapshot_file);
+		return;
+	}
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		acm_log(0, "ERROR - unable to create %s\n", tmp);
+		return;
+	}
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		goto err;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = ACMP_SNAPSHOT_MAGIC;
+	hdr.version = ACMP_SNAPSHOT_VERSION;
+	hdr.rec_size = sizeof(struct acmp_snapshot_rec);
+	if (fseek(f, sizeof(hdr), SEEK_SET))
+		ret = -1;
+
+	pthread_mutex_lock(&acmp_dev_lock);
+	list_for_each(&acmp_dev_list, dev, entry) {
+		pthread_mutex_unlock(&acmp_dev_lock);
+
+		for (i = 0; i < dev->port_cnt && !ret; i++) {
+			port = &dev->port[i];
+
+			pthread_mutex_lock(&port->lock);
+			list_for_each(&port->ep_list, ep, entry) {
+				pthread_mutex_unlock(&port->lock);
+				if (!ret) {
+					ret = acmp_snapshot_ep(f, ep);
+					if (ret >= 0) {
+						cnt += ret;
+						hdr.ep_cnt++;
+						ret = 0;
+					}
+				}
+				pthread_mutex_lock(&port->lock);
+			}
+			pthread_mutex_unlock(&port->lock);
+		}
+		pthread_mutex_lock(&acmp_dev_lock);
+	}
+	pthread_mutex_unlock(&acmp_dev_lock);
+
+	if (ret || fseek(f, 0, SEEK_SET) ||
+	    fwrite(&hdr, sizeof(hdr), 1, f) != 1) {
+		fclose(f);
+		goto err;
+	}
+	if (fclose(f) || rename(tmp, cache_snapshot_file))
+		goto err;
+
+	acm_log(1, "saved %d destinations of %u endpoints in %" PRIu64 " ms\n",
+		cnt, hdr.ep_cnt, time_stamp_ms() - start);
+	return;
+
+err:
+	acm_log(0, "ERROR - failed to write %s\n", cache_snapshot_file);
+	unlink(tmp);
+}
+
+static void *acmp_snapshot_handler(void *context)
+{
+	/* Only cancelled while waiting, never with a lock held */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	acm_log(0, "started\n");
+	while (1) {
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		sleep(cache_snapshot_interval);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+		acmp_save_snapshot();
+	}
+	return NULL;
+}
+
+static int acmp_restore_dest(struct acmp_ep *ep,
+			     const struct acmp_snapshot_rec *rec,
+			     uint64_t now, uint64_t wall)
+{
+	struct acmp_dest *dest;
+	int restored = 0;
+
+	if (!rec->addr_type || rec->addr_type >= ACM_ADDRESS_RESERVED ||
+	    rec->addr_timeout <= wall || rec->route_timeout <= wall)
+		return 0;
+
+	dest = acmp_acquire_dest(ep, rec->addr_type, rec->address);
+	if (!dest) {
+		acm_log(0, "ERROR - unable to create dest\n");
+		return 0;
+	}
+
+	pthread_mutex_lock(&dest->lock);
+	if (dest->state == ACMP_INIT) {
+		dest->path = rec->path;
+		acmp_init_path_av(ep->port, dest);
+		dest->addr_timeout = rec->addr_timeout == (uint64_t) ~0ULL ?
+			(uint64_t) ~0ULL : now + rec->addr_timeout - wall;
+		dest->route_timeout = rec->route_timeout == (uint64_t) ~0ULL ?
+			(uint64_t) ~0ULL : now + rec->route_timeout - wall;
+		dest->remote_qpn = rec->remote_qpn;
+		dest->state = ACMP_READY;
+		restored = 1;
+	}
+	pthread_mutex_unlock(&dest->lock);
+	acmp_put_dest(dest);
+	return restored;
+}
+
+/*
+ * Reloads the destinations an earlier ibacm saved for this endpoint.  They
+ * are only used if the port still has the same GID and LID, otherwise the
+ * paths may lead elsewhere.
+ */
+static void acmp_load_snapshot(struct acmp_ep *ep)
+{
+	const struct acmp_snapshot_hdr *hdr;
+	const struct acmp_snapshot_ep *ep_hdr;
+	const struct acmp_snapshot_rec *rec;
+	uint64_t now = time_stamp_min(), wall = time(NULL) / 60;
+	union ibv_gid sgid;
+	struct stat st;
+	size_t off;
+	uint32_t i, j;
+	int fd, cnt = 0;
+	void *map;
+
+	fd = open(cache_snapshot_file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	if (fstat(fd, &st) || st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return;
+
+	hdr = map;
+	if (hdr->magic != ACMP_SNAPSHOT_MAGIC ||
+	    hdr->version != ACMP_SNAPSHOT_VERSION ||
+	    hdr->rec_size != sizeof(*rec)) {
+		acm_log(0, "ERROR - %s is not a valid snapshot\n",
+			cache_snapshot_file);
+		goto out;
+	}
+
+	acm_get_gid((struct acm_port *) ep->port->port, 0, &sgid);
+	off = sizeof(*hdr);
+	for (i = 0; i < hdr->ep_cnt; i++) {
+		if (st.st_size - off < sizeof(*ep_hdr))
+			break;
+		ep_hdr = map + off;
+		off += sizeof(*ep_hdr);
+		if ((st.st_size - off) / sizeof(*rec) < ep_hdr->rec_cnt)
+			break;
+
+		rec = map + off;
+		off += ep_hdr->rec_cnt * sizeof(*rec);
+		if (memcmp(&ep_hdr->sgid, &sgid, sizeof(sgid)) ||
+		    ep_hdr->lid != ep->port->lid || ep_hdr->pkey != ep->pkey)
+			continue;
+
+		for (j = 0; j < ep_hdr->rec_cnt; j++)
+			cnt += acmp_restore_dest(ep, &rec[j], now, wall);
+	}
+
+	acm_log(1, "%s: restored %d destinations\n", ep->id_string, cnt);
+out:
+	munmap(map, st.st_size);
+}
+
 /*
  * We currently require that the routing data be preloaded in order to
  * load the address data.  This is backwards from normal operation, which
@@ -2338,11 +3322,17 @@ static void acmp_parse_hosts_file(struct acmp_ep *ep)
  */
 static void acmp_ep_preload(struct acmp_ep *ep)
 {
+	if (cache_snapshot)
+		acmp_load_snapshot(ep);
+
 	switch (route_preload) {
 	case ACMP_ROUTE_PRELOAD_OSM_FULL_V1:
 		if (acmp_parse_osm_fullv1(ep))
 			acm_log(0, "ERROR - failed to preload EP\n");
 		break;
+	case ACMP_ROUTE_PRELOAD_SA_PATH_TABLE:
+		acmp_prefetch_paths(ep);
+		break;
 	default:
 		break;
 	}
@@ -2403,9 +3393,10 @@ static int acmp_add_addr(const struct acm_address *addr, void *ep_context,
 	dest->addr_timeout = (uint64_t) ~0ULL;
 	dest->route_timeout = (uint64_t) ~0ULL;
 	dest->state = ACMP_READY;
+	acmp_pin_dest(ep, dest);
+	acm_log(1, "added loopback dest %s\n", dest->name);
 	acmp_put_dest(dest);
 	*addr_context = &ep->addr_info[i];
-	acm_log(1, "added loopback dest %s\n", dest->name);
 
 	return 0;
 }
@@ -2438,9 +3429,8 @@ static void acmp_remove_addr(void *addr_context)
 				dest = acmp_get_dest(ep, address->type, address->addr->info.addr);
 				if (dest) {
 					acm_log(2, "Found a dest addr, deleting it\n");
-					pthread_mutex_lock(&ep->lock);
 					acmp_remove_dest(ep, dest);
-					pthread_mutex_unlock(&ep->lock);
+					acmp_put_dest(dest);
 				}
 				pthread_mutex_lock(&port->lock);
 			}
@@ -2538,6 +3528,10 @@ acmp_alloc_ep(struct acmp_port *port, struct acm_endpoint *endpoint)
 		port->port_num, endpoint->pkey);
 	for (i = 0; i < ACM_MAX_COUNTER; i++)
 		atomic_init(&ep->counters[i]);
+	if (acmp_init_dest_cache(&ep->dest_cache)) {
+		free(ep);
+		return NULL;
+	}
 
 	return ep;
 }
@@ -2572,7 +3566,7 @@ static int acmp_open_endpoint(const struct acm_endpoint *endpoint,
 
 	sq_size = resolve_depth + send_depth;
 	ep->cq = ibv_create_cq(port->dev->verbs, sq_size + recv_depth,
-		ep, port->dev->channel, 0);
+		ep, port->channel, 0);
 	if (!ep->cq) {
 		acm_log(0, "ERROR - failed to create CQ\n");
 		goto err0;
@@ -2643,6 +3637,7 @@ err2:
 err1:
 	ibv_destroy_cq(ep->cq);
 err0:
+	free(ep->dest_cache.bucket);
 	free(ep);
 	return -1;
 }
@@ -2651,9 +3646,9 @@ static void acmp_port_up(struct acmp_port *port)
 {
 	struct ibv_port_attr attr;
 	uint16_t pkey;
-	__be16 pkey_be;
+	__be16 *pkeys;
 	__be16 sm_lid;
-	int i, ret;
+	int i, ret, num_pkeys;
 	int instance;
 
 	acm_log(1, "%s %d\n", port->dev->verbs->device->name, port->port_num);
@@ -2682,11 +3677,14 @@ static void acmp_port_up(struct acmp_port *port)
 
 	instance = atomic_inc(&port->sa_dest.refcnt) - 1;
 	port->sa_dest.state = ACMP_READY;
-	for (i = 0; i < attr.pkey_tbl_len; i++) {
-		ret = ibv_query_pkey(port->dev->verbs, port->port_num, i, &pkey_be);
-		if (ret)
-			continue;
-		pkey = be16toh(pkey_be);
+	num_pkeys = -1;
+	pkeys = calloc(attr.pkey_tbl_len, sizeof(*pkeys));
+	if (pkeys)
+		num_pkeys = ibv_query_pkey_table(port->dev->verbs,
+						 port->port_num, pkeys,
+						 attr.pkey_tbl_len);
+	for (i = 0; i < num_pkeys; i++) {
+		pkey = be16toh(pkeys[i]);
 		if (!(pkey & 0x7fff))
 			continue;
 
@@ -2698,7 +3696,9 @@ static void acmp_port_up(struct acmp_port *port)
 			break;
 		}
 	}
+	free(pkeys);
 
+	port->subscribed = false;
 	port->state = IBV_PORT_ACTIVE;
 	acm_log(1, "%s %d %d is up\n", port->dev->verbs->device->name, port->port_num, instance);
 }
@@ -2766,10 +3766,36 @@ static void acmp_init_port(struct acmp_port *port, struct acmp_device *dev,
 	port->port_num = port_num;
 	pthread_mutex_init(&port->lock, NULL);
 	list_head_init(&port->ep_list);
+	list_head_init(&port->prefetch_wait);
+	acmp_init_wheel(&port->wheel);
 	acmp_init_dest(&port->sa_dest, ACM_ADDRESS_LID, NULL, 0);
 	port->state = IBV_PORT_DOWN;
 }
 
+static int acmp_start_port(struct acmp_port *port)
+{
+	port->channel = ibv_create_comp_channel(port->dev->verbs);
+	if (!port->channel) {
+		acm_log(0, "ERROR - unable to create comp channel\n");
+		return -1;
+	}
+
+	if (pthread_create(&port->comp_thread_id, NULL, acmp_comp_handler, port)) {
+		acm_log(0, "Error -- failed to create the comp thread for %s %d\n",
+			port->dev->verbs->device->name, port->port_num);
+		ibv_destroy_comp_channel(port->channel);
+		return -1;
+	}
+	return 0;
+}
+
+static void acmp_stop_port(struct acmp_port *port)
+{
+	pthread_cancel(port->comp_thread_id);
+	pthread_join(port->comp_thread_id, NULL);
+	ibv_destroy_comp_channel(port->channel);
+}
+
 static int acmp_open_dev(const struct acm_device *device, void **dev_context)
 {
 	struct acmp_device *dev;
@@ -2826,20 +3852,10 @@ static int acmp_open_dev(const struct acm_device *device, void **dev_context)
 		goto err1;
 	}
 
-	dev->channel = ibv_create_comp_channel(dev->verbs);
-	if (!dev->channel) {
-		acm_log(0, "ERROR - unable to create comp channel\n");
-		goto err2;
-	}
-
 	for (i = 0; i < dev->port_cnt; i++) {
 		acmp_init_port(&dev->port[i], dev, i + 1);
-	}
-
-	if (pthread_create(&dev->comp_thread_id, NULL, acmp_comp_handler, dev)) {
-		acm_log(0, "Error -- failed to create the comp thread for dev %s",
-			dev->verbs->device->name);
-		goto err3;
+		if (acmp_start_port(&dev->port[i]))
+			goto err3;
 	}
 
 	pthread_mutex_lock(&acmp_dev_lock);
@@ -2852,8 +3868,8 @@ static int acmp_open_dev(const struct acm_device *device, void **dev_context)
 	return 0;
 
 err3:
-	ibv_destroy_comp_channel(dev->channel);
-err2:
+	while (i--)
+		acmp_stop_port(&dev->port[i]);
 	ibv_dealloc_pd(dev->pd);
 err1:
 	free(dev);
@@ -2918,6 +3934,29 @@ static void acmp_set_options(void)
 			addr_preload = acmp_convert_addr_preload(value);
 		else if (!strcasecmp("addr_data_file", opt))
 			strcpy(addr_data_file, value);
+		else if (!strcasecmp("dest_cache_size", opt))
+			dest_cache_size = atoi(value);
+		else if (!strcasecmp("negative_timeout", opt))
+			negative_timeout = atoi(value);
+		else if (!strcasecmp("refresh_ahead", opt))
+			refresh_ahead = atoi(value);
+		else if (!strcasecmp("subscribe_traps", opt))
+			subscribe_traps = !strcasecmp(value, "yes") ||
+					  !strcasecmp(value, "true") ||
+					  strtol(value, NULL, 0);
+		else if (!strcasecmp("cache_snapshot", opt))
+			cache_snapshot = !strcasecmp(value, "yes") ||
+					 !strcasecmp(value, "true") ||
+					 strtol(value, NULL, 0);
+		else if (!strcasecmp("cache_snapshot_file", opt)) {
+			if (strlen(value) >= sizeof(cache_snapshot_file))
+				acm_log(0, "ERROR - cache_snapshot_file %s is too long, using %s\n",
+					value, cache_snapshot_file);
+			else
+				strcpy(cache_snapshot_file, value);
+		}
+		else if (!strcasecmp("cache_snapshot_interval", opt))
+			cache_snapshot_interval = atoi(value);
 	}
 
 	fclose(f);
@@ -2941,6 +3980,13 @@ static void acmp_log_options(void)
 	acm_log(0, "route data file %s\n", route_data_file);
 	acm_log(0, "address preload %d\n", addr_preload);
 	acm_log(0, "address data file %s\n", addr_data_file);
+	acm_log(0, "dest cache size %d\n", dest_cache_size);
+	acm_log(0, "negative timeout %d ms\n", negative_timeout);
+	acm_log(0, "refresh ahead %d\n", refresh_ahead);
+	acm_log(0, "subscribe traps %s\n", subscribe_traps ? "yes" : "no");
+	acm_log(0, "cache snapshot %s\n", cache_snapshot ? "yes" : "no");
+	acm_log(0, "cache snapshot file %s\n", cache_snapshot_file);
+	acm_log(0, "cache snapshot interval %d s\n", cache_snapshot_interval);
 }
 
 static void __attribute__((constructor)) acmp_init(void)
@@ -2950,22 +3996,50 @@ static void __attribute__((constructor)) acmp_init(void)
 	acmp_log_options();
 
 	atomic_init(&g_tid);
-	atomic_init(&wait_cnt);
 	pthread_mutex_init(&acmp_dev_lock, NULL);
-	event_init(&timeout_event);
 
 	umad_init();
 
-	acm_log(1, "starting timeout/retry thread\n");
-	if (pthread_create(&retry_thread_id, NULL, acmp_retry_handler, NULL)) {
-		acm_log(0, "Error: failed to create the retry thread");
-		retry_thread_started = 0;
-		return;
+	if (cache_snapshot && cache_snapshot_interval > 0) {
+		acm_log(1, "starting cache snapshot thread\n");
+		if (pthread_create(&snapshot_thread_id, NULL,
+				   acmp_snapshot_handler, NULL))
+			acm_log(0, "Error: failed to create the snapshot thread\n");
+		else
+			snapshot_thread_started = 1;
 	}
 
 	acmp_initialized = 1;
 }
 
+/*
+ * Runs when ibacm unloads the provider on shutdown.  Our threads must be
+ * gone before the library is unmapped.
+ */
+static void __attribute__((destructor)) acmp_exit(void)
+{
+	struct acmp_device *dev;
+	int i;
+
+	if (!acmp_initialized)
+		return;
+
+	if (snapshot_thread_started) {
+		pthread_cancel(snapshot_thread_id);
+		pthread_join(snapshot_thread_id, NULL);
+		snapshot_thread_started = 0;
+	}
+	if (cache_snapshot)
+		acmp_save_snapshot();
+
+	list_for_each(&acmp_dev_list, dev, entry) {
+		for (i = 0; i < dev->port_cnt; i++) {
+			pthread_cancel(dev->port[i].comp_thread_id);
+			pthread_join(dev->port[i].comp_thread_id, NULL);
+		}
+	}
+}
+
 int provider_query(struct acm_provider **provider, uint32_t *version)
 {
 	acm_log(1, "\n");
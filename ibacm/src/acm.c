@@ -54,6 +54,9 @@
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <signal.h>
 #include <net/if_arp.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
@@ -65,6 +68,7 @@
 #include <systemd/sd-daemon.h>
 #include <ccan/list.h>
 #include <util/util.h>
+#include <util/acm_cache.h>
 #include "acm_mad.h"
 #include "acm_util.h"
 
@@ -72,6 +76,13 @@
 #define NL_MSG_BUF_SIZE 4096
 #define ACM_PROV_NAME_SIZE 64
 #define NL_CLIENT_INDEX 0
+#define ACM_CLIENT_CHUNK 1024
+#define ACM_MAX_CLIENT_CHUNKS 256
+#define ACM_SERVER_EVENTS 8
+/* Whether a provider's size covers an optional member of acm_provider */
+#define ACM_PROV_HAS(prov, field) \
+	((prov)->size >= offsetof(struct acm_provider, field) + \
+			 sizeof((prov)->field))
 
 struct acmc_subnet {
 	struct list_node       entry;
@@ -101,6 +112,8 @@ struct acmc_port {
 	void                *prov_port_context;
 	int		    mad_portid;
 	int		    mad_agentid;
+	/* Receives the SA reports of traps providers subscribed to */
+	int		    mad_report_agentid;
 	struct ib_mad_addr  sa_addr;
 	struct list_head    sa_pending;
 	struct list_head    sa_wait;
@@ -144,6 +157,7 @@ struct acmc_client {
 	int      sock;
 	int      index;
 	atomic_t refcnt;
+	int      next_free;
 };
 
 union socket_addr {
@@ -152,10 +166,31 @@ union socket_addr {
 	struct sockaddr_in6 sin6;
 };
 
+/*
+ * A resolve request a provider is working on, matched to its response by
+ * client and tid so the answer can be published in the client visible cache.
+ */
+struct acmc_cache_req {
+	struct list_node	entry;
+	uint64_t		id;
+	uint64_t		tid;
+	int			generation;
+	time_t			start;
+	int			key_cnt;
+	struct acm_cache_ep	key[ACM_CACHE_MAX_EP];
+};
+
+/* Requests nobody answered by then are dropped from the pending list */
+#define ACMC_CACHE_REQ_TIMEOUT 30
+
 struct acmc_sa_req {
 	struct list_node	entry;
 	struct acmc_ep		*ep;
 	void			(*resp_handler)(struct acm_sa_mad *);
+	/* Whole response when it spanned more than one MAD (RMPP) */
+	struct ib_user_mad	*rmpp;
+	/* Length umad_recv reported for the response, 0 if none came */
+	int			resp_len;
 	struct acm_sa_mad	mad;
 };
 
@@ -182,7 +217,21 @@ static LIST_HEAD(dev_list);
 
 static int listen_socket;
 static int ip_mon_socket;
-static struct acmc_client client_array[FD_SETSIZE - 1];
+/* SIGINT and SIGTERM, blocked everywhere and taken by the server loop */
+static sigset_t stop_signals;
+/*
+ * Clients are allocated in chunks so that an index handed to a provider stays
+ * valid while the table grows.  Free slots are kept on a list threaded through
+ * next_free; the netlink client owns slot 0 and is never freed.
+ */
+static struct acmc_client *client_chunks[ACM_MAX_CLIENT_CHUNKS];
+static int client_count;
+static int client_free = -1;
+static pthread_mutex_t client_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Client sockets, served by the worker threads */
+static int client_epfd = -1;
+/* Held shared while serving clients, exclusive for device and address events */
+static pthread_rwlock_t server_lock = PTHREAD_RWLOCK_INITIALIZER;
 
 static FILE *flog;
 static pthread_mutex_t log_lock;
@@ -220,6 +269,13 @@ static short server_port = 6125;
 static int server_mode = IBACM_SERVER_MODE_DEFAULT;
 static int acme_plus_kernel_only = IBACM_ACME_PLUS_KERNEL_ONLY_DEFAULT;
 static int support_ips_in_addr_cfg = 0;
+static int server_threads = 4;
+static int shm_cache_size = 16384;
+static int shm_cache_timeout = 60;
+static struct acm_cache *resp_cache;
+static atomic_t resp_cache_gen;
+static LIST_HEAD(cache_req_list);
+static pthread_mutex_t cache_req_lock = PTHREAD_MUTEX_INITIALIZER;
 static char prov_lib_path[256] = IBACM_LIB_PATH;
 
 void acm_write(int level, const char *format, ...)
@@ -493,13 +549,170 @@ __be64 acm_path_comp_mask(struct ibv_path_record *path)
 	return comp_mask;
 }
 
+static inline struct acmc_client *acm_client(uint64_t id)
+{
+	return &client_chunks[id / ACM_CLIENT_CHUNK][id % ACM_CLIENT_CHUNK];
+}
+
+static int acm_alloc_client_chunk(void)
+{
+	struct acmc_client *chunk;
+	int i, base;
+
+	if (client_count == ACM_MAX_CLIENT_CHUNKS * ACM_CLIENT_CHUNK)
+		return -1;
+
+	chunk = calloc(ACM_CLIENT_CHUNK, sizeof(*chunk));
+	if (!chunk)
+		return -1;
+
+	base = client_count;
+	for (i = ACM_CLIENT_CHUNK - 1; i >= 0; i--) {
+		pthread_mutex_init(&chunk[i].lock, NULL);
+		chunk[i].index = base + i;
+		chunk[i].sock = -1;
+		atomic_init(&chunk[i].refcnt);
+		if (base + i == NL_CLIENT_INDEX)
+			continue;
+		chunk[i].next_free = client_free;
+		client_free = base + i;
+	}
+
+	client_chunks[base / ACM_CLIENT_CHUNK] = chunk;
+	client_count += ACM_CLIENT_CHUNK;
+	acm_log(1, "client table grown to %d entries\n", client_count);
+	return 0;
+}
+
+static struct acmc_client *acm_get_client(void)
+{
+	struct acmc_client *client = NULL;
+
+	pthread_mutex_lock(&client_lock);
+	if (client_free == -1 && acm_alloc_client_chunk())
+		goto out;
+
+	client = acm_client(client_free);
+	client_free = client->next_free;
+out:
+	pthread_mutex_unlock(&client_lock);
+	return client;
+}
+
+static void acm_put_client(struct acmc_client *client)
+{
+	if (atomic_dec(&client->refcnt) > 0 ||
+	    client->index == NL_CLIENT_INDEX)
+		return;
+
+	pthread_mutex_lock(&client_lock);
+	client->next_free = client_free;
+	client_free = client->index;
+	pthread_mutex_unlock(&client_lock);
+}
+
+static time_t acm_cache_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+void acm_flush_cache(void)
+{
+	/* Answers to requests issued before this are no longer published */
+	(void) atomic_inc(&resp_cache_gen);
+	if (resp_cache)
+		acm_cache_flush(resp_cache);
+}
+
+static void acm_cache_track(struct acmc_client *client, struct acm_msg *msg)
+{
+	struct acmc_cache_req *req, *old, *next;
+	time_t now;
+	int cnt;
+
+	if (!resp_cache || client->index == NL_CLIENT_INDEX)
+		return;
+
+	/* Only requests we can key on are worth tracking */
+	cnt = (msg->hdr.length - ACM_MSG_HDR_LENGTH) / ACM_MSG_EP_LENGTH;
+	if (cnt < 1 || cnt > ACM_CACHE_MAX_EP)
+		return;
+
+	req = calloc(1, sizeof(*req));
+	if (!req)
+		return;
+
+	now = acm_cache_now();
+	req->id = client->index;
+	req->tid = msg->hdr.tid;
+	req->generation = atomic_get(&resp_cache_gen);
+	req->start = now;
+	req->key_cnt = cnt;
+	memcpy(req->key, msg->resolve_data, cnt * ACM_MSG_EP_LENGTH);
+
+	pthread_mutex_lock(&cache_req_lock);
+	list_for_each_safe(&cache_req_list, old, next, entry) {
+		if (now - old->start < ACMC_CACHE_REQ_TIMEOUT)
+			break;
+		acm_log(2, "dropping unanswered request, client %" PRIu64 "\n",
+			old->id);
+		list_del(&old->entry);
+		free(old);
+	}
+	list_add_tail(&cache_req_list, &req->entry);
+	pthread_mutex_unlock(&cache_req_lock);
+}
+
+static void acm_cache_publish(uint64_t id, struct acm_msg *msg)
+{
+	struct acmc_cache_req *req, *iter;
+	int cnt;
+
+	req = NULL;
+	pthread_mutex_lock(&cache_req_lock);
+	list_for_each(&cache_req_list, iter, entry) {
+		if (iter->id == id && iter->tid == msg->hdr.tid) {
+			list_del(&iter->entry);
+			req = iter;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&cache_req_lock);
+	if (!req)
+		return;
+
+	cnt = (msg->hdr.length - ACM_MSG_HDR_LENGTH) / ACM_MSG_EP_LENGTH;
+	if (!msg->hdr.status &&
+	    req->generation == atomic_get(&resp_cache_gen))
+		acm_cache_insert(resp_cache, req->key, req->key_cnt,
+				 (struct acm_cache_ep *) msg->resolve_data, cnt);
+	free(req);
+}
+
+static void acm_cache_cleanup(void)
+{
+	struct acmc_cache_req *req, *next;
+
+	list_for_each_safe(&cache_req_list, req, next, entry) {
+		list_del(&req->entry);
+		free(req);
+	}
+}
+
 int acm_resolve_response(uint64_t id, struct acm_msg *msg)
 {
-	struct acmc_client *client = &client_array[id];
+	struct acmc_client *client = acm_client(id);
 	int ret;
 
+	BUILD_ASSERT(sizeof(struct acm_cache_ep) == ACM_MSG_EP_LENGTH);
 	acm_log(2, "client %d, status 0x%x\n", client->index, msg->hdr.status);
 
+	if (resp_cache && id != NL_CLIENT_INDEX)
+		acm_cache_publish(id, msg);
+
 	if (msg->hdr.status == ACM_STATUS_ENODATA)
 		atomic_inc(&counter[ACM_CNTR_NODATA]);
 	else if (msg->hdr.status)
@@ -524,7 +737,7 @@ int acm_resolve_response(uint64_t id, struct acm_msg *msg)
 
 release:
 	pthread_mutex_unlock(&client->lock);
-	(void) atomic_dec(&client->refcnt);
+	acm_put_client(client);
 	return ret;
 }
 
@@ -542,7 +755,7 @@ acmc_resolve_response(uint64_t id, struct acm_msg *req_msg, uint8_t status)
 
 int acm_query_response(uint64_t id, struct acm_msg *msg)
 {
-	struct acmc_client *client = &client_array[id];
+	struct acmc_client *client = acm_client(id);
 	int ret;
 
 	acm_log(2, "status 0x%x\n", msg->hdr.status);
@@ -561,7 +774,7 @@ int acm_query_response(uint64_t id, struct acm_msg *msg)
 
 release:
 	pthread_mutex_unlock(&client->lock);
-	(void) atomic_dec(&client->refcnt);
+	acm_put_client(client);
 	return ret;
 }
 
@@ -573,16 +786,13 @@ static int acmc_query_response(uint64_t id, struct acm_msg *msg, uint8_t status)
 	return acm_query_response(id, msg);
 }
 
-static void acm_init_server(void)
+static int acm_init_server(void)
 {
 	FILE *f;
-	int i;
 
-	for (i = 0; i < FD_SETSIZE - 1; i++) {
-		pthread_mutex_init(&client_array[i].lock, NULL);
-		client_array[i].index = i;
-		client_array[i].sock = -1;
-		atomic_init(&client_array[i].refcnt);
+	if (acm_alloc_client_chunk()) {
+		acm_log(0, "ERROR - unable to allocate client table\n");
+		return -1;
 	}
 
 	if (server_mode != IBACM_SERVER_MODE_UNIX) {
@@ -604,6 +814,8 @@ static void acm_init_server(void)
 		unlink(IBACM_IBACME_PORT_FILE);
 		unlink(IBACM_PORT_FILE);
 	}
+
+	return 0;
 }
 
 static int acm_listen(void)
@@ -678,7 +890,7 @@ static int acm_listen(void)
 		}
 	}
 
-	ret = listen(listen_socket, 0);
+	ret = listen(listen_socket, SOMAXCONN);
 	if (ret == -1) {
 		acm_log(0, "ERROR - unable to start listen\n");
 		return errno;
@@ -710,12 +922,12 @@ static int acm_listen_systemd(void)
 			/* ListenNetlink for RDMA_NL_GROUP_LS multicast
 			 * messages from the kernel
 			 */
-			if (client_array[NL_CLIENT_INDEX].sock != -1) {
+			if (acm_client(NL_CLIENT_INDEX)->sock != -1) {
 				fprintf(stderr,
 					"sd_listen_fds returned more than one netlink socket\n");
 				return -1;
 			}
-			client_array[NL_CLIENT_INDEX].sock = fd;
+			acm_client(NL_CLIENT_INDEX)->sock = fd;
 
 			/* systemd sets NONBLOCK on the netlink socket, while
 			 * we want blocking send to the kernel.
@@ -751,13 +963,26 @@ static void acm_disconnect_client(struct acmc_client *client)
 	close(client->sock);
 	client->sock = -1;
 	pthread_mutex_unlock(&client->lock);
-	(void) atomic_dec(&client->refcnt);
+	acm_put_client(client);
+}
+
+/*
+ * Client sockets are one-shot: the worker that picks up a request owns the
+ * client until it rearms the socket, so receives on a client never overlap.
+ */
+static int acm_watch_client(struct acmc_client *client, int op)
+{
+	struct epoll_event event;
+
+	event.events = EPOLLIN | EPOLLONESHOT;
+	event.data.u64 = client->index;
+	return epoll_ctl(client_epfd, op, client->sock, &event);
 }
 
 static void acm_svr_accept(void)
 {
+	struct acmc_client *client;
 	int s;
-	int i;
 
 	acm_log(2, "\n");
 	s = accept(listen_socket, NULL, NULL);
@@ -766,22 +991,22 @@ static void acm_svr_accept(void)
 		return;
 	}
 
-	for (i = 0; i < FD_SETSIZE - 1; i++) {
-		if (i == NL_CLIENT_INDEX)
-			continue;
-		if (!atomic_get(&client_array[i].refcnt))
-			break;
-	}
-
-	if (i == FD_SETSIZE - 1) {
+	client = acm_get_client();
+	if (!client) {
 		acm_log(0, "ERROR - all connections busy - rejecting\n");
 		close(s);
 		return;
 	}
 
-	client_array[i].sock = s;
-	atomic_set(&client_array[i].refcnt, 1);
-	acm_log(2, "assigned client %d\n", i);
+	client->sock = s;
+	atomic_set(&client->refcnt, 1);
+	acm_log(2, "assigned client %d\n", client->index);
+
+	if (acm_watch_client(client, EPOLL_CTL_ADD)) {
+		acm_log(0, "ERROR - unable to watch client %d\n",
+			client->index);
+		acm_disconnect_client(client);
+	}
 }
 
 static int
@@ -1132,9 +1357,11 @@ static int acm_svr_resolve(struct acmc_client *client, struct acm_msg *msg)
 		if (msg->resolve_data[0].flags & ACM_FLAGS_QUERY_SA) {
 			return acm_svr_query_path(client, msg);
 		} else {
+			acm_cache_track(client, msg);
 			return acm_svr_resolve_path(client, msg);
 		}
 	} else {
+		acm_cache_track(client, msg);
 		return acm_svr_resolve_dest(client, msg);
 	}
 }
@@ -1245,18 +1472,29 @@ static int acm_msg_length(struct acm_msg *msg)
 		msg->hdr.length : be16toh(msg->hdr.length);
 }
 
-static void acm_svr_receive(struct acmc_client *client)
+static int acm_svr_receive(struct acmc_client *client)
 {
 	struct acm_msg msg;
-	int ret;
+	int ret, len;
 
 	acm_log(2, "client %d\n", client->index);
-	ret = recv(client->sock, (char *) &msg, sizeof msg, 0);
-	if (ret <= 0 || ret != acm_msg_length(&msg)) {
-		acm_log(2, "client disconnected\n");
-		ret = ACM_STATUS_ENOTCONN;
-		goto out;
-	}
+	/*
+	 * Clients may pipeline requests, so take exactly one message.  Each
+	 * one is sent whole, and a worker must never wait on a client, so a
+	 * short read is taken as a disconnect.
+	 */
+	ret = recv(client->sock, (char *) &msg, ACM_MSG_HDR_LENGTH,
+		   MSG_DONTWAIT);
+	if (ret != ACM_MSG_HDR_LENGTH)
+		goto disconnect;
+
+	len = acm_msg_length(&msg) - ACM_MSG_HDR_LENGTH;
+	if (len < 0 || len > sizeof(msg.data))
+		goto disconnect;
+
+	if (len &&
+	    recv(client->sock, (char *) msg.data, len, MSG_DONTWAIT) != len)
+		goto disconnect;
 
 	if (msg.hdr.version != ACM_VERSION) {
 		acm_log(0, "ERROR - unsupported version %d\n", msg.hdr.version);
@@ -1282,6 +1520,12 @@ static void acm_svr_receive(struct acmc_client *client)
 out:
 	if (ret)
 		acm_disconnect_client(client);
+	return ret;
+
+disconnect:
+	acm_log(2, "client disconnected\n");
+	ret = ACM_STATUS_ENOTCONN;
+	goto out;
 }
 
 static int acm_nl_to_addr_data(struct acm_ep_addr_data *ad,
@@ -1825,20 +2069,102 @@ static int acm_init_nl(void)
 	}
 
 	/* init nl client structure */
-	client_array[NL_CLIENT_INDEX].sock = nl_rcv_socket;
+	acm_client(NL_CLIENT_INDEX)->sock = nl_rcv_socket;
 	return 0;
 }
 
-static void acm_server(bool systemd)
+static void *acm_server_worker(void *arg)
 {
-	fd_set readfds;
+	struct epoll_event events[ACM_SERVER_EVENTS];
+	struct acmc_client *client;
 	int i, n, ret;
+
+	while (1) {
+		n = epoll_wait(client_epfd, events, ACM_SERVER_EVENTS, -1);
+		if (n == -1) {
+			if (errno != EINTR)
+				acm_log(0, "ERROR - client epoll error\n");
+			continue;
+		}
+
+		for (i = 0; i < n; i++) {
+			client = acm_client(events[i].data.u64);
+			acm_log(2, "receiving from client %d\n", client->index);
+
+			pthread_rwlock_rdlock(&server_lock);
+			if (client->index == NL_CLIENT_INDEX) {
+				acm_nl_receive(client);
+				ret = 0;
+			} else {
+				ret = acm_svr_receive(client);
+			}
+			pthread_rwlock_unlock(&server_lock);
+
+			/* A disconnected client may already be reused */
+			if (ret || !acm_watch_client(client, EPOLL_CTL_MOD))
+				continue;
+
+			acm_log(0, "ERROR - unable to rearm client %d\n",
+				client->index);
+			if (client->index != NL_CLIENT_INDEX)
+				acm_disconnect_client(client);
+		}
+	}
+
+	return NULL;
+}
+
+static int acm_server_watch(int epfd, int fd)
+{
+	struct epoll_event event;
+
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+	return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event);
+}
+
+static int acm_start_workers(void)
+{
+	struct acmc_client *nl_client = acm_client(NL_CLIENT_INDEX);
+	pthread_t thread;
+	int i;
+
+	client_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (client_epfd == -1) {
+		acm_log(0, "ERROR - unable to create client epoll\n");
+		return -1;
+	}
+
+	if (nl_client->sock != -1 &&
+	    acm_watch_client(nl_client, EPOLL_CTL_ADD))
+		acm_log(0, "ERROR - unable to watch netlink socket\n");
+
+	for (i = 0; i < server_threads; i++) {
+		if (pthread_create(&thread, NULL, acm_server_worker, NULL)) {
+			acm_log(0, "ERROR - unable to start server thread\n");
+			if (!i)
+				return -1;
+			break;
+		}
+		pthread_detach(thread);
+	}
+
+	acm_log(1, "started %d server threads\n", i);
+	return 0;
+}
+
+static void acm_server(bool systemd)
+{
+	struct epoll_event events[ACM_SERVER_EVENTS];
+	struct signalfd_siginfo info;
 	struct acmc_device *dev;
+	int epfd, sigfd, fd, i, n, ret;
 
 	acm_log(0, "started\n");
-	acm_init_server();
+	if (acm_init_server())
+		return;
 
-	client_array[NL_CLIENT_INDEX].sock = -1;
+	acm_client(NL_CLIENT_INDEX)->sock = -1;
 	listen_socket = -1;
 	if (systemd) {
 		ret = acm_listen_systemd();
@@ -1856,65 +2182,107 @@ static void acm_server(bool systemd)
 		}
 	}
 
-	if (client_array[NL_CLIENT_INDEX].sock == -1) {
+	if (acm_client(NL_CLIENT_INDEX)->sock == -1) {
 		ret = acm_init_nl();
 		if (ret)
 			acm_log(1, "Warn - Netlink init failed\n");
 	}
 
+	/*
+	 * This thread accepts connections and handles device and address
+	 * changes; client requests are served by the worker pool.
+	 */
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd == -1) {
+		acm_log(0, "ERROR - unable to create server epoll\n");
+		return;
+	}
+
+	sigfd = signalfd(-1, &stop_signals, SFD_CLOEXEC);
+	if (sigfd == -1) {
+		acm_log(0, "ERROR - unable to create signalfd\n");
+		goto out;
+	}
+
+	ret = acm_server_watch(epfd, listen_socket);
+	if (!ret)
+		ret = acm_server_watch(epfd, sigfd);
+	if (!ret && ip_mon_socket != -1)
+		ret = acm_server_watch(epfd, ip_mon_socket);
+	list_for_each(&dev_list, dev, entry) {
+		if (!ret)
+			ret = acm_server_watch(epfd, dev->device.verbs->async_fd);
+	}
+	if (ret) {
+		acm_log(0, "ERROR - unable to watch server sockets\n");
+		goto close;
+	}
+
+	if (shm_cache_size > 0 && !acme_plus_kernel_only) {
+		resp_cache = acm_cache_create(IBACM_CACHE_FILE, shm_cache_size,
+					      shm_cache_timeout * 1000);
+		if (!resp_cache)
+			acm_log(0, "notice - unable to publish %s\n",
+				IBACM_CACHE_FILE);
+	}
+
+	if (acm_start_workers())
+		goto close;
+
 	if (systemd)
 		sd_notify(0, "READY=1");
 
 	while (1) {
-		n = (int) listen_socket;
-		FD_ZERO(&readfds);
-		FD_SET(listen_socket, &readfds);
-		n = max(n, (int) ip_mon_socket);
-		FD_SET(ip_mon_socket, &readfds);
-
-		for (i = 0; i < FD_SETSIZE - 1; i++) {
-			if (client_array[i].sock != -1) {
-				FD_SET(client_array[i].sock, &readfds);
-				n = max(n, (int) client_array[i].sock);
-			}
-		}
-
-		list_for_each(&dev_list, dev, entry) {
-			FD_SET(dev->device.verbs->async_fd, &readfds);
-			n = max(n, (int) dev->device.verbs->async_fd);
-		}
-
-		ret = select(n + 1, &readfds, NULL, NULL, NULL);
-		if (ret == -1) {
-			acm_log(0, "ERROR - server select error\n");
+		n = epoll_wait(epfd, events, ACM_SERVER_EVENTS, -1);
+		if (n == -1) {
+			if (errno != EINTR)
+				acm_log(0, "ERROR - server epoll error\n");
 			continue;
 		}
 
-		if (FD_ISSET(listen_socket, &readfds))
-			acm_svr_accept();
-
-		if (FD_ISSET(ip_mon_socket, &readfds))
-			acm_ipnl_handler();
-
-		for (i = 0; i < FD_SETSIZE - 1; i++) {
-			if (client_array[i].sock != -1 &&
-				FD_ISSET(client_array[i].sock, &readfds)) {
-				acm_log(2, "receiving from client %d\n", i);
-				if (i == NL_CLIENT_INDEX)
-					acm_nl_receive(&client_array[i]);
-				else
-					acm_svr_receive(&client_array[i]);
+		for (i = 0; i < n; i++) {
+			fd = events[i].data.fd;
+			if (fd == listen_socket) {
+				acm_svr_accept();
+				continue;
+			}
+			if (fd == sigfd) {
+				if (read(sigfd, &info, sizeof(info)) != sizeof(info))
+					continue;
+				acm_log(0, "received signal %u\n", info.ssi_signo);
+				goto stop;
 			}
-		}
 
-		list_for_each(&dev_list, dev, entry) {
-			if (FD_ISSET(dev->device.verbs->async_fd, &readfds)) {
-				acm_log(2, "handling event from %s\n",
-					dev->device.verbs->device->name);
-				acm_event_handler(dev);
+			pthread_rwlock_wrlock(&server_lock);
+			if (fd == ip_mon_socket) {
+				acm_ipnl_handler();
+			} else {
+				list_for_each(&dev_list, dev, entry) {
+					if (dev->device.verbs->async_fd != fd)
+						continue;
+					acm_log(2, "handling event from %s\n",
+						dev->device.verbs->device->name);
+					acm_event_handler(dev);
+					break;
+				}
 			}
+			/*
+			 * Resolutions may have changed, stop serving cached
+			 * ones.  Done after the handler so nothing published
+			 * while it ran survives.
+			 */
+			acm_flush_cache();
+			pthread_rwlock_unlock(&server_lock);
 		}
 	}
+
+stop:
+	/* Keep the workers away from the providers while they shut down */
+	pthread_rwlock_wrlock(&server_lock);
+close:
+	close(sigfd);
+out:
+	close(epfd);
 }
 
 enum ibv_rate acm_get_rate(uint8_t width, uint8_t speed)
@@ -2344,8 +2712,8 @@ static void acm_port_up(struct acmc_port *port)
 {
 	struct ibv_port_attr attr;
 	uint16_t pkey;
-	__be16 pkey_be;
-	int i, ret;
+	__be16 *pkeys;
+	int i, ret, num_pkeys;
 	struct acmc_prov_context *dev_ctx;
 	int index = -1;
 	uint16_t first_pkey = 0;
@@ -2394,16 +2762,21 @@ static void acm_port_up(struct acmc_port *port)
 		goto err1;
 	}
 
+	pkeys = calloc(attr.pkey_tbl_len, sizeof(*pkeys));
+	if (!pkeys) {
+		acm_log(0, "Error -- failed to allocate pkey table\n");
+		goto err1;
+	}
+	num_pkeys = ibv_query_pkey_table(port->dev->device.verbs,
+					 port->port.port_num, pkeys,
+					 attr.pkey_tbl_len);
+
 	/* Determine the default pkey for SA access first.
 	 *     Order of preference: 0xffff, 0x7fff
 	 * Use the first pkey as the default pkey for parsing address file.
 	 */
-	for (i = 0; i < attr.pkey_tbl_len; i++) {
-		ret = ibv_query_pkey(port->dev->device.verbs,
-				     port->port.port_num, i, &pkey_be);
-		if (ret)
-			continue;
-		pkey = be16toh(pkey_be);
+	for (i = 0; i < num_pkeys; i++) {
+		pkey = be16toh(pkeys[i]);
 		if (i == 0)
 			first_pkey = pkey;
 		if (pkey == 0xffff) {
@@ -2417,17 +2790,14 @@ static void acm_port_up(struct acmc_port *port)
 	port->sa_pkey_index = index < 0 ? 0 : index;
 	port->def_acm_pkey = first_pkey;
 
-	for (i = 0; i < attr.pkey_tbl_len; i++) {
-		ret = ibv_query_pkey(port->dev->device.verbs,
-				     port->port.port_num, i, &pkey_be);
-		if (ret)
-			continue;
-		pkey = be16toh(pkey_be);
+	for (i = 0; i < num_pkeys; i++) {
+		pkey = be16toh(pkeys[i]);
 		if (!(pkey & 0x7fff))
 			continue;
 
 		acm_ep_up(port, pkey);
 	}
+	free(pkeys);
 	return;
 err1:
 	acm_release_prov_context(dev_ctx);
@@ -2437,22 +2807,30 @@ static void acm_shutdown_port(struct acmc_port *port)
 {
 	struct acmc_ep *ep;
 	struct acmc_prov_context *dev_ctx;
+	struct acm_provider *prov;
+	void *port_context;
 
 	while ((ep = list_pop(&port->ep_list, struct acmc_ep, entry)))
 		acm_ep_down(ep);
 
-	if (port->prov_port_context) {
-		port->prov->close_port(port->prov_port_context);
-		port->prov_port_context = NULL;
+	/* Keep SA reports from reaching a port that is being closed */
+	pthread_mutex_lock(&port->lock);
+	prov = port->prov;
+	port_context = port->prov_port_context;
+	port->prov = NULL;
+	port->prov_port_context = NULL;
+	pthread_mutex_unlock(&port->lock);
+
+	if (port_context) {
+		prov->close_port(port_context);
 		dev_ctx = acm_get_prov_context(&port->dev->prov_dev_context_list,
-					       port->prov);
+					       prov);
 		if (dev_ctx) {
 			if (atomic_get(&dev_ctx->refcnt) == 1)
-				port->prov->close_device(dev_ctx->context);
+				prov->close_device(dev_ctx->context);
 			acm_release_prov_context(dev_ctx);
 		}
 	}
-	port->prov = NULL;
 	if (port->gid_tbl) {
 		free(port->gid_tbl);
 		port->gid_tbl = NULL;
@@ -2592,6 +2970,19 @@ acm_open_port(struct acmc_port *port, struct acmc_device *dev, uint8_t port_num)
 		acm_log(0, "ERROR - unable to register MAD client\n");
 	}
 
+	port->mad_report_agentid = -1;
+	if (port->mad_agentid >= 0) {
+		long method_mask[16 / sizeof(long)] = {};
+
+		method_mask[IB_METHOD_REPORT / (8 * sizeof(long))] |=
+			1L << (IB_METHOD_REPORT % (8 * sizeof(long)));
+		port->mad_report_agentid = umad_register(port->mad_portid,
+							 IB_MGMT_CLASS_SA, 2, 0,
+							 method_mask);
+		if (port->mad_report_agentid < 0)
+			acm_log(0, "notice - unable to receive SA reports\n");
+	}
+
 	port->prov = NULL;
 	port->state = IBV_PORT_DOWN;
 }
@@ -2811,8 +3202,10 @@ static int acm_open_providers(void)
 			continue;
 		}
 
+		/* Providers built before the optional members were added */
 		if (version != ACM_PROV_VERSION ||
-		    provider->size != sizeof(struct acm_provider)) {
+		    provider->size < offsetof(struct acm_provider,
+					      handle_sa_report)) {
 			acm_log(0, "Error -unmatched provider version 0x%08x (size %zd)"
 				" core 0x%08x (size %zd)\n", version, provider->size,
 				ACM_PROV_VERSION, sizeof(struct acm_provider));
@@ -2916,9 +3309,24 @@ void acm_free_sa_mad(struct acm_sa_mad *mad)
 	struct acmc_sa_req *req;
 	req = container_of(mad, struct acmc_sa_req, mad);
 	acm_log(2, "%p\n", req);
+	free(req->rmpp);
 	free(req);
 }
 
+struct umad_sa_packet *acm_get_sa_mad_data(struct acm_sa_mad *mad, size_t *len)
+{
+	struct acmc_sa_req *req;
+
+	req = container_of(mad, struct acmc_sa_req, mad);
+	if (!req->rmpp) {
+		*len = min_t(size_t, req->resp_len, sizeof(mad->sa_mad));
+		return &mad->sa_mad;
+	}
+
+	*len = req->resp_len;
+	return (struct umad_sa_packet *) umad_get_mad(req->rmpp);
+}
+
 int acm_send_sa_mad(struct acm_sa_mad *mad)
 {
 	struct acmc_port *port;
@@ -2978,10 +3386,59 @@ static void acmc_send_queued_req(struct acmc_port *port)
 	}
 }
 
+static void acmc_recv_report(struct acmc_port *port, struct acm_sa_mad *report)
+{
+	struct acm_sa_mad resp;
+	int ret;
+
+	/* Acknowledge the notice first, or the SA keeps sending it */
+	resp = *report;
+	resp.sa_mad.mad_hdr.method = IB_METHOD_REPORT_RESP;
+	resp.umad.addr.qkey = port->sa_addr.qkey;
+	ret = umad_send(port->mad_portid, port->mad_report_agentid, &resp.umad,
+			sizeof resp.sa_mad, 0, 0);
+	if (ret)
+		acm_log(0, "ERROR - failed to send report response %d\n", ret);
+
+	/* The port may be going down, or its provider predate the callback */
+	pthread_mutex_lock(&port->lock);
+	if (port->prov && port->prov_port_context &&
+	    ACM_PROV_HAS(port->prov, handle_sa_report) &&
+	    port->prov->handle_sa_report)
+		port->prov->handle_sa_report(port->prov_port_context,
+					     &report->sa_mad);
+	pthread_mutex_unlock(&port->lock);
+}
+
+/*
+ * The kernel reassembles RMPP transfers, like the reply to a GetTable, and
+ * leaves them queued when the buffer was too small, telling us the length.
+ */
+static struct ib_user_mad *acmc_recv_rmpp(struct acmc_port *port, int *len)
+{
+	struct ib_user_mad *umad;
+	int ret;
+
+	umad = malloc(sizeof(*umad) + *len);
+	if (!umad) {
+		acm_log(0, "ERROR - no memory for %d byte SA response\n", *len);
+		return NULL;
+	}
+
+	ret = umad_recv(port->mad_portid, umad, len, 0);
+	if (ret < 0) {
+		acm_log(1, "umad_recv error %d\n", ret);
+		free(umad);
+		return NULL;
+	}
+	return umad;
+}
+
 static void acmc_recv_mad(struct acmc_port *port)
 {
 	struct acmc_sa_req *req;
 	struct acm_sa_mad resp;
+	struct ib_user_mad *rmpp = NULL;
 	int ret, len, found;
 	struct umad_hdr *hdr;
 
@@ -2993,7 +3450,12 @@ static void acmc_recv_mad(struct acmc_port *port)
 	acm_log(2, "\n");
 	len = sizeof(resp.sa_mad);
 	ret = umad_recv(port->mad_portid, &resp.umad, &len, 0);
-	if (ret < 0) {
+	if (ret == -ENOSPC) {
+		rmpp = acmc_recv_rmpp(port, &len);
+		if (!rmpp)
+			return;
+		memcpy(&resp.umad, rmpp, sizeof(resp.umad) + sizeof(resp.sa_mad));
+	} else if (ret < 0) {
 		acm_log(1, "umad_recv error %d\n", ret);
 		return;
 	}
@@ -3002,6 +3464,13 @@ static void acmc_recv_mad(struct acmc_port *port)
 	acm_log(2, "bv %x cls %x cv %x mtd %x st %d tid %" PRIx64 "x at %x atm %x\n",
 		hdr->base_version, hdr->mgmt_class, hdr->class_version,
 		hdr->method, hdr->status, be64toh(hdr->tid), hdr->attr_id, hdr->attr_mod);
+	if (hdr->method == IB_METHOD_REPORT &&
+	    resp.umad.agent_id == port->mad_report_agentid) {
+		acmc_recv_report(port, &resp);
+		free(rmpp);
+		return;
+	}
+
 	found = 0;
 	pthread_mutex_lock(&port->lock);
 	list_for_each(&port->sa_pending, req, entry) {
@@ -3016,8 +3485,13 @@ static void acmc_recv_mad(struct acmc_port *port)
 	pthread_mutex_unlock(&port->lock);
 
 	if (found) {
-		memcpy(&req->mad.umad, &resp.umad, sizeof(resp.umad) + len);
+		memcpy(&req->mad.umad, &resp.umad,
+		       sizeof(resp.umad) + min_t(int, len, sizeof(resp.sa_mad)));
+		req->rmpp = rmpp;
+		req->resp_len = len;
 		req->resp_handler(&req->mad);
+	} else {
+		free(rmpp);
 	}
 }
 
@@ -3123,6 +3597,12 @@ static void acm_set_options(void)
 			sa.retries = atoi(value);
 		else if (!strcasecmp("sa_depth", opt))
 			sa.depth = atoi(value);
+		else if (!strcasecmp("server_threads", opt))
+			server_threads = max(atoi(value), 1);
+		else if (!strcasecmp("shm_cache_size", opt))
+			shm_cache_size = atoi(value);
+		else if (!strcasecmp("shm_cache_timeout", opt))
+			shm_cache_timeout = atoi(value);
 	}
 
 	fclose(f);
@@ -3141,6 +3621,9 @@ static void acm_log_options(void)
 	acm_log(0, "lock file %s\n", lock_file);
 	acm_log(0, "server_port %d\n", server_port);
 	acm_log(0, "server_mode %s\n", server_mode_names[server_mode]);
+	acm_log(0, "server_threads %d\n", server_threads);
+	acm_log(0, "shm_cache_size %d\n", shm_cache_size);
+	acm_log(0, "shm_cache_timeout %d s\n", shm_cache_timeout);
 	acm_log(0, "acme_plus_kernel_only %s\n",
 		acme_plus_kernel_only ? "yes" : "no");
 	acm_log(0, "timeout %d ms\n", sa.timeout);
@@ -3255,8 +3738,15 @@ int main(int argc, char **argv)
 	acm_log(0, "Assistant to the InfiniBand Communication Manager\n");
 	acm_log_options();
 
+	/* Before any thread is started, so that all of them inherit the mask */
+	sigemptyset(&stop_signals);
+	sigaddset(&stop_signals, SIGINT);
+	sigaddset(&stop_signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+
 	for (i = 0; i < ACM_MAX_COUNTER; i++)
 		atomic_init(&counter[i]);
+	atomic_init(&resp_cache_gen);
 
 	if (umad_init() != 0) {
 		acm_log(0, "ERROR - fail to initialize umad\n");
@@ -3292,10 +3782,17 @@ int main(int argc, char **argv)
 	acm_server(systemd);
 
 	acm_log(0, "shutting down\n");
-	if (client_array[NL_CLIENT_INDEX].sock != -1)
-		close(client_array[NL_CLIENT_INDEX].sock);
-	acm_close_providers();
+	if (client_count && acm_client(NL_CLIENT_INDEX)->sock != -1)
+		close(acm_client(NL_CLIENT_INDEX)->sock);
+	/* Stop SA responses first, they call into the providers */
 	acm_stop_sa_handler();
+	acm_close_providers();
+	/* Providers publish and flush until their threads are gone */
+	if (resp_cache) {
+		acm_cache_destroy(resp_cache, IBACM_CACHE_FILE);
+		resp_cache = NULL;
+	}
+	acm_cache_cleanup();
 	umad_done();
 	acm_fini_if_iter_sys();
 	fclose(flog);
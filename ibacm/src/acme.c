@@ -181,6 +181,55 @@ static void gen_opts_temp(FILE *f)
 	fprintf(f, "\n");
 	fprintf(f, "route_timeout -1\n");
 	fprintf(f, "\n");
+	fprintf(f, "# dest_cache_size:\n");
+	fprintf(f, "# Maximum number of resolved destinations cached per endpoint.  Least\n");
+	fprintf(f, "# recently used entries are evicted beyond this size.  Preloaded and\n");
+	fprintf(f, "# local destinations are not counted.  A value of 0 disables the limit.\n");
+	fprintf(f, "\n");
+	fprintf(f, "dest_cache_size 65536\n");
+	fprintf(f, "\n");
+	fprintf(f, "# negative_timeout:\n");
+	fprintf(f, "# Number of milliseconds that a failed address or route resolution is\n");
+	fprintf(f, "# remembered.  Requests for the same destination fail immediately with\n");
+	fprintf(f, "# the cached status during that time.  A value of 0 disables it.\n");
+	fprintf(f, "\n");
+	fprintf(f, "negative_timeout 1000\n");
+	fprintf(f, "\n");
+	fprintf(f, "# refresh_ahead:\n");
+	fprintf(f, "# Number of minutes before a route expires during which a request for\n");
+	fprintf(f, "# it also sends a path record query in the background, so the route is\n");
+	fprintf(f, "# renewed before it is needed.  Only used with route_prot sa and a\n");
+	fprintf(f, "# route_timeout.  A value of 0 disables it.\n");
+	fprintf(f, "\n");
+	fprintf(f, "refresh_ahead 1\n");
+	fprintf(f, "\n");
+	fprintf(f, "# subscribe_traps:\n");
+	fprintf(f, "# Ask the SA to report ports that go in or out of service, and drop the\n");
+	fprintf(f, "# cached routes to those ports.\n");
+	fprintf(f, "# Supported settings are: yes, no\n");
+	fprintf(f, "\n");
+	fprintf(f, "subscribe_traps yes\n");
+	fprintf(f, "\n");
+	fprintf(f, "# cache_snapshot:\n");
+	fprintf(f, "# Save the resolved destinations to cache_snapshot_file periodically and\n");
+	fprintf(f, "# when ibacm stops, and load them again when it starts, so that a restart\n");
+	fprintf(f, "# does not resolve every destination anew.  Saved destinations are only\n");
+	fprintf(f, "# used by an endpoint whose port GID, LID and pkey have not changed.\n");
+	fprintf(f, "# Supported settings are: yes, no\n");
+	fprintf(f, "\n");
+	fprintf(f, "cache_snapshot no\n");
+	fprintf(f, "\n");
+	fprintf(f, "# cache_snapshot_file:\n");
+	fprintf(f, "# Specifies where the destination cache is saved when cache_snapshot is set.\n");
+	fprintf(f, "# Default is %s\n", IBACM_SNAPSHOT_FILE);
+	fprintf(f, "# cache_snapshot_file %s\n", IBACM_SNAPSHOT_FILE);
+	fprintf(f, "\n");
+	fprintf(f, "# cache_snapshot_interval:\n");
+	fprintf(f, "# Number of seconds between two saves of the destination cache.  A value\n");
+	fprintf(f, "# of 0 only saves it when ibacm stops.\n");
+	fprintf(f, "\n");
+	fprintf(f, "cache_snapshot_interval 300\n");
+	fprintf(f, "\n");
 	fprintf(f, "# loopback_prot:\n");
 	fprintf(f, "# Address and route resolution protocol to resolve local addresses\n");
 	fprintf(f, "# Supported protocols are:\n");
@@ -227,6 +276,27 @@ static void gen_opts_temp(FILE *f)
 #else
 	fprintf(f, "acme_plus_kernel_only no\n");
 #endif
+	fprintf(f, "\n");
+	fprintf(f, "# server_threads:\n");
+	fprintf(f, "# Number of threads used to receive and process client requests.\n");
+	fprintf(f, "# Connections are accepted by a separate thread, so this only\n");
+	fprintf(f, "# needs to grow with the rate of incoming requests.\n");
+	fprintf(f, "\n");
+	fprintf(f, "server_threads 4\n");
+	fprintf(f, "\n");
+	fprintf(f, "# shm_cache_size:\n");
+	fprintf(f, "# Number of resolutions published in %s.  Local\n", IBACM_CACHE_FILE);
+	fprintf(f, "# clients look requests up there before contacting the service.\n");
+	fprintf(f, "# A value of 0 disables the cache.  It is also disabled when\n");
+	fprintf(f, "# acme_plus_kernel_only is set.\n");
+	fprintf(f, "\n");
+	fprintf(f, "shm_cache_size 16384\n");
+	fprintf(f, "\n");
+	fprintf(f, "# shm_cache_timeout:\n");
+	fprintf(f, "# Number of seconds that clients may use a published resolution.\n");
+	fprintf(f, "# The whole cache is dropped on any address or port change.\n");
+	fprintf(f, "\n");
+	fprintf(f, "shm_cache_timeout 60\n");
 	fprintf(f, "\n");
 	fprintf(f, "# timeout:\n");
 	fprintf(f, "# Additional time, in milliseconds, that the ACM service will wait for a\n");
@@ -300,6 +370,11 @@ static void gen_opts_temp(FILE *f)
 	fprintf(f, "# Supported preload values are:\n");
 	fprintf(f, "# none - The routing cache is not pre-built (default)\n");
 	fprintf(f, "# opensm_full_v1 - OpenSM 'full' path records dump file format (version 1)\n");
+	fprintf(f, "# sa_path_table - Fetch the paths to all ports in the partition from the SA\n");
+	fprintf(f, "#   with a single PathRecord GetTable per endpoint when it is opened.\n");
+	fprintf(f, "#   Endpoints on the same port query the SA one after the other, and the\n");
+	fprintf(f, "#   time taken is logged.  At most a quarter of dest_cache_size records\n");
+	fprintf(f, "#   are loaded, all of them when dest_cache_size is 0.\n");
 	fprintf(f, "\n");
 	fprintf(f, "route_preload none\n");
 	fprintf(f, "\n");
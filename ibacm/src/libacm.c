@@ -33,6 +33,7 @@
 #include <osd.h>
 #include "libacm.h"
 #include <infiniband/acm.h>
+#include <util/acm_cache.h>
 #include <stdio.h>
 #include <errno.h>
 #include <netdb.h>
@@ -43,6 +44,8 @@
 static pthread_mutex_t acm_lock = PTHREAD_MUTEX_INITIALIZER;
 static int sock = -1;
 static short server_port = 6125;
+/* Only set when talking to the daemon on this host */
+static struct acm_cache *resp_cache;
 
 static void acm_set_server_port(void)
 {
@@ -119,6 +122,7 @@ static int ib_acm_connect_unix(char *dest)
 		return ret;
 	}
 
+	resp_cache = acm_cache_open(IBACM_CACHE_FILE);
 	return 0;
 }
 
@@ -137,6 +141,10 @@ void ib_acm_disconnect(void)
 		close(sock);
 		sock = -1;
 	}
+	if (resp_cache) {
+		acm_cache_close(resp_cache);
+		resp_cache = NULL;
+	}
 }
 
 static int acm_format_resp(struct acm_msg *msg,
@@ -248,6 +256,36 @@ static int acm_error(uint8_t status)
 	}
 }
 
+/* Caller must hold acm_lock. */
+static int acm_cache_resolve(struct acm_msg *msg)
+{
+	int cnt;
+
+	BUILD_ASSERT(sizeof(struct acm_cache_ep) == ACM_MSG_EP_LENGTH);
+	if (!resp_cache || (msg->resolve_data[0].flags & ACM_FLAGS_QUERY_SA))
+		return 0;
+
+	if (acm_cache_stale(resp_cache)) {
+		acm_cache_close(resp_cache);
+		resp_cache = acm_cache_open(IBACM_CACHE_FILE);
+		if (!resp_cache)
+			return 0;
+	}
+
+	cnt = acm_cache_lookup(resp_cache,
+			       (struct acm_cache_ep *) msg->resolve_data,
+			       (msg->hdr.length - ACM_MSG_HDR_LENGTH) /
+			       ACM_MSG_EP_LENGTH,
+			       (struct acm_cache_ep *) msg->resolve_data);
+	if (!cnt)
+		return 0;
+
+	msg->hdr.opcode |= ACM_OP_ACK;
+	msg->hdr.status = ACM_STATUS_SUCCESS;
+	msg->hdr.length = ACM_MSG_HDR_LENGTH + cnt * ACM_MSG_EP_LENGTH;
+	return 1;
+}
+
 static int acm_resolve(uint8_t *src, uint8_t *dest, uint8_t type,
 	struct ibv_path_data **paths, int *count, uint32_t flags, int print)
 {
@@ -273,6 +311,9 @@ static int acm_resolve(uint8_t *src, uint8_t *dest, uint8_t type,
 
 	msg.hdr.length = ACM_MSG_HDR_LENGTH + (cnt * ACM_MSG_EP_LENGTH);
 
+	if (acm_cache_resolve(&msg))
+		goto format;
+
 	ret = send(sock, (char *) &msg, msg.hdr.length, 0);
 	if (ret != msg.hdr.length)
 		goto out;
@@ -286,6 +327,7 @@ static int acm_resolve(uint8_t *src, uint8_t *dest, uint8_t type,
 		goto out;
 	}
 
+format:
 	ret = acm_format_resp(&msg, paths, count, print);
 out:
 	pthread_mutex_unlock(&acm_lock);
@@ -328,6 +370,12 @@ int ib_acm_resolve_path(struct ibv_path_record *path, uint32_t flags)
 	data->type = ACM_EP_INFO_PATH;
 	data->info.path = *path;
 
+	if (acm_cache_resolve(&msg)) {
+		ret = 0;
+		*path = data->info.path;
+		goto out;
+	}
+
 	ret = send(sock, (char *) &msg, msg.hdr.length, 0);
 	if (ret != msg.hdr.length)
 		goto out;
@@ -520,9 +568,15 @@ const char *ib_acm_cntr_name(int index)
 		[ACM_CNTR_ADDR_CACHE]	= "Addr Cache Count",
 		[ACM_CNTR_ROUTE_QUERY]	= "Route Query Count",
 		[ACM_CNTR_ROUTE_CACHE]	= "Route Cache Count",
+		[ACM_CNTR_DEST_CACHE_HIT]	= "Dest Cache Hit",
+		[ACM_CNTR_DEST_CACHE_MISS]	= "Dest Cache Miss",
+		[ACM_CNTR_DEST_CACHE_EVICT]	= "Dest Cache Evict",
+		[ACM_CNTR_DEST_CACHE_NEG]	= "Dest Cache Negative Hit",
+		[ACM_CNTR_ROUTE_REFRESH]	= "Route Refresh Count",
+		[ACM_CNTR_DEST_INVALIDATE]	= "Dest Invalidate Count",
 	};
 
-	if (index < ACM_CNTR_ERROR || index > ACM_MAX_COUNTER)
+	if (index < ACM_CNTR_ERROR || index >= ACM_MAX_COUNTER)
 		return "Unknown";
 
 	return cntr_name[index];
@@ -0,0 +1,414 @@
+/*
+ * Copyright (c) 2019, Mellanox Technologies. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *	Redistribution and use in source and binary forms, with or
+ *	without modification, are permitted provided that the following
+ *	conditions are met:
+ *
+ *	- Redistributions of source code must retain the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer.
+ *
+ *	- Redistributions in binary form must reproduce the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer in the documentation and/or other materials
+ *	  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Opens many client connections to a running ibacm and keeps one request
+ * outstanding on each of them, the way a large job start up looks to the
+ * daemon.  Reports connection setup time and completed requests per second.
+ *
+ * Without -d the clients send performance queries, which exercise the
+ * server front end without involving a provider.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <infiniband/acm.h>
+#include <util/util.h>
+
+#define LOAD_MAX_DEST 64
+#define LOAD_EVENTS 256
+
+struct load_client {
+	int		sock;
+	uint32_t	remaining;
+};
+
+struct load {
+	const char		*server;
+	uint32_t		num_clients;
+	uint32_t		requests;
+	struct acm_ep_addr_data	src;
+	bool			have_src;
+	struct acm_ep_addr_data	dest[LOAD_MAX_DEST];
+	uint32_t		num_dest;
+	uint32_t		next_dest;
+	struct load_client	*clients;
+	uint64_t		done;
+	uint64_t		failed;
+	uint64_t		lost;
+};
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int parse_addr(struct acm_ep_addr_data *data, const char *str,
+		      uint32_t flags)
+{
+	memset(data, 0, sizeof(*data));
+	data->flags = flags;
+
+	if (inet_pton(AF_INET, str, data->info.addr) == 1) {
+		data->type = ACM_EP_INFO_ADDRESS_IP;
+	} else if (inet_pton(AF_INET6, str, data->info.addr) == 1) {
+		data->type = ACM_EP_INFO_ADDRESS_IP6;
+	} else {
+		if (strlen(str) >= ACM_MAX_ADDRESS)
+			return -1;
+		data->type = ACM_EP_INFO_NAME;
+		strcpy((char *)data->info.name, str);
+	}
+
+	return 0;
+}
+
+static int connect_unix(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int s;
+
+	if (snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path) >=
+	    sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (s < 0)
+		return -1;
+
+	if (connect(s, (struct sockaddr *)&addr, sizeof(addr))) {
+		close(s);
+		return -1;
+	}
+
+	return s;
+}
+
+static int connect_tcp(const char *server)
+{
+	struct addrinfo hint = { .ai_protocol = IPPROTO_TCP }, *res;
+	char host[256], *port;
+	int s;
+
+	/* host[:port], the port defaults to the one ibacm publishes */
+	snprintf(host, sizeof(host), "%s", server);
+	port = strrchr(host, ':');
+	if (port)
+		*port++ = '\0';
+
+	if (getaddrinfo(host, port ? port : "6125", &hint, &res)) {
+		errno = EHOSTUNREACH;
+		return -1;
+	}
+
+	s = socket(res->ai_family, res->ai_socktype | SOCK_CLOEXEC,
+		   res->ai_protocol);
+	if (s >= 0 && connect(s, res->ai_addr, res->ai_addrlen)) {
+		close(s);
+		s = -1;
+	}
+
+	freeaddrinfo(res);
+	return s;
+}
+
+static int load_send(struct load *l, struct load_client *c)
+{
+	struct acm_msg msg = {};
+	size_t len;
+	int cnt = 0;
+
+	msg.hdr.version = ACM_VERSION;
+	if (!l->num_dest) {
+		msg.hdr.opcode = ACM_OP_PERF_QUERY;
+		msg.hdr.length = htobe16(ACM_MSG_HDR_LENGTH);
+		len = ACM_MSG_HDR_LENGTH;
+	} else {
+		msg.hdr.opcode = ACM_OP_RESOLVE;
+		if (l->have_src)
+			msg.resolve_data[cnt++] = l->src;
+		msg.resolve_data[cnt++] = l->dest[l->next_dest++ % l->num_dest];
+		len = ACM_MSG_HDR_LENGTH + cnt * ACM_MSG_EP_LENGTH;
+		msg.hdr.length = len;
+	}
+
+	if (send(c->sock, &msg, len, 0) != len)
+		return -1;
+	c->remaining--;
+	return 0;
+}
+
+static int load_recv(struct load *l, struct load_client *c)
+{
+	struct acm_msg msg;
+	ssize_t ret;
+	size_t len;
+
+	ret = recv(c->sock, &msg, sizeof(msg), 0);
+	if (ret < ACM_MSG_HDR_LENGTH)
+		return -1;
+
+	len = (msg.hdr.opcode & ACM_OP_MASK) == ACM_OP_RESOLVE ?
+		msg.hdr.length : be16toh(msg.hdr.length);
+	if (ret != len)
+		return -1;
+
+	l->done++;
+	if (msg.hdr.status)
+		l->failed++;
+	return 0;
+}
+
+static void load_close(struct load *l, struct load_client *c, uint32_t lost)
+{
+	l->lost += lost;
+	close(c->sock);
+	c->sock = -1;
+}
+
+static int raise_fd_limit(uint32_t num_clients)
+{
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl))
+		return -1;
+
+	if (rl.rlim_cur >= num_clients + 16)
+		return 0;
+
+	rl.rlim_cur = num_clients + 16;
+	if (rl.rlim_max < rl.rlim_cur)
+		rl.rlim_max = rl.rlim_cur;
+	return setrlimit(RLIMIT_NOFILE, &rl);
+}
+
+static int run_load(struct load *l)
+{
+	struct epoll_event events[LOAD_EVENTS];
+	struct epoll_event event = { .events = EPOLLIN };
+	uint32_t i, active = 0;
+	double start, connected, end;
+	int epfd, n, j;
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		perror("epoll_create1");
+		return -1;
+	}
+
+	start = now_sec();
+	for (i = 0; i < l->num_clients; i++) {
+		struct load_client *c = &l->clients[i];
+
+		c->sock = l->server[0] == '/' ? connect_unix(l->server) :
+						connect_tcp(l->server);
+		if (c->sock < 0) {
+			fprintf(stderr, "client %u: connect to %s failed: %s\n",
+				i, l->server, strerror(errno));
+			break;
+		}
+		c->remaining = l->requests;
+
+		event.data.u32 = i;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, c->sock, &event)) {
+			perror("epoll_ctl");
+			close(c->sock);
+			c->sock = -1;
+			break;
+		}
+	}
+	l->num_clients = i;
+	connected = now_sec();
+
+	for (i = 0; i < l->num_clients; i++) {
+		if (load_send(l, &l->clients[i]))
+			load_close(l, &l->clients[i], l->requests);
+		else
+			active++;
+	}
+
+	while (active) {
+		n = epoll_wait(epfd, events, LOAD_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			break;
+		}
+
+		for (j = 0; j < n; j++) {
+			struct load_client *c = &l->clients[events[j].data.u32];
+
+			if (load_recv(l, c)) {
+				load_close(l, c, c->remaining + 1);
+				active--;
+			} else if (!c->remaining) {
+				load_close(l, c, 0);
+				active--;
+			} else if (load_send(l, c)) {
+				load_close(l, c, c->remaining);
+				active--;
+			}
+		}
+	}
+	end = now_sec();
+
+	for (i = 0; i < l->num_clients; i++)
+		if (l->clients[i].sock >= 0)
+			close(l->clients[i].sock);
+	close(epfd);
+
+	printf("clients:           %u\n", l->num_clients);
+	printf("connect time:      %.3f sec\n", connected - start);
+	printf("requests:          %" PRIu64 " (%" PRIu64 " failed, %" PRIu64
+	       " lost)\n", l->done, l->failed, l->lost);
+	printf("request time:      %.3f sec\n", end - connected);
+	if (end > connected)
+		printf("requests/sec:      %.0f\n", l->done / (end - connected));
+
+	return l->lost ? -1 : 0;
+}
+
+static void usage(const char *argv0)
+{
+	printf("Usage: %s [options]\n", argv0);
+	printf("\n");
+	printf("Options:\n");
+	printf("  -S, --server=<addr>    unix socket path or host[:port] (default %s)\n",
+	       IBACM_IBACME_SERVER_PATH);
+	printf("  -c, --clients=<n>      number of client connections (default 10000)\n");
+	printf("  -n, --requests=<n>     requests sent by each client (default 100)\n");
+	printf("  -s, --src=<addr>       source address or name for resolves\n");
+	printf("  -d, --dest=<addr>      destination address or name, may be repeated;\n");
+	printf("                         without it the clients send perf queries\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct load l = {
+		.server = IBACM_IBACME_SERVER_PATH,
+		.num_clients = 10000,
+		.requests = 100,
+	};
+	int ret;
+
+	while (1) {
+		static const struct option long_options[] = {
+			{ .name = "server",   .has_arg = 1, .val = 'S' },
+			{ .name = "clients",  .has_arg = 1, .val = 'c' },
+			{ .name = "requests", .has_arg = 1, .val = 'n' },
+			{ .name = "src",      .has_arg = 1, .val = 's' },
+			{ .name = "dest",     .has_arg = 1, .val = 'd' },
+			{ .name = "help",     .has_arg = 0, .val = 'h' },
+			{}
+		};
+		int c;
+
+		c = getopt_long(argc, argv, "S:c:n:s:d:h", long_options, NULL);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'S':
+			l.server = optarg;
+			break;
+		case 'c':
+			l.num_clients = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			l.requests = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			if (parse_addr(&l.src, optarg, ACM_EP_FLAG_SOURCE)) {
+				fprintf(stderr, "invalid source %s\n", optarg);
+				return 1;
+			}
+			l.have_src = true;
+			break;
+		case 'd':
+			if (l.num_dest == LOAD_MAX_DEST ||
+			    parse_addr(&l.dest[l.num_dest], optarg,
+				       ACM_EP_FLAG_DEST)) {
+				fprintf(stderr, "invalid destination %s\n",
+					optarg);
+				return 1;
+			}
+			l.num_dest++;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!l.num_clients || !l.requests) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (raise_fd_limit(l.num_clients))
+		fprintf(stderr, "unable to raise the open file limit to %u: %s\n",
+			l.num_clients + 16, strerror(errno));
+
+	l.clients = calloc(l.num_clients, sizeof(*l.clients));
+	if (!l.clients) {
+		perror("calloc");
+		return 1;
+	}
+
+	ret = run_load(&l);
+	free(l.clients);
+	return ret ? 1 : 0;
+}
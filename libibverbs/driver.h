@@ -342,6 +342,10 @@ struct verbs_context_ops {
 			    struct ibv_ops_wr **bad_op);
 	int (*post_srq_recv)(struct ibv_srq *srq, struct ibv_recv_wr *recv_wr,
 			     struct ibv_recv_wr **bad_recv_wr);
+	int (*post_srq_recv_bulk)(struct ibv_srq *srq, uint32_t num_wr,
+				  const uint64_t *wr_id,
+				  const struct ibv_sge *sg_list,
+				  uint32_t *num_posted);
 	int (*query_device)(struct ibv_context *context,
 			    struct ibv_device_attr *device_attr);
 	int (*query_device_ex)(struct ibv_context *context,
@@ -363,6 +363,15 @@ static int post_srq_recv(struct ibv_srq *srq, struct ibv_recv_wr *recv_wr,
 	return EOPNOTSUPP;
 }
 
+static int post_srq_recv_bulk(struct ibv_srq *srq, uint32_t num_wr,
+			      const uint64_t *wr_id,
+			      const struct ibv_sge *sg_list,
+			      uint32_t *num_posted)
+{
+	*num_posted = 0;
+	return EOPNOTSUPP;
+}
+
 static int query_device(struct ibv_context *context,
 			struct ibv_device_attr *device_attr)
 {
@@ -506,6 +515,7 @@ const struct verbs_context_ops verbs_dummy_ops = {
 	post_send,
 	post_srq_ops,
 	post_srq_recv,
+	post_srq_recv_bulk,
 	query_device,
 	query_device_ex,
 	query_port,
@@ -622,6 +632,7 @@ void verbs_set_ops(struct verbs_context *vctx,
 	SET_OP(ctx, post_send);
 	SET_OP(vctx, post_srq_ops);
 	SET_OP(ctx, post_srq_recv);
+	SET_PRIV_OP_IC(ctx, post_srq_recv_bulk);
 	SET_PRIV_OP(ctx, query_device);
 	SET_OP(vctx, query_device_ex);
 	SET_PRIV_OP_IC(ctx, query_port);
@@ -60,6 +60,7 @@ static int use_odp;
 static int implicit_odp;
 static int prefetch_mr;
 static int use_ts;
+static int use_cq_ex;
 static int validate_buf;
 static int use_dm;
 static int use_new_send;
@@ -87,7 +88,7 @@ struct pingpong_context {
 
 static struct ibv_cq *pp_cq(struct pingpong_context *ctx)
 {
-	return use_ts ? ibv_cq_ex_to_cq(ctx->cq_s.cq_ex) :
+	return use_cq_ex ? ibv_cq_ex_to_cq(ctx->cq_s.cq_ex) :
 		ctx->cq_s.cq;
 }
 
@@ -460,13 +461,14 @@ static struct pingpong_context *pp_init_ctx(struct ibv_device *ib_dev, int size,
 			fprintf(stderr, "Couldn't prefetch MR(%d). Continue anyway\n", ret);
 	}
 
-	if (use_ts) {
+	if (use_cq_ex) {
 		struct ibv_cq_init_attr_ex attr_ex = {
 			.cqe = rx_depth + 1,
 			.cq_context = NULL,
 			.channel = ctx->channel,
 			.comp_vector = 0,
-			.wc_flags = IBV_WC_EX_WITH_COMPLETION_TIMESTAMP
+			.wc_flags = use_ts ?
+				IBV_WC_EX_WITH_COMPLETION_TIMESTAMP : 0
 		};
 
 		ctx->cq_s.cq_ex = ibv_create_cq_ex(ctx->context, &attr_ex);
@@ -784,6 +786,7 @@ static void usage(const char *argv0)
 	printf("  -O, --iodp		    use implicit on demand paging\n");
 	printf("  -P, --prefetch	    prefetch an ODP MR\n");
 	printf("  -t, --ts	            get CQE with timestamp\n");
+	printf("  -x, --ex_cq            poll the CQ with ibv_start_poll() (default ibv_poll_cq())\n");
 	printf("  -c, --chk	            validate received buffer\n");
 	printf("  -j, --dm	            use device memory\n");
 	printf("  -N, --new_send            use new post send WR API\n");
@@ -834,13 +837,14 @@ int main(int argc, char *argv[])
 			{ .name = "iodp",     .has_arg = 0, .val = 'O' },
 			{ .name = "prefetch", .has_arg = 0, .val = 'P' },
 			{ .name = "ts",       .has_arg = 0, .val = 't' },
+			{ .name = "ex_cq",    .has_arg = 0, .val = 'x' },
 			{ .name = "chk",      .has_arg = 0, .val = 'c' },
 			{ .name = "dm",       .has_arg = 0, .val = 'j' },
 			{ .name = "new_send", .has_arg = 0, .val = 'N' },
 			{}
 		};
 
-		c = getopt_long(argc, argv, "p:d:i:s:m:r:n:l:eg:oOPtcjN",
+		c = getopt_long(argc, argv, "p:d:i:s:m:r:n:l:eg:oOPtxcjN",
 				long_options, NULL);
 
 		if (c == -1)
@@ -911,6 +915,10 @@ int main(int argc, char *argv[])
 			break;
 		case 't':
 			use_ts = 1;
+			use_cq_ex = 1;
+			break;
+		case 'x':
+			use_cq_ex = 1;
 			break;
 		case 'c':
 			validate_buf = 1;
@@ -1095,7 +1103,7 @@ int main(int argc, char *argv[])
 			}
 		}
 
-		if (use_ts) {
+		if (use_cq_ex) {
 			struct ibv_poll_cq_attr attr = {};
 
 			do {
@@ -1110,7 +1118,7 @@ int main(int argc, char *argv[])
 					      iters,
 					      ctx->cq_s.cq_ex->wr_id,
 					      ctx->cq_s.cq_ex->status,
-					      ibv_wc_read_completion_ts(ctx->cq_s.cq_ex),
+					      use_ts ? ibv_wc_read_completion_ts(ctx->cq_s.cq_ex) : 0,
 					      &ts);
 			if (ret) {
 				ibv_end_poll(ctx->cq_s.cq_ex);
@@ -1122,7 +1130,7 @@ int main(int argc, char *argv[])
 						      iters,
 						      ctx->cq_s.cq_ex->wr_id,
 						      ctx->cq_s.cq_ex->status,
-						      ibv_wc_read_completion_ts(ctx->cq_s.cq_ex),
+						      use_ts ? ibv_wc_read_completion_ts(ctx->cq_s.cq_ex) : 0,
 						      &ts);
 			ibv_end_poll(ctx->cq_s.cq_ex);
 			if (ret && ret != ENOENT) {
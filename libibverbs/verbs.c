@@ -39,6 +39,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <linux/ip.h>
 #include <dirent.h>
@@ -260,20 +261,86 @@ LATEST_SYMVER_FUNC(ibv_query_pkey, 1_1, "IBVERBS_1.1",
 	return 0;
 }
 
+static int open_pkey_dir(struct ibv_context *context, uint8_t port_num)
+{
+	struct verbs_device *verbs_device = verbs_get_device(context->device);
+	char *path;
+	int dirfd;
+
+	if (asprintf(&path, "%s/ports/%d/pkeys",
+		     verbs_device->sysfs->ibdev_path, port_num) < 0)
+		return -1;
+
+	dirfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	free(path);
+	return dirfd;
+}
+
+static int read_pkey_at(int dirfd, int index, __be16 *pkey)
+{
+	char name[16];
+	char attr[8];
+	uint16_t val;
+
+	snprintf(name, sizeof(name), "%d", index);
+	if (ibv_read_sysfs_file_at(dirfd, name, attr, sizeof(attr)) < 0)
+		return -1;
+
+	if (sscanf(attr, "%hx", &val) != 1)
+		return -1;
+
+	*pkey = htobe16(val);
+	return 0;
+}
+
+int ibv_query_pkey_table(struct ibv_context *context, uint8_t port_num,
+			 __be16 *pkeys, int num_entries)
+{
+	int dirfd;
+	int i, nread = 0;
+
+	dirfd = open_pkey_dir(context, port_num);
+	if (dirfd < 0)
+		return -1;
+
+	/* Like the callers' per-index loops, skip entries that cannot be read */
+	for (i = 0; i < num_entries; i++) {
+		if (read_pkey_at(dirfd, i, &pkeys[i]))
+			pkeys[i] = 0;
+		else
+			nread++;
+	}
+	close(dirfd);
+
+	return nread ? num_entries : -1;
+}
+
 LATEST_SYMVER_FUNC(ibv_get_pkey_index, 1_5, "IBVERBS_1.5",
 		   int,
 		   struct ibv_context *context, uint8_t port_num, __be16 pkey)
 {
 	__be16 pkey_i;
-	int i, ret;
+	int dirfd;
+	int i;
+
+	/* Walk the table through one directory fd instead of resolving the
+	 * full sysfs path for every index.
+	 */
+	dirfd = open_pkey_dir(context, port_num);
+	if (dirfd < 0)
+		return -1;
 
 	for (i = 0; ; i++) {
-		ret = ibv_query_pkey(context, port_num, i, &pkey_i);
-		if (ret < 0)
-			return ret;
+		if (read_pkey_at(dirfd, i, &pkey_i)) {
+			i = -1;
+			break;
+		}
 		if (pkey == pkey_i)
-			return i;
+			break;
 	}
+	close(dirfd);
+
+	return i;
 }
 
 LATEST_SYMVER_FUNC(ibv_alloc_pd, 1_1, "IBVERBS_1.1",
@@ -593,6 +660,49 @@ LATEST_SYMVER_FUNC(ibv_destroy_srq, 1_1, "IBVERBS_1.1",
 	return get_ops(srq->context)->destroy_srq(srq);
 }
 
+/* WRs handed to post_srq_recv() at a time when the provider has no bulk op */
+#define SRQ_RECV_BULK_CHUNK 64
+
+int ibv_post_srq_recv_bulk(struct ibv_srq *srq, uint32_t num_wr,
+			   const uint64_t *wr_id, const struct ibv_sge *sg_list,
+			   uint32_t *num_posted)
+{
+	struct ibv_recv_wr wr[SRQ_RECV_BULK_CHUNK];
+	struct ibv_recv_wr *bad_wr;
+	uint32_t done = 0, n, i;
+	int ret;
+
+	ret = get_ops(srq->context)->post_srq_recv_bulk(srq, num_wr, wr_id,
+							sg_list, num_posted);
+	if (ret != EOPNOTSUPP)
+		return ret;
+
+	while (done < num_wr) {
+		n = num_wr - done;
+		if (n > SRQ_RECV_BULK_CHUNK)
+			n = SRQ_RECV_BULK_CHUNK;
+
+		for (i = 0; i < n; i++) {
+			wr[i].wr_id = wr_id[done + i];
+			wr[i].sg_list = (struct ibv_sge *)&sg_list[done + i];
+			wr[i].num_sge = 1;
+			wr[i].next = i + 1 < n ? &wr[i + 1] : NULL;
+		}
+
+		bad_wr = NULL;
+		ret = ibv_post_srq_recv(srq, wr, &bad_wr);
+		if (ret) {
+			if (bad_wr >= wr && bad_wr < wr + n)
+				done += bad_wr - wr;
+			break;
+		}
+		done += n;
+	}
+
+	*num_posted = done;
+	return ret;
+}
+
 LATEST_SYMVER_FUNC(ibv_create_qp, 1_1, "IBVERBS_1.1",
 		   struct ibv_qp *,
 		   struct ibv_pd *pd,
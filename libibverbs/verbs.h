@@ -2290,6 +2290,15 @@ int ibv_query_pkey(struct ibv_context *context, uint8_t port_num,
 int ibv_get_pkey_index(struct ibv_context *context, uint8_t port_num,
 		       __be16 pkey);
 
+/**
+ * ibv_query_pkey_table - Read the first @num_entries P_Keys of a port
+ *
+ * Entries that cannot be read are stored as 0.  Returns @num_entries, or
+ * -1 if no entry could be read.
+ */
+int ibv_query_pkey_table(struct ibv_context *context, uint8_t port_num,
+			 __be16 *pkeys, int num_entries);
+
 /**
  * ibv_alloc_pd - Allocate a protection domain
  */
@@ -2846,6 +2855,21 @@ static inline int ibv_post_srq_recv(struct ibv_srq *srq,
 	return srq->context->ops.post_srq_recv(srq, recv_wr, bad_recv_wr);
 }
 
+/**
+ * ibv_post_srq_recv_bulk - Post single SGE receive work requests to an SRQ
+ * @srq: The SRQ to post the work requests on.
+ * @num_wr: Number of work requests to post.
+ * @wr_id: Array of @num_wr work request IDs.
+ * @sg_list: Array of @num_wr scatter entries, one per work request.
+ * @num_posted: Returns how many work requests were posted.
+ *
+ * Work requests are posted in array order and posting stops at the first
+ * failure, whose reason is returned.
+ */
+int ibv_post_srq_recv_bulk(struct ibv_srq *srq, uint32_t num_wr,
+			   const uint64_t *wr_id, const struct ibv_sge *sg_list,
+			   uint32_t *num_posted);
+
 static inline int ibv_post_srq_ops(struct ibv_srq *srq,
 				   struct ibv_ops_wr *op,
 				   struct ibv_ops_wr **bad_op)
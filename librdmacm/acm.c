@@ -44,6 +44,7 @@
 #include <rdma/rdma_cma.h>
 #include <infiniband/ib.h>
 #include <infiniband/sa.h>
+#include <util/acm_cache.h>
 
 #define ACM_VERSION             1
 
@@ -114,6 +115,8 @@ struct acm_msg {
 static pthread_mutex_t acm_lock = PTHREAD_MUTEX_INITIALIZER;
 static int sock = -1;
 static uint16_t server_port;
+/* Resolutions published by ibacm, protected by acm_lock */
+static struct acm_cache *resp_cache;
 
 static int ucma_set_server_port(void)
 {
@@ -129,27 +132,20 @@ static int ucma_set_server_port(void)
 	return server_port;
 }
 
-void ucma_ib_init(void)
+/* Caller must hold acm_lock. */
+static void ucma_ib_connect(void)
 {
 	union {
 		struct sockaddr any;
 		struct sockaddr_in inet;
 		struct sockaddr_un unx;
 	} addr;
-	static int init;
 	int ret;
 
-	if (init)
-		return;
-
-	pthread_mutex_lock(&acm_lock);
-	if (init)
-		goto unlock;
-
-	if (ucma_set_server_port()) {
+	if (server_port) {
 		sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
 		if (sock < 0)
-			goto out;
+			return;
 
 		memset(&addr, 0, sizeof(addr));
 		addr.any.sa_family = AF_INET;
@@ -163,7 +159,7 @@ void ucma_ib_init(void)
 	} else {
 		sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
 		if (sock < 0)
-			goto out;
+			return;
 
 		memset(&addr, 0, sizeof(addr));
 		addr.any.sa_family = AF_UNIX;
@@ -176,7 +172,23 @@ void ucma_ib_init(void)
 			sock = -1;
 		}
 	}
-out:
+}
+
+void ucma_ib_init(void)
+{
+	static int init;
+
+	if (init)
+		return;
+
+	pthread_mutex_lock(&acm_lock);
+	if (init)
+		goto unlock;
+
+	ucma_set_server_port();
+	ucma_ib_connect();
+	if (sock >= 0)
+		resp_cache = acm_cache_open(IBACM_CACHE_FILE);
 	init = 1;
 unlock:
 	pthread_mutex_unlock(&acm_lock);
@@ -188,6 +200,8 @@ void ucma_ib_cleanup(void)
 		shutdown(sock, SHUT_RDWR);
 		close(sock);
 	}
+	if (resp_cache)
+		acm_cache_close(resp_cache);
 }
 
 static int ucma_ib_set_addr(struct rdma_addrinfo *ib_rai,
@@ -362,6 +376,33 @@ static void ucma_ib_save_resp(struct rdma_addrinfo *rai, struct acm_msg *msg)
 	}
 }
 
+/* Caller must hold acm_lock. */
+static int ucma_ib_cache_lookup(struct acm_msg *msg)
+{
+	int cnt;
+
+	BUILD_ASSERT(sizeof(struct acm_cache_ep) == ACM_MSG_EP_LENGTH);
+	if (resp_cache && acm_cache_stale(resp_cache)) {
+		acm_cache_close(resp_cache);
+		resp_cache = acm_cache_open(IBACM_CACHE_FILE);
+	}
+	if (!resp_cache)
+		return 0;
+
+	cnt = acm_cache_lookup(resp_cache,
+			       (struct acm_cache_ep *) msg->resolve_data,
+			       (msg->hdr.length - ACM_MSG_HDR_LENGTH) /
+			       ACM_MSG_EP_LENGTH,
+			       (struct acm_cache_ep *) msg->resolve_data);
+	if (!cnt)
+		return 0;
+
+	msg->hdr.opcode |= ACM_OP_ACK;
+	msg->hdr.status = ACM_STATUS_SUCCESS;
+	msg->hdr.length = ACM_MSG_HDR_LENGTH + cnt * ACM_MSG_EP_LENGTH;
+	return 1;
+}
+
 static void ucma_set_ep_addr(struct acm_ep_addr_data *data, struct sockaddr *addr)
 {
 	if (addr->sa_family == AF_INET) {
@@ -384,42 +425,36 @@ static int ucma_ib_addr(struct sockaddr *addr, socklen_t len)
 	return len && addr && (addr->sa_family == AF_IB);
 }
 
-void ucma_ib_resolve(struct rdma_addrinfo **rai,
-		     const struct rdma_addrinfo *hints)
+static void ucma_ib_format_req(struct acm_msg *msg, struct rdma_addrinfo *rai,
+			       const struct rdma_addrinfo *hints)
 {
-	struct acm_msg msg;
 	struct acm_ep_addr_data *data;
-	int ret;
-
-	ucma_ib_init();
-	if (sock < 0)
-		return;
 
-	memset(&msg, 0, sizeof msg);
-	msg.hdr.version = ACM_VERSION;
-	msg.hdr.opcode = ACM_OP_RESOLVE;
-	msg.hdr.length = ACM_MSG_HDR_LENGTH;
+	memset(msg, 0, sizeof *msg);
+	msg->hdr.version = ACM_VERSION;
+	msg->hdr.opcode = ACM_OP_RESOLVE;
+	msg->hdr.length = ACM_MSG_HDR_LENGTH;
 
-	data = &msg.resolve_data[0];
-	if (ucma_inet_addr((*rai)->ai_src_addr, (*rai)->ai_src_len)) {
+	data = &msg->resolve_data[0];
+	if (ucma_inet_addr(rai->ai_src_addr, rai->ai_src_len)) {
 		data->flags = ACM_EP_FLAG_SOURCE;
-		ucma_set_ep_addr(data, (*rai)->ai_src_addr);
+		ucma_set_ep_addr(data, rai->ai_src_addr);
 		data++;
-		msg.hdr.length += ACM_MSG_EP_LENGTH;
+		msg->hdr.length += ACM_MSG_EP_LENGTH;
 	}
 
-	if (ucma_inet_addr((*rai)->ai_dst_addr, (*rai)->ai_dst_len)) {
+	if (ucma_inet_addr(rai->ai_dst_addr, rai->ai_dst_len)) {
 		data->flags = ACM_EP_FLAG_DEST;
 		if (hints->ai_flags & (RAI_NUMERICHOST | RAI_NOROUTE))
 			data->flags |= ACM_FLAGS_NODELAY;
-		ucma_set_ep_addr(data, (*rai)->ai_dst_addr);
+		ucma_set_ep_addr(data, rai->ai_dst_addr);
 		data++;
-		msg.hdr.length += ACM_MSG_EP_LENGTH;
+		msg->hdr.length += ACM_MSG_EP_LENGTH;
 	}
 
 	if (hints->ai_route_len ||
-	    ucma_ib_addr((*rai)->ai_src_addr, (*rai)->ai_src_len) ||
-	    ucma_ib_addr((*rai)->ai_dst_addr, (*rai)->ai_dst_len)) {
+	    ucma_ib_addr(rai->ai_src_addr, rai->ai_src_len) ||
+	    ucma_ib_addr(rai->ai_dst_addr, rai->ai_dst_len)) {
 		struct ibv_path_record *path;
 
 		if (hints->ai_route_len == sizeof(struct ibv_path_record))
@@ -432,33 +467,199 @@ void ucma_ib_resolve(struct rdma_addrinfo **rai,
 		if (path)
 			memcpy(&data->info.path, path, sizeof(*path));
 
-		if (ucma_ib_addr((*rai)->ai_src_addr, (*rai)->ai_src_len)) {
+		if (ucma_ib_addr(rai->ai_src_addr, rai->ai_src_len)) {
 			memcpy(&data->info.path.sgid,
-			       &((struct sockaddr_ib *) (*rai)->ai_src_addr)->sib_addr, 16);
+			       &((struct sockaddr_ib *) rai->ai_src_addr)->sib_addr, 16);
 		}
-		if (ucma_ib_addr((*rai)->ai_dst_addr, (*rai)->ai_dst_len)) {
+		if (ucma_ib_addr(rai->ai_dst_addr, rai->ai_dst_len)) {
 			memcpy(&data->info.path.dgid,
-			       &((struct sockaddr_ib *) (*rai)->ai_dst_addr)->sib_addr, 16);
+			       &((struct sockaddr_ib *) rai->ai_dst_addr)->sib_addr, 16);
 		}
 		data->type = ACM_EP_INFO_PATH;
 		data++;
-		msg.hdr.length += ACM_MSG_EP_LENGTH;
+		msg->hdr.length += ACM_MSG_EP_LENGTH;
 	}
+}
+
+/*
+ * Reads a single response.  The stream may hold several when requests are
+ * pipelined, so the header is read first to learn the message length.
+ */
+static int ucma_ib_recv(struct acm_msg *msg)
+{
+	int ret, len;
+
+	ret = recv(sock, (char *) msg, ACM_MSG_HDR_LENGTH, MSG_WAITALL);
+	if (ret != ACM_MSG_HDR_LENGTH)
+		return -1;
+
+	len = msg->hdr.length - ACM_MSG_HDR_LENGTH;
+	if (len < 0 || len > sizeof(msg->data))
+		return -1;
+
+	if (len && recv(sock, (char *) msg->data, len, MSG_WAITALL) != len)
+		return -1;
+	return 0;
+}
+
+/* Caller must hold acm_lock. */
+static void ucma_ib_disconnect(void)
+{
+	shutdown(sock, SHUT_RDWR);
+	close(sock);
+	sock = -1;
+}
+
+static void ucma_ib_save(struct rdma_addrinfo **rai,
+			 const struct rdma_addrinfo *hints, struct acm_msg *msg)
+{
+	ucma_ib_save_resp(*rai, msg);
+
+	if (af_ib_support && !(hints->ai_flags & RAI_ROUTEONLY) && (*rai)->ai_route_len)
+		ucma_resolve_af_ib(rai);
+}
+
+/* Caller must hold acm_lock. */
+static int ucma_ib_resolve_one(struct acm_msg *msg)
+{
+	if (send(sock, (char *) msg, msg->hdr.length, 0) != msg->hdr.length)
+		return -1;
+	return ucma_ib_recv(msg);
+}
+
+void ucma_ib_resolve(struct rdma_addrinfo **rai,
+		     const struct rdma_addrinfo *hints)
+{
+	struct acm_msg msg;
+	int ret;
+
+	ucma_ib_init();
+	if (sock < 0)
+		return;
+
+	ucma_ib_format_req(&msg, *rai, hints);
 
 	pthread_mutex_lock(&acm_lock);
-	ret = send(sock, (char *) &msg, msg.hdr.length, 0);
-	if (ret != msg.hdr.length) {
+	if (ucma_ib_cache_lookup(&msg)) {
 		pthread_mutex_unlock(&acm_lock);
-		return;
+		goto save;
 	}
 
-	ret = recv(sock, (char *) &msg, sizeof msg, 0);
+	ret = sock < 0 ? -1 : ucma_ib_resolve_one(&msg);
 	pthread_mutex_unlock(&acm_lock);
-	if (ret < ACM_MSG_HDR_LENGTH || ret != msg.hdr.length || msg.hdr.status)
+	if (ret || msg.hdr.status)
 		return;
 
-	ucma_ib_save_resp(*rai, &msg);
+save:
+	ucma_ib_save(rai, hints, &msg);
+}
 
-	if (af_ib_support && !(hints->ai_flags & RAI_ROUTEONLY) && (*rai)->ai_route_len)
-		ucma_resolve_af_ib(rai);
+/*
+ * ibacm answers each request as soon as it is resolved, so keep up to
+ * UCMA_IB_BATCH_DEPTH requests in flight and match the responses by tid.
+ * The window keeps both sides from blocking on a full socket buffer.
+ */
+#define UCMA_IB_BATCH_DEPTH	64
+
+/*
+ * Cleared, under acm_lock, once a pipelined stream broke.  Older ibacm
+ * versions read a whole socket buffer as one request and drop the
+ * connection when several are queued, so from then on the batch falls
+ * back to one request at a time.
+ */
+static int acm_pipeline = 1;
+
+/* Caller must hold acm_lock. */
+static void ucma_ib_resolve_serial(struct rdma_addrinfo **rai, int count,
+				   const struct rdma_addrinfo *hints,
+				   const uint8_t *done)
+{
+	struct acm_msg msg;
+	int i;
+
+	for (i = 0; i < count && sock >= 0; i++) {
+		if (!rai[i] || (rai[i]->ai_flags & RAI_PASSIVE) ||
+		    (done && done[i]))
+			continue;
+
+		ucma_ib_format_req(&msg, rai[i], hints);
+		if (!ucma_ib_cache_lookup(&msg)) {
+			if (ucma_ib_resolve_one(&msg)) {
+				ucma_ib_disconnect();
+				break;
+			}
+			if (msg.hdr.status)
+				continue;
+		}
+		ucma_ib_save(&rai[i], hints, &msg);
+	}
+}
+
+void ucma_ib_resolve_batch(struct rdma_addrinfo **rai, int count,
+			   const struct rdma_addrinfo *hints)
+{
+	struct acm_msg msg;
+	uint8_t *done;
+	int i = 0, pending = 0;
+
+	ucma_ib_init();
+	if (sock < 0)
+		return;
+
+	pthread_mutex_lock(&acm_lock);
+	done = acm_pipeline ? calloc(count, sizeof(*done)) : NULL;
+	if (!done) {
+		ucma_ib_resolve_serial(rai, count, hints, NULL);
+		goto unlock;
+	}
+
+	while ((i < count || pending) && sock >= 0) {
+		if (i < count && pending < UCMA_IB_BATCH_DEPTH) {
+			if (!rai[i] || (rai[i]->ai_flags & RAI_PASSIVE)) {
+				i++;
+				continue;
+			}
+
+			ucma_ib_format_req(&msg, rai[i], hints);
+			msg.hdr.tid = i;
+			if (ucma_ib_cache_lookup(&msg)) {
+				done[i] = 1;
+				ucma_ib_save(&rai[i++], hints, &msg);
+				continue;
+			}
+
+			if (send(sock, (char *) &msg, msg.hdr.length, 0) !=
+			    msg.hdr.length)
+				break;
+			pending++;
+			i++;
+			continue;
+		}
+
+		if (ucma_ib_recv(&msg))
+			break;
+
+		pending--;
+		if (msg.hdr.tid < (uint64_t) count) {
+			done[msg.hdr.tid] = 1;
+			if (!msg.hdr.status)
+				ucma_ib_save(&rai[msg.hdr.tid], hints, &msg);
+		}
+	}
+
+	/*
+	 * A lost response would be taken for the answer to a later request,
+	 * so a broken stream is dropped.  Reconnect and finish what is left
+	 * one request at a time rather than giving up on ibacm.
+	 */
+	if (i < count || pending) {
+		if (sock >= 0)
+			ucma_ib_disconnect();
+		acm_pipeline = 0;
+		ucma_ib_connect();
+		ucma_ib_resolve_serial(rai, count, hints, done);
+	}
+	free(done);
+unlock:
+	pthread_mutex_unlock(&acm_lock);
 }
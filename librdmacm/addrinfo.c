@@ -234,27 +234,17 @@ static int ucma_getaddrinfo(const char *node, const char *service,
 	return ret;
 }
 
-int rdma_getaddrinfo(const char *node, const char *service,
-		     const struct rdma_addrinfo *hints,
-		     struct rdma_addrinfo **res)
+static int ucma_new_addrinfo(const char *node, const char *service,
+			     const struct rdma_addrinfo *hints,
+			     struct rdma_addrinfo **res)
 {
 	struct rdma_addrinfo *rai;
-	int ret;
-
-	if (!service && !node && !hints)
-		return ERR(EINVAL);
-
-	ret = ucma_init();
-	if (ret)
-		return ret;
+	int ret = 0;
 
 	rai = calloc(1, sizeof(*rai));
 	if (!rai)
 		return ERR(ENOMEM);
 
-	if (!hints)
-		hints = &nohints;
-
 	if (node || service) {
 		ret = ucma_getaddrinfo(node, service, hints, rai);
 	} else {
@@ -277,9 +267,6 @@ int rdma_getaddrinfo(const char *node, const char *service,
 			goto err;
 	}
 
-	if (!(rai->ai_flags & RAI_PASSIVE))
-		ucma_ib_resolve(&rai, hints);
-
 	*res = rai;
 	return 0;
 
@@ -288,6 +275,66 @@ err:
 	return ret;
 }
 
+int rdma_getaddrinfo(const char *node, const char *service,
+		     const struct rdma_addrinfo *hints,
+		     struct rdma_addrinfo **res)
+{
+	struct rdma_addrinfo *rai;
+	int ret;
+
+	if (!service && !node && !hints)
+		return ERR(EINVAL);
+
+	ret = ucma_init();
+	if (ret)
+		return ret;
+
+	if (!hints)
+		hints = &nohints;
+
+	ret = ucma_new_addrinfo(node, service, hints, &rai);
+	if (ret)
+		return ret;
+
+	if (!(rai->ai_flags & RAI_PASSIVE))
+		ucma_ib_resolve(&rai, hints);
+
+	*res = rai;
+	return 0;
+}
+
+int rdma_getaddrinfo_batch(const char *const *node, const char *service,
+			   const struct rdma_addrinfo *hints,
+			   struct rdma_addrinfo **res, int count)
+{
+	int i, ret, cnt = 0;
+
+	if (!node || !res || count <= 0)
+		return ERR(EINVAL);
+
+	ret = ucma_init();
+	if (ret)
+		return ret;
+
+	if (!hints)
+		hints = &nohints;
+
+	for (i = 0; i < count; i++) {
+		if ((!node[i] && !service) ||
+		    ucma_new_addrinfo(node[i], service, hints, &res[i]))
+			res[i] = NULL;
+	}
+
+	/* All the route lookups go to ibacm together */
+	ucma_ib_resolve_batch(res, count, hints);
+
+	for (i = 0; i < count; i++) {
+		if (res[i])
+			cnt++;
+	}
+	return cnt;
+}
+
 void rdma_freeaddrinfo(struct rdma_addrinfo *res)
 {
 	struct rdma_addrinfo *rai;
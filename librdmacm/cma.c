@@ -331,20 +331,17 @@ static struct ibv_context *ucma_open_device(__be64 guid)
 	return verbs;
 }
 
-static int ucma_init_device(struct cma_device *cma_dev)
+static int ucma_query_device(struct cma_device *cma_dev,
+			     struct ibv_context *verbs)
 {
 	struct ibv_port_attr port_attr;
 	struct ibv_device_attr attr;
 	int i, ret;
 
-	if (cma_dev->verbs)
-		return 0;
-
-	cma_dev->verbs = ucma_open_device(cma_dev->guid);
-	if (!cma_dev->verbs)
+	if (!verbs)
 		return ERR(ENODEV);
 
-	ret = ibv_query_device(cma_dev->verbs, &attr);
+	ret = ibv_query_device(verbs, &attr);
 	if (ret) {
 		ret = ERR(ret);
 		goto err;
@@ -357,7 +354,7 @@ static int ucma_init_device(struct cma_device *cma_dev)
 	}
 
 	for (i = 1; i <= attr.phys_port_cnt; i++) {
-		if (ibv_query_port(cma_dev->verbs, i, &port_attr))
+		if (ibv_query_port(verbs, i, &port_attr))
 			cma_dev->port[i - 1].link_layer = IBV_LINK_LAYER_UNSPECIFIED;
 		else
 			cma_dev->port[i - 1].link_layer = port_attr.link_layer;
@@ -367,12 +364,103 @@ static int ucma_init_device(struct cma_device *cma_dev)
 	cma_dev->max_qpsize = attr.max_qp_wr;
 	cma_dev->max_initiator_depth = (uint8_t) attr.max_qp_init_rd_atom;
 	cma_dev->max_responder_resources = (uint8_t) attr.max_qp_rd_atom;
-	cma_init_cnt++;
+	cma_dev->verbs = verbs;
 	return 0;
 
 err:
-	ibv_close_device(cma_dev->verbs);
-	cma_dev->verbs = NULL;
+	ibv_close_device(verbs);
+	return ret;
+}
+
+static int ucma_init_device(struct cma_device *cma_dev)
+{
+	int ret;
+
+	if (cma_dev->verbs)
+		return 0;
+
+	ret = ucma_query_device(cma_dev, ucma_open_device(cma_dev->guid));
+	if (!ret)
+		cma_init_cnt++;
+	return ret;
+}
+
+struct ucma_init_work {
+	struct cma_device	*cma_dev;
+	struct ibv_device	*ibdev;
+	pthread_t		thread;
+	int			started;
+	int			err;
+};
+
+static void *ucma_init_worker(void *arg)
+{
+	struct ucma_init_work *work = arg;
+
+	if (ucma_query_device(work->cma_dev, ibv_open_device(work->ibdev)))
+		work->err = errno;
+	return NULL;
+}
+
+/*
+ * Opening a device and querying its ports costs several commands, so on
+ * hosts with many HCAs/VFs open all uninitialized devices concurrently.
+ * Called holding the mutex lock.
+ */
+static int ucma_init_devices_parallel(void)
+{
+	struct ucma_init_work *work;
+	struct ibv_device **dev_list;
+	int i, j, ret = 0;
+
+	dev_list = ibv_get_device_list(NULL);
+	if (!dev_list)
+		return ERR(ENODEV);
+
+	work = calloc(cma_dev_cnt, sizeof(*work));
+	if (!work) {
+		ret = ERR(ENOMEM);
+		goto free_list;
+	}
+
+	for (i = 0; i < cma_dev_cnt; i++) {
+		work[i].cma_dev = &cma_dev_array[i];
+		if (work[i].cma_dev->verbs)
+			continue;
+
+		for (j = 0; dev_list[j]; j++) {
+			if (ibv_get_device_guid(dev_list[j]) ==
+			    work[i].cma_dev->guid) {
+				work[i].ibdev = dev_list[j];
+				break;
+			}
+		}
+		if (!work[i].ibdev) {
+			work[i].err = ENODEV;
+			continue;
+		}
+
+		if (!pthread_create(&work[i].thread, NULL, ucma_init_worker,
+				    &work[i]))
+			work[i].started = 1;
+		else
+			ucma_init_worker(&work[i]);
+	}
+
+	for (i = 0; i < cma_dev_cnt; i++) {
+		if (work[i].started)
+			pthread_join(work[i].thread, NULL);
+		if (work[i].err) {
+			if (!ret)
+				ret = ERR(work[i].err);
+		} else if (work[i].ibdev) {
+			cma_init_cnt++;
+		}
+	}
+
+	free(work);
+free_list:
+	ibv_free_device_list(dev_list);
 	return ret;
 }
 
@@ -390,10 +478,14 @@ static int ucma_init_all(void)
 		return 0;
 
 	pthread_mutex_lock(&mut);
-	for (i = 0; i < cma_dev_cnt; i++) {
-		ret = ucma_init_device(&cma_dev_array[i]);
-		if (ret)
-			break;
+	if (cma_dev_cnt - cma_init_cnt > 1) {
+		ret = ucma_init_devices_parallel();
+	} else {
+		for (i = 0; i < cma_dev_cnt; i++) {
+			ret = ucma_init_device(&cma_dev_array[i]);
+			if (ret)
+				break;
+		}
 	}
 	pthread_mutex_unlock(&mut);
 	return ret;
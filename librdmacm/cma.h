@@ -101,6 +101,8 @@ void ucma_ib_init(void);
 void ucma_ib_cleanup(void);
 void ucma_ib_resolve(struct rdma_addrinfo **rai,
 		     const struct rdma_addrinfo *hints);
+void ucma_ib_resolve_batch(struct rdma_addrinfo **rai, int count,
+			   const struct rdma_addrinfo *hints);
 
 struct ib_connect_hdr {
 	uint8_t  cma_version;
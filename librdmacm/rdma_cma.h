@@ -741,6 +741,25 @@ int rdma_getaddrinfo(const char *node, const char *service,
 		     const struct rdma_addrinfo *hints,
 		     struct rdma_addrinfo **res);
 
+/**
+ * rdma_getaddrinfo_batch - Resolve several destinations in one call.
+ * @node: Array of count destination names or addresses.
+ * @service: Service name or port number shared by all destinations.
+ * @hints: Optional hints, as for rdma_getaddrinfo.
+ * @res: Array of count result pointers.  Entries that could not be resolved
+ *   are set to NULL, the others must be released with rdma_freeaddrinfo.
+ * @count: Number of destinations.
+ * Description:
+ *   Equivalent to calling rdma_getaddrinfo for every destination, except
+ *   that the route queries to the ibacm service are issued together rather
+ *   than one at a time.
+ * Return:
+ *   The number of destinations resolved, or -1 on error.
+ */
+int rdma_getaddrinfo_batch(const char *const *node, const char *service,
+			   const struct rdma_addrinfo *hints,
+			   struct rdma_addrinfo **res, int count);
+
 void rdma_freeaddrinfo(struct rdma_addrinfo *res);
 
 /**
@@ -159,13 +159,16 @@ static struct verbs_context *bnxt_re_alloc_context(struct ibv_device *vdev,
 					 BNXT_RE_CHIP_ID0_CHIP_MET_SFT) &
 					 0xFF;
 	}
+	if (util_arena_init(&cntx->arena, dev->pg_size,
+			    UTIL_ARENA_THP | UTIL_ARENA_DONTFORK))
+		goto failed;
 	pthread_spin_init(&cntx->fqlock, PTHREAD_PROCESS_PRIVATE);
 	/* mmap shared page. */
 	cntx->shpg = mmap(NULL, dev->pg_size, PROT_READ | PROT_WRITE,
 			  MAP_SHARED, cmd_fd, 0);
 	if (cntx->shpg == MAP_FAILED) {
 		cntx->shpg = NULL;
-		goto failed;
+		goto free_arena;
 	}
 	pthread_mutex_init(&cntx->shlock, NULL);
 
@@ -173,6 +176,9 @@ static struct verbs_context *bnxt_re_alloc_context(struct ibv_device *vdev,
 
 	return &cntx->ibvctx;
 
+free_arena:
+	pthread_spin_destroy(&cntx->fqlock);
+	util_arena_cleanup(&cntx->arena);
 failed:
 	verbs_uninit_context(&cntx->ibvctx);
 	free(cntx);
@@ -189,6 +195,7 @@ static void bnxt_re_free_context(struct ibv_context *ibvctx)
 	if (cntx->shpg)
 		munmap(cntx->shpg, dev->pg_size);
 	pthread_spin_destroy(&cntx->fqlock);
+	util_arena_cleanup(&cntx->arena);
 
 	/* Un-map DPI only for the first PD that was
 	 * allocated in this context.
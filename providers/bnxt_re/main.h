@@ -173,6 +173,7 @@ struct bnxt_re_context {
 	void *shpg;
 	pthread_mutex_t shlock;
 	pthread_spinlock_t fqlock;
+	struct util_buf_arena arena;
 };
 
 /* Chip context related functions */
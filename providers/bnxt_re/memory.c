@@ -38,39 +38,33 @@
  */
 
 #include <string.h>
-#include <sys/mman.h>
 
 #include "main.h"
 
-int bnxt_re_alloc_aligned(struct bnxt_re_queue *que, uint32_t pg_size)
+int bnxt_re_alloc_aligned(struct bnxt_re_queue *que,
+			  struct util_buf_arena *arena)
 {
-	int ret, bytes;
+	int ret;
 
-	bytes = (que->depth * que->stride);
-	que->bytes = get_aligned(bytes, pg_size);
-	que->va = mmap(NULL, que->bytes, PROT_READ | PROT_WRITE,
-		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-	if (que->va == MAP_FAILED) {
+	/* Queues are carved out of the per-context arena in page units. */
+	ret = util_arena_alloc(arena, &que->abuf, que->depth * que->stride);
+	if (ret) {
 		que->bytes = 0;
-		return errno;
+		return ret;
 	}
+	que->arena = arena;
+	que->va = que->abuf.buf;
+	que->bytes = que->abuf.length;
 	/* Touch pages before proceeding. */
 	memset(que->va, 0, que->bytes);
 
-	ret = ibv_dontfork_range(que->va, que->bytes);
-	if (ret) {
-		munmap(que->va, que->bytes);
-		que->bytes = 0;
-	}
-
-	return ret;
+	return 0;
 }
 
 void bnxt_re_free_aligned(struct bnxt_re_queue *que)
 {
 	if (que->bytes) {
-		ibv_dofork_range(que->va, que->bytes);
-		munmap(que->va, que->bytes);
+		util_arena_free(que->arena, &que->abuf);
 		que->bytes = 0;
 	}
 }
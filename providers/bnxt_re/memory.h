@@ -41,6 +41,7 @@
 #define __MEMORY_H__
 
 #include <pthread.h>
+#include <util/buf_arena.h>
 
 struct bnxt_re_queue {
 	void *va;
@@ -58,6 +59,8 @@ struct bnxt_re_queue {
 	 */
 	uint32_t diff;
 	pthread_spinlock_t qlock;
+	struct util_buf_arena *arena;
+	struct util_arena_buf abuf;
 };
 
 static inline unsigned long get_aligned(uint32_t size, uint32_t al_size)
@@ -78,7 +81,8 @@ static inline unsigned long roundup_pow_of_two(unsigned long val)
 	return roundup;
 }
 
-int bnxt_re_alloc_aligned(struct bnxt_re_queue *que, uint32_t pg_size);
+int bnxt_re_alloc_aligned(struct bnxt_re_queue *que,
+			  struct util_buf_arena *arena);
 void bnxt_re_free_aligned(struct bnxt_re_queue *que);
 
 /* Basic queue operation */
@@ -184,7 +184,7 @@ struct ibv_cq *bnxt_re_create_cq(struct ibv_context *ibvctx, int ncqe,
 	if (cq->cqq.depth > dev->max_cq_depth + 1)
 		cq->cqq.depth = dev->max_cq_depth + 1;
 	cq->cqq.stride = dev->cqe_size;
-	if (bnxt_re_alloc_aligned(&cq->cqq, dev->pg_size))
+	if (bnxt_re_alloc_aligned(&cq->cqq, &cntx->arena))
 		goto fail;
 
 	pthread_spin_init(&cq->cqq.qlock, PTHREAD_PROCESS_PRIVATE);
@@ -842,7 +842,7 @@ static void bnxt_re_free_queues(struct bnxt_re_qp *qp)
 
 static int bnxt_re_alloc_queues(struct bnxt_re_qp *qp,
 				struct ibv_qp_init_attr *attr,
-				uint32_t pg_size) {
+				struct util_buf_arena *arena) {
 	struct bnxt_re_psns_ext *psns_ext;
 	struct bnxt_re_queue *que;
 	struct bnxt_re_psns *psns;
@@ -870,7 +870,7 @@ static int bnxt_re_alloc_queues(struct bnxt_re_qp *qp,
 	 * is UD-qp. UD-qp use this memory to maintain WC-opcode.
 	 * See definition of bnxt_re_fill_psns() for the use case.
 	 */
-	ret = bnxt_re_alloc_aligned(qp->sqq, pg_size);
+	ret = bnxt_re_alloc_aligned(qp->sqq, arena);
 	if (ret)
 		return ret;
 	/* exclude psns depth*/
@@ -901,7 +901,7 @@ static int bnxt_re_alloc_queues(struct bnxt_re_qp *qp,
 		que->stride = bnxt_re_get_rqe_sz();
 		que->depth = roundup_pow_of_two(attr->cap.max_recv_wr + 1);
 		que->diff = que->depth - attr->cap.max_recv_wr;
-		ret = bnxt_re_alloc_aligned(qp->rqq, pg_size);
+		ret = bnxt_re_alloc_aligned(qp->rqq, arena);
 		if (ret)
 			goto fail;
 		pthread_spin_init(&que->qlock, PTHREAD_PROCESS_PRIVATE);
@@ -929,7 +929,6 @@ struct ibv_qp *bnxt_re_create_qp(struct ibv_pd *ibvpd,
 	struct bnxt_re_qpcap *cap;
 
 	struct bnxt_re_context *cntx = to_bnxt_re_context(ibvpd->context);
-	struct bnxt_re_dev *dev = to_bnxt_re_dev(cntx->ibvctx.context.device);
 
 	if (bnxt_re_check_qp_limits(cntx, attr))
 		return NULL;
@@ -942,7 +941,7 @@ struct ibv_qp *bnxt_re_create_qp(struct ibv_pd *ibvpd,
 		goto fail;
 	/* alloc queues */
 	qp->cctx = &cntx->cctx;
-	if (bnxt_re_alloc_queues(qp, attr, dev->pg_size))
+	if (bnxt_re_alloc_queues(qp, attr, &cntx->arena))
 		goto failq;
 	/* Fill ibv_cmd */
 	cap = &qp->cap;
@@ -1472,7 +1471,7 @@ static void bnxt_re_srq_free_queue(struct bnxt_re_srq *srq)
 
 static int bnxt_re_srq_alloc_queue(struct bnxt_re_srq *srq,
 				   struct ibv_srq_init_attr *attr,
-				   uint32_t pg_size)
+				   struct util_buf_arena *arena)
 {
 	struct bnxt_re_queue *que;
 	int ret, idx;
@@ -1481,7 +1480,7 @@ static int bnxt_re_srq_alloc_queue(struct bnxt_re_srq *srq,
 	que->depth = roundup_pow_of_two(attr->attr.max_wr + 1);
 	que->diff = que->depth - attr->attr.max_wr;
 	que->stride = bnxt_re_get_srqe_sz();
-	ret = bnxt_re_alloc_aligned(que, pg_size);
+	ret = bnxt_re_alloc_aligned(que, arena);
 	if (ret)
 		goto bail;
 	pthread_spin_init(&que->qlock, PTHREAD_PROCESS_PRIVATE);
@@ -1512,7 +1511,6 @@ struct ibv_srq *bnxt_re_create_srq(struct ibv_pd *ibvpd,
 	struct ubnxt_re_srq req;
 	struct ubnxt_re_srq_resp resp;
 	struct bnxt_re_context *cntx = to_bnxt_re_context(ibvpd->context);
-	struct bnxt_re_dev *dev = to_bnxt_re_dev(cntx->ibvctx.context.device);
 	int ret;
 
 	/*TODO: Check max limit on queue depth and sge.*/
@@ -1520,7 +1518,7 @@ struct ibv_srq *bnxt_re_create_srq(struct ibv_pd *ibvpd,
 	if (!srq)
 		goto fail;
 
-	if (bnxt_re_srq_alloc_queue(srq, attr, dev->pg_size))
+	if (bnxt_re_srq_alloc_queue(srq, attr, &cntx->arena))
 		goto fail;
 
 	req.srqva = (uintptr_t)srq->srqq->va;
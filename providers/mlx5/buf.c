@@ -33,297 +33,34 @@
 #include <config.h>
 
 #include <signal.h>
-#include <sys/ipc.h>
-#include <sys/shm.h>
+#include <sys/mman.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 
 #include "mlx5.h"
-#include "bitmap.h"
-
-static int mlx5_bitmap_init(struct mlx5_bitmap *bitmap, uint32_t num,
-			    uint32_t mask)
-{
-	bitmap->last = 0;
-	bitmap->top  = 0;
-	bitmap->max  = num;
-	bitmap->avail = num;
-	bitmap->mask = mask;
-	bitmap->avail = bitmap->max;
-	bitmap->table = calloc(BITS_TO_LONGS(bitmap->max), sizeof(*bitmap->table));
-	if (!bitmap->table)
-		return -ENOMEM;
-
-	return 0;
-}
-
-static void bitmap_free_range(struct mlx5_bitmap *bitmap, uint32_t obj,
-			      int cnt)
-{
-	int i;
-
-	obj &= bitmap->max - 1;
-
-	for (i = 0; i < cnt; i++)
-		mlx5_clear_bit(obj + i, bitmap->table);
-	bitmap->last = min(bitmap->last, obj);
-	bitmap->top = (bitmap->top + bitmap->max) & bitmap->mask;
-	bitmap->avail += cnt;
-}
-
-static int bitmap_empty(struct mlx5_bitmap *bitmap)
-{
-	return (bitmap->avail == bitmap->max) ? 1 : 0;
-}
-
-static int bitmap_avail(struct mlx5_bitmap *bitmap)
-{
-	return bitmap->avail;
-}
-
-static void mlx5_bitmap_cleanup(struct mlx5_bitmap *bitmap)
-{
-	if (bitmap->table)
-		free(bitmap->table);
-}
-
-static void free_huge_mem(struct mlx5_hugetlb_mem *hmem)
-{
-	mlx5_bitmap_cleanup(&hmem->bitmap);
-	if (shmdt(hmem->shmaddr) == -1)
-		mlx5_dbg(stderr, MLX5_DBG_CONTIG, "%s\n", strerror(errno));
-	shmctl(hmem->shmid, IPC_RMID, NULL);
-	free(hmem);
-}
-
-static int mlx5_bitmap_alloc(struct mlx5_bitmap *bitmap)
-{
-	uint32_t obj;
-	int ret;
-
-	obj = mlx5_find_first_zero_bit(bitmap->table, bitmap->max);
-	if (obj < bitmap->max) {
-		mlx5_set_bit(obj, bitmap->table);
-		bitmap->last = (obj + 1);
-		if (bitmap->last == bitmap->max)
-			bitmap->last = 0;
-		obj |= bitmap->top;
-		ret = obj;
-	} else
-		ret = -1;
-
-	if (ret != -1)
-		--bitmap->avail;
-
-	return ret;
-}
-
-static uint32_t find_aligned_range(unsigned long *bitmap,
-				   uint32_t start, uint32_t nbits,
-				   int len, int alignment)
-{
-	uint32_t end, i;
-
-again:
-	start = align(start, alignment);
-
-	while ((start < nbits) && mlx5_test_bit(start, bitmap))
-		start += alignment;
-
-	if (start >= nbits)
-		return -1;
-
-	end = start + len;
-	if (end > nbits)
-		return -1;
-
-	for (i = start + 1; i < end; i++) {
-		if (mlx5_test_bit(i, bitmap)) {
-			start = i + 1;
-			goto again;
-		}
-	}
-
-	return start;
-}
-
-static int bitmap_alloc_range(struct mlx5_bitmap *bitmap, int cnt,
-			      int align)
-{
-	uint32_t obj;
-	int ret, i;
-
-	if (cnt == 1 && align == 1)
-		return mlx5_bitmap_alloc(bitmap);
-
-	if (cnt > bitmap->max)
-		return -1;
-
-	obj = find_aligned_range(bitmap->table, bitmap->last,
-				 bitmap->max, cnt, align);
-	if (obj >= bitmap->max) {
-		bitmap->top = (bitmap->top + bitmap->max) & bitmap->mask;
-		obj = find_aligned_range(bitmap->table, 0, bitmap->max,
-					 cnt, align);
-	}
-
-	if (obj < bitmap->max) {
-		for (i = 0; i < cnt; i++)
-			mlx5_set_bit(obj + i, bitmap->table);
-		if (obj == bitmap->last) {
-			bitmap->last = (obj + cnt);
-			if (bitmap->last >= bitmap->max)
-				bitmap->last = 0;
-		}
-		obj |= bitmap->top;
-		ret = obj;
-	} else
-		ret = -1;
-
-	if (ret != -1)
-		bitmap->avail -= cnt;
-
-	return obj;
-}
-
-static struct mlx5_hugetlb_mem *alloc_huge_mem(size_t size)
-{
-	struct mlx5_hugetlb_mem *hmem;
-	size_t shm_len;
-
-	hmem = malloc(sizeof(*hmem));
-	if (!hmem)
-		return NULL;
-
-	shm_len = align(size, MLX5_SHM_LENGTH);
-	hmem->shmid = shmget(IPC_PRIVATE, shm_len, SHM_HUGETLB | SHM_R | SHM_W);
-	if (hmem->shmid == -1) {
-		mlx5_dbg(stderr, MLX5_DBG_CONTIG, "%s\n", strerror(errno));
-		goto out_free;
-	}
-
-	hmem->shmaddr = shmat(hmem->shmid, MLX5_SHM_ADDR, MLX5_SHMAT_FLAGS);
-	if (hmem->shmaddr == (void *)-1) {
-		mlx5_dbg(stderr, MLX5_DBG_CONTIG, "%s\n", strerror(errno));
-		goto out_rmid;
-	}
-
-	if (mlx5_bitmap_init(&hmem->bitmap, shm_len / MLX5_Q_CHUNK_SIZE,
-			     shm_len / MLX5_Q_CHUNK_SIZE - 1)) {
-		mlx5_dbg(stderr, MLX5_DBG_CONTIG, "%s\n", strerror(errno));
-		goto out_shmdt;
-	}
-
-	/*
-	 * Marked to be destroyed when process detaches from shmget segment
-	 */
-	shmctl(hmem->shmid, IPC_RMID, NULL);
-
-	return hmem;
-
-out_shmdt:
-	if (shmdt(hmem->shmaddr) == -1)
-		mlx5_dbg(stderr, MLX5_DBG_CONTIG, "%s\n", strerror(errno));
-
-out_rmid:
-	shmctl(hmem->shmid, IPC_RMID, NULL);
-
-out_free:
-	free(hmem);
-	return NULL;
-}
 
 static int alloc_huge_buf(struct mlx5_context *mctx, struct mlx5_buf *buf,
 			  size_t size, int page_size)
 {
-	int found = 0;
-	int nchunk;
-	struct mlx5_hugetlb_mem *hmem;
 	int ret;
 
-	buf->length = align(size, MLX5_Q_CHUNK_SIZE);
-	nchunk = buf->length / MLX5_Q_CHUNK_SIZE;
-
-	if (!nchunk)
-		return 0;
-
-	mlx5_spin_lock(&mctx->hugetlb_lock);
-	list_for_each(&mctx->hugetlb_list, hmem, entry) {
-		if (bitmap_avail(&hmem->bitmap)) {
-			buf->base = bitmap_alloc_range(&hmem->bitmap, nchunk, 1);
-			if (buf->base != -1) {
-				buf->hmem = hmem;
-				found = 1;
-				break;
-			}
-		}
-	}
-	mlx5_spin_unlock(&mctx->hugetlb_lock);
-
-	if (!found) {
-		hmem = alloc_huge_mem(buf->length);
-		if (!hmem)
-			return -1;
-
-		buf->base = bitmap_alloc_range(&hmem->bitmap, nchunk, 1);
-		if (buf->base == -1) {
-			free_huge_mem(hmem);
-			/* TBD: remove after proven stability */
-			fprintf(stderr, "BUG: huge allocation\n");
-			return -1;
-		}
-
-		buf->hmem = hmem;
-
-		mlx5_spin_lock(&mctx->hugetlb_lock);
-		if (bitmap_avail(&hmem->bitmap))
-			list_add(&mctx->hugetlb_list, &hmem->entry);
-		else
-			list_add_tail(&mctx->hugetlb_list, &hmem->entry);
-		mlx5_spin_unlock(&mctx->hugetlb_lock);
-	}
-
-	buf->buf = hmem->shmaddr + buf->base * MLX5_Q_CHUNK_SIZE;
-
-	ret = ibv_dontfork_range(buf->buf, buf->length);
+	ret = util_arena_alloc(&mctx->hugetlb_arena, &buf->hbuf, size);
 	if (ret) {
-		mlx5_dbg(stderr, MLX5_DBG_CONTIG, "\n");
-		goto out_fork;
+		mlx5_dbg(stderr, MLX5_DBG_CONTIG, "%s\n", strerror(ret));
+		return -1;
 	}
+
+	buf->buf = buf->hbuf.buf;
+	buf->length = buf->hbuf.length;
 	buf->type = MLX5_ALLOC_TYPE_HUGE;
 
 	return 0;
-
-out_fork:
-	mlx5_spin_lock(&mctx->hugetlb_lock);
-	bitmap_free_range(&hmem->bitmap, buf->base, nchunk);
-	if (bitmap_empty(&hmem->bitmap)) {
-		list_del(&hmem->entry);
-		mlx5_spin_unlock(&mctx->hugetlb_lock);
-		free_huge_mem(hmem);
-	} else
-		mlx5_spin_unlock(&mctx->hugetlb_lock);
-
-	return -1;
 }
 
 static void free_huge_buf(struct mlx5_context *ctx, struct mlx5_buf *buf)
 {
-	int nchunk;
-
-	nchunk = buf->length / MLX5_Q_CHUNK_SIZE;
-	if (!nchunk)
-		return;
-
-	mlx5_spin_lock(&ctx->hugetlb_lock);
-	bitmap_free_range(&buf->hmem->bitmap, buf->base, nchunk);
-	if (bitmap_empty(&buf->hmem->bitmap)) {
-		list_del(&buf->hmem->entry);
-		mlx5_spin_unlock(&ctx->hugetlb_lock);
-		free_huge_mem(buf->hmem);
-	} else
-		mlx5_spin_unlock(&ctx->hugetlb_lock);
+	util_arena_free(&ctx->hugetlb_arena, &buf->hbuf);
 }
 
 void mlx5_free_buf_extern(struct mlx5_context *ctx, struct mlx5_buf *buf)
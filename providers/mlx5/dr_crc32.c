@@ -56,9 +56,151 @@
 #include <string.h>
 #include "mlx5dv_dr.h"
 
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#elif defined(__aarch64__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
 #define DR_STE_CRC_POLY		0xEDB88320L
 
+typedef uint32_t (*dr_crc32_fn_t)(const void *, size_t);
+
 static uint32_t dr_ste_crc_tab32[8][256];
+static dr_crc32_fn_t dr_crc32_calc_fn = dr_crc32_slice8_calc;
+
+static uint32_t dr_crc32_swap(uint32_t crc)
+{
+	return ((crc>>24) & 0xff) | ((crc<<8) & 0xff0000) |
+		((crc>>8) & 0xff00) | ((crc<<24) & 0xff000000);
+}
+
+static uint32_t dr_crc32_bytes(uint32_t crc, const uint8_t *data,
+			       size_t length)
+{
+	while (length-- != 0)
+		crc = (crc >> 8) ^ dr_ste_crc_tab32[0][(crc & 0xff) ^ *data++];
+
+	return crc;
+}
+
+#if defined(__x86_64__)
+/*
+ * Carry-less multiply folding of the bit reflected polynomial, see Intel's
+ * "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction".
+ * The constants are the bit reflected fold multipliers for a 128 bit and a
+ * 64 bit distance and the Barrett reduction pair (P and x^64 / P).
+ */
+static const uint64_t dr_crc32_fold128[2] __attribute__((aligned(16))) = {
+	0x01751997d0, 0x00ccaa009e };
+static const uint64_t dr_crc32_fold64[2] __attribute__((aligned(16))) = {
+	0x0163cd6124, 0 };
+static const uint64_t dr_crc32_barrett[2] __attribute__((aligned(16))) = {
+	0x01db710641, 0x01f7011641 };
+
+static uint32_t __attribute__((target("pclmul")))
+dr_crc32_pclmul_calc(const void *input_data, size_t length)
+{
+	const uint8_t *data = input_data;
+	__m128i x0, x1, x2, x3;
+	uint32_t crc;
+
+	if (length < 16)
+		return dr_crc32_slice8_calc(input_data, length);
+
+	x0 = _mm_load_si128((const __m128i *)dr_crc32_fold128);
+	x1 = _mm_loadu_si128((const __m128i *)data);
+	data += 16;
+	length -= 16;
+
+	/* Fold 128 bits at a time */
+	while (length >= 16) {
+		x2 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(x1, x2);
+		x1 = _mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)data));
+		data += 16;
+		length -= 16;
+	}
+
+	/* Fold 128 bits to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_loadl_epi64((const __m128i *)dr_crc32_fold64);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x0 = _mm_load_si128((const __m128i *)dr_crc32_barrett);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	crc = _mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+
+	return dr_crc32_swap(dr_crc32_bytes(crc, data, length));
+}
+
+static dr_crc32_fn_t dr_crc32_select(void)
+{
+	unsigned int ax, bx, cx, dx;
+
+	if (__get_cpuid(1, &ax, &bx, &cx, &dx) && (cx & bit_PCLMUL))
+		return dr_crc32_pclmul_calc;
+
+	return dr_crc32_slice8_calc;
+}
+#elif defined(__aarch64__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#if defined(__clang__)
+#define DR_CRC32_TARGET_CRC __attribute__((target("crc")))
+#else
+#define DR_CRC32_TARGET_CRC __attribute__((target("+crc")))
+#endif
+
+/* The ARMv8 CRC32 instructions use the same polynomial with no inversion */
+static uint32_t DR_CRC32_TARGET_CRC
+dr_crc32_arm64_calc(const void *input_data, size_t length)
+{
+	const uint8_t *data = input_data;
+	uint32_t crc = 0;
+	uint64_t val;
+
+	while (length >= 8) {
+		memcpy(&val, data, sizeof(val));
+		crc = __crc32d(crc, val);
+		data += 8;
+		length -= 8;
+	}
+
+	while (length-- != 0)
+		crc = __crc32b(crc, *data++);
+
+	return dr_crc32_swap(crc);
+}
+
+static dr_crc32_fn_t dr_crc32_select(void)
+{
+	if (getauxval(AT_HWCAP) & HWCAP_CRC32)
+		return dr_crc32_arm64_calc;
+
+	return dr_crc32_slice8_calc;
+}
+#else
+static dr_crc32_fn_t dr_crc32_select(void)
+{
+	return dr_crc32_slice8_calc;
+}
+#endif
 
 static void dr_crc32_calc_lookup_entry(uint32_t (*tbl)[256], uint8_t i,
 				       uint8_t j)
@@ -91,6 +233,8 @@ void dr_crc32_init_table(void)
 		dr_crc32_calc_lookup_entry(dr_ste_crc_tab32, 6, i);
 		dr_crc32_calc_lookup_entry(dr_ste_crc_tab32, 7, i);
 	}
+
+	dr_crc32_calc_fn = dr_crc32_select();
 }
 
 /* Compute CRC32 (Slicing-by-8 algorithm) */
@@ -122,10 +266,16 @@ uint32_t dr_crc32_slice8_calc(const void *input_data, size_t length)
 
 	current_char = (const uint8_t *)current;
 	/* Remaining 1 to 7 bytes (standard algorithm) */
-	while (length-- != 0)
-		crc = (crc >> 8) ^ dr_ste_crc_tab32[0][(crc & 0xff)
-			^ *current_char++];
+	crc = dr_crc32_bytes(crc, current_char, length);
 
-	return ((crc>>24) & 0xff) | ((crc<<8) & 0xff0000) |
-		((crc>>8) & 0xff00) | ((crc<<24) & 0xff000000);
+	return dr_crc32_swap(crc);
+}
+
+/* Same result as dr_crc32_slice8_calc, using CPU CRC support if present */
+uint32_t dr_crc32_calc(const void *input_data, size_t length)
+{
+	if (!input_data)
+		return 0;
+
+	return dr_crc32_calc_fn(input_data, length);
 }
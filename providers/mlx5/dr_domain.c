@@ -70,12 +70,14 @@ static int dr_domain_init_resources(struct mlx5dv_dr_domain *dmn)
 		goto free_ste_icm_pool;
 	}
 
-	ret = dr_send_ring_alloc(dmn);
-	if (ret) {
+	dmn->send_ring[0] = dr_send_ring_alloc(dmn);
+	if (!dmn->send_ring[0]) {
 		dr_dbg(dmn, "Couldn't create send-ring for %s\n",
 		       ibv_get_device_name(dmn->ctx->device));
+		ret = errno;
 		goto free_action_icm_pool;
 	}
+	dmn->num_send_rings = 1;
 
 	return 0;
 
@@ -93,7 +95,11 @@ clean_pd:
 
 static void dr_free_resources(struct mlx5dv_dr_domain *dmn)
 {
-	dr_send_ring_free(dmn->send_ring);
+	uint32_t i;
+
+	for (i = 0; i < dmn->num_send_rings; i++)
+		dr_send_ring_free(dmn->send_ring[i]);
+
 	dr_icm_pool_destroy(dmn->action_icm_pool);
 	dr_icm_pool_destroy(dmn->ste_icm_pool);
 	mlx5dv_devx_free_uar(dmn->uar);
@@ -326,7 +332,7 @@ int mlx5dv_dr_domain_sync(struct mlx5dv_dr_domain *dmn, uint32_t flags)
 
 	if (flags & MLX5DV_DR_DOMAIN_SYNC_FLAGS_SW) {
 		pthread_mutex_lock(&dmn->mutex);
-		ret = dr_send_ring_force_drain(dmn);
+		ret = dr_send_ring_drain_all(dmn);
 		if (ret)
 			goto out_unlock;
 
@@ -343,6 +349,58 @@ out_unlock:
 	return ret;
 }
 
+/*
+ * Give the domain num_rings send rings. Ring 0 keeps serving the table and
+ * matcher updates while each new matcher gets the next ring for its rules,
+ * so rules of different matchers can be inserted from different threads.
+ */
+int mlx5dv_dr_domain_set_send_rings(struct mlx5dv_dr_domain *dmn,
+				    uint32_t num_rings)
+{
+	int ret = 0;
+
+	if (!dmn->info.supp_sw_steering) {
+		errno = EOPNOTSUPP;
+		return errno;
+	}
+
+	if (!num_rings || num_rings > DR_MAX_SEND_RINGS) {
+		errno = EINVAL;
+		return errno;
+	}
+
+	pthread_mutex_lock(&dmn->mutex);
+
+	/* Matchers hold on to their ring, only allow it on an empty domain */
+	if (atomic_load(&dmn->refcount) > 1) {
+		ret = EBUSY;
+		goto out_unlock;
+	}
+
+	while (dmn->num_send_rings > num_rings) {
+		dmn->num_send_rings--;
+		dr_send_ring_free(dmn->send_ring[dmn->num_send_rings]);
+		dmn->send_ring[dmn->num_send_rings] = NULL;
+	}
+
+	while (dmn->num_send_rings < num_rings) {
+		dmn->send_ring[dmn->num_send_rings] = dr_send_ring_alloc(dmn);
+		if (!dmn->send_ring[dmn->num_send_rings]) {
+			ret = errno;
+			goto out_unlock;
+		}
+		dmn->num_send_rings++;
+	}
+
+	dmn->next_send_ring = 0;
+
+out_unlock:
+	pthread_mutex_unlock(&dmn->mutex);
+	if (ret)
+		errno = ret;
+	return ret;
+}
+
 int mlx5dv_dr_domain_destroy(struct mlx5dv_dr_domain *dmn)
 {
 	if (atomic_load(&dmn->refcount) > 1)
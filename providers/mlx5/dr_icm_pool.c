@@ -458,6 +458,18 @@ struct dr_icm_chunk *dr_icm_alloc_chunk(struct dr_icm_pool *pool,
 	if (list_empty(&bucket->free_list)) {
 		if (dr_icm_reuse_hot_entries(pool, bucket)) {
 			dr_icm_chill_buckets_start(pool, bucket, bucks);
+			/*
+			 * The writes unhooking the hot chunks may still be in
+			 * flight on a ring other than the one reusing them.
+			 */
+			if (dr_domain_is_multi_ring(pool->dmn)) {
+				err = dr_send_ring_drain_all(pool->dmn);
+				if (err) {
+					dr_icm_chill_buckets_abort(pool, bucket, bucks);
+					chunk = NULL;
+					goto out;
+				}
+			}
 			err = dr_devx_sync_steering(pool->dmn->ctx);
 			if (err) {
 				dr_icm_chill_buckets_abort(pool, bucket, bucks);
@@ -439,7 +439,7 @@ static int dr_matcher_connect(struct mlx5dv_dr_domain *dmn,
 		info.type = CONNECT_MISS;
 		info.miss_icm_addr = nic_dmn->default_icm_addr;
 	}
-	ret = dr_ste_htbl_init_and_postsend(dmn, nic_dmn,
+	ret = dr_ste_htbl_init_and_postsend(dmn, dmn->send_ring[0], nic_dmn,
 					    curr_nic_matcher->e_anchor,
 					    &info, info.type == CONNECT_HIT);
 	if (ret)
@@ -448,7 +448,7 @@ static int dr_matcher_connect(struct mlx5dv_dr_domain *dmn,
 	/* Connect start hash table to end anchor */
 	info.type = CONNECT_MISS;
 	info.miss_icm_addr = curr_nic_matcher->e_anchor->chunk->icm_addr;
-	ret = dr_ste_htbl_init_and_postsend(dmn, nic_dmn,
+	ret = dr_ste_htbl_init_and_postsend(dmn, dmn->send_ring[0], nic_dmn,
 					    curr_nic_matcher->s_htbl,
 					    &info, false);
 	if (ret)
@@ -462,8 +462,8 @@ static int dr_matcher_connect(struct mlx5dv_dr_domain *dmn,
 
 	info.type = CONNECT_HIT;
 	info.hit_next_htbl = curr_nic_matcher->s_htbl;
-	ret = dr_ste_htbl_init_and_postsend(dmn, nic_dmn, prev_htbl,
-					    &info, true);
+	ret = dr_ste_htbl_init_and_postsend(dmn, dmn->send_ring[0], nic_dmn,
+					    prev_htbl, &info, true);
 	if (ret)
 		return ret;
 
@@ -479,6 +479,43 @@ static int dr_matcher_connect(struct mlx5dv_dr_domain *dmn,
 	return 0;
 }
 
+/*
+ * With several send rings the rules of the next matcher may rehash its start
+ * table and rewrite the anchor pointing to it from their own ring. Keep them
+ * out while the anchors are rewritten and let their writes land first, then
+ * let the ring 0 writes land before they come back.
+ */
+static int dr_matcher_lock_next(struct mlx5dv_dr_domain *dmn,
+				struct mlx5dv_dr_matcher *next_matcher)
+{
+	int ret;
+
+	if (!dr_domain_is_multi_ring(dmn) || !next_matcher)
+		return 0;
+
+	pthread_mutex_lock(&next_matcher->mutex);
+	ret = dr_send_ring_force_drain(dmn, next_matcher->send_ring);
+	if (ret)
+		pthread_mutex_unlock(&next_matcher->mutex);
+
+	return ret;
+}
+
+static int dr_matcher_unlock_next(struct mlx5dv_dr_domain *dmn,
+				  struct mlx5dv_dr_matcher *next_matcher)
+{
+	int ret;
+
+	if (!dr_domain_is_multi_ring(dmn))
+		return 0;
+
+	ret = dr_send_ring_force_drain(dmn, dmn->send_ring[0]);
+	if (next_matcher)
+		pthread_mutex_unlock(&next_matcher->mutex);
+
+	return ret;
+}
+
 static int dr_matcher_add_to_tbl(struct mlx5dv_dr_matcher *matcher)
 {
 	struct mlx5dv_dr_matcher *next_matcher, *prev_matcher, *tmp_matcher;
@@ -506,13 +543,17 @@ static int dr_matcher_add_to_tbl(struct mlx5dv_dr_matcher *matcher)
 					 struct mlx5dv_dr_matcher,
 					 matcher_list);
 
+	ret = dr_matcher_lock_next(dmn, next_matcher);
+	if (ret)
+		return ret;
+
 	if (dmn->type == MLX5DV_DR_DOMAIN_TYPE_FDB ||
 	    dmn->type == MLX5DV_DR_DOMAIN_TYPE_NIC_RX) {
 		ret = dr_matcher_connect(dmn, &matcher->rx,
 					 next_matcher ? &next_matcher->rx : NULL,
 					 prev_matcher ?	&prev_matcher->rx : NULL);
 		if (ret)
-			return ret;
+			goto unlock_next;
 	}
 
 	if (dmn->type == MLX5DV_DR_DOMAIN_TYPE_FDB ||
@@ -521,9 +562,14 @@ static int dr_matcher_add_to_tbl(struct mlx5dv_dr_matcher *matcher)
 					 next_matcher ? &next_matcher->tx : NULL,
 					 prev_matcher ?	&prev_matcher->tx : NULL);
 		if (ret)
-			return ret;
+			goto unlock_next;
 	}
 
+	/* Also makes sure the new matcher tables are written before its rules */
+	ret = dr_matcher_unlock_next(dmn, next_matcher);
+	if (ret)
+		return ret;
+
 	if (prev_matcher)
 		list_add_after(&tbl->matcher_list,
 			       &prev_matcher->matcher_list,
@@ -536,6 +582,10 @@ static int dr_matcher_add_to_tbl(struct mlx5dv_dr_matcher *matcher)
 		list_add(&tbl->matcher_list, &matcher->matcher_list);
 
 	return 0;
+
+unlock_next:
+	dr_matcher_unlock_next(dmn, next_matcher);
+	return ret;
 }
 
 static void dr_matcher_uninit_nic(struct dr_matcher_rx_tx *nic_matcher)
@@ -732,9 +782,16 @@ mlx5dv_dr_matcher_create(struct mlx5dv_dr_table *tbl,
 	matcher->match_criteria = match_criteria_enable;
 	atomic_init(&matcher->refcount, 1);
 	list_node_init(&matcher->matcher_list);
+	pthread_mutex_init(&matcher->mutex, NULL);
 
 	pthread_mutex_lock(&tbl->dmn->mutex);
 
+	if (tbl->dmn->num_send_rings) {
+		matcher->send_ring = tbl->dmn->send_ring[tbl->dmn->next_send_ring];
+		tbl->dmn->next_send_ring = (tbl->dmn->next_send_ring + 1) %
+					   tbl->dmn->num_send_rings;
+	}
+
 	ret = dr_matcher_init(matcher, mask);
 	if (ret)
 		goto free_matcher;
@@ -751,6 +808,7 @@ matcher_uninit:
 	dr_matcher_uninit(matcher);
 free_matcher:
 	pthread_mutex_unlock(&tbl->dmn->mutex);
+	pthread_mutex_destroy(&matcher->mutex);
 	free(matcher);
 dec_ref:
 	atomic_fetch_sub(&tbl->refcount, 1);
@@ -783,8 +841,8 @@ static int dr_matcher_disconnect(struct mlx5dv_dr_domain *dmn,
 		prev_anchor->ste_arr[0].next_htbl = NULL;
 	}
 
-	return dr_ste_htbl_init_and_postsend(dmn, nic_dmn, prev_anchor,
-					     &info, true);
+	return dr_ste_htbl_init_and_postsend(dmn, dmn->send_ring[0], nic_dmn,
+					     prev_anchor, &info, true);
 }
 
 static int dr_matcher_remove_from_tbl(struct mlx5dv_dr_matcher *matcher)
@@ -800,13 +858,17 @@ static int dr_matcher_remove_from_tbl(struct mlx5dv_dr_matcher *matcher)
 	prev_matcher = list_prev(&tbl->matcher_list, matcher, matcher_list);
 	next_matcher = list_next(&tbl->matcher_list, matcher, matcher_list);
 
+	ret = dr_matcher_lock_next(dmn, next_matcher);
+	if (ret)
+		return ret;
+
 	if (dmn->type == MLX5DV_DR_DOMAIN_TYPE_FDB ||
 	    dmn->type == MLX5DV_DR_DOMAIN_TYPE_NIC_RX) {
 		ret = dr_matcher_disconnect(dmn, &tbl->rx,
 					    next_matcher ? &next_matcher->rx : NULL,
 					    prev_matcher ? &prev_matcher->rx : NULL);
 		if (ret)
-			return ret;
+			goto unlock_next;
 	}
 
 	if (dmn->type == MLX5DV_DR_DOMAIN_TYPE_FDB ||
@@ -815,12 +877,20 @@ static int dr_matcher_remove_from_tbl(struct mlx5dv_dr_matcher *matcher)
 					    next_matcher ? &next_matcher->tx : NULL,
 					    prev_matcher ? &prev_matcher->tx : NULL);
 		if (ret)
-			return ret;
+			goto unlock_next;
 	}
 
+	ret = dr_matcher_unlock_next(dmn, next_matcher);
+	if (ret)
+		return ret;
+
 	list_del(&matcher->matcher_list);
 
 	return 0;
+
+unlock_next:
+	dr_matcher_unlock_next(dmn, next_matcher);
+	return ret;
 }
 
 int mlx5dv_dr_matcher_destroy(struct mlx5dv_dr_matcher *matcher)
@@ -837,6 +907,7 @@ int mlx5dv_dr_matcher_destroy(struct mlx5dv_dr_matcher *matcher)
 	atomic_fetch_sub(&matcher->tbl->refcount, 1);
 
 	pthread_mutex_unlock(&tbl->dmn->mutex);
+	pthread_mutex_destroy(&matcher->mutex);
 	free(matcher);
 
 	return 0;
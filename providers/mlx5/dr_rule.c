@@ -128,13 +128,15 @@ free_tbl:
 }
 
 static int dr_rule_handle_one_ste_in_update_list(struct dr_ste_send_info *ste_info,
-						 struct mlx5dv_dr_domain *dmn)
+						 struct mlx5dv_dr_domain *dmn,
+						 struct dr_send_ring *send_ring)
 {
 	int ret;
 
 	list_del(&ste_info->send_list);
-	ret = dr_send_postsend_ste(dmn, ste_info->ste, ste_info->data,
-				   ste_info->size, ste_info->offset);
+	ret = dr_send_postsend_ste(dmn, send_ring, ste_info->ste,
+				   ste_info->data, ste_info->size,
+				   ste_info->offset);
 	if (ret)
 		goto out;
 	/* Copy data to ste, only reduced size, the last 16B (mask)
@@ -149,6 +151,7 @@ out:
 
 static int dr_rule_send_update_list(struct list_head *send_ste_list,
 				    struct mlx5dv_dr_domain *dmn,
+				    struct dr_send_ring *send_ring,
 				    bool is_reverse)
 {
 	struct dr_ste_send_info *ste_info, *tmp_ste_info;
@@ -158,7 +161,8 @@ static int dr_rule_send_update_list(struct list_head *send_ste_list,
 		list_for_each_rev_safe(send_ste_list, ste_info, tmp_ste_info,
 				       send_list) {
 			ret = dr_rule_handle_one_ste_in_update_list(ste_info,
-								    dmn);
+								    dmn,
+								    send_ring);
 			if (ret)
 				return ret;
 		}
@@ -166,7 +170,8 @@ static int dr_rule_send_update_list(struct list_head *send_ste_list,
 		list_for_each_safe(send_ste_list, ste_info, tmp_ste_info,
 				   send_list) {
 			ret = dr_rule_handle_one_ste_in_update_list(ste_info,
-								    dmn);
+								    dmn,
+								    send_ring);
 			if (ret)
 				return ret;
 		}
@@ -424,7 +429,8 @@ static struct dr_ste_htbl *dr_rule_rehash_htbl(struct mlx5dv_dr_rule *rule,
 	if (err)
 		goto free_new_htbl;
 
-	if (dr_send_postsend_htbl(dmn, new_htbl, formated_ste,
+	if (dr_send_postsend_htbl(dmn, matcher->send_ring, new_htbl,
+				  formated_ste,
 				  nic_matcher->ste_builder[ste_location - 1].bit_mask)) {
 		dr_dbg(dmn, "Failed writing table to HW\n");
 		goto free_new_htbl;
@@ -435,7 +441,8 @@ static struct dr_ste_htbl *dr_rule_rehash_htbl(struct mlx5dv_dr_rule *rule,
 	 * in order to have the origin data written before the miss address of
 	 * collision entries, if exists.
 	 */
-	if (dr_rule_send_update_list(&rehash_table_send_list, dmn, false)) {
+	if (dr_rule_send_update_list(&rehash_table_send_list, dmn,
+				     matcher->send_ring, false)) {
 		dr_dbg(dmn, "Failed updating table to HW\n");
 		goto free_ste_list;
 	}
@@ -1098,7 +1105,8 @@ dr_rule_create_rule_nic(struct mlx5dv_dr_rule *rule,
 		dr_dbg(dmn, "Failed apply actions\n");
 		goto free_rule;
 	}
-	ret = dr_rule_send_update_list(&send_ste_list, dmn, true);
+	ret = dr_rule_send_update_list(&send_ste_list, dmn,
+				       matcher->send_ring, true);
 	if (ret) {
 		dr_dbg(dmn, "Failed sending ste!\n");
 		goto free_rule;
@@ -1281,45 +1289,195 @@ free_rule:
 	return NULL;
 }
 
-struct mlx5dv_dr_rule *mlx5dv_dr_rule_create(struct mlx5dv_dr_matcher *matcher,
-					     struct mlx5dv_flow_match_parameters *value,
-					     size_t num_actions,
-					     struct mlx5dv_dr_action *actions[])
+/*
+ * The create helpers report failures through errno only, so clear it first
+ * to be sure the error returned comes from this rule and not an earlier call.
+ */
+static int dr_rule_create(struct mlx5dv_dr_matcher *matcher,
+			  struct mlx5dv_flow_match_parameters *value,
+			  size_t num_actions,
+			  struct mlx5dv_dr_action *actions[],
+			  struct mlx5dv_dr_rule **rule)
 {
-	struct mlx5dv_dr_rule *rule;
+	int saved_errno = errno;
 
-	pthread_mutex_lock(&matcher->tbl->dmn->mutex);
 	atomic_fetch_add(&matcher->refcount, 1);
 
+	errno = 0;
 	if (dr_is_root_table(matcher->tbl))
-		rule = dr_rule_create_rule_root(matcher, value, num_actions, actions);
+		*rule = dr_rule_create_rule_root(matcher, value, num_actions, actions);
 	else
-		rule = dr_rule_create_rule(matcher, value, num_actions, actions);
+		*rule = dr_rule_create_rule(matcher, value, num_actions, actions);
 
-	if (!rule)
+	if (!*rule) {
 		atomic_fetch_sub(&matcher->refcount, 1);
+		return errno ? errno : EINVAL;
+	}
 
-	pthread_mutex_unlock(&matcher->tbl->dmn->mutex);
-
-	return rule;
+	errno = saved_errno;
+	return 0;
 }
 
-int mlx5dv_dr_rule_destroy(struct mlx5dv_dr_rule *rule)
+static int dr_rule_destroy(struct mlx5dv_dr_rule *rule)
 {
 	struct mlx5dv_dr_matcher *matcher = rule->matcher;
-	struct mlx5dv_dr_table *tbl = rule->matcher->tbl;
 	int ret;
 
-	pthread_mutex_lock(&tbl->dmn->mutex);
-
-	if (dr_is_root_table(tbl))
+	if (dr_is_root_table(matcher->tbl))
 		ret = dr_rule_destroy_rule_root(rule);
 	else
 		ret = dr_rule_destroy_rule(rule);
 
-	pthread_mutex_unlock(&tbl->dmn->mutex);
-
 	if (!ret)
 		atomic_fetch_sub(&matcher->refcount, 1);
 	return ret;
 }
+
+/*
+ * With a single send ring the domain lock serializes all the rule updates.
+ * With several rings each matcher has its own ring and its rules only touch
+ * the matcher tables, so the matcher lock is enough.
+ */
+static void dr_rule_lock(struct mlx5dv_dr_matcher *matcher)
+{
+	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
+
+	if (dr_domain_is_multi_ring(dmn))
+		pthread_mutex_lock(&matcher->mutex);
+	else
+		pthread_mutex_lock(&dmn->mutex);
+}
+
+static void dr_rule_unlock(struct mlx5dv_dr_matcher *matcher)
+{
+	struct mlx5dv_dr_domain *dmn = matcher->tbl->dmn;
+
+	if (dr_domain_is_multi_ring(dmn))
+		pthread_mutex_unlock(&matcher->mutex);
+	else
+		pthread_mutex_unlock(&dmn->mutex);
+}
+
+static void dr_rule_batch_start(struct mlx5dv_dr_matcher *matcher)
+{
+	dr_rule_lock(matcher);
+	if (matcher->send_ring)
+		dr_send_ring_begin_batch(matcher->send_ring);
+}
+
+static void dr_rule_batch_end(struct mlx5dv_dr_matcher *matcher)
+{
+	if (matcher->send_ring)
+		dr_send_ring_end_batch(matcher->send_ring);
+	dr_rule_unlock(matcher);
+}
+
+struct mlx5dv_dr_rule *mlx5dv_dr_rule_create(struct mlx5dv_dr_matcher *matcher,
+					     struct mlx5dv_flow_match_parameters *value,
+					     size_t num_actions,
+					     struct mlx5dv_dr_action *actions[])
+{
+	struct mlx5dv_dr_rule *rule;
+	int ret;
+
+	dr_rule_lock(matcher);
+	ret = dr_rule_create(matcher, value, num_actions, actions, &rule);
+	dr_rule_unlock(matcher);
+
+	if (ret)
+		errno = ret;
+	return rule;
+}
+
+int mlx5dv_dr_rule_destroy(struct mlx5dv_dr_rule *rule)
+{
+	struct mlx5dv_dr_matcher *matcher = rule->matcher;
+	int ret;
+
+	dr_rule_lock(matcher);
+	ret = dr_rule_destroy(rule);
+	dr_rule_unlock(matcher);
+
+	return ret;
+}
+
+/*
+ * The bulk calls take the rule lock once per matcher and hold back the send
+ * ring doorbell for the whole batch, so the STE writes of many rules go to
+ * the device together.
+ */
+int mlx5dv_dr_rule_create_bulk(struct mlx5dv_dr_matcher *matcher,
+			       size_t num_rules,
+			       struct mlx5dv_dr_rule_attr *attr,
+			       struct mlx5dv_dr_rule *rules[])
+{
+	size_t i;
+	int ret = 0;
+
+	dr_rule_batch_start(matcher);
+
+	for (i = 0; i < num_rules; i++) {
+		ret = dr_rule_create(matcher, attr[i].value,
+				     attr[i].num_actions, attr[i].actions,
+				     &rules[i]);
+		if (ret)
+			break;
+	}
+
+	/* All or nothing, remove the rules created so far */
+	if (ret) {
+		while (i--) {
+			dr_rule_destroy(rules[i]);
+			rules[i] = NULL;
+		}
+	}
+
+	dr_rule_batch_end(matcher);
+
+	if (ret)
+		errno = ret;
+	return ret;
+}
+
+int mlx5dv_dr_rule_destroy_bulk(size_t num_rules,
+				struct mlx5dv_dr_rule *rules[])
+{
+	struct mlx5dv_dr_matcher *matcher = NULL;
+	struct mlx5dv_dr_domain *dmn;
+	size_t i;
+	int ret = 0;
+
+	if (!num_rules)
+		return 0;
+
+	/* Refuse the whole batch before any rule is gone */
+	dmn = rules[0]->matcher->tbl->dmn;
+	for (i = 1; i < num_rules; i++) {
+		if (rules[i]->matcher->tbl->dmn != dmn) {
+			errno = EINVAL;
+			return EINVAL;
+		}
+	}
+
+	for (i = 0; i < num_rules; i++) {
+		if (rules[i]->matcher != matcher) {
+			if (matcher)
+				dr_rule_batch_end(matcher);
+			matcher = rules[i]->matcher;
+			dr_rule_batch_start(matcher);
+		}
+
+		ret = dr_rule_destroy(rules[i]);
+		if (ret)
+			break;
+
+		rules[i] = NULL;
+	}
+
+	if (matcher)
+		dr_rule_batch_end(matcher);
+
+	if (ret)
+		errno = ret;
+	return ret;
+}
@@ -379,10 +379,8 @@ static void dr_set_raddr_seg(struct mlx5_wqe_raddr_seg *rseg,
 	rseg->reserved = 0;
 }
 
-static void dr_post_send_db(struct dr_qp *dr_qp, int size, void *ctrl)
+static void dr_ring_db(struct dr_qp *dr_qp, void *ctrl)
 {
-	dr_qp->sq.head += 2; /* RDMA_WRITE + RDMA_READ */
-
 	/*
 	 * Make sure that descriptors are written before
 	 * updating doorbell record and ringing the doorbell
@@ -396,6 +394,21 @@ static void dr_post_send_db(struct dr_qp *dr_qp, int size, void *ctrl)
 	mmio_wc_start();
 	mmio_write64_be((uint8_t *)dr_qp->uar->reg_addr, *(__be64 *)ctrl);
 	mmio_flush_writes();
+
+	dr_qp->db_ctrl = NULL;
+}
+
+static void dr_post_send_db(struct dr_qp *dr_qp, int size, void *ctrl)
+{
+	dr_qp->sq.head += 2; /* RDMA_WRITE + RDMA_READ */
+
+	/* In a batch only the last posted WQE is rung, see dr_ring_db() */
+	if (dr_qp->defer_db) {
+		dr_qp->db_ctrl = ctrl;
+		return;
+	}
+
+	dr_ring_db(dr_qp, ctrl);
 }
 
 static void dr_set_data_ptr_seg(struct mlx5_wqe_data_seg *dseg,
@@ -558,9 +571,20 @@ static int dr_handle_pending_wc(struct mlx5dv_dr_domain *dmn,
 
 	if (send_ring->pending_wqe >= send_ring->signal_th) {
 		/* Queue is full start drain it */
-		if (send_ring->pending_wqe >= dmn->send_ring->signal_th * TH_NUMS_TO_DRAIN)
+		if (send_ring->pending_wqe >= send_ring->signal_th * TH_NUMS_TO_DRAIN)
 			is_drain = true;
 
+		/*
+		 * With a deferred doorbell nothing new can complete, so only
+		 * ring it once the queue has to be drained.
+		 */
+		if (send_ring->qp->db_ctrl) {
+			if (!is_drain)
+				return 0;
+
+			dr_ring_db(send_ring->qp, send_ring->qp->db_ctrl);
+		}
+
 		do {
 			/*
 			 * On IBV_EVENT_DEVICE_FATAL a success is returned to
@@ -617,9 +641,9 @@ static void dr_fill_data_segs(struct dr_send_ring *send_ring,
 }
 
 static int dr_postsend_icm_data(struct mlx5dv_dr_domain *dmn,
+				struct dr_send_ring *send_ring,
 				struct postsend_info *send_info)
 {
-	struct dr_send_ring *send_ring = dmn->send_ring;
 	uint32_t buff_offset;
 	int ret;
 
@@ -628,7 +652,7 @@ static int dr_postsend_icm_data(struct mlx5dv_dr_domain *dmn,
 		return ret;
 
 	if (send_info->write.length > dmn->info.max_inline_size) {
-		buff_offset = (send_ring->tx_head & (dmn->send_ring->signal_th - 1)) *
+		buff_offset = (send_ring->tx_head & (send_ring->signal_th - 1)) *
 			send_ring->max_post_send_size;
 		/* Copy to ring mr */
 		memcpy(send_ring->buf + buff_offset,
@@ -645,7 +669,7 @@ static int dr_postsend_icm_data(struct mlx5dv_dr_domain *dmn,
 	return 0;
 }
 
-static int dr_get_tbl_copy_details(struct mlx5dv_dr_domain *dmn,
+static int dr_get_tbl_copy_details(struct dr_send_ring *send_ring,
 				   struct dr_ste_htbl *htbl,
 				   uint8_t **data,
 				   uint32_t *byte_size,
@@ -654,9 +678,9 @@ static int dr_get_tbl_copy_details(struct mlx5dv_dr_domain *dmn,
 {
 	int alloc_size;
 
-	if (htbl->chunk->byte_size > dmn->send_ring->max_post_send_size) {
-		*iterations = htbl->chunk->byte_size / dmn->send_ring->max_post_send_size;
-		*byte_size = dmn->send_ring->max_post_send_size;
+	if (htbl->chunk->byte_size > send_ring->max_post_send_size) {
+		*iterations = htbl->chunk->byte_size / send_ring->max_post_send_size;
+		*byte_size = send_ring->max_post_send_size;
 		alloc_size = *byte_size;
 		*num_stes = *byte_size / DR_STE_SIZE;
 	} else {
@@ -678,8 +702,9 @@ static int dr_get_tbl_copy_details(struct mlx5dv_dr_domain *dmn,
  * dr_postsend_ste: write size bytes into offset from the hw icm.
  *
  * Input:
- *     dmn     - Domain
- *     ste     - The ste struct that contains the data (at least part of it)
+ *     dmn       - Domain
+ *     send_ring - The ring to post on, the rule's matcher ring
+ *     ste       - The ste struct that contains the data (at least part of it)
  *     data    - The real data to send
  *     size    - data size for writing.
  *     offset  - The offset from the icm mapped data to start write to.
@@ -687,10 +712,12 @@ static int dr_get_tbl_copy_details(struct mlx5dv_dr_domain *dmn,
  *
  * Return: 0 on success.
  */
-int dr_send_postsend_ste(struct mlx5dv_dr_domain *dmn, struct dr_ste *ste,
+int dr_send_postsend_ste(struct mlx5dv_dr_domain *dmn,
+			 struct dr_send_ring *send_ring, struct dr_ste *ste,
 			 uint8_t *data, uint16_t size, uint16_t offset)
 {
 	struct postsend_info send_info = {};
+	int ret;
 
 	send_info.write.addr    = (uintptr_t) data;
 	send_info.write.length  = size;
@@ -698,10 +725,16 @@ int dr_send_postsend_ste(struct mlx5dv_dr_domain *dmn, struct dr_ste *ste,
 	send_info.remote_addr   = dr_ste_get_mr_addr(ste) + offset;
 	send_info.rkey          = ste->htbl->chunk->rkey;
 
-	return dr_postsend_icm_data(dmn, &send_info);
+	pthread_mutex_lock(&send_ring->mutex);
+	ret = dr_postsend_icm_data(dmn, send_ring, &send_info);
+	pthread_mutex_unlock(&send_ring->mutex);
+
+	return ret;
 }
 
-int dr_send_postsend_htbl(struct mlx5dv_dr_domain *dmn, struct dr_ste_htbl *htbl,
+int dr_send_postsend_htbl(struct mlx5dv_dr_domain *dmn,
+			  struct dr_send_ring *send_ring,
+			  struct dr_ste_htbl *htbl,
 			  uint8_t *formated_ste, uint8_t *mask)
 {
 	uint32_t byte_size = htbl->chunk->byte_size;
@@ -709,11 +742,13 @@ int dr_send_postsend_htbl(struct mlx5dv_dr_domain *dmn, struct dr_ste_htbl *htbl
 	uint8_t *data;
 	int ret;
 
-	ret = dr_get_tbl_copy_details(dmn, htbl, &data, &byte_size,
+	ret = dr_get_tbl_copy_details(send_ring, htbl, &data, &byte_size,
 				      &iterations, &num_stes_per_iter);
 	if (ret)
 		return ret;
 
+	pthread_mutex_lock(&send_ring->mutex);
+
 	/* Send the data iteration times */
 	for (i = 0; i < iterations; i++) {
 		uint32_t ste_index = i * (byte_size / DR_STE_SIZE);
@@ -740,18 +775,20 @@ int dr_send_postsend_htbl(struct mlx5dv_dr_domain *dmn, struct dr_ste_htbl *htbl
 		send_info.remote_addr	= dr_ste_get_mr_addr(htbl->ste_arr + ste_index);
 		send_info.rkey		= htbl->chunk->rkey;
 
-		ret = dr_postsend_icm_data(dmn, &send_info);
+		ret = dr_postsend_icm_data(dmn, send_ring, &send_info);
 		if (ret)
-			goto out_free;
+			goto out_unlock;
 	}
 
-out_free:
+out_unlock:
+	pthread_mutex_unlock(&send_ring->mutex);
 	free(data);
 	return ret;
 }
 
 /* Initialize htble with default STEs */
 int dr_send_postsend_formated_htbl(struct mlx5dv_dr_domain *dmn,
+				   struct dr_send_ring *send_ring,
 				   struct dr_ste_htbl *htbl,
 				   uint8_t *ste_init_data,
 				   bool update_hw_ste)
@@ -760,7 +797,7 @@ int dr_send_postsend_formated_htbl(struct mlx5dv_dr_domain *dmn,
 	int i, num_stes, iterations, ret;
 	uint8_t *data;
 
-	ret = dr_get_tbl_copy_details(dmn, htbl, &data, &byte_size,
+	ret = dr_get_tbl_copy_details(send_ring, htbl, &data, &byte_size,
 				      &iterations, &num_stes);
 	if (ret)
 		return ret;
@@ -779,6 +816,8 @@ int dr_send_postsend_formated_htbl(struct mlx5dv_dr_domain *dmn,
 		}
 	}
 
+	pthread_mutex_lock(&send_ring->mutex);
+
 	/* Send the data iteration times */
 	for (i = 0; i < iterations; i++) {
 		uint32_t ste_index = i * (byte_size / DR_STE_SIZE);
@@ -790,12 +829,13 @@ int dr_send_postsend_formated_htbl(struct mlx5dv_dr_domain *dmn,
 		send_info.remote_addr	= dr_ste_get_mr_addr(htbl->ste_arr + ste_index);
 		send_info.rkey		= htbl->chunk->rkey;
 
-		ret = dr_postsend_icm_data(dmn, &send_info);
+		ret = dr_postsend_icm_data(dmn, send_ring, &send_info);
 		if (ret)
-			goto out_free;
+			goto out_unlock;
 	}
 
-out_free:
+out_unlock:
+	pthread_mutex_unlock(&send_ring->mutex);
 	free(data);
 	return ret;
 }
@@ -813,17 +853,19 @@ int dr_send_postsend_action(struct mlx5dv_dr_domain *dmn,
 	send_info.rkey		= action->rewrite.chunk->rkey;
 
 	pthread_mutex_lock(&dmn->mutex);
-	ret = dr_postsend_icm_data(dmn, &send_info);
+	pthread_mutex_lock(&dmn->send_ring[0]->mutex);
+	ret = dr_postsend_icm_data(dmn, dmn->send_ring[0], &send_info);
+	pthread_mutex_unlock(&dmn->send_ring[0]->mutex);
 	pthread_mutex_unlock(&dmn->mutex);
 
 	return ret;
 }
 
-static int dr_prepare_qp_to_rts(struct mlx5dv_dr_domain *dmn)
+static int dr_prepare_qp_to_rts(struct mlx5dv_dr_domain *dmn,
+				struct dr_qp *dr_qp)
 {
 	struct dr_devx_qp_rts_attr rts_attr = {};
 	struct dr_devx_qp_rtr_attr rtr_attr = {};
-	struct dr_qp *dr_qp = dmn->send_ring->qp;
 	enum ibv_mtu mtu = IBV_MTU_1024;
 	uint16_t gid_index = 0;
 	int port = 1;
@@ -870,8 +912,9 @@ static int dr_prepare_qp_to_rts(struct mlx5dv_dr_domain *dmn)
 }
 
 /* Each domain has its own ib resources */
-int dr_send_ring_alloc(struct mlx5dv_dr_domain *dmn)
+struct dr_send_ring *dr_send_ring_alloc(struct mlx5dv_dr_domain *dmn)
 {
+	struct dr_send_ring *send_ring;
 	struct dr_qp_init_attr init_attr = {};
 	struct mlx5dv_pd mlx5_pd = {};
 	struct mlx5dv_cq mlx5_cq = {};
@@ -882,33 +925,33 @@ int dr_send_ring_alloc(struct mlx5dv_dr_domain *dmn)
 			   IBV_ACCESS_REMOTE_READ;
 	int ret;
 
-	dmn->send_ring = calloc(1, sizeof(*dmn->send_ring));
-	if (!dmn->send_ring) {
+	send_ring = calloc(1, sizeof(*send_ring));
+	if (!send_ring) {
 		dr_dbg(dmn, "Couldn't allocate send-ring\n");
 		errno = ENOMEM;
-		return errno;
+		return NULL;
 	}
 
 	cq_size = QUEUE_SIZE + 1;
-	dmn->send_ring->cq.ibv_cq = ibv_create_cq(dmn->ctx, cq_size, NULL, NULL, 0);
-	if (!dmn->send_ring->cq.ibv_cq) {
+	send_ring->cq.ibv_cq = ibv_create_cq(dmn->ctx, cq_size, NULL, NULL, 0);
+	if (!send_ring->cq.ibv_cq) {
 		dr_dbg(dmn, "Failed to create CQ with %u entries\n", cq_size);
 		ret = ENODEV;
 		errno = ENODEV;
 		goto free_send_ring;
 	}
 
-	obj.cq.in = dmn->send_ring->cq.ibv_cq;
+	obj.cq.in = send_ring->cq.ibv_cq;
 	obj.cq.out = &mlx5_cq;
 
 	ret = mlx5dv_init_obj(&obj, MLX5DV_OBJ_CQ);
 	if (ret)
 		goto clean_cq;
 
-	dmn->send_ring->cq.buf = mlx5_cq.buf;
-	dmn->send_ring->cq.db = mlx5_cq.dbrec;
-	dmn->send_ring->cq.ncqe = mlx5_cq.cqe_cnt;
-	dmn->send_ring->cq.cqe_sz = mlx5_cq.cqe_size;
+	send_ring->cq.buf = mlx5_cq.buf;
+	send_ring->cq.db = mlx5_cq.dbrec;
+	send_ring->cq.ncqe = mlx5_cq.cqe_cnt;
+	send_ring->cq.cqe_sz = mlx5_cq.cqe_size;
 
 	obj.pd.in = dmn->pd;
 	obj.pd.out = &mlx5_pd;
@@ -926,76 +969,79 @@ int dr_send_ring_alloc(struct mlx5dv_dr_domain *dmn)
 	init_attr.cap.max_recv_sge	= 1;
 	init_attr.cap.max_inline_data	= DR_STE_SIZE;
 
-	dmn->send_ring->qp = dr_create_rc_qp(dmn->ctx, &init_attr);
-	if (!dmn->send_ring->qp)  {
+	send_ring->qp = dr_create_rc_qp(dmn->ctx, &init_attr);
+	if (!send_ring->qp)  {
 		dr_dbg(dmn, "Couldn't create QP\n");
 		ret = errno;
 		goto clean_cq;
 	}
-	dmn->send_ring->cq.qp = dmn->send_ring->qp;
+	send_ring->cq.qp = send_ring->qp;
 
 	dmn->info.max_send_wr = QUEUE_SIZE;
-	dmn->info.max_inline_size = min(dmn->send_ring->qp->max_inline_data,
+	dmn->info.max_inline_size = min(send_ring->qp->max_inline_data,
 					DR_STE_SIZE);
 
-	dmn->send_ring->signal_th = dmn->info.max_send_wr / SIGNAL_PER_DIV_QUEUE;
+	send_ring->signal_th = dmn->info.max_send_wr / SIGNAL_PER_DIV_QUEUE;
 
 	/* Prepare qp to be used */
-	ret = dr_prepare_qp_to_rts(dmn);
+	ret = dr_prepare_qp_to_rts(dmn, send_ring->qp);
 	if (ret) {
 		dr_dbg(dmn, "Couldn't prepare QP\n");
 		goto clean_qp;
 	}
 
-	dmn->send_ring->max_post_send_size =
+	send_ring->max_post_send_size =
 		dr_icm_pool_chunk_size_to_byte(DR_CHUNK_SIZE_1K, DR_ICM_TYPE_STE);
 
 	/* Allocating the max size as a buffer for writing */
-	size = dmn->send_ring->signal_th * dmn->send_ring->max_post_send_size;
+	size = send_ring->signal_th * send_ring->max_post_send_size;
 	page_size = sysconf(_SC_PAGESIZE);
-	ret = posix_memalign(&dmn->send_ring->buf, page_size, size);
+	ret = posix_memalign(&send_ring->buf, page_size, size);
 	if (ret) {
 		dr_dbg(dmn, "Couldn't allocate send-ring buf.\n");
 		errno = ret;
 		goto clean_qp;
 	}
 
-	memset(dmn->send_ring->buf, 0, size);
-	dmn->send_ring->buf_size = size;
+	memset(send_ring->buf, 0, size);
+	send_ring->buf_size = size;
 
-	dmn->send_ring->mr = ibv_reg_mr(dmn->pd, dmn->send_ring->buf, size,
+	send_ring->mr = ibv_reg_mr(dmn->pd, send_ring->buf, size,
 					access_flags);
-	if (!dmn->send_ring->mr) {
+	if (!send_ring->mr) {
 		dr_dbg(dmn, "Couldn't register send-ring MR\n");
 		ret = errno;
 		goto free_mem;
 	}
 
-	dmn->send_ring->sync_mr = ibv_reg_mr(dmn->pd, dmn->send_ring->sync_buff,
+	send_ring->sync_mr = ibv_reg_mr(dmn->pd, send_ring->sync_buff,
 					     MIN_READ_SYNC,
 					     IBV_ACCESS_LOCAL_WRITE |
 					     IBV_ACCESS_REMOTE_READ |
 					     IBV_ACCESS_REMOTE_WRITE);
-	if (!dmn->send_ring->sync_mr) {
+	if (!send_ring->sync_mr) {
 		dr_dbg(dmn, "Couldn't register sync mr\n");
 		ret = errno;
 		goto clean_mr;
 	}
 
-	return 0;
+	pthread_mutex_init(&send_ring->mutex, NULL);
+
+	return send_ring;
 
 clean_mr:
-	ibv_dereg_mr(dmn->send_ring->mr);
+	ibv_dereg_mr(send_ring->mr);
 free_mem:
-	free(dmn->send_ring->buf);
+	free(send_ring->buf);
 clean_qp:
-	dr_destroy_qp(dmn->send_ring->qp);
+	dr_destroy_qp(send_ring->qp);
 clean_cq:
-	ibv_destroy_cq(dmn->send_ring->cq.ibv_cq);
+	ibv_destroy_cq(send_ring->cq.ibv_cq);
 free_send_ring:
-	free(dmn->send_ring);
+	free(send_ring);
+	errno = ret;
 
-	return ret;
+	return NULL;
 }
 
 void dr_send_ring_free(struct dr_send_ring *send_ring)
@@ -1005,12 +1051,36 @@ void dr_send_ring_free(struct dr_send_ring *send_ring)
 	ibv_dereg_mr(send_ring->sync_mr);
 	ibv_dereg_mr(send_ring->mr);
 	free(send_ring->buf);
+	pthread_mutex_destroy(&send_ring->mutex);
 	free(send_ring);
 }
 
-int dr_send_ring_force_drain(struct mlx5dv_dr_domain *dmn)
+/*
+ * Between dr_send_ring_begin_batch() and dr_send_ring_end_batch() WQEs are
+ * written to the send queue but the doorbell is only rung when the queue has
+ * to be drained or at the end of the batch, instead of once per write.
+ */
+void dr_send_ring_begin_batch(struct dr_send_ring *send_ring)
+{
+	pthread_mutex_lock(&send_ring->mutex);
+	send_ring->qp->defer_db++;
+	pthread_mutex_unlock(&send_ring->mutex);
+}
+
+void dr_send_ring_end_batch(struct dr_send_ring *send_ring)
+{
+	struct dr_qp *dr_qp = send_ring->qp;
+
+	pthread_mutex_lock(&send_ring->mutex);
+	dr_qp->defer_db--;
+	if (dr_qp->db_ctrl)
+		dr_ring_db(dr_qp, dr_qp->db_ctrl);
+	pthread_mutex_unlock(&send_ring->mutex);
+}
+
+int dr_send_ring_force_drain(struct mlx5dv_dr_domain *dmn,
+			     struct dr_send_ring *send_ring)
 {
-	struct dr_send_ring *send_ring = dmn->send_ring;
 	struct postsend_info send_info = {};
 	uint8_t data[DR_STE_SIZE];
 	int i, num_of_sends_req;
@@ -1027,14 +1097,32 @@ int dr_send_ring_force_drain(struct mlx5dv_dr_domain *dmn)
 	send_info.remote_addr	= (uintptr_t) send_ring->sync_mr->addr;
 	send_info.rkey		= send_ring->sync_mr->rkey;
 
+	pthread_mutex_lock(&send_ring->mutex);
 
 	for (i = 0; i < num_of_sends_req; i++) {
-		ret = dr_postsend_icm_data(dmn, &send_info);
+		ret = dr_postsend_icm_data(dmn, send_ring, &send_info);
 		if (ret)
-			return ret;
+			goto out_unlock;
 	}
 
 	ret = dr_handle_pending_wc(dmn, send_ring);
 
+out_unlock:
+	pthread_mutex_unlock(&send_ring->mutex);
 	return ret;
 }
+
+/* Make sure the writes posted on all the domain send rings have completed */
+int dr_send_ring_drain_all(struct mlx5dv_dr_domain *dmn)
+{
+	uint32_t i;
+	int ret;
+
+	for (i = 0; i < dmn->num_send_rings; i++) {
+		ret = dr_send_ring_force_drain(dmn, dmn->send_ring[i]);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
@@ -1349,15 +1349,16 @@ static struct verbs_context *mlx5_alloc_context(struct ibv_device *ibdev,
 
 	mlx5_read_env(ibdev, context);
 
-	mlx5_spinlock_init(&context->hugetlb_lock, !mlx5_single_threaded);
-	list_head_init(&context->hugetlb_list);
+	if (util_arena_init(&context->hugetlb_arena, MLX5_Q_CHUNK_SIZE,
+			    UTIL_ARENA_HUGETLB | UTIL_ARENA_DONTFORK))
+		goto err_free_bf;
 
 	verbs_set_ops(v_ctx, &mlx5_ctx_common_ops);
 	if (context->cqe_version) {
 		if (context->cqe_version == MLX5_CQE_VERSION_V1)
 			verbs_set_ops(v_ctx, &mlx5_ctx_cqev1_ops);
 		else
-			goto err_free;
+			goto err_free_arena;
 	}
 
 	memset(&device_attr, 0, sizeof(device_attr));
@@ -1380,6 +1381,9 @@ static struct verbs_context *mlx5_alloc_context(struct ibv_device *ibdev,
 
 	return v_ctx;
 
+err_free_arena:
+	util_arena_cleanup(&context->hugetlb_arena);
+
 err_free_bf:
 	free(context->bfs);
 
@@ -1419,6 +1423,7 @@ static void mlx5_free_context(struct ibv_context *ibctx)
 		       page_size);
 	if (context->clock_info_page)
 		munmap((void *)context->clock_info_page, page_size);
+	util_arena_cleanup(&context->hugetlb_arena);
 	close_debug_file(context);
 
 	verbs_uninit_context(&context->ibv_ctx);
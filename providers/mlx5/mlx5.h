@@ -41,9 +41,9 @@
 #include <infiniband/driver.h>
 #include <util/udma_barrier.h>
 #include <util/util.h>
+#include <util/buf_arena.h>
 #include "mlx5-abi.h"
 #include <ccan/list.h>
-#include "bitmap.h"
 #include <ccan/minmax.h>
 #include "mlx5dv.h"
 
@@ -74,6 +74,7 @@ enum {
 #define MLX5_SRQ_PREFIX "MLX_SRQ"
 #define MLX5_MAX_LOG2_CONTIG_BLOCK_SIZE 23
 #define MLX5_MIN_LOG2_CONTIG_BLOCK_SIZE 12
+#define MLX5_Q_CHUNK_SIZE 32768
 
 enum {
 	MLX5_DBG_QP		= 1 << 0,
@@ -279,8 +280,7 @@ struct mlx5_context {
 	struct mlx5_bf		       *bfs;
 	FILE			       *dbg_fp;
 	char				hostname[40];
-	struct mlx5_spinlock            hugetlb_lock;
-	struct list_head                hugetlb_list;
+	struct util_buf_arena		hugetlb_arena;
 	int				cqe_version;
 	uint8_t				cached_link_layer[MLX5_MAX_PORTS_NUM];
 	uint8_t				cached_port_flags[MLX5_MAX_PORTS_NUM];
@@ -314,27 +314,10 @@ struct mlx5_context {
 	uint32_t			flags;
 };
 
-struct mlx5_bitmap {
-	uint32_t		last;
-	uint32_t		top;
-	uint32_t		max;
-	uint32_t		avail;
-	uint32_t		mask;
-	unsigned long	       *table;
-};
-
-struct mlx5_hugetlb_mem {
-	int			shmid;
-	void		       *shmaddr;
-	struct mlx5_bitmap	bitmap;
-	struct list_node	entry;
-};
-
 struct mlx5_buf {
 	void			       *buf;
 	size_t				length;
-	int                             base;
-	struct mlx5_hugetlb_mem	       *hmem;
+	struct util_arena_buf		hbuf;
 	enum mlx5_alloc_type		type;
 	uint64_t			resource_type;
 	size_t				req_alignment;
@@ -1455,6 +1455,9 @@ int mlx5dv_dr_domain_destroy(struct mlx5dv_dr_domain *domain);
 
 int mlx5dv_dr_domain_sync(struct mlx5dv_dr_domain *domain, uint32_t flags);
 
+int mlx5dv_dr_domain_set_send_rings(struct mlx5dv_dr_domain *domain,
+				    uint32_t num_rings);
+
 struct mlx5dv_dr_table *
 mlx5dv_dr_table_create(struct mlx5dv_dr_domain *domain, uint32_t level);
 
@@ -1476,6 +1479,20 @@ mlx5dv_dr_rule_create(struct mlx5dv_dr_matcher *matcher,
 
 int mlx5dv_dr_rule_destroy(struct mlx5dv_dr_rule *rule);
 
+struct mlx5dv_dr_rule_attr {
+	struct mlx5dv_flow_match_parameters	*value;
+	size_t					num_actions;
+	struct mlx5dv_dr_action			**actions;
+};
+
+int mlx5dv_dr_rule_create_bulk(struct mlx5dv_dr_matcher *matcher,
+			       size_t num_rules,
+			       struct mlx5dv_dr_rule_attr *attr,
+			       struct mlx5dv_dr_rule *rules[]);
+
+int mlx5dv_dr_rule_destroy_bulk(size_t num_rules,
+				struct mlx5dv_dr_rule *rules[]);
+
 enum mlx5dv_dr_action_flags {
 	MLX5DV_DR_ACTION_FLAGS_ROOT_LEVEL	= 1 << 0,
 };
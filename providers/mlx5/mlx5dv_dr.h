@@ -42,6 +42,7 @@
 
 #define DR_RULE_MAX_STES	17
 #define DR_ACTION_MAX_STES	3
+#define DR_MAX_SEND_RINGS	16
 #define WIRE_PORT		0xFFFF
 #define DR_STE_SVLAN		0x1
 #define DR_STE_CVLAN		0x2
@@ -632,7 +633,11 @@ struct mlx5dv_dr_domain {
 	pthread_mutex_t			mutex;
 	struct dr_icm_pool		*ste_icm_pool;
 	struct dr_icm_pool		*action_icm_pool;
-	struct dr_send_ring		*send_ring;
+	struct dr_send_ring		*send_ring[DR_MAX_SEND_RINGS];
+	/* Ring 0 serves the domain, table and matcher updates */
+	uint32_t			num_send_rings;
+	/* Next ring handed to a new matcher */
+	uint32_t			next_send_ring;
 	struct dr_domain_info		info;
 };
 
@@ -671,6 +676,9 @@ struct mlx5dv_dr_matcher {
 	uint8_t				match_criteria;
 	atomic_int			refcount;
 	struct mlx5dv_flow_matcher	*dv_matcher;
+	/* Ring and lock used by the rules of this matcher */
+	struct dr_send_ring		*send_ring;
+	pthread_mutex_t			mutex;
 };
 
 struct dr_rule_member {
@@ -919,6 +927,12 @@ static inline bool dr_is_root_table(struct mlx5dv_dr_table *tbl)
 	return tbl->level == 0;
 }
 
+/* Rules of different matchers are inserted concurrently on their own ring */
+static inline bool dr_domain_is_multi_ring(struct mlx5dv_dr_domain *dmn)
+{
+	return dmn->num_send_rings > 1;
+}
+
 struct dr_icm_pool *dr_icm_pool_create(struct mlx5dv_dr_domain *dmn,
 				       enum dr_icm_type icm_type);
 void dr_icm_pool_destroy(struct dr_icm_pool *pool);
@@ -928,6 +942,7 @@ struct dr_icm_chunk *dr_icm_alloc_chunk(struct dr_icm_pool *pool,
 void dr_icm_free_chunk(struct dr_icm_chunk *chunk);
 bool dr_ste_is_not_valid_entry(uint8_t *p_hw_ste);
 int dr_ste_htbl_init_and_postsend(struct mlx5dv_dr_domain *dmn,
+				  struct dr_send_ring *send_ring,
 				  struct dr_domain_rx_tx *nic_dmn,
 				  struct dr_ste_htbl *htbl,
 				  struct dr_htbl_connect_info *connect_info,
@@ -943,6 +958,7 @@ void dr_ste_copy_param(uint8_t match_criteria,
 
 void dr_crc32_init_table(void);
 uint32_t dr_crc32_slice8_calc(const void *input_data, size_t length);
+uint32_t dr_crc32_calc(const void *input_data, size_t length);
 
 struct dr_wq {
 	unsigned	*wqe_head;
@@ -969,6 +985,10 @@ struct dr_qp {
 	struct mlx5dv_devx_uar		*uar;
 	struct mlx5dv_devx_umem		*buf_umem;
 	struct mlx5dv_devx_umem		*db_umem;
+	/* Number of open batches holding back the doorbell */
+	uint32_t			defer_db;
+	/* Control segment of the last WQE not rung yet */
+	void				*db_ctrl;
 };
 
 struct dr_cq {
@@ -1002,16 +1022,25 @@ struct dr_send_ring {
 	struct ibv_wc		wc[MAX_SEND_CQE];
 	uint8_t			sync_buff[MIN_READ_SYNC];
 	struct ibv_mr		*sync_mr;
+	pthread_mutex_t		mutex;
 };
 
-int dr_send_ring_alloc(struct mlx5dv_dr_domain *dmn);
+struct dr_send_ring *dr_send_ring_alloc(struct mlx5dv_dr_domain *dmn);
 void dr_send_ring_free(struct dr_send_ring *send_ring);
-int dr_send_ring_force_drain(struct mlx5dv_dr_domain *dmn);
-int dr_send_postsend_ste(struct mlx5dv_dr_domain *dmn, struct dr_ste *ste,
+int dr_send_ring_force_drain(struct mlx5dv_dr_domain *dmn,
+			     struct dr_send_ring *send_ring);
+int dr_send_ring_drain_all(struct mlx5dv_dr_domain *dmn);
+void dr_send_ring_begin_batch(struct dr_send_ring *send_ring);
+void dr_send_ring_end_batch(struct dr_send_ring *send_ring);
+int dr_send_postsend_ste(struct mlx5dv_dr_domain *dmn,
+			 struct dr_send_ring *send_ring, struct dr_ste *ste,
 			 uint8_t *data, uint16_t size, uint16_t offset);
-int dr_send_postsend_htbl(struct mlx5dv_dr_domain *dmn, struct dr_ste_htbl *htbl,
+int dr_send_postsend_htbl(struct mlx5dv_dr_domain *dmn,
+			  struct dr_send_ring *send_ring,
+			  struct dr_ste_htbl *htbl,
 			  uint8_t *formated_ste, uint8_t *mask);
 int dr_send_postsend_formated_htbl(struct mlx5dv_dr_domain *dmn,
+				   struct dr_send_ring *send_ring,
 				   struct dr_ste_htbl *htbl,
 				   uint8_t *ste_init_data,
 				   bool update_hw_ste);
@@ -0,0 +1,1290 @@
+/*
+ * Copyright (c) 2019, Mellanox Technologies. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *	Redistribution and use in source and binary forms, with or
+ *	without modification, are permitted provided that the following
+ *	conditions are met:
+ *
+ *	- Redistributions of source code must retain the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer.
+ *
+ *	- Redistributions in binary form must reproduce the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer in the documentation and/or other materials
+ *	  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Replays a ruleset through the mlx5 SW steering rule compiler on top of the
+ * fake device in dr_fake.c and reports insertion rate, hash table occupancy
+ * and ICM usage.
+ *
+ * Ruleset format, one rule per line, '#' starts a comment:
+ *
+ *   rule [table=<level>] [prio=<prio>] <field>=<value>... [action=<action>]
+ *
+ * Fields: smac, dmac, ethertype, vid, src_ip, dst_ip (a.b.c.d[/len]),
+ *         ip_proto, ttl, tcp_sport, tcp_dport, udp_sport, udp_dport,
+ *         in_port, vni, reg_c0
+ * Actions: drop (default), goto:<level>, vport:<vport>
+ *
+ * Rules with the same table, priority, field set and prefix lengths share a
+ * matcher. With --threads the matchers are split between the threads, which
+ * insert into their own matchers concurrently over separate send rings.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "dr_fake.h"
+
+#define BENCH_MAX_LEVEL		63
+#define BENCH_MAX_DEPTH		(2 * DR_RULE_MAX_STES)
+
+enum bench_field {
+	BENCH_SMAC,
+	BENCH_DMAC,
+	BENCH_ETHERTYPE,
+	BENCH_VID,
+	BENCH_SRC_IP,
+	BENCH_DST_IP,
+	BENCH_IP_PROTO,
+	BENCH_TTL,
+	BENCH_TCP_SPORT,
+	BENCH_TCP_DPORT,
+	BENCH_UDP_SPORT,
+	BENCH_UDP_DPORT,
+	BENCH_IN_PORT,
+	BENCH_VNI,
+	BENCH_REG_C0,
+	BENCH_NUM_FIELDS,
+};
+
+enum bench_action {
+	BENCH_ACTION_DROP,
+	BENCH_ACTION_GOTO,
+	BENCH_ACTION_VPORT,
+};
+
+struct bench_rule {
+	uint32_t		fields;
+	uint32_t		table;
+	uint16_t		prio;
+	uint8_t			src_plen;
+	uint8_t			dst_plen;
+	enum bench_action	action;
+	uint32_t		action_arg;
+	uint8_t			smac[6];
+	uint8_t			dmac[6];
+	uint64_t		val[BENCH_NUM_FIELDS];
+	struct bench_matcher	*matcher;
+	struct mlx5dv_dr_rule	*dr_rule;
+};
+
+struct bench_matcher {
+	uint32_t		fields;
+	uint32_t		table;
+	uint16_t		prio;
+	uint8_t			src_plen;
+	uint8_t			dst_plen;
+	uint32_t		num_rules;
+	/* Thread inserting the rules of this matcher */
+	uint32_t		worker;
+	struct mlx5dv_dr_matcher *dr_matcher;
+};
+
+struct bench_level_stats {
+	uint64_t		tables;
+	uint64_t		slots;
+	uint64_t		used;
+	uint64_t		stes;
+	uint64_t		collision_tables;
+	uint64_t		max_chain;
+	uint64_t		icm_bytes;
+	uint64_t		host_bytes;
+};
+
+struct bench {
+	struct ibv_context	*ctx;
+	struct mlx5dv_dr_domain	*dmn;
+	struct mlx5dv_dr_table	*tables[BENCH_MAX_LEVEL + 1];
+	struct mlx5dv_dr_action	*goto_actions[BENCH_MAX_LEVEL + 1];
+	struct mlx5dv_dr_action	**vport_actions;
+	struct mlx5dv_dr_action	*drop_action;
+	struct bench_matcher	**matchers;
+	uint32_t		num_matchers;
+	struct bench_rule	*rules;
+	uint32_t		num_rules;
+	uint32_t		num_vports;
+	struct bench_level_stats levels[BENCH_MAX_DEPTH];
+	uint64_t		icm_mismatch;
+	uint32_t		batch;
+	uint32_t		threads;
+	bool			check;
+};
+
+struct bench_worker {
+	struct bench		*b;
+	uint32_t		id;
+	/* Per rule insertion latency, shared by all workers */
+	uint64_t		*lat;
+	int			ret;
+	pthread_t		thread;
+};
+
+static const char * const field_names[BENCH_NUM_FIELDS] = {
+	[BENCH_SMAC] = "smac",
+	[BENCH_DMAC] = "dmac",
+	[BENCH_ETHERTYPE] = "ethertype",
+	[BENCH_VID] = "vid",
+	[BENCH_SRC_IP] = "src_ip",
+	[BENCH_DST_IP] = "dst_ip",
+	[BENCH_IP_PROTO] = "ip_proto",
+	[BENCH_TTL] = "ttl",
+	[BENCH_TCP_SPORT] = "tcp_sport",
+	[BENCH_TCP_DPORT] = "tcp_dport",
+	[BENCH_UDP_SPORT] = "udp_sport",
+	[BENCH_UDP_DPORT] = "udp_dport",
+	[BENCH_IN_PORT] = "in_port",
+	[BENCH_VNI] = "vni",
+	[BENCH_REG_C0] = "reg_c0",
+};
+
+static const uint64_t field_max[BENCH_NUM_FIELDS] = {
+	[BENCH_ETHERTYPE] = 0xffff,
+	[BENCH_VID] = 0xfff,
+	[BENCH_IP_PROTO] = 0xff,
+	[BENCH_TTL] = 0xff,
+	[BENCH_TCP_SPORT] = 0xffff,
+	[BENCH_TCP_DPORT] = 0xffff,
+	[BENCH_UDP_SPORT] = 0xffff,
+	[BENCH_UDP_DPORT] = 0xffff,
+	[BENCH_IN_PORT] = 0xffff,
+	[BENCH_VNI] = 0xffffff,
+	[BENCH_REG_C0] = 0xffffffff,
+};
+
+#define BENCH_OUTER_FIELDS						\
+	((1 << BENCH_SMAC) | (1 << BENCH_DMAC) | (1 << BENCH_ETHERTYPE) |	\
+	 (1 << BENCH_VID) | (1 << BENCH_SRC_IP) | (1 << BENCH_DST_IP) |	\
+	 (1 << BENCH_IP_PROTO) | (1 << BENCH_TTL) |			\
+	 (1 << BENCH_TCP_SPORT) | (1 << BENCH_TCP_DPORT) |		\
+	 (1 << BENCH_UDP_SPORT) | (1 << BENCH_UDP_DPORT))
+#define BENCH_IPV4_FIELDS						\
+	((1 << BENCH_SRC_IP) | (1 << BENCH_DST_IP) |			\
+	 (1 << BENCH_IP_PROTO) | (1 << BENCH_TTL) |			\
+	 (1 << BENCH_TCP_SPORT) | (1 << BENCH_TCP_DPORT) |		\
+	 (1 << BENCH_UDP_SPORT) | (1 << BENCH_UDP_DPORT))
+#define BENCH_MISC_FIELDS ((1 << BENCH_IN_PORT) | (1 << BENCH_VNI))
+#define BENCH_MISC2_FIELDS (1 << BENCH_REG_C0)
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* xorshift64*, so generated rulesets do not depend on the libc */
+static uint64_t bench_rand(uint64_t *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static int parse_mac(const char *str, uint8_t *mac)
+{
+	char end;
+
+	if (sscanf(str, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx%c", &mac[0], &mac[1],
+		   &mac[2], &mac[3], &mac[4], &mac[5], &end) != 6)
+		return EINVAL;
+
+	return 0;
+}
+
+static int parse_ipv4(const char *str, uint64_t *addr, uint8_t *plen)
+{
+	char buf[INET_ADDRSTRLEN];
+	struct in_addr in;
+	const char *slash;
+	unsigned long len = 32;
+	char *end;
+
+	slash = strchr(str, '/');
+	if (slash) {
+		len = strtoul(slash + 1, &end, 10);
+		if (*end || !len || len > 32)
+			return EINVAL;
+	} else {
+		slash = str + strlen(str);
+	}
+
+	if (slash - str >= sizeof(buf))
+		return EINVAL;
+	memcpy(buf, str, slash - str);
+	buf[slash - str] = 0;
+
+	if (inet_pton(AF_INET, buf, &in) != 1)
+		return EINVAL;
+
+	*plen = len;
+	*addr = ntohl(in.s_addr) & (0xffffffffULL << (32 - len));
+
+	return 0;
+}
+
+static int parse_num(const char *str, uint64_t max, uint64_t *val)
+{
+	char *end;
+
+	errno = 0;
+	*val = strtoull(str, &end, 0);
+	if (errno || end == str || *end || *val > max)
+		return EINVAL;
+
+	return 0;
+}
+
+static int parse_action(const char *str, struct bench_rule *rule)
+{
+	uint64_t val;
+
+	if (!strcmp(str, "drop")) {
+		rule->action = BENCH_ACTION_DROP;
+		return 0;
+	}
+
+	if (!strncmp(str, "goto:", 5)) {
+		if (parse_num(str + 5, BENCH_MAX_LEVEL, &val) || !val)
+			return EINVAL;
+		rule->action = BENCH_ACTION_GOTO;
+		rule->action_arg = val;
+		return 0;
+	}
+
+	if (!strncmp(str, "vport:", 6)) {
+		if (parse_num(str + 6, UINT16_MAX, &val))
+			return EINVAL;
+		rule->action = BENCH_ACTION_VPORT;
+		rule->action_arg = val;
+		return 0;
+	}
+
+	return EINVAL;
+}
+
+static int parse_token(char *token, struct bench_rule *rule)
+{
+	uint64_t val;
+	char *value;
+	int i;
+
+	value = strchr(token, '=');
+	if (!value)
+		return EINVAL;
+	*value++ = 0;
+
+	if (!strcmp(token, "table")) {
+		if (parse_num(value, BENCH_MAX_LEVEL, &val) || !val)
+			return EINVAL;
+		rule->table = val;
+		return 0;
+	}
+
+	if (!strcmp(token, "prio")) {
+		if (parse_num(value, UINT16_MAX, &val))
+			return EINVAL;
+		rule->prio = val;
+		return 0;
+	}
+
+	if (!strcmp(token, "action"))
+		return parse_action(value, rule);
+
+	for (i = 0; i < BENCH_NUM_FIELDS; i++)
+		if (!strcmp(token, field_names[i]))
+			break;
+
+	if (i == BENCH_NUM_FIELDS || rule->fields & (1 << i))
+		return EINVAL;
+
+	rule->fields |= 1 << i;
+
+	switch (i) {
+	case BENCH_SMAC:
+		return parse_mac(value, rule->smac);
+	case BENCH_DMAC:
+		return parse_mac(value, rule->dmac);
+	case BENCH_SRC_IP:
+		return parse_ipv4(value, &rule->val[i], &rule->src_plen);
+	case BENCH_DST_IP:
+		return parse_ipv4(value, &rule->val[i], &rule->dst_plen);
+	default:
+		return parse_num(value, field_max[i], &rule->val[i]);
+	}
+}
+
+static int parse_line(char *line, struct bench_rule *rule)
+{
+	char *token, *save;
+
+	memset(rule, 0, sizeof(*rule));
+	rule->table = 1;
+
+	token = strtok_r(line, " \t\n", &save);
+	if (!token || strcmp(token, "rule"))
+		return EINVAL;
+
+	while ((token = strtok_r(NULL, " \t\n", &save)))
+		if (parse_token(token, rule))
+			return EINVAL;
+
+	if (!rule->fields)
+		return EINVAL;
+
+	if (rule->action == BENCH_ACTION_GOTO &&
+	    rule->action_arg <= rule->table)
+		return EINVAL;
+
+	return 0;
+}
+
+static int add_rule(struct bench *b, const struct bench_rule *rule)
+{
+	struct bench_rule *rules;
+
+	if (!(b->num_rules & (b->num_rules + 1)) || !b->rules) {
+		rules = realloc(b->rules, ((b->num_rules + 1) * 2) *
+				sizeof(*rules));
+		if (!rules)
+			return ENOMEM;
+		b->rules = rules;
+	}
+
+	b->rules[b->num_rules++] = *rule;
+
+	return 0;
+}
+
+static int load_ruleset(struct bench *b, const char *path)
+{
+	struct bench_rule rule;
+	unsigned int lineno = 0;
+	size_t len = 0;
+	char *line = NULL;
+	FILE *f;
+	int ret = 0;
+
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "Couldn't open %s: %s\n", path,
+			strerror(errno));
+		return errno;
+	}
+
+	while (getline(&line, &len, f) != -1) {
+		char *p = line;
+
+		lineno++;
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (*p == '#' || *p == '\n' || !*p)
+			continue;
+
+		ret = parse_line(p, &rule);
+		if (ret) {
+			fprintf(stderr, "%s:%u: invalid rule\n", path, lineno);
+			break;
+		}
+
+		ret = add_rule(b, &rule);
+		if (ret)
+			break;
+	}
+
+	free(line);
+	fclose(f);
+	return ret;
+}
+
+static int generate_ruleset(struct bench *b, uint32_t num, uint64_t seed)
+{
+	uint64_t state = seed ? seed : 1;
+	struct bench_rule rule;
+	uint32_t i;
+	int ret;
+
+	for (i = 0; i < num; i++) {
+		memset(&rule, 0, sizeof(rule));
+		rule.table = 1;
+		/* One matcher per thread */
+		rule.prio = i % b->threads;
+		rule.fields = (1 << BENCH_SRC_IP) | (1 << BENCH_DST_IP) |
+			      (1 << BENCH_IP_PROTO) | (1 << BENCH_TCP_SPORT) |
+			      (1 << BENCH_TCP_DPORT);
+		rule.src_plen = 32;
+		rule.dst_plen = 32;
+		rule.val[BENCH_SRC_IP] = 0x0a000000 |
+					 (bench_rand(&state) & 0xffffff);
+		rule.val[BENCH_DST_IP] = 0x0a000000 |
+					 (bench_rand(&state) & 0xffffff);
+		rule.val[BENCH_IP_PROTO] = IPPROTO_TCP;
+		rule.val[BENCH_TCP_SPORT] = bench_rand(&state) & 0xffff;
+		rule.val[BENCH_TCP_DPORT] = bench_rand(&state) & 0xffff;
+
+		if (b->num_vports) {
+			rule.action = BENCH_ACTION_VPORT;
+			rule.action_arg = bench_rand(&state) % b->num_vports;
+		}
+
+		ret = add_rule(b, &rule);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static void print_ipv4(FILE *f, uint64_t addr, uint8_t plen)
+{
+	fprintf(f, "%u.%u.%u.%u", (unsigned int)(addr >> 24) & 0xff,
+		(unsigned int)(addr >> 16) & 0xff,
+		(unsigned int)(addr >> 8) & 0xff, (unsigned int)addr & 0xff);
+	if (plen != 32)
+		fprintf(f, "/%u", plen);
+}
+
+static void print_mac(FILE *f, const uint8_t *mac)
+{
+	fprintf(f, "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2],
+		mac[3], mac[4], mac[5]);
+}
+
+static int save_ruleset(struct bench *b, const char *path)
+{
+	struct bench_rule *rule;
+	uint32_t i;
+	FILE *f;
+	int j;
+
+	f = fopen(path, "w");
+	if (!f) {
+		fprintf(stderr, "Couldn't open %s: %s\n", path,
+			strerror(errno));
+		return errno;
+	}
+
+	fprintf(f, "# mlx5_dr_bench ruleset, %u rules\n", b->num_rules);
+
+	for (i = 0; i < b->num_rules; i++) {
+		rule = &b->rules[i];
+		fprintf(f, "rule table=%u prio=%u", rule->table, rule->prio);
+
+		for (j = 0; j < BENCH_NUM_FIELDS; j++) {
+			if (!(rule->fields & (1 << j)))
+				continue;
+
+			fprintf(f, " %s=", field_names[j]);
+			switch (j) {
+			case BENCH_SMAC:
+				print_mac(f, rule->smac);
+				break;
+			case BENCH_DMAC:
+				print_mac(f, rule->dmac);
+				break;
+			case BENCH_SRC_IP:
+				print_ipv4(f, rule->val[j], rule->src_plen);
+				break;
+			case BENCH_DST_IP:
+				print_ipv4(f, rule->val[j], rule->dst_plen);
+				break;
+			default:
+				fprintf(f, "0x%" PRIx64, rule->val[j]);
+				break;
+			}
+		}
+
+		switch (rule->action) {
+		case BENCH_ACTION_DROP:
+			fprintf(f, " action=drop\n");
+			break;
+		case BENCH_ACTION_GOTO:
+			fprintf(f, " action=goto:%u\n", rule->action_arg);
+			break;
+		case BENCH_ACTION_VPORT:
+			fprintf(f, " action=vport:%u\n", rule->action_arg);
+			break;
+		}
+	}
+
+	if (fclose(f)) {
+		fprintf(stderr, "Couldn't write %s: %s\n", path,
+			strerror(errno));
+		return errno;
+	}
+
+	return 0;
+}
+
+/* Fill a match parameter buffer in device format, mask when value is NULL */
+static uint8_t rule_to_param(const struct bench_rule *rule,
+			     const struct bench_rule *value,
+			     struct mlx5dv_flow_match_parameters *param)
+{
+	uint8_t *outer = (uint8_t *)param->match_buf;
+	uint8_t *misc = outer + sizeof(struct dr_match_spec);
+	uint8_t *misc2 = misc + sizeof(struct dr_match_misc) +
+			 sizeof(struct dr_match_spec);
+	const uint64_t *val = value ? value->val : NULL;
+	uint8_t criteria = 0;
+	const uint8_t *mac;
+	uint32_t fields = rule->fields;
+
+#define FIELD_VAL(_f) (val ? val[_f] : field_max[_f])
+	memset(param->match_buf, 0, sizeof(struct dr_match_param));
+	param->match_sz = sizeof(struct dr_match_param);
+
+	if (fields & (1 << BENCH_SMAC)) {
+		mac = value ? value->smac : (const uint8_t [6]){
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+		DEVX_SET(dr_match_spec, outer, smac_47_16,
+			 mac[0] << 24 | mac[1] << 16 | mac[2] << 8 | mac[3]);
+		DEVX_SET(dr_match_spec, outer, smac_15_0, mac[4] << 8 | mac[5]);
+	}
+
+	if (fields & (1 << BENCH_DMAC)) {
+		mac = value ? value->dmac : (const uint8_t [6]){
+			0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+		DEVX_SET(dr_match_spec, outer, dmac_47_16,
+			 mac[0] << 24 | mac[1] << 16 | mac[2] << 8 | mac[3]);
+		DEVX_SET(dr_match_spec, outer, dmac_15_0, mac[4] << 8 | mac[5]);
+	}
+
+	if (fields & (1 << BENCH_ETHERTYPE))
+		DEVX_SET(dr_match_spec, outer, ethertype,
+			 FIELD_VAL(BENCH_ETHERTYPE));
+
+	if (fields & (1 << BENCH_VID)) {
+		DEVX_SET(dr_match_spec, outer, cvlan_tag, 1);
+		DEVX_SET(dr_match_spec, outer, first_vid, FIELD_VAL(BENCH_VID));
+	}
+
+	/* The IPv4 STE builders need ip_version 4 in both mask and value */
+	if (fields & BENCH_IPV4_FIELDS)
+		DEVX_SET(dr_match_spec, outer, ip_version, 4);
+
+	if (fields & (1 << BENCH_SRC_IP))
+		DEVX_SET(dr_match_spec, outer, src_ip_31_0,
+			 val ? val[BENCH_SRC_IP] :
+			 0xffffffffULL << (32 - rule->src_plen));
+
+	if (fields & (1 << BENCH_DST_IP))
+		DEVX_SET(dr_match_spec, outer, dst_ip_31_0,
+			 val ? val[BENCH_DST_IP] :
+			 0xffffffffULL << (32 - rule->dst_plen));
+
+	if (fields & (1 << BENCH_IP_PROTO))
+		DEVX_SET(dr_match_spec, outer, ip_protocol,
+			 FIELD_VAL(BENCH_IP_PROTO));
+
+	if (fields & (1 << BENCH_TTL))
+		DEVX_SET(dr_match_spec, outer, ip_ttl_hoplimit,
+			 FIELD_VAL(BENCH_TTL));
+
+	if (fields & (1 << BENCH_TCP_SPORT))
+		DEVX_SET(dr_match_spec, outer, tcp_sport,
+			 FIELD_VAL(BENCH_TCP_SPORT));
+
+	if (fields & (1 << BENCH_TCP_DPORT))
+		DEVX_SET(dr_match_spec, outer, tcp_dport,
+			 FIELD_VAL(BENCH_TCP_DPORT));
+
+	if (fields & (1 << BENCH_UDP_SPORT))
+		DEVX_SET(dr_match_spec, outer, udp_sport,
+			 FIELD_VAL(BENCH_UDP_SPORT));
+
+	if (fields & (1 << BENCH_UDP_DPORT))
+		DEVX_SET(dr_match_spec, outer, udp_dport,
+			 FIELD_VAL(BENCH_UDP_DPORT));
+
+	if (fields & (1 << BENCH_IN_PORT))
+		DEVX_SET(dr_match_set_misc, misc, source_port,
+			 FIELD_VAL(BENCH_IN_PORT));
+
+	if (fields & (1 << BENCH_VNI))
+		DEVX_SET(dr_match_set_misc, misc, vxlan_vni,
+			 FIELD_VAL(BENCH_VNI));
+
+	if (fields & (1 << BENCH_REG_C0))
+		DEVX_SET(dr_match_set_misc2, misc2, metadata_reg_c_0,
+			 FIELD_VAL(BENCH_REG_C0));
+#undef FIELD_VAL
+
+	if (fields & BENCH_OUTER_FIELDS)
+		criteria |= DR_MATCHER_CRITERIA_OUTER;
+	if (fields & BENCH_MISC_FIELDS)
+		criteria |= DR_MATCHER_CRITERIA_MISC;
+	if (fields & BENCH_MISC2_FIELDS)
+		criteria |= DR_MATCHER_CRITERIA_MISC2;
+
+	return criteria;
+}
+
+static struct mlx5dv_dr_table *get_table(struct bench *b, uint32_t level)
+{
+	if (!b->tables[level]) {
+		b->tables[level] = mlx5dv_dr_table_create(b->dmn, level);
+		if (!b->tables[level])
+			fprintf(stderr, "Couldn't create table %u: %s\n", level,
+				strerror(errno));
+	}
+
+	return b->tables[level];
+}
+
+static struct mlx5dv_dr_action *get_action(struct bench *b,
+					   const struct bench_rule *rule)
+{
+	struct mlx5dv_dr_action **action;
+	struct mlx5dv_dr_table *tbl;
+
+	switch (rule->action) {
+	case BENCH_ACTION_GOTO:
+		action = &b->goto_actions[rule->action_arg];
+		if (!*action) {
+			tbl = get_table(b, rule->action_arg);
+			if (!tbl)
+				return NULL;
+			*action = mlx5dv_dr_action_create_dest_table(tbl);
+		}
+		break;
+	case BENCH_ACTION_VPORT:
+		if (rule->action_arg >= b->num_vports) {
+			errno = EINVAL;
+			return NULL;
+		}
+		action = &b->vport_actions[rule->action_arg];
+		if (!*action)
+			*action = mlx5dv_dr_action_create_dest_vport(b->dmn,
+							rule->action_arg);
+		break;
+	default:
+		action = &b->drop_action;
+		if (!*action)
+			*action = mlx5dv_dr_action_create_drop();
+		break;
+	}
+
+	return *action;
+}
+
+static struct bench_matcher *get_matcher(struct bench *b,
+					 const struct bench_rule *rule,
+					 struct mlx5dv_flow_match_parameters *mask)
+{
+	struct bench_matcher *matcher, **matchers;
+	struct mlx5dv_dr_table *tbl;
+	uint8_t criteria;
+	uint32_t i;
+
+	for (i = 0; i < b->num_matchers; i++) {
+		matcher = b->matchers[i];
+		if (matcher->fields == rule->fields &&
+		    matcher->table == rule->table &&
+		    matcher->prio == rule->prio &&
+		    matcher->src_plen == rule->src_plen &&
+		    matcher->dst_plen == rule->dst_plen)
+			return matcher;
+	}
+
+	tbl = get_table(b, rule->table);
+	if (!tbl)
+		return NULL;
+
+	matchers = realloc(b->matchers,
+			   (b->num_matchers + 1) * sizeof(*matchers));
+	if (!matchers)
+		return NULL;
+	b->matchers = matchers;
+
+	matcher = calloc(1, sizeof(*matcher));
+	if (!matcher)
+		return NULL;
+	matcher->fields = rule->fields;
+	matcher->table = rule->table;
+	matcher->prio = rule->prio;
+	matcher->src_plen = rule->src_plen;
+	matcher->dst_plen = rule->dst_plen;
+	matcher->worker = b->num_matchers % b->threads;
+
+	criteria = rule_to_param(rule, NULL, mask);
+	matcher->dr_matcher = mlx5dv_dr_matcher_create(tbl, rule->prio,
+						       criteria, mask);
+	if (!matcher->dr_matcher) {
+		fprintf(stderr, "Couldn't create matcher: %s\n",
+			strerror(errno));
+		free(matcher);
+		return NULL;
+	}
+
+	b->matchers[b->num_matchers++] = matcher;
+	return matcher;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Number of rules from first that can go in one bulk call */
+static uint32_t batch_len(struct bench *b, uint32_t first)
+{
+	uint32_t n = 1;
+
+	while (n < b->batch && first + n < b->num_rules &&
+	       b->rules[first + n].matcher == b->rules[first].matcher)
+		n++;
+
+	return n;
+}
+
+static void *insert_worker(void *arg)
+{
+	size_t param_sz = align(sizeof(struct mlx5dv_flow_match_parameters) +
+				sizeof(struct dr_match_param), 8);
+	struct bench_worker *w = arg;
+	struct bench *b = w->b;
+	struct mlx5dv_flow_match_parameters *param;
+	struct mlx5dv_dr_action **actions = NULL;
+	struct mlx5dv_dr_rule_attr *attr = NULL;
+	struct mlx5dv_dr_rule **dr_rules = NULL;
+	uint32_t batch = b->batch ? b->batch : 1;
+	struct bench_rule *rule;
+	uint64_t start, end;
+	uint8_t *params;
+	uint32_t i, j, n;
+
+	params = calloc(batch, param_sz);
+	actions = calloc(batch, sizeof(*actions));
+	attr = calloc(batch, sizeof(*attr));
+	dr_rules = calloc(batch, sizeof(*dr_rules));
+	if (!params || !actions || !attr || !dr_rules) {
+		w->ret = ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < b->num_rules; i += n) {
+		n = batch_len(b, i);
+		rule = &b->rules[i];
+		if (rule->matcher->worker != w->id)
+			continue;
+
+		for (j = 0; j < n; j++) {
+			rule = &b->rules[i + j];
+			param = (struct mlx5dv_flow_match_parameters *)
+				(params + j * param_sz);
+			rule_to_param(rule, rule, param);
+			actions[j] = get_action(b, rule);
+			attr[j].value = param;
+			attr[j].num_actions = 1;
+			attr[j].actions = &actions[j];
+		}
+
+		rule = &b->rules[i];
+		start = now_ns();
+		if (b->batch) {
+			w->ret = mlx5dv_dr_rule_create_bulk(rule->matcher->dr_matcher,
+							    n, attr, dr_rules);
+		} else {
+			dr_rules[0] = mlx5dv_dr_rule_create(rule->matcher->dr_matcher,
+							    attr[0].value, 1,
+							    attr[0].actions);
+			w->ret = dr_rules[0] ? 0 : errno;
+		}
+		end = now_ns();
+		if (w->ret) {
+			fprintf(stderr, "Rule %u: insertion failed: %s\n", i,
+				strerror(w->ret));
+			goto out;
+		}
+
+		rule->matcher->num_rules += n;
+		for (j = 0; j < n; j++) {
+			b->rules[i + j].dr_rule = dr_rules[j];
+			w->lat[i + j] = (end - start) / n;
+		}
+	}
+
+out:
+	free(dr_rules);
+	free(attr);
+	free(actions);
+	free(params);
+	return NULL;
+}
+
+static int insert_rules(struct bench *b)
+{
+	size_t param_sz = align(sizeof(struct mlx5dv_flow_match_parameters) +
+				sizeof(struct dr_match_param), 8);
+	struct mlx5dv_flow_match_parameters *param;
+	struct bench_worker *workers;
+	uint64_t start, end, sum = 0;
+	struct bench_rule *rule;
+	uint64_t *lat;
+	uint32_t i;
+	int ret = 0;
+
+	param = calloc(1, param_sz);
+	lat = calloc(b->num_rules, sizeof(*lat));
+	workers = calloc(b->threads, sizeof(*workers));
+	if (!param || !lat || !workers) {
+		ret = ENOMEM;
+		goto out;
+	}
+
+	/* Tables, matchers and actions are set up outside the timed loop */
+	for (i = 0; i < b->num_rules; i++) {
+		rule = &b->rules[i];
+		rule->matcher = get_matcher(b, rule, param);
+		if (!rule->matcher || !get_action(b, rule)) {
+			ret = errno ? errno : EINVAL;
+			fprintf(stderr, "Rule %u: couldn't set up matcher or action\n",
+				i);
+			goto out;
+		}
+	}
+
+	start = now_ns();
+	for (i = 0; i < b->threads; i++) {
+		workers[i].b = b;
+		workers[i].id = i;
+		workers[i].lat = lat;
+		if (b->threads == 1) {
+			insert_worker(&workers[i]);
+			continue;
+		}
+
+		ret = pthread_create(&workers[i].thread, NULL, insert_worker,
+				     &workers[i]);
+		if (ret) {
+			fprintf(stderr, "Couldn't create thread: %s\n",
+				strerror(ret));
+			b->threads = i;
+			break;
+		}
+	}
+
+	for (i = 0; i < b->threads; i++) {
+		if (b->threads > 1)
+			pthread_join(workers[i].thread, NULL);
+		if (workers[i].ret && !ret)
+			ret = workers[i].ret;
+	}
+	end = now_ns();
+	if (ret)
+		goto out;
+
+	for (i = 0; i < b->num_rules; i++)
+		sum += lat[i];
+
+	qsort(lat, b->num_rules, sizeof(*lat), cmp_u64);
+
+	printf("Inserted %u rules in %u matchers", b->num_rules,
+	       b->num_matchers);
+	if (b->batch)
+		printf(", batches of up to %u", b->batch);
+	if (b->threads > 1)
+		printf(", %u threads", b->threads);
+	printf("\n");
+	if (b->num_rules)
+		printf("  %.0f rules/sec, latency ns: avg %" PRIu64
+		       " p50 %" PRIu64 " p99 %" PRIu64 " max %" PRIu64 "\n",
+		       end > start ? b->num_rules * 1e9 / (end - start) : 0.0,
+		       sum / b->num_rules, lat[b->num_rules / 2],
+		       lat[(uint64_t)b->num_rules * 99 / 100],
+		       lat[b->num_rules - 1]);
+
+out:
+	free(workers);
+	free(lat);
+	free(param);
+	return ret;
+}
+
+static void check_ste_icm(struct bench *b, struct dr_ste *ste)
+{
+	uint8_t *icm;
+
+	icm = dr_fake_icm_ptr(b->ctx, dr_ste_get_icm_addr(ste), DR_STE_SIZE);
+	if (!icm || memcmp(icm, ste->hw_ste, DR_STE_SIZE_REDUCED))
+		b->icm_mismatch++;
+}
+
+static void account_htbl(struct bench_level_stats *ls,
+			 struct dr_ste_htbl *htbl)
+{
+	uint32_t entries = htbl->chunk->num_of_entries;
+
+	ls->icm_bytes += htbl->chunk->byte_size;
+	ls->host_bytes += entries * (sizeof(struct dr_ste) +
+				     DR_STE_SIZE_REDUCED +
+				     sizeof(struct list_head));
+}
+
+static void walk_htbl(struct bench *b, struct dr_ste_htbl *htbl,
+		      unsigned int depth)
+{
+	struct bench_level_stats *ls;
+	struct dr_ste *ste, *tmp;
+	uint64_t chain;
+	uint32_t i;
+
+	if (depth >= BENCH_MAX_DEPTH)
+		return;
+
+	ls = &b->levels[depth];
+	ls->tables++;
+	ls->slots += htbl->chunk->num_of_entries;
+	account_htbl(ls, htbl);
+
+	for (i = 0; i < htbl->chunk->num_of_entries; i++) {
+		ste = &htbl->ste_arr[i];
+		if (dr_ste_not_used_ste(ste))
+			continue;
+
+		ls->used++;
+		chain = 0;
+		list_for_each(dr_ste_get_miss_list(ste), tmp, miss_list_node) {
+			chain++;
+			if (tmp->htbl != htbl) {
+				ls->collision_tables++;
+				account_htbl(ls, tmp->htbl);
+			}
+
+			if (b->check)
+				check_ste_icm(b, tmp);
+
+			if (tmp->next_htbl)
+				walk_htbl(b, tmp->next_htbl, depth + 1);
+		}
+
+		ls->stes += chain;
+		if (chain > ls->max_chain)
+			ls->max_chain = chain;
+	}
+}
+
+static void report_matchers(struct bench *b)
+{
+	struct bench_level_stats *ls;
+	struct mlx5dv_dr_matcher *m;
+	uint64_t icm_bytes = 0, host_bytes = 0;
+	uint32_t i, j;
+
+	for (i = 0; i < b->num_matchers; i++) {
+		m = b->matchers[i]->dr_matcher;
+
+		printf("Matcher %u: table %u prio %u rules %u STE chain:", i,
+		       b->matchers[i]->table, b->matchers[i]->prio,
+		       b->matchers[i]->num_rules);
+		for (j = 0; j < m->rx.num_of_builders; j++)
+			printf(" 0x%02x", m->rx.ste_builder[j].lu_type);
+		printf("\n");
+
+		walk_htbl(b, m->rx.s_htbl, 0);
+		walk_htbl(b, m->tx.s_htbl, 0);
+	}
+
+	printf("\nHash tables by STE depth (RX and TX):\n");
+	printf("%5s %8s %10s %10s %10s %8s %6s %6s\n", "depth", "tables",
+	       "slots", "used", "stes", "coll_tbl", "load%", "chain");
+	for (i = 0; i < BENCH_MAX_DEPTH; i++) {
+		ls = &b->levels[i];
+		if (!ls->tables)
+			continue;
+
+		printf("%5u %8" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+		       " %8" PRIu64 " %6.1f %6" PRIu64 "\n", i, ls->tables,
+		       ls->slots, ls->used, ls->stes, ls->collision_tables,
+		       ls->slots ? 100.0 * ls->used / ls->slots : 0.0,
+		       ls->max_chain);
+		icm_bytes += ls->icm_bytes;
+		host_bytes += ls->host_bytes;
+	}
+
+	printf("\nMemory:\n");
+	printf("  rule hash tables: %" PRIu64 " bytes ICM, %" PRIu64
+	       " bytes host shadow\n", icm_bytes, host_bytes);
+}
+
+static void report_device(struct bench *b)
+{
+	struct dr_fake_stats *stats = dr_fake_get_stats(b->ctx);
+
+	printf("  device memory: %" PRIu64 " bytes ICM in %u allocations\n",
+	       stats->icm_alloc_bytes, stats->icm_alloc_count);
+	printf("  ICM writes: %" PRIu64 " posts, %" PRIu64 " bytes, %" PRIu64
+	       " doorbells, %" PRIu64 " steering syncs\n", stats->icm_writes,
+	       stats->icm_write_bytes, stats->doorbells, stats->sync_steering);
+
+	if (b->check)
+		printf("  ICM check: %" PRIu64 " STEs differ from the shadow copy\n",
+		       b->icm_mismatch);
+}
+
+static void remove_rules(struct bench *b)
+{
+	struct mlx5dv_dr_rule **dr_rules;
+	uint32_t batch = b->batch ? b->batch : 1;
+	uint64_t start, end;
+	uint32_t i, j, n;
+
+	dr_rules = calloc(batch, sizeof(*dr_rules));
+	if (!dr_rules)
+		return;
+
+	start = now_ns();
+	for (i = 0; i < b->num_rules; i += n) {
+		for (n = 0; n < batch && i + n < b->num_rules; n++)
+			dr_rules[n] = b->rules[i + n].dr_rule;
+
+		if (b->batch) {
+			if (mlx5dv_dr_rule_destroy_bulk(n, dr_rules))
+				break;
+		} else if (mlx5dv_dr_rule_destroy(dr_rules[0])) {
+			break;
+		}
+
+		for (j = 0; j < n; j++)
+			b->rules[i + j].dr_rule = NULL;
+	}
+	end = now_ns();
+
+	if (i < b->num_rules)
+		fprintf(stderr, "Rule %u: removal failed: %s\n", i,
+			strerror(errno));
+	else if (b->num_rules)
+		printf("\nRemoved %u rules, %.0f rules/sec\n", b->num_rules,
+		       end > start ? b->num_rules * 1e9 / (end - start) : 0.0);
+
+	free(dr_rules);
+}
+
+static void cleanup(struct bench *b)
+{
+	uint32_t i;
+
+	for (i = 0; i < b->num_matchers; i++) {
+		mlx5dv_dr_matcher_destroy(b->matchers[i]->dr_matcher);
+		free(b->matchers[i]);
+	}
+
+	for (i = 0; i <= BENCH_MAX_LEVEL; i++)
+		if (b->goto_actions[i])
+			mlx5dv_dr_action_destroy(b->goto_actions[i]);
+
+	for (i = 0; i < b->num_vports; i++)
+		if (b->vport_actions[i])
+			mlx5dv_dr_action_destroy(b->vport_actions[i]);
+
+	if (b->drop_action)
+		mlx5dv_dr_action_destroy(b->drop_action);
+
+	for (i = 0; i <= BENCH_MAX_LEVEL; i++)
+		if (b->tables[i])
+			mlx5dv_dr_table_destroy(b->tables[i]);
+
+	if (b->dmn)
+		mlx5dv_dr_domain_destroy(b->dmn);
+	if (b->ctx)
+		dr_fake_close(b->ctx);
+
+	free(b->vport_actions);
+	free(b->matchers);
+	free(b->rules);
+}
+
+static void usage(const char *argv0)
+{
+	printf("Usage: %s [options]\n", argv0);
+	printf("\n");
+	printf("Options:\n");
+	printf("  -f, --file=<path>      replay the ruleset in <path>\n");
+	printf("  -g, --generate=<n>     generate <n> random IPv4 5-tuple rules\n");
+	printf("  -s, --seed=<seed>      seed for --generate (default 1)\n");
+	printf("  -o, --output=<path>    write the ruleset to <path>\n");
+	printf("  -l, --log-icm=<log>    log2 of the biggest hash table (default 20)\n");
+	printf("  -p, --vports=<n>       number of eswitch vports (default 4)\n");
+	printf("  -b, --batch=<n>        use the bulk rule calls, <n> rules per call\n");
+	printf("  -t, --threads=<n>      insert from <n> threads, one send ring each\n");
+	printf("  -c, --check            compare the fake ICM with the STE shadow copy\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct dr_fake_attr attr = {
+		.log_icm_size = DR_CHUNK_SIZE_1024K,
+		.num_vports = 4,
+	};
+	const char *in_path = NULL, *out_path = NULL;
+	struct bench b = { .threads = 1 };
+	uint32_t generate = 0;
+	uint64_t seed = 1;
+	int ret;
+
+	while (1) {
+		static const struct option long_options[] = {
+			{ .name = "file",     .has_arg = 1, .val = 'f' },
+			{ .name = "generate", .has_arg = 1, .val = 'g' },
+			{ .name = "seed",     .has_arg = 1, .val = 's' },
+			{ .name = "output",   .has_arg = 1, .val = 'o' },
+			{ .name = "log-icm",  .has_arg = 1, .val = 'l' },
+			{ .name = "vports",   .has_arg = 1, .val = 'p' },
+			{ .name = "batch",    .has_arg = 1, .val = 'b' },
+			{ .name = "threads",  .has_arg = 1, .val = 't' },
+			{ .name = "check",    .has_arg = 0, .val = 'c' },
+			{ .name = "help",     .has_arg = 0, .val = 'h' },
+			{}
+		};
+		int c;
+
+		c = getopt_long(argc, argv, "f:g:s:o:l:p:b:t:ch", long_options,
+				NULL);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'f':
+			in_path = optarg;
+			break;
+		case 'g':
+			generate = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		case 'l':
+			attr.log_icm_size = strtoul(optarg, NULL, 0);
+			if (attr.log_icm_size < DR_CHUNK_SIZE_1K ||
+			    attr.log_icm_size > DR_CHUNK_SIZE_1024K) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'p':
+			attr.num_vports = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			b.batch = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			b.threads = strtoul(optarg, NULL, 0);
+			if (!b.threads || b.threads > DR_MAX_SEND_RINGS) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'c':
+			b.check = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc || (!in_path && !generate)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	b.num_vports = attr.num_vports;
+	b.vport_actions = calloc(b.num_vports + 1, sizeof(*b.vport_actions));
+	if (!b.vport_actions)
+		return 1;
+
+	ret = in_path ? load_ruleset(&b, in_path) :
+			generate_ruleset(&b, generate, seed);
+	if (ret)
+		goto out;
+
+	if (out_path) {
+		ret = save_ruleset(&b, out_path);
+		if (ret)
+			goto out;
+	}
+
+	b.ctx = dr_fake_open(&attr);
+	if (!b.ctx) {
+		ret = errno;
+		goto out;
+	}
+
+	b.dmn = mlx5dv_dr_domain_create(b.ctx, MLX5DV_DR_DOMAIN_TYPE_FDB);
+	if (!b.dmn) {
+		ret = errno;
+		fprintf(stderr, "Couldn't create domain: %s\n", strerror(errno));
+		goto out;
+	}
+
+	if (b.threads > 1) {
+		ret = mlx5dv_dr_domain_set_send_rings(b.dmn, b.threads);
+		if (ret) {
+			fprintf(stderr, "Couldn't set send rings: %s\n",
+				strerror(ret));
+			goto out;
+		}
+	}
+
+	ret = insert_rules(&b);
+	if (ret)
+		goto out;
+
+	report_matchers(&b);
+	report_device(&b);
+	remove_rules(&b);
+
+	if (b.icm_mismatch)
+		ret = EIO;
+out:
+	cleanup(&b);
+	return ret ? 1 : 0;
+}
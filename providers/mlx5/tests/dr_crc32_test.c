@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2019, Mellanox Technologies. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *	Redistribution and use in source and binary forms, with or
+ *	without modification, are permitted provided that the following
+ *	conditions are met:
+ *
+ *	- Redistributions of source code must retain the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer.
+ *
+ *	- Redistributions in binary form must reproduce the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer in the documentation and/or other materials
+ *	  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/*
+ * Checks that dr_crc32_calc(), which may use CPU CRC support, is bit exact
+ * with the slicing-by-8 tables and a bitwise reference, then times both on
+ * the STE tag size used for hash table lookups.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../mlx5dv_dr.h"
+
+#define CRC_TEST_MAX_LEN	1024
+#define CRC_TEST_ITERS		10000000
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static uint32_t crc32_bitwise(const uint8_t *data, size_t length)
+{
+	uint32_t crc = 0;
+	int i;
+
+	while (length--) {
+		crc ^= *data++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+
+	return ((crc>>24) & 0xff) | ((crc<<8) & 0xff0000) |
+		((crc>>8) & 0xff00) | ((crc<<24) & 0xff000000);
+}
+
+static int check(void)
+{
+	static uint8_t buf[CRC_TEST_MAX_LEN + 16];
+	uint32_t ref, table, calc;
+	uint64_t state = 1;
+	unsigned int errors = 0;
+	size_t len, off, i;
+	int round;
+
+	for (round = 0; round < 8; round++) {
+		for (i = 0; i < sizeof(buf); i++)
+			buf[i] = round == 1 ? 0xff : round ? xorshift(&state) : 0;
+
+		for (off = 0; off < 16; off++) {
+			for (len = 0; len <= CRC_TEST_MAX_LEN; len++) {
+				ref = crc32_bitwise(buf + off, len);
+				table = dr_crc32_slice8_calc(buf + off, len);
+				calc = dr_crc32_calc(buf + off, len);
+				if (ref == table && ref == calc)
+					continue;
+
+				if (errors++ < 10)
+					fprintf(stderr,
+						"len %zu off %zu: ref 0x%08x table 0x%08x calc 0x%08x\n",
+						len, off, ref, table, calc);
+			}
+		}
+	}
+
+	return errors;
+}
+
+static void bench(const char *name, uint32_t (*fn)(const void *, size_t),
+		  size_t len)
+{
+	uint8_t buf[64] = {};
+	uint32_t sum = 0;
+	uint64_t start;
+	int i;
+
+	start = now_ns();
+	for (i = 0; i < CRC_TEST_ITERS; i++) {
+		buf[0] = i;
+		sum += fn(buf, len);
+	}
+
+	printf("  %-8s %2zu bytes: %6.2f ns/call (0x%08x)\n", name, len,
+	       (double)(now_ns() - start) / CRC_TEST_ITERS, sum);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int errors;
+
+	dr_crc32_init_table();
+
+	errors = check();
+	printf("CRC32 check: %u mismatches\n", errors);
+
+	printf("CRC32 speed:\n");
+	bench("table", dr_crc32_slice8_calc, DR_STE_SIZE_TAG);
+	bench("selected", dr_crc32_calc, DR_STE_SIZE_TAG);
+	bench("table", dr_crc32_slice8_calc, 64);
+	bench("selected", dr_crc32_calc, 64);
+
+	return errors ? 1 : 0;
+}
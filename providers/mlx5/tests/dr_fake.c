@@ -0,0 +1,725 @@
+/*
+ * Copyright (c) 2019, Mellanox Technologies. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *	Redistribution and use in source and binary forms, with or
+ *	without modification, are permitted provided that the following
+ *	conditions are met:
+ *
+ *	- Redistributions of source code must retain the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer.
+ *
+ *	- Redistributions in binary form must reproduce the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer in the documentation and/or other materials
+ *	  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "dr_fake.h"
+
+/*
+ * Fake ICM lives above 4GB and below the 40 bit limit of the STE next table
+ * and miss addresses. The fixed addresses the device reports for vport
+ * tables and drop/allow actions sit below it so they never alias a table.
+ */
+#define DR_FAKE_ICM_BASE		(1ULL << 32)
+#define DR_FAKE_VPORT_ICM_BASE		0x10000000ULL
+#define DR_FAKE_RX_DROP_ICM_ADDR	0x20000000ULL
+#define DR_FAKE_TX_DROP_ICM_ADDR	0x20001000ULL
+#define DR_FAKE_TX_ALLOW_ICM_ADDR	0x20002000ULL
+#define DR_FAKE_HDR_MODIFY_ICM_ADDR	0x30000000ULL
+#define DR_FAKE_MAX_FT_LEVEL		64
+#define DR_FAKE_POST_SEND_SIZE		(DR_STE_SIZE * 1024)
+/*
+ * dr_send.c drains the queue once 2 * signal_th WQEs (8 write + read pairs)
+ * are outstanding, which is when a batch has to ring its doorbell.
+ */
+#define DR_FAKE_POSTS_PER_DRAIN		8
+
+struct dr_fake_dm {
+	struct mlx5_dm		mdm;
+	struct ibv_mr		mr;
+	uint8_t			*buf;
+};
+
+struct dr_fake_context {
+	struct mlx5_context	mctx;
+	struct ibv_device	device;
+	struct dr_fake_attr	attr;
+	struct dr_fake_stats	stats;
+	uint64_t		next_icm_addr;
+	uint32_t		next_obj_id;
+	/* Indexed by MR key - 1 */
+	struct dr_fake_dm	**dms;
+	uint32_t		num_dms;
+	/* The send rings may post from several threads */
+	pthread_mutex_t		lock;
+};
+
+struct dr_fake_send_ring {
+	struct dr_send_ring	ring;
+	struct dr_fake_context	*fctx;
+	uint32_t		batch;
+	uint32_t		deferred_posts;
+};
+
+static struct dr_fake_context *to_fctx(struct ibv_context *ctx)
+{
+	return container_of(to_mctx(ctx), struct dr_fake_context, mctx);
+}
+
+static struct dr_fake_send_ring *to_fring(struct dr_send_ring *send_ring)
+{
+	return container_of(send_ring, struct dr_fake_send_ring, ring);
+}
+
+static int dr_fake_query_port(struct ibv_context *ctx, uint8_t port_num,
+			      struct ibv_port_attr *port_attr,
+			      size_t port_attr_len)
+{
+	memset(port_attr, 0, port_attr_len);
+	port_attr->state = IBV_PORT_ACTIVE;
+	port_attr->link_layer = IBV_LINK_LAYER_ETHERNET;
+
+	return 0;
+}
+
+static struct ibv_mr *dr_fake_reg_dm_mr(struct ibv_pd *pd, struct ibv_dm *dm,
+					uint64_t dm_offset, size_t length,
+					unsigned int access)
+{
+	struct dr_fake_dm *fdm = container_of(to_mdm(dm), struct dr_fake_dm,
+					      mdm);
+
+	if (!(access & IBV_ACCESS_ZERO_BASED) || dm_offset + length >
+	    fdm->mdm.length) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	fdm->mr.length = length;
+
+	return &fdm->mr;
+}
+
+struct ibv_context *dr_fake_open(const struct dr_fake_attr *attr)
+{
+	struct dr_fake_context *fctx;
+	struct verbs_context *vctx;
+
+	fctx = calloc(1, sizeof(*fctx));
+	if (!fctx) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	fctx->attr = *attr;
+	fctx->next_icm_addr = DR_FAKE_ICM_BASE;
+	pthread_mutex_init(&fctx->lock, NULL);
+	fctx->mctx.dbg_fp = stderr;
+	strcpy(fctx->device.name, "dr_fake");
+
+	vctx = &fctx->mctx.ibv_ctx;
+	vctx->sz = sizeof(*vctx);
+	vctx->query_port = dr_fake_query_port;
+	vctx->reg_dm_mr = dr_fake_reg_dm_mr;
+	vctx->context.device = &fctx->device;
+	vctx->context.abi_compat = __VERBS_ABI_IS_EXTENDED;
+
+	return &vctx->context;
+}
+
+void dr_fake_close(struct ibv_context *ctx)
+{
+	struct dr_fake_context *fctx = to_fctx(ctx);
+
+	free(fctx->dms);
+	pthread_mutex_destroy(&fctx->lock);
+	free(fctx);
+}
+
+struct dr_fake_stats *dr_fake_get_stats(struct ibv_context *ctx)
+{
+	return &to_fctx(ctx)->stats;
+}
+
+void *dr_fake_icm_ptr(struct ibv_context *ctx, uint64_t icm_addr,
+		      size_t length)
+{
+	struct dr_fake_context *fctx = to_fctx(ctx);
+	struct dr_fake_dm *fdm;
+	uint32_t i;
+
+	for (i = 0; i < fctx->num_dms; i++) {
+		fdm = fctx->dms[i];
+		if (!fdm || icm_addr < fdm->mdm.remote_va ||
+		    icm_addr + length > fdm->mdm.remote_va + fdm->mdm.length)
+			continue;
+
+		return fdm->buf + (icm_addr - fdm->mdm.remote_va);
+	}
+
+	return NULL;
+}
+
+/* libibverbs */
+
+const char *ibv_get_device_name(struct ibv_device *device)
+{
+	return device->name;
+}
+
+int ibv_query_device(struct ibv_context *context,
+		     struct ibv_device_attr *device_attr)
+{
+	struct dr_fake_context *fctx = to_fctx(context);
+
+	memset(device_attr, 0, sizeof(*device_attr));
+	strcpy(device_attr->fw_ver, "0.0.0");
+	device_attr->vendor_id = 0x02c9;
+	device_attr->phys_port_cnt = fctx->attr.num_vports + 1;
+
+	return 0;
+}
+
+/* Only reached by contexts without query_port, which the fake always sets */
+int (ibv_query_port)(struct ibv_context *context, uint8_t port_num,
+		     struct _compat_ibv_port_attr *port_attr)
+{
+	return EOPNOTSUPP;
+}
+
+struct ibv_pd *ibv_alloc_pd(struct ibv_context *context)
+{
+	struct ibv_pd *pd;
+
+	pd = calloc(1, sizeof(*pd));
+	if (!pd) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	pd->context = context;
+
+	return pd;
+}
+
+int ibv_dealloc_pd(struct ibv_pd *pd)
+{
+	free(pd);
+	return 0;
+}
+
+int ibv_dereg_mr(struct ibv_mr *mr)
+{
+	/* Only device memory is registered, the MR goes away with the DM */
+	return 0;
+}
+
+/* mlx5 device memory */
+
+struct ibv_dm *mlx5dv_alloc_dm(struct ibv_context *context,
+			       struct ibv_alloc_dm_attr *dm_attr,
+			       struct mlx5dv_alloc_dm_attr *mlx5_dm_attr)
+{
+	struct dr_fake_context *fctx = to_fctx(context);
+	struct dr_fake_dm **dms;
+	struct dr_fake_dm *fdm;
+	uint64_t icm_align;
+
+	fdm = calloc(1, sizeof(*fdm));
+	if (!fdm)
+		goto err;
+
+	fdm->buf = calloc(1, dm_attr->length);
+	if (!fdm->buf)
+		goto err_free_fdm;
+
+	pthread_mutex_lock(&fctx->lock);
+
+	dms = realloc(fctx->dms, (fctx->num_dms + 1) * sizeof(*dms));
+	if (!dms) {
+		pthread_mutex_unlock(&fctx->lock);
+		goto err_free_buf;
+	}
+
+	fctx->dms = dms;
+	fctx->dms[fctx->num_dms++] = fdm;
+
+	/* Hand out naturally aligned ICM like the device allocator */
+	icm_align = roundup_pow_of_two(dm_attr->length);
+	fctx->next_icm_addr = align(fctx->next_icm_addr, icm_align);
+
+	fdm->mdm.verbs_dm.dm.context = context;
+	fdm->mdm.length = dm_attr->length;
+	fdm->mdm.remote_va = fctx->next_icm_addr;
+	fctx->next_icm_addr += dm_attr->length;
+
+	fdm->mr.context = context;
+	fdm->mr.lkey = fctx->num_dms;
+	fdm->mr.rkey = fctx->num_dms;
+
+	fctx->stats.icm_alloc_bytes += dm_attr->length;
+	fctx->stats.icm_alloc_count++;
+
+	pthread_mutex_unlock(&fctx->lock);
+
+	return &fdm->mdm.verbs_dm.dm;
+
+err_free_buf:
+	free(fdm->buf);
+err_free_fdm:
+	free(fdm);
+err:
+	errno = ENOMEM;
+	return NULL;
+}
+
+int mlx5_free_dm(struct ibv_dm *ibdm)
+{
+	struct dr_fake_dm *fdm = container_of(to_mdm(ibdm), struct dr_fake_dm,
+					      mdm);
+	struct dr_fake_context *fctx = to_fctx(ibdm->context);
+
+	pthread_mutex_lock(&fctx->lock);
+	fctx->dms[fdm->mr.rkey - 1] = NULL;
+	fctx->stats.icm_alloc_bytes -= fdm->mdm.length;
+	fctx->stats.icm_alloc_count--;
+	pthread_mutex_unlock(&fctx->lock);
+
+	free(fdm->buf);
+	free(fdm);
+
+	return 0;
+}
+
+/* mlx5 devx */
+
+struct mlx5dv_devx_uar *mlx5dv_devx_alloc_uar(struct ibv_context *context,
+					      uint32_t flags)
+{
+	struct mlx5dv_devx_uar *uar;
+
+	uar = calloc(1, sizeof(*uar));
+	if (!uar)
+		errno = ENOMEM;
+
+	return uar;
+}
+
+void mlx5dv_devx_free_uar(struct mlx5dv_devx_uar *devx_uar)
+{
+	free(devx_uar);
+}
+
+static struct mlx5dv_devx_obj *dr_fake_obj_create(struct ibv_context *ctx)
+{
+	struct mlx5dv_devx_obj *obj;
+
+	obj = calloc(1, sizeof(*obj));
+	if (!obj) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	obj->context = ctx;
+	obj->object_id = ++to_fctx(ctx)->next_obj_id;
+
+	return obj;
+}
+
+int mlx5dv_devx_obj_destroy(struct mlx5dv_devx_obj *obj)
+{
+	free(obj);
+	return 0;
+}
+
+int dr_devx_query_esw_vport_context(struct ibv_context *ctx,
+				    bool other_vport, uint16_t vport_number,
+				    uint64_t *icm_address_rx,
+				    uint64_t *icm_address_tx)
+{
+	*icm_address_rx = DR_FAKE_VPORT_ICM_BASE + vport_number * 0x2000ULL;
+	*icm_address_tx = *icm_address_rx + 0x1000;
+
+	return 0;
+}
+
+int dr_devx_query_gvmi(struct ibv_context *ctx, bool other_vport,
+		       uint16_t vport_number, uint16_t *gvmi)
+{
+	*gvmi = vport_number;
+
+	return 0;
+}
+
+int dr_devx_query_esw_caps(struct ibv_context *ctx, struct dr_esw_caps *caps)
+{
+	uint32_t uplink = to_fctx(ctx)->attr.num_vports;
+
+	caps->drop_icm_address_rx = DR_FAKE_RX_DROP_ICM_ADDR;
+	caps->drop_icm_address_tx = DR_FAKE_TX_DROP_ICM_ADDR;
+	caps->uplink_icm_address_rx = DR_FAKE_VPORT_ICM_BASE + uplink * 0x2000ULL;
+	caps->uplink_icm_address_tx = caps->uplink_icm_address_rx + 0x1000;
+	caps->sw_owner = true;
+
+	return 0;
+}
+
+int dr_devx_query_device(struct ibv_context *ctx, struct dr_devx_caps *caps)
+{
+	caps->eswitch_manager = true;
+	caps->gvmi = 0;
+	caps->flex_protocols = MLX5_FLEX_PARSER_ICMP_V4_ENABLED |
+			       MLX5_FLEX_PARSER_ICMP_V6_ENABLED;
+	caps->flex_parser_id_icmp_dw0 = 0;
+	caps->flex_parser_id_icmp_dw1 = 1;
+	caps->flex_parser_id_icmpv6_dw0 = 2;
+	caps->flex_parser_id_icmpv6_dw1 = 3;
+	caps->nic_rx_drop_address = DR_FAKE_RX_DROP_ICM_ADDR;
+	caps->nic_tx_drop_address = DR_FAKE_TX_DROP_ICM_ADDR;
+	caps->nic_tx_allow_address = DR_FAKE_TX_ALLOW_ICM_ADDR;
+	caps->rx_sw_owner = true;
+	caps->tx_sw_owner = true;
+	caps->max_ft_level = DR_FAKE_MAX_FT_LEVEL;
+	caps->log_icm_size = to_fctx(ctx)->attr.log_icm_size;
+	caps->hdr_modify_icm_addr = DR_FAKE_HDR_MODIFY_ICM_ADDR;
+
+	return 0;
+}
+
+int dr_devx_sync_steering(struct ibv_context *ctx)
+{
+	struct dr_fake_context *fctx = to_fctx(ctx);
+
+	pthread_mutex_lock(&fctx->lock);
+	fctx->stats.sync_steering++;
+	pthread_mutex_unlock(&fctx->lock);
+
+	return 0;
+}
+
+struct mlx5dv_devx_obj *dr_devx_create_flow_table(struct ibv_context *ctx,
+						  uint32_t table_type,
+						  uint64_t icm_addr_rx,
+						  uint64_t icm_addr_tx,
+						  u8 level)
+{
+	return dr_fake_obj_create(ctx);
+}
+
+struct mlx5dv_devx_obj *dr_devx_create_reformat_ctx(struct ibv_context *ctx,
+						    enum reformat_type rt,
+						    size_t reformat_size,
+						    void *reformat_data)
+{
+	return dr_fake_obj_create(ctx);
+}
+
+struct mlx5dv_devx_obj *dr_devx_create_meter(struct ibv_context *ctx,
+					     struct mlx5dv_dr_flow_meter_attr *attr)
+{
+	return dr_fake_obj_create(ctx);
+}
+
+int dr_devx_query_meter(struct mlx5dv_devx_obj *obj, uint64_t *rx_icm_addr,
+			uint64_t *tx_icm_addr)
+{
+	*rx_icm_addr = DR_FAKE_RX_DROP_ICM_ADDR;
+	*tx_icm_addr = DR_FAKE_TX_DROP_ICM_ADDR;
+
+	return 0;
+}
+
+int dr_devx_modify_meter(struct mlx5dv_devx_obj *obj,
+			 struct mlx5dv_dr_flow_meter_attr *attr,
+			 __be64 modify_bits)
+{
+	return 0;
+}
+
+/* Root tables are owned by the kernel steering, which is not emulated */
+
+struct mlx5dv_flow_matcher *
+mlx5dv_create_flow_matcher(struct ibv_context *context,
+			   struct mlx5dv_flow_matcher_attr *matcher_attr)
+{
+	errno = EOPNOTSUPP;
+	return NULL;
+}
+
+int mlx5dv_destroy_flow_matcher(struct mlx5dv_flow_matcher *matcher)
+{
+	return EOPNOTSUPP;
+}
+
+struct ibv_flow *
+__mlx5dv_create_flow(struct mlx5dv_flow_matcher *flow_matcher,
+		     struct mlx5dv_flow_match_parameters *match_value,
+		     size_t num_actions,
+		     struct mlx5dv_flow_action_attr actions_attr[],
+		     struct mlx5_flow_action_attr_aux actions_attr_aux[])
+{
+	errno = EOPNOTSUPP;
+	return NULL;
+}
+
+struct ibv_flow_action *
+mlx5dv_create_flow_action_modify_header(struct ibv_context *ctx,
+					size_t actions_sz,
+					uint64_t actions[],
+					enum mlx5dv_flow_table_type ft_type)
+{
+	errno = EOPNOTSUPP;
+	return NULL;
+}
+
+struct ibv_flow_action *
+mlx5dv_create_flow_action_packet_reformat(struct ibv_context *ctx,
+					  size_t data_sz,
+					  void *data,
+					  enum mlx5dv_flow_action_packet_reformat_type reformat_type,
+					  enum mlx5dv_flow_table_type ft_type)
+{
+	errno = EOPNOTSUPP;
+	return NULL;
+}
+
+int mlx5_destroy_flow_action(struct ibv_flow_action *action)
+{
+	return EOPNOTSUPP;
+}
+
+/* Send ring */
+
+static int dr_fake_postsend(struct mlx5dv_dr_domain *dmn,
+			    struct dr_send_ring *send_ring, uint32_t rkey,
+			    uint64_t remote_addr, const void *data,
+			    uint32_t length)
+{
+	struct dr_fake_send_ring *fring = to_fring(send_ring);
+	struct dr_fake_context *fctx = to_fctx(dmn->ctx);
+	struct dr_fake_dm *fdm;
+	int ret = 0;
+
+	pthread_mutex_lock(&send_ring->mutex);
+	pthread_mutex_lock(&fctx->lock);
+
+	if (!rkey || rkey > fctx->num_dms || !fctx->dms[rkey - 1]) {
+		ret = EINVAL;
+		goto out_unlock;
+	}
+
+	fdm = fctx->dms[rkey - 1];
+	if (remote_addr + length > fdm->mr.length) {
+		ret = EINVAL;
+		goto out_unlock;
+	}
+
+	memcpy(fdm->buf + remote_addr, data, length);
+
+	fctx->stats.icm_writes++;
+	fctx->stats.icm_write_bytes += length;
+
+	if (!fring->batch ||
+	    ++fring->deferred_posts == DR_FAKE_POSTS_PER_DRAIN) {
+		fctx->stats.doorbells++;
+		fring->deferred_posts = 0;
+	}
+
+out_unlock:
+	pthread_mutex_unlock(&fctx->lock);
+	pthread_mutex_unlock(&send_ring->mutex);
+	return ret;
+}
+
+struct dr_send_ring *dr_send_ring_alloc(struct mlx5dv_dr_domain *dmn)
+{
+	struct dr_fake_send_ring *fring;
+
+	fring = calloc(1, sizeof(*fring));
+	if (!fring) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	dmn->info.max_send_wr = 128;
+	dmn->info.max_inline_size = DR_STE_SIZE;
+	fring->fctx = to_fctx(dmn->ctx);
+	fring->ring.max_post_send_size = DR_FAKE_POST_SEND_SIZE;
+	pthread_mutex_init(&fring->ring.mutex, NULL);
+
+	return &fring->ring;
+}
+
+void dr_send_ring_free(struct dr_send_ring *send_ring)
+{
+	pthread_mutex_destroy(&send_ring->mutex);
+	free(to_fring(send_ring));
+}
+
+int dr_send_ring_force_drain(struct mlx5dv_dr_domain *dmn,
+			     struct dr_send_ring *send_ring)
+{
+	return 0;
+}
+
+int dr_send_ring_drain_all(struct mlx5dv_dr_domain *dmn)
+{
+	return 0;
+}
+
+void dr_send_ring_begin_batch(struct dr_send_ring *send_ring)
+{
+	pthread_mutex_lock(&send_ring->mutex);
+	to_fring(send_ring)->batch++;
+	pthread_mutex_unlock(&send_ring->mutex);
+}
+
+void dr_send_ring_end_batch(struct dr_send_ring *send_ring)
+{
+	struct dr_fake_send_ring *fring = to_fring(send_ring);
+
+	pthread_mutex_lock(&send_ring->mutex);
+	fring->batch--;
+	if (fring->deferred_posts) {
+		pthread_mutex_lock(&fring->fctx->lock);
+		fring->fctx->stats.doorbells++;
+		pthread_mutex_unlock(&fring->fctx->lock);
+	}
+	fring->deferred_posts = 0;
+	pthread_mutex_unlock(&send_ring->mutex);
+}
+
+void dr_send_fill_and_append_ste_send_info(struct dr_ste *ste, uint16_t size,
+					   uint16_t offset, uint8_t *data,
+					   struct dr_ste_send_info *ste_info,
+					   struct list_head *send_list,
+					   bool copy_data)
+{
+	ste_info->size		= size;
+	ste_info->ste		= ste;
+	ste_info->offset	= offset;
+
+	if (copy_data) {
+		memcpy(ste_info->data_cont, data, size);
+		ste_info->data = ste_info->data_cont;
+	} else {
+		ste_info->data = data;
+	}
+
+	list_add_tail(send_list, &ste_info->send_list);
+}
+
+int dr_send_postsend_ste(struct mlx5dv_dr_domain *dmn,
+			 struct dr_send_ring *send_ring, struct dr_ste *ste,
+			 uint8_t *data, uint16_t size, uint16_t offset)
+{
+	return dr_fake_postsend(dmn, send_ring, ste->htbl->chunk->rkey,
+				dr_ste_get_mr_addr(ste) + offset, data, size);
+}
+
+/* Hash tables are written in post send sized pieces like the real ring */
+static int dr_fake_postsend_htbl_data(struct mlx5dv_dr_domain *dmn,
+				      struct dr_send_ring *send_ring,
+				      struct dr_ste_htbl *htbl,
+				      uint8_t *formated_ste, uint8_t *mask,
+				      bool formated_only)
+{
+	uint32_t num_stes = htbl->chunk->num_of_entries;
+	uint32_t stes_per_iter, i, j;
+	uint8_t *data;
+	int ret = 0;
+
+	stes_per_iter = min_t(uint32_t, num_stes,
+			      send_ring->max_post_send_size / DR_STE_SIZE);
+	data = calloc(stes_per_iter, DR_STE_SIZE);
+	if (!data) {
+		errno = ENOMEM;
+		return errno;
+	}
+
+	for (i = 0; i < num_stes; i += stes_per_iter) {
+		for (j = 0; j < stes_per_iter; j++) {
+			uint8_t *dst = data + j * DR_STE_SIZE;
+			uint8_t *hw_ste = htbl->ste_arr[i + j].hw_ste;
+
+			if (formated_only || dr_ste_is_not_valid_entry(hw_ste)) {
+				memcpy(dst, formated_ste, DR_STE_SIZE);
+			} else {
+				memcpy(dst, hw_ste, DR_STE_SIZE_REDUCED);
+				memcpy(dst + DR_STE_SIZE_REDUCED, mask,
+				       DR_STE_SIZE_MASK);
+			}
+		}
+
+		ret = dr_fake_postsend(dmn, send_ring, htbl->chunk->rkey,
+				       dr_ste_get_mr_addr(htbl->ste_arr + i),
+				       data, stes_per_iter * DR_STE_SIZE);
+		if (ret)
+			break;
+	}
+
+	free(data);
+	return ret;
+}
+
+int dr_send_postsend_htbl(struct mlx5dv_dr_domain *dmn,
+			  struct dr_send_ring *send_ring,
+			  struct dr_ste_htbl *htbl,
+			  uint8_t *formated_ste, uint8_t *mask)
+{
+	return dr_fake_postsend_htbl_data(dmn, send_ring, htbl, formated_ste,
+					  mask, false);
+}
+
+int dr_send_postsend_formated_htbl(struct mlx5dv_dr_domain *dmn,
+				   struct dr_send_ring *send_ring,
+				   struct dr_ste_htbl *htbl,
+				   uint8_t *ste_init_data,
+				   bool update_hw_ste)
+{
+	uint32_t i;
+
+	if (update_hw_ste)
+		for (i = 0; i < htbl->chunk->num_of_entries; i++)
+			memcpy(htbl->hw_ste_arr + i * DR_STE_SIZE_REDUCED,
+			       ste_init_data, DR_STE_SIZE_REDUCED);
+
+	return dr_fake_postsend_htbl_data(dmn, send_ring, htbl, ste_init_data,
+					  NULL, true);
+}
+
+int dr_send_postsend_action(struct mlx5dv_dr_domain *dmn,
+			    struct mlx5dv_dr_action *action)
+{
+	int ret;
+
+	pthread_mutex_lock(&dmn->mutex);
+	ret = dr_fake_postsend(dmn, dmn->send_ring[0],
+			       action->rewrite.chunk->rkey,
+			       action->rewrite.chunk->mr_addr,
+			       action->rewrite.data,
+			       action->rewrite.chunk->byte_size);
+	pthread_mutex_unlock(&dmn->mutex);
+
+	return ret;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2019, Mellanox Technologies. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *	Redistribution and use in source and binary forms, with or
+ *	without modification, are permitted provided that the following
+ *	conditions are met:
+ *
+ *	- Redistributions of source code must retain the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer.
+ *
+ *	- Redistributions in binary form must reproduce the above
+ *	  copyright notice, this list of conditions and the following
+ *	  disclaimer in the documentation and/or other materials
+ *	  provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _DR_FAKE_H_
+#define _DR_FAKE_H_
+
+#include "../mlx5dv_dr.h"
+
+/*
+ * A software only stand-in for the device side of mlx5 SW steering: ICM is
+ * host memory, devx commands return canned capabilities and the send ring
+ * copies STEs straight into the fake ICM instead of posting RDMA writes.
+ */
+
+struct dr_fake_attr {
+	/* log2 of the biggest STE hash table the device allows */
+	uint32_t	log_icm_size;
+	/* number of eswitch vports, not counting the uplink */
+	uint32_t	num_vports;
+};
+
+struct dr_fake_stats {
+	/* ICM handed out by the fake device memory allocator */
+	uint64_t	icm_alloc_bytes;
+	uint32_t	icm_alloc_count;
+	/* Writes the send ring would have posted and their payload */
+	uint64_t	icm_writes;
+	uint64_t	icm_write_bytes;
+	/* Doorbells the send ring would have rung for those writes */
+	uint64_t	doorbells;
+	uint64_t	sync_steering;
+};
+
+struct ibv_context *dr_fake_open(const struct dr_fake_attr *attr);
+void dr_fake_close(struct ibv_context *ctx);
+struct dr_fake_stats *dr_fake_get_stats(struct ibv_context *ctx);
+/* Returns the host memory backing the given ICM address or NULL */
+void *dr_fake_icm_ptr(struct ibv_context *ctx, uint64_t icm_addr,
+		      size_t length);
+
+#endif
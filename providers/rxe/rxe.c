@@ -99,31 +99,121 @@ static struct ibv_pd *rxe_alloc_pd(struct ibv_context *context)
 {
 	struct ibv_alloc_pd cmd;
 	struct ib_uverbs_alloc_pd_resp resp;
-	struct ibv_pd *pd;
+	struct rxe_pd *pd;
 
-	pd = malloc(sizeof *pd);
+	pd = calloc(1, sizeof(*pd));
 	if (!pd)
 		return NULL;
 
-	if (ibv_cmd_alloc_pd(context, pd, &cmd, sizeof cmd, &resp, sizeof resp)) {
+	if (ibv_cmd_alloc_pd(context, &pd->ibv_pd, &cmd, sizeof cmd,
+			     &resp, sizeof resp)) {
 		free(pd);
 		return NULL;
 	}
 
-	return pd;
+	atomic_init(&pd->refcount, 1);
+	return &pd->ibv_pd;
 }
 
-static int rxe_dealloc_pd(struct ibv_pd *pd)
+static int rxe_dealloc_parent_domain(struct rxe_pd *pd)
 {
+	if (atomic_load(&pd->refcount) > 1)
+		return EBUSY;
+
+	atomic_fetch_sub(&pd->protection_domain->refcount, 1);
+	if (pd->td)
+		atomic_fetch_sub(&pd->td->refcount, 1);
+
+	free(pd);
+	return 0;
+}
+
+static int rxe_dealloc_pd(struct ibv_pd *ibpd)
+{
+	struct rxe_pd *pd = to_rpd(ibpd);
 	int ret;
 
-	ret = ibv_cmd_dealloc_pd(pd);
+	if (pd->protection_domain)
+		return rxe_dealloc_parent_domain(pd);
+
+	if (atomic_load(&pd->refcount) > 1)
+		return EBUSY;
+
+	ret = ibv_cmd_dealloc_pd(ibpd);
 	if (!ret)
 		free(pd);
 
 	return ret;
 }
 
+static struct ibv_td *rxe_alloc_td(struct ibv_context *context,
+				   struct ibv_td_init_attr *init_attr)
+{
+	struct rxe_td *td;
+
+	if (init_attr->comp_mask) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	td = calloc(1, sizeof(*td));
+	if (!td) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	td->ibv_td.context = context;
+	atomic_init(&td->refcount, 1);
+
+	return &td->ibv_td;
+}
+
+static int rxe_dealloc_td(struct ibv_td *ibtd)
+{
+	struct rxe_td *td = to_rtd(ibtd);
+
+	if (atomic_load(&td->refcount) > 1)
+		return EBUSY;
+
+	free(td);
+	return 0;
+}
+
+static struct ibv_pd *
+rxe_alloc_parent_domain(struct ibv_context *context,
+			struct ibv_parent_domain_init_attr *attr)
+{
+	struct rxe_pd *pd;
+
+	if (ibv_check_alloc_parent_domain(attr))
+		return NULL;
+
+	if (attr->comp_mask) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pd = calloc(1, sizeof(*pd));
+	if (!pd) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if (attr->td) {
+		pd->td = to_rtd(attr->td);
+		atomic_fetch_add(&pd->td->refcount, 1);
+	}
+
+	pd->protection_domain = to_rpd(attr->pd);
+	atomic_fetch_add(&pd->protection_domain->refcount, 1);
+	atomic_init(&pd->refcount, 1);
+
+	ibv_initialize_parent_domain(&pd->ibv_pd,
+				     &pd->protection_domain->ibv_pd);
+
+	return &pd->ibv_pd;
+}
+
 static struct ibv_mr *rxe_reg_mr(struct ibv_pd *pd, void *addr, size_t length,
 				 uint64_t hca_va, int access)
 {
@@ -188,11 +278,228 @@ static struct ibv_cq *rxe_create_cq(struct ibv_context *context, int cqe,
 	}
 
 	cq->mmap_info = resp.mi;
+	cq->single_threaded = false;
 	pthread_spin_init(&cq->lock, PTHREAD_PROCESS_PRIVATE);
 
 	return &cq->ibv_cq;
 }
 
+static inline void rxe_cq_lock(struct rxe_cq *cq)
+{
+	if (!cq->single_threaded)
+		pthread_spin_lock(&cq->lock);
+}
+
+static inline void rxe_cq_unlock(struct rxe_cq *cq)
+{
+	if (!cq->single_threaded)
+		pthread_spin_unlock(&cq->lock);
+}
+
+static inline void rxe_wq_lock(struct rxe_wq *wq)
+{
+	if (!wq->single_threaded)
+		pthread_spin_lock(&wq->lock);
+}
+
+static inline void rxe_wq_unlock(struct rxe_wq *wq)
+{
+	if (!wq->single_threaded)
+		pthread_spin_unlock(&wq->lock);
+}
+
+/*
+ * Extended CQ polling hands out CQEs in place: the readers below access the
+ * ib_uverbs_wc written by the kernel in the mmapped queue, and the consumer
+ * index is only published once, from end_poll.
+ */
+static inline void rxe_cq_read_cur(struct rxe_cq *cq)
+{
+	struct rxe_queue *q = cq->queue;
+
+	atomic_thread_fence(memory_order_acquire);
+	cq->wc = addr_from_index(q, cq->cur_index);
+	cq->ibv_cq_ex.wr_id = cq->wc->wr_id;
+	cq->ibv_cq_ex.status = cq->wc->status;
+	cq->cur_index = next_index(q, cq->cur_index);
+}
+
+static inline bool rxe_cq_cur_empty(struct rxe_cq *cq)
+{
+	return cq->cur_index == atomic_load(&cq->queue->producer_index);
+}
+
+static int rxe_start_poll(struct ibv_cq_ex *ibcq,
+			  struct ibv_poll_cq_attr *attr)
+{
+	struct rxe_cq *cq = to_rcq_ex(ibcq);
+
+	if (attr->comp_mask)
+		return EINVAL;
+
+	rxe_cq_lock(cq);
+	cq->cur_index = atomic_load_explicit(&cq->queue->consumer_index,
+					     memory_order_relaxed);
+	if (rxe_cq_cur_empty(cq)) {
+		rxe_cq_unlock(cq);
+		return ENOENT;
+	}
+
+	rxe_cq_read_cur(cq);
+	return 0;
+}
+
+static int rxe_next_poll(struct ibv_cq_ex *ibcq)
+{
+	struct rxe_cq *cq = to_rcq_ex(ibcq);
+
+	if (rxe_cq_cur_empty(cq))
+		return ENOENT;
+
+	rxe_cq_read_cur(cq);
+	return 0;
+}
+
+static void rxe_end_poll(struct ibv_cq_ex *ibcq)
+{
+	struct rxe_cq *cq = to_rcq_ex(ibcq);
+
+	atomic_store(&cq->queue->consumer_index, cq->cur_index);
+	rxe_cq_unlock(cq);
+}
+
+static enum ibv_wc_opcode rxe_wc_read_opcode(struct ibv_cq_ex *ibcq)
+{
+	return to_rcq_ex(ibcq)->wc->opcode;
+}
+
+static uint32_t rxe_wc_read_vendor_err(struct ibv_cq_ex *ibcq)
+{
+	return to_rcq_ex(ibcq)->wc->vendor_err;
+}
+
+static uint32_t rxe_wc_read_byte_len(struct ibv_cq_ex *ibcq)
+{
+	return to_rcq_ex(ibcq)->wc->byte_len;
+}
+
+static __be32 rxe_wc_read_imm_data(struct ibv_cq_ex *ibcq)
+{
+	struct ib_uverbs_wc *wc = to_rcq_ex(ibcq)->wc;
+
+	/*
+	 * This is returning invalidate_rkey which is in host order, see
+	 * ibv_wc_read_invalidated_rkey
+	 */
+	if (wc->opcode == IBV_WC_RECV &&
+	    (wc->wc_flags & IBV_WC_WITH_INV))
+		return (__force __be32)wc->ex.invalidate_rkey;
+
+	return wc->ex.imm_data;
+}
+
+static uint32_t rxe_wc_read_qp_num(struct ibv_cq_ex *ibcq)
+{
+	return to_rcq_ex(ibcq)->wc->qp_num;
+}
+
+static uint32_t rxe_wc_read_src_qp(struct ibv_cq_ex *ibcq)
+{
+	return to_rcq_ex(ibcq)->wc->src_qp;
+}
+
+static unsigned int rxe_wc_read_wc_flags(struct ibv_cq_ex *ibcq)
+{
+	return to_rcq_ex(ibcq)->wc->wc_flags;
+}
+
+static uint32_t rxe_wc_read_slid(struct ibv_cq_ex *ibcq)
+{
+	return to_rcq_ex(ibcq)->wc->slid;
+}
+
+static uint8_t rxe_wc_read_sl(struct ibv_cq_ex *ibcq)
+{
+	return to_rcq_ex(ibcq)->wc->sl;
+}
+
+static uint8_t rxe_wc_read_dlid_path_bits(struct ibv_cq_ex *ibcq)
+{
+	return to_rcq_ex(ibcq)->wc->dlid_path_bits;
+}
+
+enum {
+	RXE_CQ_SUPPORTED_WC_FLAGS = IBV_WC_STANDARD_FLAGS,
+	RXE_CQ_SUPPORTED_COMP_MASK = IBV_CQ_INIT_ATTR_MASK_FLAGS,
+	RXE_CQ_SUPPORTED_FLAGS = IBV_CREATE_CQ_ATTR_SINGLE_THREADED,
+};
+
+static struct ibv_cq_ex *rxe_create_cq_ex(struct ibv_context *context,
+					  struct ibv_cq_init_attr_ex *attr)
+{
+	struct urxe_create_cq_ex cmd = {};
+	struct urxe_create_cq_ex_resp resp = {};
+	struct rxe_cq *cq;
+	int ret;
+
+	if (attr->comp_mask & ~RXE_CQ_SUPPORTED_COMP_MASK ||
+	    attr->wc_flags & ~RXE_CQ_SUPPORTED_WC_FLAGS ||
+	    (attr->comp_mask & IBV_CQ_INIT_ATTR_MASK_FLAGS &&
+	     attr->flags & ~RXE_CQ_SUPPORTED_FLAGS)) {
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
+
+	cq = calloc(1, sizeof(*cq));
+	if (!cq)
+		return NULL;
+
+	ret = ibv_cmd_create_cq_ex(context, attr, &cq->ibv_cq_ex,
+				   &cmd.ibv_cmd, sizeof(cmd),
+				   &resp.ibv_resp, sizeof(resp));
+	if (ret) {
+		errno = ret;
+		free(cq);
+		return NULL;
+	}
+
+	cq->queue = mmap(NULL, resp.mi.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			 context->cmd_fd, resp.mi.offset);
+	if ((void *)cq->queue == MAP_FAILED) {
+		ibv_cmd_destroy_cq(&cq->ibv_cq);
+		free(cq);
+		return NULL;
+	}
+
+	cq->mmap_info = resp.mi;
+	cq->single_threaded = attr->comp_mask & IBV_CQ_INIT_ATTR_MASK_FLAGS &&
+			      attr->flags & IBV_CREATE_CQ_ATTR_SINGLE_THREADED;
+	pthread_spin_init(&cq->lock, PTHREAD_PROCESS_PRIVATE);
+
+	cq->ibv_cq_ex.start_poll = rxe_start_poll;
+	cq->ibv_cq_ex.next_poll = rxe_next_poll;
+	cq->ibv_cq_ex.end_poll = rxe_end_poll;
+	cq->ibv_cq_ex.read_opcode = rxe_wc_read_opcode;
+	cq->ibv_cq_ex.read_vendor_err = rxe_wc_read_vendor_err;
+	cq->ibv_cq_ex.read_wc_flags = rxe_wc_read_wc_flags;
+	if (attr->wc_flags & IBV_WC_EX_WITH_BYTE_LEN)
+		cq->ibv_cq_ex.read_byte_len = rxe_wc_read_byte_len;
+	if (attr->wc_flags & IBV_WC_EX_WITH_IMM)
+		cq->ibv_cq_ex.read_imm_data = rxe_wc_read_imm_data;
+	if (attr->wc_flags & IBV_WC_EX_WITH_QP_NUM)
+		cq->ibv_cq_ex.read_qp_num = rxe_wc_read_qp_num;
+	if (attr->wc_flags & IBV_WC_EX_WITH_SRC_QP)
+		cq->ibv_cq_ex.read_src_qp = rxe_wc_read_src_qp;
+	if (attr->wc_flags & IBV_WC_EX_WITH_SLID)
+		cq->ibv_cq_ex.read_slid = rxe_wc_read_slid;
+	if (attr->wc_flags & IBV_WC_EX_WITH_SL)
+		cq->ibv_cq_ex.read_sl = rxe_wc_read_sl;
+	if (attr->wc_flags & IBV_WC_EX_WITH_DLID_PATH_BITS)
+		cq->ibv_cq_ex.read_dlid_path_bits = rxe_wc_read_dlid_path_bits;
+
+	return &cq->ibv_cq_ex;
+}
+
 static int rxe_resize_cq(struct ibv_cq *ibcq, int cqe)
 {
 	struct rxe_cq *cq = to_rcq(ibcq);
@@ -200,12 +507,12 @@ static int rxe_resize_cq(struct ibv_cq *ibcq, int cqe)
 	struct urxe_resize_cq_resp resp;
 	int ret;
 
-	pthread_spin_lock(&cq->lock);
+	rxe_cq_lock(cq);
 
 	ret = ibv_cmd_resize_cq(ibcq, cqe, &cmd, sizeof cmd,
 				&resp.ibv_resp, sizeof resp);
 	if (ret) {
-		pthread_spin_unlock(&cq->lock);
+		rxe_cq_unlock(cq);
 		return ret;
 	}
 
@@ -216,7 +523,7 @@ static int rxe_resize_cq(struct ibv_cq *ibcq, int cqe)
 			 ibcq->context->cmd_fd, resp.mi.offset);
 
 	ret = errno;
-	pthread_spin_unlock(&cq->lock);
+	rxe_cq_unlock(cq);
 
 	if ((void *)cq->queue == MAP_FAILED) {
 		cq->queue = NULL;
@@ -252,7 +559,7 @@ static int rxe_poll_cq(struct ibv_cq *ibcq, int ne, struct ibv_wc *wc)
 	int npolled;
 	uint8_t *src;
 
-	pthread_spin_lock(&cq->lock);
+	rxe_cq_lock(cq);
 	q = cq->queue;
 
 	for (npolled = 0; npolled < ne; ++npolled, ++wc) {
@@ -265,7 +572,7 @@ static int rxe_poll_cq(struct ibv_cq *ibcq, int ne, struct ibv_wc *wc)
 		advance_consumer(q);
 	}
 
-	pthread_spin_unlock(&cq->lock);
+	rxe_cq_unlock(cq);
 	return npolled;
 }
 
@@ -300,6 +607,7 @@ static struct ibv_srq *rxe_create_srq(struct ibv_pd *pd,
 
 	srq->mmap_info = resp.mi;
 	srq->rq.max_sge = attr->attr.max_sge;
+	srq->rq.single_threaded = rxe_pd_single_threaded(pd);
 	pthread_spin_init(&srq->rq.lock, PTHREAD_PROCESS_PRIVATE);
 
 	return &srq->ibv_srq;
@@ -419,7 +727,7 @@ static int rxe_post_srq_recv(struct ibv_srq *ibvsrq,
 	struct rxe_srq *srq = to_rsrq(ibvsrq);
 	int rc = 0;
 
-	pthread_spin_lock(&srq->rq.lock);
+	rxe_wq_lock(&srq->rq);
 
 	while (recv_wr) {
 		rc = rxe_post_one_recv(&srq->rq, recv_wr);
@@ -431,11 +739,105 @@ static int rxe_post_srq_recv(struct ibv_srq *ibvsrq,
 		recv_wr = recv_wr->next;
 	}
 
-	pthread_spin_unlock(&srq->rq.lock);
+	rxe_wq_unlock(&srq->rq);
+
+	return rc;
+}
+
+/*
+ * Fill the RQEs for the whole batch and publish them with a single
+ * producer index update.
+ */
+static int rxe_post_srq_recv_bulk(struct ibv_srq *ibvsrq, uint32_t num_wr,
+				  const uint64_t *wr_id,
+				  const struct ibv_sge *sg_list,
+				  uint32_t *num_posted)
+{
+	struct rxe_srq *srq = to_rsrq(ibvsrq);
+	struct rxe_queue *q = srq->rq.queue;
+	struct rxe_recv_wqe *wqe;
+	uint32_t prod, cons;
+	uint32_t i;
+	int rc = 0;
+
+	rxe_wq_lock(&srq->rq);
+
+	prod = atomic_load_explicit(&q->producer_index, memory_order_relaxed);
+	cons = atomic_load(&q->consumer_index);
+
+	for (i = 0; i < num_wr; i++) {
+		if (((prod + 1 - cons) & q->index_mask) == 0) {
+			rc = ENOMEM;
+			break;
+		}
+
+		wqe = addr_from_index(q, prod);
+		wqe->wr_id = wr_id[i];
+		wqe->num_sge = 1;
+		wqe->dma.sge[0].addr = sg_list[i].addr;
+		wqe->dma.sge[0].length = sg_list[i].length;
+		wqe->dma.sge[0].lkey = sg_list[i].lkey;
+		wqe->dma.length = sg_list[i].length;
+		wqe->dma.resid = sg_list[i].length;
+		wqe->dma.cur_sge = 0;
+		wqe->dma.num_sge = 1;
+		wqe->dma.sge_offset = 0;
+
+		prod = next_index(q, prod);
+	}
+
+	if (i) {
+		atomic_thread_fence(memory_order_release);
+		atomic_store(&q->producer_index, prod);
+	}
+
+	rxe_wq_unlock(&srq->rq);
 
+	*num_posted = i;
 	return rc;
 }
 
+static int map_queue_pair(int cmd_fd, struct rxe_qp *qp,
+			  struct ibv_qp_cap *cap, struct ibv_srq *srq,
+			  struct urxe_create_qp_resp *resp)
+{
+	bool single_threaded = rxe_pd_single_threaded(qp->ibv_qp.pd);
+
+	if (srq) {
+		qp->rq.max_sge = 0;
+		qp->rq.queue = NULL;
+		qp->rq_mmap_info.size = 0;
+	} else {
+		qp->rq.max_sge = cap->max_recv_sge;
+		qp->rq.queue = mmap(NULL, resp->rq_mi.size, PROT_READ | PROT_WRITE,
+				    MAP_SHARED, cmd_fd, resp->rq_mi.offset);
+		if ((void *)qp->rq.queue == MAP_FAILED)
+			return errno;
+
+		qp->rq_mmap_info = resp->rq_mi;
+		qp->rq.single_threaded = single_threaded;
+		pthread_spin_init(&qp->rq.lock, PTHREAD_PROCESS_PRIVATE);
+	}
+
+	qp->sq.max_sge = cap->max_send_sge;
+	qp->sq.max_inline = cap->max_inline_data;
+	qp->sq.queue = mmap(NULL, resp->sq_mi.size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED, cmd_fd, resp->sq_mi.offset);
+	if ((void *)qp->sq.queue == MAP_FAILED) {
+		int ret = errno;
+
+		if (qp->rq_mmap_info.size)
+			munmap(qp->rq.queue, qp->rq_mmap_info.size);
+		return ret;
+	}
+
+	qp->sq_mmap_info = resp->sq_mi;
+	qp->sq.single_threaded = single_threaded;
+	pthread_spin_init(&qp->sq.lock, PTHREAD_PROCESS_PRIVATE);
+
+	return 0;
+}
+
 static struct ibv_qp *rxe_create_qp(struct ibv_pd *pd,
 				    struct ibv_qp_init_attr *attr)
 {
@@ -444,7 +846,7 @@ static struct ibv_qp *rxe_create_qp(struct ibv_pd *pd,
 	struct rxe_qp *qp;
 	int ret;
 
-	qp = malloc(sizeof *qp);
+	qp = calloc(1, sizeof(*qp));
 	if (!qp) {
 		return NULL;
 	}
@@ -456,41 +858,15 @@ static struct ibv_qp *rxe_create_qp(struct ibv_pd *pd,
 		return NULL;
 	}
 
-	if (attr->srq) {
-		qp->rq.max_sge = 0;
-		qp->rq.queue = NULL;
-		qp->rq_mmap_info.size = 0;
-	} else {
-		qp->rq.max_sge = attr->cap.max_recv_sge;
-		qp->rq.queue = mmap(NULL, resp.rq_mi.size, PROT_READ | PROT_WRITE,
-				    MAP_SHARED,
-				    pd->context->cmd_fd, resp.rq_mi.offset);
-		if ((void *)qp->rq.queue == MAP_FAILED) {
-			ibv_cmd_destroy_qp(&qp->ibv_qp);
-			free(qp);
-			return NULL;
-		}
-
-		qp->rq_mmap_info = resp.rq_mi;
-		pthread_spin_init(&qp->rq.lock, PTHREAD_PROCESS_PRIVATE);
-	}
-
-	qp->sq.max_sge = attr->cap.max_send_sge;
-	qp->sq.max_inline = attr->cap.max_inline_data;
-	qp->sq.queue = mmap(NULL, resp.sq_mi.size, PROT_READ | PROT_WRITE,
-			    MAP_SHARED,
-			    pd->context->cmd_fd, resp.sq_mi.offset);
-	if ((void *)qp->sq.queue == MAP_FAILED) {
-		if (qp->rq_mmap_info.size)
-			munmap(qp->rq.queue, qp->rq_mmap_info.size);
+	ret = map_queue_pair(pd->context->cmd_fd, qp, &attr->cap, attr->srq,
+			     &resp);
+	if (ret) {
 		ibv_cmd_destroy_qp(&qp->ibv_qp);
 		free(qp);
+		errno = ret;
 		return NULL;
 	}
 
-	qp->sq_mmap_info = resp.sq_mi;
-	pthread_spin_init(&qp->sq.lock, PTHREAD_PROCESS_PRIVATE);
-
 	return &qp->ibv_qp;
 }
 
@@ -706,7 +1082,7 @@ static int rxe_post_send(struct ibv_qp *ibqp,
 	if (!sq || !wr_list || !sq->queue)
 	 	return EINVAL;
 
-	pthread_spin_lock(&sq->lock);
+	rxe_wq_lock(sq);
 
 	while (wr_list) {
 		rc = post_one_send(qp, sq, wr_list);
@@ -718,12 +1094,464 @@ static int rxe_post_send(struct ibv_qp *ibqp,
 		wr_list = wr_list->next;
 	}
 
-	pthread_spin_unlock(&sq->lock);
+	rxe_wq_unlock(sq);
 
 	err =  post_send_db(ibqp);
 	return err ? err : rc;
 }
 
+/*
+ * ibv_wr_* builders write each WQE straight into the next free slot of the
+ * mmapped SQ. The producer index is only published, and the doorbell rung,
+ * once per wr_complete, so an aborted or failed batch never reaches the
+ * kernel.
+ */
+static struct rxe_send_wqe *init_send_wqe_ex(struct rxe_qp *qp,
+					     enum ibv_wr_opcode opcode)
+{
+	struct rxe_queue *q = qp->sq.queue;
+	struct rxe_send_wqe *wqe;
+
+	if (qp->err)
+		return NULL;
+
+	if (next_index(q, qp->cur_index) == atomic_load(&q->consumer_index)) {
+		qp->err = ENOMEM;
+		return NULL;
+	}
+
+	wqe = addr_from_index(q, qp->cur_index);
+	memset(wqe, 0, sizeof(*wqe));
+
+	wqe->wr.wr_id = qp->vqp.qp_ex.wr_id;
+	wqe->wr.opcode = opcode;
+	wqe->wr.send_flags = qp->vqp.qp_ex.wr_flags & ~IBV_SEND_INLINE;
+	wqe->ssn = qp->ssn++;
+
+	qp->wqe = wqe;
+	qp->cur_index = next_index(q, qp->cur_index);
+	return wqe;
+}
+
+static void wr_atomic_cmp_swp(struct ibv_qp_ex *ibqp, uint32_t rkey,
+			      uint64_t remote_addr, uint64_t compare,
+			      uint64_t swap)
+{
+	struct rxe_qp *qp = to_rqp_ex(ibqp);
+	struct rxe_send_wqe *wqe;
+
+	wqe = init_send_wqe_ex(qp, IBV_WR_ATOMIC_CMP_AND_SWP);
+	if (!wqe)
+		return;
+
+	if (remote_addr & 0x7) {
+		qp->err = EINVAL;
+		return;
+	}
+
+	wqe->wr.wr.atomic.remote_addr = remote_addr;
+	wqe->wr.wr.atomic.compare_add = compare;
+	wqe->wr.wr.atomic.swap = swap;
+	wqe->wr.wr.atomic.rkey = rkey;
+	wqe->iova = remote_addr;
+}
+
+static void wr_atomic_fetch_add(struct ibv_qp_ex *ibqp, uint32_t rkey,
+				uint64_t remote_addr, uint64_t add)
+{
+	struct rxe_qp *qp = to_rqp_ex(ibqp);
+	struct rxe_send_wqe *wqe;
+
+	wqe = init_send_wqe_ex(qp, IBV_WR_ATOMIC_FETCH_AND_ADD);
+	if (!wqe)
+		return;
+
+	if (remote_addr & 0x7) {
+		qp->err = EINVAL;
+		return;
+	}
+
+	wqe->wr.wr.atomic.remote_addr = remote_addr;
+	wqe->wr.wr.atomic.compare_add = add;
+	wqe->wr.wr.atomic.rkey = rkey;
+	wqe->iova = remote_addr;
+}
+
+static void wr_local_inv(struct ibv_qp_ex *ibqp, uint32_t invalidate_rkey)
+{
+	struct rxe_send_wqe *wqe;
+
+	wqe = init_send_wqe_ex(to_rqp_ex(ibqp), IBV_WR_LOCAL_INV);
+	if (!wqe)
+		return;
+
+	wqe->wr.ex.invalidate_rkey = invalidate_rkey;
+}
+
+static void wr_rdma_common(struct ibv_qp_ex *ibqp, enum ibv_wr_opcode opcode,
+			   uint32_t rkey, uint64_t remote_addr, __be32 imm_data)
+{
+	struct rxe_send_wqe *wqe;
+
+	wqe = init_send_wqe_ex(to_rqp_ex(ibqp), opcode);
+	if (!wqe)
+		return;
+
+	wqe->wr.wr.rdma.remote_addr = remote_addr;
+	wqe->wr.wr.rdma.rkey = rkey;
+	wqe->wr.ex.imm_data = imm_data;
+	wqe->iova = remote_addr;
+}
+
+static void wr_rdma_read(struct ibv_qp_ex *ibqp, uint32_t rkey,
+			 uint64_t remote_addr)
+{
+	wr_rdma_common(ibqp, IBV_WR_RDMA_READ, rkey, remote_addr, 0);
+}
+
+static void wr_rdma_write(struct ibv_qp_ex *ibqp, uint32_t rkey,
+			  uint64_t remote_addr)
+{
+	wr_rdma_common(ibqp, IBV_WR_RDMA_WRITE, rkey, remote_addr, 0);
+}
+
+static void wr_rdma_write_imm(struct ibv_qp_ex *ibqp, uint32_t rkey,
+			      uint64_t remote_addr, __be32 imm_data)
+{
+	wr_rdma_common(ibqp, IBV_WR_RDMA_WRITE_WITH_IMM, rkey, remote_addr,
+		       imm_data);
+}
+
+static void wr_send(struct ibv_qp_ex *ibqp)
+{
+	init_send_wqe_ex(to_rqp_ex(ibqp), IBV_WR_SEND);
+}
+
+static void wr_send_imm(struct ibv_qp_ex *ibqp, __be32 imm_data)
+{
+	struct rxe_send_wqe *wqe;
+
+	wqe = init_send_wqe_ex(to_rqp_ex(ibqp), IBV_WR_SEND_WITH_IMM);
+	if (!wqe)
+		return;
+
+	wqe->wr.ex.imm_data = imm_data;
+}
+
+static void wr_send_inv(struct ibv_qp_ex *ibqp, uint32_t invalidate_rkey)
+{
+	struct rxe_send_wqe *wqe;
+
+	wqe = init_send_wqe_ex(to_rqp_ex(ibqp), IBV_WR_SEND_WITH_INV);
+	if (!wqe)
+		return;
+
+	wqe->wr.ex.invalidate_rkey = invalidate_rkey;
+}
+
+static void wr_set_ud_addr(struct ibv_qp_ex *ibqp, struct ibv_ah *ibah,
+			   uint32_t remote_qpn, uint32_t remote_qkey)
+{
+	struct rxe_qp *qp = to_rqp_ex(ibqp);
+	struct rxe_send_wqe *wqe = qp->wqe;
+
+	if (qp->err)
+		return;
+
+	memcpy(&wqe->av, &to_rah(ibah)->av, sizeof(struct rxe_av));
+	wqe->wr.wr.ud.remote_qpn = remote_qpn;
+	wqe->wr.wr.ud.remote_qkey = remote_qkey;
+}
+
+static void set_wqe_dma(struct rxe_qp *qp, struct rxe_send_wqe *wqe,
+			unsigned int num_sge, unsigned int length)
+{
+	enum ibv_wr_opcode opcode = wqe->wr.opcode;
+
+	if ((opcode == IBV_WR_ATOMIC_CMP_AND_SWP ||
+	     opcode == IBV_WR_ATOMIC_FETCH_AND_ADD) && length < 8) {
+		qp->err = EINVAL;
+		return;
+	}
+
+	wqe->wr.num_sge = num_sge;
+	wqe->dma.length = length;
+	wqe->dma.resid = length;
+	wqe->dma.num_sge = num_sge;
+}
+
+static void wr_set_sge(struct ibv_qp_ex *ibqp, uint32_t lkey, uint64_t addr,
+		       uint32_t length)
+{
+	struct rxe_qp *qp = to_rqp_ex(ibqp);
+	struct rxe_send_wqe *wqe = qp->wqe;
+
+	if (qp->err)
+		return;
+
+	wqe->dma.sge[0].addr = addr;
+	wqe->dma.sge[0].length = length;
+	wqe->dma.sge[0].lkey = lkey;
+	set_wqe_dma(qp, wqe, 1, length);
+}
+
+static void wr_set_sge_list(struct ibv_qp_ex *ibqp, size_t num_sge,
+			    const struct ibv_sge *sg_list)
+{
+	struct rxe_qp *qp = to_rqp_ex(ibqp);
+	struct rxe_send_wqe *wqe = qp->wqe;
+	unsigned int length = 0;
+	size_t i;
+
+	if (qp->err)
+		return;
+
+	if (num_sge > qp->sq.max_sge) {
+		qp->err = EINVAL;
+		return;
+	}
+
+	for (i = 0; i < num_sge; i++)
+		length += sg_list[i].length;
+
+	memcpy(wqe->dma.sge, sg_list, num_sge * sizeof(struct ibv_sge));
+	set_wqe_dma(qp, wqe, num_sge, length);
+}
+
+static void wr_set_inline_data(struct ibv_qp_ex *ibqp, void *addr,
+			       size_t length)
+{
+	struct rxe_qp *qp = to_rqp_ex(ibqp);
+	struct rxe_send_wqe *wqe = qp->wqe;
+
+	if (qp->err)
+		return;
+
+	if (length > qp->sq.max_inline) {
+		qp->err = EINVAL;
+		return;
+	}
+
+	memcpy(wqe->dma.inline_data, addr, length);
+	wqe->wr.send_flags |= IBV_SEND_INLINE;
+	set_wqe_dma(qp, wqe, 0, length);
+}
+
+static void wr_set_inline_data_list(struct ibv_qp_ex *ibqp, size_t num_buf,
+				    const struct ibv_data_buf *buf_list)
+{
+	struct rxe_qp *qp = to_rqp_ex(ibqp);
+	struct rxe_send_wqe *wqe = qp->wqe;
+	uint8_t *data;
+	size_t length = 0;
+	size_t i;
+
+	if (qp->err)
+		return;
+
+	for (i = 0; i < num_buf; i++)
+		length += buf_list[i].length;
+
+	if (length > qp->sq.max_inline) {
+		qp->err = EINVAL;
+		return;
+	}
+
+	data = wqe->dma.inline_data;
+	for (i = 0; i < num_buf; i++) {
+		memcpy(data, buf_list[i].addr, buf_list[i].length);
+		data += buf_list[i].length;
+	}
+
+	wqe->wr.send_flags |= IBV_SEND_INLINE;
+	set_wqe_dma(qp, wqe, 0, length);
+}
+
+static void wr_start(struct ibv_qp_ex *ibqp)
+{
+	struct rxe_qp *qp = to_rqp_ex(ibqp);
+
+	rxe_wq_lock(&qp->sq);
+
+	qp->err = 0;
+	qp->cur_index = atomic_load_explicit(&qp->sq.queue->producer_index,
+					     memory_order_relaxed);
+}
+
+static void wr_rollback(struct rxe_qp *qp)
+{
+	struct rxe_queue *q = qp->sq.queue;
+	uint32_t producer = atomic_load_explicit(&q->producer_index,
+						 memory_order_relaxed);
+
+	qp->ssn -= (qp->cur_index - producer) & q->index_mask;
+	qp->cur_index = producer;
+}
+
+static int wr_complete(struct ibv_qp_ex *ibqp)
+{
+	struct rxe_qp *qp = to_rqp_ex(ibqp);
+	struct rxe_queue *q = qp->sq.queue;
+	int err = qp->err;
+
+	if (err) {
+		wr_rollback(qp);
+		rxe_wq_unlock(&qp->sq);
+		return err;
+	}
+
+	if (qp->cur_index == atomic_load_explicit(&q->producer_index,
+						  memory_order_relaxed)) {
+		rxe_wq_unlock(&qp->sq);
+		return 0;
+	}
+
+	atomic_thread_fence(memory_order_release);
+	atomic_store(&q->producer_index, qp->cur_index);
+
+	rxe_wq_unlock(&qp->sq);
+
+	return post_send_db(&qp->ibv_qp);
+}
+
+static void wr_abort(struct ibv_qp_ex *ibqp)
+{
+	struct rxe_qp *qp = to_rqp_ex(ibqp);
+
+	wr_rollback(qp);
+	rxe_wq_unlock(&qp->sq);
+}
+
+enum {
+	RXE_QP_EX_SUPPORTED_COMP_MASK = IBV_QP_INIT_ATTR_PD |
+					IBV_QP_INIT_ATTR_SEND_OPS_FLAGS,
+};
+
+enum {
+	RXE_SUP_RC_QP_SEND_OPS_FLAGS =
+		IBV_QP_EX_WITH_RDMA_WRITE | IBV_QP_EX_WITH_RDMA_WRITE_WITH_IMM |
+		IBV_QP_EX_WITH_SEND | IBV_QP_EX_WITH_SEND_WITH_IMM |
+		IBV_QP_EX_WITH_RDMA_READ | IBV_QP_EX_WITH_ATOMIC_CMP_AND_SWP |
+		IBV_QP_EX_WITH_ATOMIC_FETCH_AND_ADD | IBV_QP_EX_WITH_LOCAL_INV |
+		IBV_QP_EX_WITH_SEND_WITH_INV,
+
+	RXE_SUP_UC_QP_SEND_OPS_FLAGS =
+		IBV_QP_EX_WITH_RDMA_WRITE | IBV_QP_EX_WITH_RDMA_WRITE_WITH_IMM |
+		IBV_QP_EX_WITH_SEND | IBV_QP_EX_WITH_SEND_WITH_IMM |
+		IBV_QP_EX_WITH_SEND_WITH_INV,
+
+	RXE_SUP_UD_QP_SEND_OPS_FLAGS =
+		IBV_QP_EX_WITH_SEND | IBV_QP_EX_WITH_SEND_WITH_IMM,
+};
+
+static int check_qp_init_attr(struct ibv_qp_init_attr_ex *attr)
+{
+	uint64_t supported;
+
+	if (!check_comp_mask(attr->comp_mask, RXE_QP_EX_SUPPORTED_COMP_MASK))
+		return EOPNOTSUPP;
+
+	if (!(attr->comp_mask & IBV_QP_INIT_ATTR_SEND_OPS_FLAGS))
+		return 0;
+
+	switch (attr->qp_type) {
+	case IBV_QPT_RC:
+		supported = RXE_SUP_RC_QP_SEND_OPS_FLAGS;
+		break;
+	case IBV_QPT_UC:
+		supported = RXE_SUP_UC_QP_SEND_OPS_FLAGS;
+		break;
+	case IBV_QPT_UD:
+		supported = RXE_SUP_UD_QP_SEND_OPS_FLAGS;
+		break;
+	default:
+		return EOPNOTSUPP;
+	}
+
+	if (!check_comp_mask(attr->send_ops_flags, supported))
+		return EOPNOTSUPP;
+
+	return 0;
+}
+
+static void set_qp_send_ops(struct rxe_qp *qp, uint64_t flags)
+{
+	struct ibv_qp_ex *qpx = &qp->vqp.qp_ex;
+
+	if (flags & IBV_QP_EX_WITH_ATOMIC_CMP_AND_SWP)
+		qpx->wr_atomic_cmp_swp = wr_atomic_cmp_swp;
+	if (flags & IBV_QP_EX_WITH_ATOMIC_FETCH_AND_ADD)
+		qpx->wr_atomic_fetch_add = wr_atomic_fetch_add;
+	if (flags & IBV_QP_EX_WITH_LOCAL_INV)
+		qpx->wr_local_inv = wr_local_inv;
+	if (flags & IBV_QP_EX_WITH_RDMA_READ)
+		qpx->wr_rdma_read = wr_rdma_read;
+	if (flags & IBV_QP_EX_WITH_RDMA_WRITE)
+		qpx->wr_rdma_write = wr_rdma_write;
+	if (flags & IBV_QP_EX_WITH_RDMA_WRITE_WITH_IMM)
+		qpx->wr_rdma_write_imm = wr_rdma_write_imm;
+	if (flags & IBV_QP_EX_WITH_SEND)
+		qpx->wr_send = wr_send;
+	if (flags & IBV_QP_EX_WITH_SEND_WITH_IMM)
+		qpx->wr_send_imm = wr_send_imm;
+	if (flags & IBV_QP_EX_WITH_SEND_WITH_INV)
+		qpx->wr_send_inv = wr_send_inv;
+
+	qpx->wr_set_ud_addr = wr_set_ud_addr;
+	qpx->wr_set_inline_data = wr_set_inline_data;
+	qpx->wr_set_inline_data_list = wr_set_inline_data_list;
+	qpx->wr_set_sge = wr_set_sge;
+	qpx->wr_set_sge_list = wr_set_sge_list;
+
+	qpx->wr_start = wr_start;
+	qpx->wr_complete = wr_complete;
+	qpx->wr_abort = wr_abort;
+}
+
+static struct ibv_qp *rxe_create_qp_ex(struct ibv_context *context,
+				       struct ibv_qp_init_attr_ex *attr)
+{
+	struct urxe_create_qp cmd = {};
+	struct urxe_create_qp_resp resp = {};
+	struct rxe_qp *qp;
+	int ret;
+
+	ret = check_qp_init_attr(attr);
+	if (ret) {
+		errno = ret;
+		return NULL;
+	}
+
+	qp = calloc(1, sizeof(*qp));
+	if (!qp)
+		return NULL;
+
+	ret = ibv_cmd_create_qp_ex(context, &qp->vqp, sizeof(qp->vqp), attr,
+				   &cmd.ibv_cmd, sizeof(cmd),
+				   &resp.ibv_resp, sizeof(resp));
+	if (ret)
+		goto err_free;
+
+	ret = map_queue_pair(context->cmd_fd, qp, &attr->cap, attr->srq,
+			     &resp);
+	if (ret)
+		goto err_destroy;
+
+	if (attr->comp_mask & IBV_QP_INIT_ATTR_SEND_OPS_FLAGS) {
+		set_qp_send_ops(qp, attr->send_ops_flags);
+		qp->vqp.comp_mask |= VERBS_QP_EX;
+	}
+
+	return &qp->ibv_qp;
+
+err_destroy:
+	ibv_cmd_destroy_qp(&qp->ibv_qp);
+err_free:
+	free(qp);
+	errno = ret;
+	return NULL;
+}
+
 static int rxe_post_recv(struct ibv_qp *ibqp,
 			 struct ibv_recv_wr *recv_wr,
 			 struct ibv_recv_wr **bad_wr)
@@ -740,7 +1568,7 @@ static int rxe_post_recv(struct ibv_qp *ibqp,
 	if (!rq || !recv_wr || !rq->queue)
 		return EINVAL;
 
-	pthread_spin_lock(&rq->lock);
+	rxe_wq_lock(rq);
 
 	while (recv_wr) {
 		rc = rxe_post_one_recv(rq, recv_wr);
@@ -752,7 +1580,7 @@ static int rxe_post_recv(struct ibv_qp *ibqp,
 		recv_wr = recv_wr->next;
 	}
 
-	pthread_spin_unlock(&rq->lock);
+	rxe_wq_unlock(rq);
 
 	return rc;
 }
@@ -840,6 +1668,7 @@ static const struct verbs_context_ops rxe_ctx_ops = {
 	.reg_mr = rxe_reg_mr,
 	.dereg_mr = rxe_dereg_mr,
 	.create_cq = rxe_create_cq,
+	.create_cq_ex = rxe_create_cq_ex,
 	.poll_cq = rxe_poll_cq,
 	.req_notify_cq = ibv_cmd_req_notify_cq,
 	.resize_cq = rxe_resize_cq,
@@ -849,7 +1678,9 @@ static const struct verbs_context_ops rxe_ctx_ops = {
 	.query_srq = rxe_query_srq,
 	.destroy_srq = rxe_destroy_srq,
 	.post_srq_recv = rxe_post_srq_recv,
+	.post_srq_recv_bulk = rxe_post_srq_recv_bulk,
 	.create_qp = rxe_create_qp,
+	.create_qp_ex = rxe_create_qp_ex,
 	.query_qp = rxe_query_qp,
 	.modify_qp = rxe_modify_qp,
 	.destroy_qp = rxe_destroy_qp,
@@ -860,6 +1691,9 @@ static const struct verbs_context_ops rxe_ctx_ops = {
 	.attach_mcast = ibv_cmd_attach_mcast,
 	.detach_mcast = ibv_cmd_detach_mcast,
 	.free_context = rxe_free_context,
+	.alloc_td = rxe_alloc_td,
+	.dealloc_td = rxe_dealloc_td,
+	.alloc_parent_domain = rxe_alloc_parent_domain,
 };
 
 static struct verbs_context *rxe_alloc_context(struct ibv_device *ibdev,
@@ -36,6 +36,7 @@
 #ifndef RXE_H
 #define RXE_H
 
+#include <stdbool.h>
 #include <infiniband/driver.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -57,11 +58,32 @@ struct rxe_context {
 	struct verbs_context	ibv_ctx;
 };
 
+struct rxe_td {
+	struct ibv_td		ibv_td;
+	_Atomic(int)		refcount;
+};
+
+struct rxe_pd {
+	struct ibv_pd		ibv_pd;
+	/* Only set for parent domains */
+	struct rxe_pd		*protection_domain;
+	struct rxe_td		*td;
+	_Atomic(int)		refcount;
+};
+
 struct rxe_cq {
-	struct ibv_cq		ibv_cq;
+	union {
+		struct ibv_cq		ibv_cq;
+		struct ibv_cq_ex	ibv_cq_ex;
+	};
 	struct mminfo		mmap_info;
 	struct rxe_queue		*queue;
 	pthread_spinlock_t	lock;
+	/* CQE currently exposed through the ibv_cq_ex readers */
+	struct ib_uverbs_wc	*wc;
+	/* Next CQE to hand out between start_poll and end_poll */
+	uint32_t		cur_index;
+	bool			single_threaded;
 };
 
 struct rxe_ah {
@@ -74,15 +96,25 @@ struct rxe_wq {
 	pthread_spinlock_t	lock;
 	unsigned int		max_sge;
 	unsigned int		max_inline;
+	/* Owned by a thread domain, the post path runs without the lock */
+	bool			single_threaded;
 };
 
 struct rxe_qp {
-	struct ibv_qp		ibv_qp;
+	union {
+		struct ibv_qp		ibv_qp;
+		struct verbs_qp		vqp;
+	};
 	struct mminfo		rq_mmap_info;
 	struct rxe_wq		rq;
 	struct mminfo		sq_mmap_info;
 	struct rxe_wq		sq;
 	unsigned int		ssn;
+
+	/* ibv_wr_* state, only valid while sq.lock is held by wr_start */
+	struct rxe_send_wqe	*wqe;
+	uint32_t		cur_index;
+	int			err;
 };
 
 #define qp_type(qp)		((qp)->ibv_qp.qp_type)
@@ -106,16 +138,44 @@ static inline struct rxe_device *to_rdev(struct ibv_device *ibdev)
 	return container_of(ibdev, struct rxe_device, ibv_dev.device);
 }
 
+static inline struct rxe_td *to_rtd(struct ibv_td *ibtd)
+{
+	return container_of(ibtd, struct rxe_td, ibv_td);
+}
+
+static inline struct rxe_pd *to_rpd(struct ibv_pd *ibpd)
+{
+	return container_of(ibpd, struct rxe_pd, ibv_pd);
+}
+
+/* QPs and SRQs created on a parent domain with a thread domain */
+static inline bool rxe_pd_single_threaded(struct ibv_pd *ibpd)
+{
+	struct rxe_pd *pd = to_rpd(ibpd);
+
+	return pd->protection_domain && pd->td;
+}
+
 static inline struct rxe_cq *to_rcq(struct ibv_cq *ibcq)
 {
 	return to_rxxx(cq, cq);
 }
 
+static inline struct rxe_cq *to_rcq_ex(struct ibv_cq_ex *ibcq)
+{
+	return container_of(ibcq, struct rxe_cq, ibv_cq_ex);
+}
+
 static inline struct rxe_qp *to_rqp(struct ibv_qp *ibqp)
 {
 	return to_rxxx(qp, qp);
 }
 
+static inline struct rxe_qp *to_rqp_ex(struct ibv_qp_ex *ibqp)
+{
+	return container_of(ibqp, struct rxe_qp, vqp.qp_ex);
+}
+
 static inline struct rxe_srq *to_rsrq(struct ibv_srq *ibsrq)
 {
 	return to_rxxx(srq, srq);
@@ -19,6 +19,8 @@
 
 static const int siw_debug;
 static void siw_free_context(struct ibv_context *ibv_ctx);
+static void siw_set_qp_send_ops(struct siw_qp *qp, uint64_t flags);
+static void siw_init_sqe_flags(struct siw_qp *qp);
 
 static int siw_query_device(struct ibv_context *ctx,
 			    struct ibv_device_attr *attr)
@@ -69,7 +71,7 @@ static struct ibv_pd *siw_alloc_pd(struct ibv_context *ctx)
 {
 	struct ibv_alloc_pd cmd;
 	struct ib_uverbs_alloc_pd_resp resp;
-	struct ibv_pd *pd;
+	struct siw_pd *pd;
 
 	memset(&cmd, 0, sizeof(cmd));
 
@@ -77,18 +79,33 @@ static struct ibv_pd *siw_alloc_pd(struct ibv_context *ctx)
 	if (!pd)
 		return NULL;
 
-	if (ibv_cmd_alloc_pd(ctx, pd, &cmd, sizeof(cmd), &resp, sizeof(resp))) {
+	if (ibv_cmd_alloc_pd(ctx, &pd->base_pd, &cmd, sizeof(cmd), &resp,
+			     sizeof(resp))) {
 		free(pd);
 		return NULL;
 	}
-	return pd;
+	atomic_init(&pd->refcount, 1);
+
+	return &pd->base_pd;
 }
 
-static int siw_free_pd(struct ibv_pd *pd)
+static int siw_free_pd(struct ibv_pd *base_pd)
 {
+	struct siw_pd *pd = pd_base2siw(base_pd);
 	int rv;
 
-	rv = ibv_cmd_dealloc_pd(pd);
+	if (atomic_load(&pd->refcount) > 1)
+		return EBUSY;
+
+	if (pd->protection_domain) {
+		atomic_fetch_sub(&pd->protection_domain->refcount, 1);
+		if (pd->td)
+			atomic_fetch_sub(&pd->td->refcount, 1);
+		free(pd);
+		return 0;
+	}
+
+	rv = ibv_cmd_dealloc_pd(base_pd);
 	if (rv)
 		return rv;
 
@@ -96,6 +113,71 @@ static int siw_free_pd(struct ibv_pd *pd)
 	return 0;
 }
 
+static struct ibv_td *siw_alloc_td(struct ibv_context *ctx,
+				   struct ibv_td_init_attr *attr)
+{
+	struct siw_td *td;
+
+	if (attr->comp_mask) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	td = calloc(1, sizeof(*td));
+	if (!td) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	td->base_td.context = ctx;
+	atomic_init(&td->refcount, 1);
+
+	return &td->base_td;
+}
+
+static int siw_dealloc_td(struct ibv_td *base_td)
+{
+	struct siw_td *td = td_base2siw(base_td);
+
+	if (atomic_load(&td->refcount) > 1)
+		return EBUSY;
+
+	free(td);
+	return 0;
+}
+
+static struct ibv_pd *
+siw_alloc_parent_domain(struct ibv_context *ctx,
+			struct ibv_parent_domain_init_attr *attr)
+{
+	struct siw_pd *pd;
+
+	if (ibv_check_alloc_parent_domain(attr))
+		return NULL;
+
+	if (attr->comp_mask) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pd = calloc(1, sizeof(*pd));
+	if (!pd) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (attr->td) {
+		pd->td = td_base2siw(attr->td);
+		atomic_fetch_add(&pd->td->refcount, 1);
+	}
+	pd->protection_domain = pd_base2siw(attr->pd);
+	atomic_fetch_add(&pd->protection_domain->refcount, 1);
+	atomic_init(&pd->refcount, 1);
+
+	ibv_initialize_parent_domain(&pd->base_pd,
+				     &pd->protection_domain->base_pd);
+
+	return &pd->base_pd;
+}
+
 static struct ibv_mr *siw_reg_mr(struct ibv_pd *pd, void *addr, size_t len,
 				 uint64_t hca_va, int access)
 {
@@ -131,6 +213,38 @@ static int siw_dereg_mr(struct verbs_mr *base_mr)
 	return 0;
 }
 
+static int siw_map_cq(struct ibv_context *ctx, struct siw_cq *cq,
+		      struct siw_uresp_create_cq *resp)
+{
+	int cq_size;
+
+	if (resp->cq_key == SIW_INVAL_UOBJ_KEY) {
+		if (siw_debug)
+			printf("libsiw: prepare CQ mapping failed\n");
+		return -1;
+	}
+	pthread_spin_init(&cq->lock, PTHREAD_PROCESS_PRIVATE);
+	cq->id = resp->cq_id;
+	cq->num_cqe = resp->num_cqe;
+
+	cq_size = resp->num_cqe * sizeof(struct siw_cqe) +
+		  sizeof(struct siw_cq_ctrl);
+
+	cq->queue = mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED, ctx->cmd_fd, resp->cq_key);
+
+	if (cq->queue == MAP_FAILED) {
+		if (siw_debug)
+			printf("libsiw: CQ mapping failed: %d", errno);
+		cq->queue = NULL;
+		return -1;
+	}
+	cq->ctrl = (struct siw_cq_ctrl *)&cq->queue[cq->num_cqe];
+	cq->ctrl->flags = SIW_NOTIFY_NOT;
+
+	return 0;
+}
+
 static struct ibv_cq *siw_create_cq(struct ibv_context *ctx, int num_cqe,
 				    struct ibv_comp_channel *channel,
 				    int comp_vector)
@@ -138,7 +252,7 @@ static struct ibv_cq *siw_create_cq(struct ibv_context *ctx, int num_cqe,
 	struct siw_cmd_create_cq cmd = {};
 	struct siw_cmd_create_cq_resp resp = {};
 	struct siw_cq *cq;
-	int cq_size, rv;
+	int rv;
 
 	cq = calloc(1, sizeof(*cq));
 	if (!cq)
@@ -153,28 +267,8 @@ static struct ibv_cq *siw_create_cq(struct ibv_context *ctx, int num_cqe,
 		free(cq);
 		return NULL;
 	}
-	if (resp.cq_key == SIW_INVAL_UOBJ_KEY) {
-		if (siw_debug)
-			printf("libsiw: prepare CQ mapping failed\n");
-		goto fail;
-	}
-	pthread_spin_init(&cq->lock, PTHREAD_PROCESS_PRIVATE);
-	cq->id = resp.cq_id;
-	cq->num_cqe = resp.num_cqe;
-
-	cq_size = resp.num_cqe * sizeof(struct siw_cqe) +
-		  sizeof(struct siw_cq_ctrl);
-
-	cq->queue = mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
-			 MAP_SHARED, ctx->cmd_fd, resp.cq_key);
-
-	if (cq->queue == MAP_FAILED) {
-		if (siw_debug)
-			printf("libsiw: CQ mapping failed: %d", errno);
+	if (siw_map_cq(ctx, cq, &resp.drv_payload))
 		goto fail;
-	}
-	cq->ctrl = (struct siw_cq_ctrl *)&cq->queue[cq->num_cqe];
-	cq->ctrl->flags = SIW_NOTIFY_NOT;
 
 	return &cq->base_cq;
 fail:
@@ -239,6 +333,7 @@ static struct ibv_srq *siw_create_srq(struct ibv_pd *pd,
 		goto fail;
 	}
 	pthread_spin_init(&srq->lock, PTHREAD_PROCESS_PRIVATE);
+	srq->single_threaded = siw_pd_single_threaded(pd);
 	rq_size = resp.num_rqe * sizeof(struct siw_rqe);
 	srq->num_rqe = resp.num_rqe;
 
@@ -294,24 +389,34 @@ static int siw_destroy_srq(struct ibv_srq *base_srq)
 	return 0;
 }
 
-static struct ibv_qp *siw_create_qp(struct ibv_pd *pd,
-				    struct ibv_qp_init_attr *attr)
+#define SIW_SUP_QP_SEND_OPS_FLAGS                                             \
+	(IBV_QP_EX_WITH_RDMA_WRITE | IBV_QP_EX_WITH_SEND |                     \
+	 IBV_QP_EX_WITH_RDMA_READ | IBV_QP_EX_WITH_SEND_WITH_INV)
+
+static struct ibv_qp *siw_create_qp_ex(struct ibv_context *base_ctx,
+				       struct ibv_qp_init_attr_ex *attr)
 {
 	struct siw_cmd_create_qp cmd = {};
 	struct siw_cmd_create_qp_resp resp = {};
 	struct siw_qp *qp;
-	struct ibv_context *base_ctx = pd->context;
 	int sq_size, rq_size, rv;
 
-	memset(&cmd, 0, sizeof(cmd));
-	memset(&resp, 0, sizeof(resp));
+	if (!check_comp_mask(attr->comp_mask, IBV_QP_INIT_ATTR_PD |
+			     IBV_QP_INIT_ATTR_SEND_OPS_FLAGS) ||
+	    (attr->comp_mask & IBV_QP_INIT_ATTR_SEND_OPS_FLAGS &&
+	     !check_comp_mask(attr->send_ops_flags,
+			      SIW_SUP_QP_SEND_OPS_FLAGS))) {
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
 
 	qp = calloc(1, sizeof(*qp));
 	if (!qp)
 		return NULL;
 
-	rv = ibv_cmd_create_qp(pd, &qp->base_qp, attr, &cmd.ibv_cmd,
-			       sizeof(cmd), &resp.ibv_resp, sizeof(resp));
+	rv = ibv_cmd_create_qp_ex(base_ctx, &qp->vqp, sizeof(qp->vqp), attr,
+				  &cmd.ibv_cmd, sizeof(cmd), &resp.ibv_resp,
+				  sizeof(resp));
 
 	if (rv) {
 		if (siw_debug)
@@ -329,6 +434,7 @@ static struct ibv_qp *siw_create_qp(struct ibv_pd *pd,
 	qp->num_sqe = resp.num_sqe;
 	qp->num_rqe = resp.num_rqe;
 	qp->sq_sig_all = attr->sq_sig_all;
+	siw_init_sqe_flags(qp);
 
 	/* Init doorbell request structure */
 	qp->db_req.hdr.command = IB_USER_VERBS_CMD_POST_SEND;
@@ -341,6 +447,7 @@ static struct ibv_qp *siw_create_qp(struct ibv_pd *pd,
 
 	pthread_spin_init(&qp->sq_lock, PTHREAD_PROCESS_PRIVATE);
 	pthread_spin_init(&qp->rq_lock, PTHREAD_PROCESS_PRIVATE);
+	qp->single_threaded = siw_pd_single_threaded(attr->pd);
 
 	sq_size = resp.num_sqe * sizeof(struct siw_sqe);
 
@@ -372,6 +479,11 @@ static struct ibv_qp *siw_create_qp(struct ibv_pd *pd,
 	}
 	qp->db_req.qp_handle = qp->base_qp.handle;
 
+	if (attr->comp_mask & IBV_QP_INIT_ATTR_SEND_OPS_FLAGS) {
+		siw_set_qp_send_ops(qp, attr->send_ops_flags);
+		qp->vqp.comp_mask |= VERBS_QP_EX;
+	}
+
 	return &qp->base_qp;
 fail:
 	ibv_cmd_destroy_qp(&qp->base_qp);
@@ -386,6 +498,23 @@ fail:
 	return NULL;
 }
 
+static struct ibv_qp *siw_create_qp(struct ibv_pd *pd,
+				    struct ibv_qp_init_attr *attr)
+{
+	struct ibv_qp_init_attr_ex attr_ex = {};
+	struct ibv_qp *base_qp;
+
+	memcpy(&attr_ex, attr, sizeof(*attr));
+	attr_ex.comp_mask = IBV_QP_INIT_ATTR_PD;
+	attr_ex.pd = pd;
+
+	base_qp = siw_create_qp_ex(pd->context, &attr_ex);
+	if (base_qp)
+		memcpy(attr, &attr_ex, sizeof(*attr));
+
+	return base_qp;
+}
+
 static int siw_modify_qp(struct ibv_qp *base_qp, struct ibv_qp_attr *attr,
 			 int attr_mask)
 {
@@ -528,10 +657,22 @@ static inline uint16_t map_send_flags(int ibv_flags)
 	return flags;
 }
 
-static inline int push_send_wqe(struct ibv_send_wr *base_wr,
-				struct siw_sqe *siw_sqe, int sig_all)
+static void siw_init_sqe_flags(struct siw_qp *qp)
 {
-	uint32_t flags = map_send_flags(base_wr->send_flags);
+	unsigned int i;
+
+	for (i = 0; i <= SIW_SEND_FLAGS_MASK; i++) {
+		qp->sqe_flags[i] = map_send_flags(i);
+		if (qp->sq_sig_all)
+			qp->sqe_flags[i] |= SIW_WQE_SIGNALLED;
+	}
+}
+
+static inline int push_send_wqe(struct siw_qp *qp, struct ibv_send_wr *base_wr,
+				struct siw_sqe *siw_sqe)
+{
+	uint16_t flags = qp->sqe_flags[base_wr->send_flags &
+				       SIW_SEND_FLAGS_MASK];
 	atomic_ushort *fp = (atomic_ushort *)&siw_sqe->flags;
 
 	siw_sqe->id = base_wr->wr_id;
@@ -546,10 +687,27 @@ static inline int push_send_wqe(struct ibv_send_wr *base_wr,
 			       base_wr->opcode);
 		return -EINVAL;
 	}
-	if (sig_all)
-		flags |= SIW_WQE_SIGNALLED;
 
-	if (flags & SIW_WQE_INLINE) {
+	/*
+	 * Fast path for the common single buffer case, avoiding the
+	 * generic SGE list walk and copy.
+	 */
+	if (base_wr->num_sge == 1) {
+		const struct ibv_sge *sge = base_wr->sg_list;
+
+		if (flags & SIW_WQE_INLINE) {
+			if (sge->length > SIW_MAX_INLINE)
+				return -EINVAL;
+
+			memcpy(&siw_sqe->sge[1], (void *)(uintptr_t)sge->addr,
+			       sge->length);
+			siw_sqe->sge[0].length = sge->length;
+		} else {
+			siw_sqe->sge[0].laddr = sge->addr;
+			siw_sqe->sge[0].length = sge->length;
+			siw_sqe->sge[0].lkey = sge->lkey;
+		}
+	} else if (flags & SIW_WQE_INLINE) {
 		char *data = (char *)&siw_sqe->sge[1];
 		int bytes = 0, i = 0;
 
@@ -582,6 +740,27 @@ static inline int push_send_wqe(struct ibv_send_wr *base_wr,
 	return 0;
 }
 
+/*
+ * If last WQE pushed before position where current post_send
+ * started is idle, we assume SQ is not being actively
+ * processed. Only then, the doorbell call will be issued.
+ * This may significantly reduce unnecessary doorbell calls
+ * on a busy SQ. We also always ring the doorbell, if the
+ * complete SQ was re-written during current post_send.
+ */
+static int siw_sq_kick(struct siw_qp *qp, uint32_t new_sqe)
+{
+	if (new_sqe < qp->num_sqe) {
+		uint32_t old_idx = (qp->sq_put - 1) % qp->num_sqe;
+		struct siw_sqe *old_sqe = &qp->sendq[old_idx];
+		atomic_ushort *fp = (atomic_ushort *)&old_sqe->flags;
+
+		if (atomic_load(fp) & SIW_WQE_VALID)
+			return 0;
+	}
+	return siw_db(qp);
+}
+
 static int siw_post_send(struct ibv_qp *base_qp, struct ibv_send_wr *wr,
 			 struct ibv_send_wr **bad_wr)
 {
@@ -592,7 +771,7 @@ static int siw_post_send(struct ibv_qp *base_qp, struct ibv_send_wr *wr,
 
 	*bad_wr = NULL;
 
-	pthread_spin_lock(&qp->sq_lock);
+	siw_lock(&qp->sq_lock, qp->single_threaded);
 
 	sq_put = qp->sq_put;
 
@@ -608,7 +787,7 @@ static int siw_post_send(struct ibv_qp *base_qp, struct ibv_send_wr *wr,
 		sqe_flags = atomic_load(fp);
 
 		if (!(sqe_flags & SIW_WQE_VALID)) {
-			rv = push_send_wqe(wr, sqe, qp->sq_sig_all);
+			rv = push_send_wqe(qp, wr, sqe);
 			if (rv) {
 				*bad_wr = wr;
 				break;
@@ -626,34 +805,253 @@ static int siw_post_send(struct ibv_qp *base_qp, struct ibv_send_wr *wr,
 		wr = wr->next;
 	}
 	if (new_sqe) {
-		/*
-		 * If last WQE pushed before position where current post_send
-		 * started is idle, we assume SQ is not being actively
-		 * processed. Only then, the doorbell call will be issued.
-		 * This may significantly reduce unnecessary doorbell calls
-		 * on a busy SQ. We also always ring the doorbell, if the
-		 * complete SQ was re-written during current post_send.
-		 */
-		if (new_sqe < qp->num_sqe) {
-			uint32_t old_idx = (qp->sq_put - 1) % qp->num_sqe;
-			struct siw_sqe *old_sqe = &qp->sendq[old_idx];
-
-			fp = (atomic_ushort *)&old_sqe->flags;
-			if (!(atomic_load(fp) & SIW_WQE_VALID))
-				rv = siw_db(qp);
-		} else {
-			rv = siw_db(qp);
-		}
+		rv = siw_sq_kick(qp, new_sqe);
 		if (rv)
 			*bad_wr = wr;
 
 		qp->sq_put = sq_put;
 	}
-	pthread_spin_unlock(&qp->sq_lock);
+	siw_unlock(&qp->sq_lock, qp->single_threaded);
 
 	return rv;
 }
 
+/*
+ * ibv_wr_* builders fill SQEs in place but leave SIW_WQE_VALID clear, so the
+ * kernel does not pick them up. wr_complete then validates the whole batch in
+ * order and rings the doorbell at most once.
+ */
+static struct siw_sqe *siw_wr_next_sqe(struct siw_qp *qp,
+				       enum siw_opcode opcode)
+{
+	struct ibv_qp_ex *qpx = &qp->vqp.qp_ex;
+	struct siw_sqe *sqe;
+	uint16_t flags;
+
+	if (qp->wr_err)
+		return NULL;
+
+	sqe = &qp->sendq[qp->wr_put % qp->num_sqe];
+	if (qp->wr_put - qp->sq_put >= qp->num_sqe ||
+	    atomic_load((atomic_ushort *)&sqe->flags) & SIW_WQE_VALID) {
+		qp->wr_err = ENOMEM;
+		return NULL;
+	}
+
+	flags = qp->sqe_flags[qpx->wr_flags & SIW_SEND_FLAGS_MASK &
+			      ~IBV_SEND_INLINE] & ~SIW_WQE_VALID;
+
+	sqe->id = qpx->wr_id;
+	sqe->opcode = opcode;
+	sqe->num_sge = 0;
+	sqe->raddr = 0;
+	sqe->rkey = 0;
+	atomic_store((atomic_ushort *)&sqe->flags, flags);
+
+	qp->wr_sqe = sqe;
+	qp->wr_put++;
+	return sqe;
+}
+
+static void siw_wr_rdma_read(struct ibv_qp_ex *base_qp, uint32_t rkey,
+			     uint64_t remote_addr)
+{
+	struct siw_sqe *sqe = siw_wr_next_sqe(qp_ex2siw(base_qp), SIW_OP_READ);
+
+	if (!sqe)
+		return;
+
+	sqe->raddr = remote_addr;
+	sqe->rkey = rkey;
+}
+
+static void siw_wr_rdma_write(struct ibv_qp_ex *base_qp, uint32_t rkey,
+			      uint64_t remote_addr)
+{
+	struct siw_sqe *sqe = siw_wr_next_sqe(qp_ex2siw(base_qp), SIW_OP_WRITE);
+
+	if (!sqe)
+		return;
+
+	sqe->raddr = remote_addr;
+	sqe->rkey = rkey;
+}
+
+static void siw_wr_send(struct ibv_qp_ex *base_qp)
+{
+	siw_wr_next_sqe(qp_ex2siw(base_qp), SIW_OP_SEND);
+}
+
+static void siw_wr_send_inv(struct ibv_qp_ex *base_qp,
+			    uint32_t invalidate_rkey)
+{
+	struct siw_sqe *sqe;
+
+	sqe = siw_wr_next_sqe(qp_ex2siw(base_qp), SIW_OP_SEND_REMOTE_INV);
+	if (!sqe)
+		return;
+
+	sqe->rkey = invalidate_rkey;
+}
+
+static void siw_wr_set_sge(struct ibv_qp_ex *base_qp, uint32_t lkey,
+			   uint64_t addr, uint32_t length)
+{
+	struct siw_qp *qp = qp_ex2siw(base_qp);
+	struct siw_sqe *sqe = qp->wr_sqe;
+
+	if (qp->wr_err)
+		return;
+
+	sqe->sge[0].laddr = addr;
+	sqe->sge[0].length = length;
+	sqe->sge[0].lkey = lkey;
+	sqe->num_sge = 1;
+}
+
+static void siw_wr_set_sge_list(struct ibv_qp_ex *base_qp, size_t num_sge,
+				const struct ibv_sge *sg_list)
+{
+	struct siw_qp *qp = qp_ex2siw(base_qp);
+	struct siw_sqe *sqe = qp->wr_sqe;
+
+	if (qp->wr_err)
+		return;
+
+	if (num_sge > SIW_MAX_SGE) {
+		qp->wr_err = EINVAL;
+		return;
+	}
+
+	/* this assumes same layout of siw and base SGE */
+	memcpy(sqe->sge, sg_list, num_sge * sizeof(struct ibv_sge));
+	sqe->num_sge = num_sge;
+}
+
+static void siw_wr_set_inline_data_list(struct ibv_qp_ex *base_qp,
+					size_t num_buf,
+					const struct ibv_data_buf *buf_list)
+{
+	struct siw_qp *qp = qp_ex2siw(base_qp);
+	struct siw_sqe *sqe = qp->wr_sqe;
+	char *data = (char *)&sqe->sge[1];
+	size_t bytes = 0, i;
+
+	if (qp->wr_err)
+		return;
+
+	for (i = 0; i < num_buf; i++)
+		bytes += buf_list[i].length;
+
+	if (bytes > SIW_MAX_INLINE) {
+		qp->wr_err = EINVAL;
+		return;
+	}
+
+	for (i = 0; i < num_buf; i++) {
+		memcpy(data, buf_list[i].addr, buf_list[i].length);
+		data += buf_list[i].length;
+	}
+	sqe->sge[0].length = bytes;
+	sqe->num_sge = 1;
+	sqe->flags |= SIW_WQE_INLINE;
+}
+
+static void siw_wr_set_inline_data(struct ibv_qp_ex *base_qp, void *addr,
+				   size_t length)
+{
+	struct ibv_data_buf buf = { .addr = addr, .length = length };
+
+	siw_wr_set_inline_data_list(base_qp, 1, &buf);
+}
+
+static void siw_wr_set_ud_addr(struct ibv_qp_ex *base_qp, struct ibv_ah *ah,
+			       uint32_t remote_qpn, uint32_t remote_qkey)
+{
+	qp_ex2siw(base_qp)->wr_err = EOPNOTSUPP;
+}
+
+static void siw_wr_start(struct ibv_qp_ex *base_qp)
+{
+	struct siw_qp *qp = qp_ex2siw(base_qp);
+
+	siw_lock(&qp->sq_lock, qp->single_threaded);
+
+	qp->wr_err = 0;
+	qp->wr_put = qp->sq_put;
+}
+
+static void siw_wr_rollback(struct siw_qp *qp)
+{
+	for (; qp->wr_put != qp->sq_put; qp->wr_put--) {
+		struct siw_sqe *sqe = &qp->sendq[(qp->wr_put - 1) % qp->num_sqe];
+
+		atomic_store((atomic_ushort *)&sqe->flags, 0);
+	}
+}
+
+static int siw_wr_complete(struct ibv_qp_ex *base_qp)
+{
+	struct siw_qp *qp = qp_ex2siw(base_qp);
+	uint32_t new_sqe = qp->wr_put - qp->sq_put;
+	uint32_t sq_put;
+	int rv = qp->wr_err;
+
+	if (rv) {
+		siw_wr_rollback(qp);
+		goto out;
+	}
+	if (!new_sqe)
+		goto out;
+
+	for (sq_put = qp->sq_put; sq_put != qp->wr_put; sq_put++) {
+		struct siw_sqe *sqe = &qp->sendq[sq_put % qp->num_sqe];
+		atomic_ushort *fp = (atomic_ushort *)&sqe->flags;
+
+		atomic_store(fp, atomic_load_explicit(fp,
+						      memory_order_relaxed) |
+				 SIW_WQE_VALID);
+	}
+	rv = siw_sq_kick(qp, new_sqe);
+	qp->sq_put = qp->wr_put;
+out:
+	siw_unlock(&qp->sq_lock, qp->single_threaded);
+
+	return rv;
+}
+
+static void siw_wr_abort(struct ibv_qp_ex *base_qp)
+{
+	struct siw_qp *qp = qp_ex2siw(base_qp);
+
+	siw_wr_rollback(qp);
+	siw_unlock(&qp->sq_lock, qp->single_threaded);
+}
+
+static void siw_set_qp_send_ops(struct siw_qp *qp, uint64_t flags)
+{
+	struct ibv_qp_ex *qpx = &qp->vqp.qp_ex;
+
+	if (flags & IBV_QP_EX_WITH_RDMA_READ)
+		qpx->wr_rdma_read = siw_wr_rdma_read;
+	if (flags & IBV_QP_EX_WITH_RDMA_WRITE)
+		qpx->wr_rdma_write = siw_wr_rdma_write;
+	if (flags & IBV_QP_EX_WITH_SEND)
+		qpx->wr_send = siw_wr_send;
+	if (flags & IBV_QP_EX_WITH_SEND_WITH_INV)
+		qpx->wr_send_inv = siw_wr_send_inv;
+
+	qpx->wr_set_ud_addr = siw_wr_set_ud_addr;
+	qpx->wr_set_inline_data = siw_wr_set_inline_data;
+	qpx->wr_set_inline_data_list = siw_wr_set_inline_data_list;
+	qpx->wr_set_sge = siw_wr_set_sge;
+	qpx->wr_set_sge_list = siw_wr_set_sge_list;
+
+	qpx->wr_start = siw_wr_start;
+	qpx->wr_complete = siw_wr_complete;
+	qpx->wr_abort = siw_wr_abort;
+}
+
 static inline int push_recv_wqe(struct ibv_recv_wr *base_wr,
 				struct siw_rqe *siw_rqe)
 {
@@ -685,7 +1083,7 @@ static int siw_post_recv(struct ibv_qp *base_qp, struct ibv_recv_wr *wr,
 	uint32_t rq_put;
 	int rv = 0;
 
-	pthread_spin_lock(&qp->rq_lock);
+	siw_lock(&qp->rq_lock, qp->single_threaded);
 
 	rq_put = qp->rq_put;
 
@@ -714,7 +1112,7 @@ static int siw_post_recv(struct ibv_qp *base_qp, struct ibv_recv_wr *wr,
 	}
 	qp->rq_put = rq_put;
 
-	pthread_spin_unlock(&qp->rq_lock);
+	siw_unlock(&qp->rq_lock, qp->single_threaded);
 
 	return rv;
 }
@@ -726,7 +1124,7 @@ static int siw_post_srq_recv(struct ibv_srq *base_srq, struct ibv_recv_wr *wr,
 	uint32_t srq_put;
 	int rv = 0;
 
-	pthread_spin_lock(&srq->lock);
+	siw_lock(&srq->lock, srq->single_threaded);
 
 	srq_put = srq->rq_put;
 
@@ -754,8 +1152,53 @@ static int siw_post_srq_recv(struct ibv_srq *base_srq, struct ibv_recv_wr *wr,
 	}
 	srq->rq_put = srq_put;
 
-	pthread_spin_unlock(&srq->lock);
+	siw_unlock(&srq->lock, srq->single_threaded);
+
+	return rv;
+}
+
+/*
+ * The kernel consumes each RQE as soon as its VALID flag is set, so
+ * there is nothing to batch beyond the lock; what is saved is walking
+ * the WR list and the per-WR SGE count checks.
+ */
+static int siw_post_srq_recv_bulk(struct ibv_srq *base_srq, uint32_t num_wr,
+				  const uint64_t *wr_id,
+				  const struct ibv_sge *sg_list,
+				  uint32_t *num_posted)
+{
+	struct siw_srq *srq = srq_base2siw(base_srq);
+	uint32_t srq_put, i;
+	int rv = 0;
+
+	siw_lock(&srq->lock, srq->single_threaded);
+
+	srq_put = srq->rq_put;
+
+	for (i = 0; i < num_wr; i++) {
+		struct siw_rqe *rqe = &srq->recvq[srq_put % srq->num_rqe];
+		atomic_ushort *fp = (atomic_ushort *)&rqe->flags;
+
+		if (atomic_load(fp) & SIW_WQE_VALID) {
+			if (siw_debug)
+				printf("libsiw: SRQ[%p]: SRQ overflow\n", srq);
+			rv = ENOMEM;
+			break;
+		}
+		rqe->id = wr_id[i];
+		rqe->num_sge = 1;
+		rqe->sge[0].laddr = sg_list[i].addr;
+		rqe->sge[0].length = sg_list[i].length;
+		rqe->sge[0].lkey = sg_list[i].lkey;
+
+		atomic_store(fp, SIW_WQE_VALID);
+		srq_put++;
+	}
+	srq->rq_put = srq_put;
 
+	siw_unlock(&srq->lock, srq->single_threaded);
+
+	*num_posted = i;
 	return rv;
 }
 
@@ -810,7 +1253,7 @@ static int siw_poll_cq(struct ibv_cq *ibcq, int num_entries, struct ibv_wc *wc)
 	struct siw_cq *cq = cq_base2siw(ibcq);
 	int new = 0;
 
-	pthread_spin_lock(&cq->lock);
+	siw_lock(&cq->lock, cq->single_threaded);
 
 	for (; num_entries--; wc++) {
 		struct siw_cqe *cqe = &cq->queue[cq->cq_get % cq->num_cqe];
@@ -824,19 +1267,164 @@ static int siw_poll_cq(struct ibv_cq *ibcq, int num_entries, struct ibv_wc *wc)
 		} else
 			break;
 	}
-	pthread_spin_unlock(&cq->lock);
+	siw_unlock(&cq->lock, cq->single_threaded);
 
 	return new;
 }
 
+/*
+ * Extended CQ polling reads CQEs in place. A CQE is handed back to the
+ * kernel, by clearing its valid flag, once the next one is requested or
+ * polling ends.
+ */
+static inline void siw_cq_release_cur(struct siw_cq *cq)
+{
+	atomic_store((atomic_uchar *)&cq->cur_cqe->flags, 0);
+	cq->cq_get++;
+	cq->cur_cqe = NULL;
+}
+
+static inline int siw_cq_read_next(struct siw_cq *cq)
+{
+	struct siw_cqe *cqe = &cq->queue[cq->cq_get % cq->num_cqe];
+
+	if (!(atomic_load((atomic_uchar *)&cqe->flags) & SIW_WQE_VALID))
+		return ENOENT;
+
+	cq->cur_cqe = cqe;
+	cq->base_cq_ex.wr_id = cqe->id;
+	cq->base_cq_ex.status = map_cqe_status[cqe->status].base;
+	return 0;
+}
+
+static int siw_start_poll(struct ibv_cq_ex *base_cq,
+			  struct ibv_poll_cq_attr *attr)
+{
+	struct siw_cq *cq = cq_ex2siw(base_cq);
+	int rv;
+
+	if (attr->comp_mask)
+		return EINVAL;
+
+	siw_lock(&cq->lock, cq->single_threaded);
+	rv = siw_cq_read_next(cq);
+	if (rv)
+		siw_unlock(&cq->lock, cq->single_threaded);
+
+	return rv;
+}
+
+static int siw_next_poll(struct ibv_cq_ex *base_cq)
+{
+	struct siw_cq *cq = cq_ex2siw(base_cq);
+
+	siw_cq_release_cur(cq);
+	return siw_cq_read_next(cq);
+}
+
+static void siw_end_poll(struct ibv_cq_ex *base_cq)
+{
+	struct siw_cq *cq = cq_ex2siw(base_cq);
+
+	if (cq->cur_cqe)
+		siw_cq_release_cur(cq);
+	siw_unlock(&cq->lock, cq->single_threaded);
+}
+
+static enum ibv_wc_opcode siw_wc_read_opcode(struct ibv_cq_ex *base_cq)
+{
+	return map_cqe_opcode[cq_ex2siw(base_cq)->cur_cqe->opcode].base;
+}
+
+static uint32_t siw_wc_read_vendor_err(struct ibv_cq_ex *base_cq)
+{
+	return 0;
+}
+
+static uint32_t siw_wc_read_byte_len(struct ibv_cq_ex *base_cq)
+{
+	return cq_ex2siw(base_cq)->cur_cqe->bytes;
+}
+
+static uint32_t siw_wc_read_qp_num(struct ibv_cq_ex *base_cq)
+{
+	return (uint32_t)cq_ex2siw(base_cq)->cur_cqe->qp_id;
+}
+
+static unsigned int siw_wc_read_wc_flags(struct ibv_cq_ex *base_cq)
+{
+	/* No immediate data supported yet */
+	return 0;
+}
+
+#define SIW_SUP_CQ_WC_FLAGS (IBV_WC_EX_WITH_BYTE_LEN | IBV_WC_EX_WITH_QP_NUM)
+
+static struct ibv_cq_ex *siw_create_cq_ex(struct ibv_context *ctx,
+					  struct ibv_cq_init_attr_ex *attr)
+{
+	struct siw_cmd_create_cq_ex cmd = {};
+	struct siw_cmd_create_cq_ex_resp resp = {};
+	struct siw_cq *cq;
+	int rv;
+
+	if (!check_comp_mask(attr->comp_mask, IBV_CQ_INIT_ATTR_MASK_FLAGS) ||
+	    !check_comp_mask(attr->wc_flags, SIW_SUP_CQ_WC_FLAGS) ||
+	    (attr->comp_mask & IBV_CQ_INIT_ATTR_MASK_FLAGS &&
+	     !check_comp_mask(attr->flags,
+			      IBV_CREATE_CQ_ATTR_SINGLE_THREADED))) {
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
+
+	cq = calloc(1, sizeof(*cq));
+	if (!cq)
+		return NULL;
+
+	rv = ibv_cmd_create_cq_ex(ctx, attr, &cq->base_cq_ex, &cmd.ibv_cmd,
+				  sizeof(cmd), &resp.ibv_resp, sizeof(resp));
+	if (rv) {
+		if (siw_debug)
+			printf("libsiw: CQ creation failed: %d\n", rv);
+		free(cq);
+		errno = rv;
+		return NULL;
+	}
+	if (siw_map_cq(ctx, cq, &resp.drv_payload)) {
+		ibv_cmd_destroy_cq(&cq->base_cq);
+		free(cq);
+		return NULL;
+	}
+	cq->single_threaded =
+		attr->comp_mask & IBV_CQ_INIT_ATTR_MASK_FLAGS &&
+		attr->flags & IBV_CREATE_CQ_ATTR_SINGLE_THREADED;
+
+	cq->base_cq_ex.start_poll = siw_start_poll;
+	cq->base_cq_ex.next_poll = siw_next_poll;
+	cq->base_cq_ex.end_poll = siw_end_poll;
+	cq->base_cq_ex.read_opcode = siw_wc_read_opcode;
+	cq->base_cq_ex.read_vendor_err = siw_wc_read_vendor_err;
+	cq->base_cq_ex.read_wc_flags = siw_wc_read_wc_flags;
+	if (attr->wc_flags & IBV_WC_EX_WITH_BYTE_LEN)
+		cq->base_cq_ex.read_byte_len = siw_wc_read_byte_len;
+	if (attr->wc_flags & IBV_WC_EX_WITH_QP_NUM)
+		cq->base_cq_ex.read_qp_num = siw_wc_read_qp_num;
+
+	return &cq->base_cq_ex;
+}
+
 static const struct verbs_context_ops siw_context_ops = {
+	.alloc_parent_domain = siw_alloc_parent_domain,
 	.alloc_pd = siw_alloc_pd,
+	.alloc_td = siw_alloc_td,
 	.async_event = siw_async_event,
 	.create_ah = siw_create_ah,
 	.create_cq = siw_create_cq,
+	.create_cq_ex = siw_create_cq_ex,
 	.create_qp = siw_create_qp,
+	.create_qp_ex = siw_create_qp_ex,
 	.create_srq = siw_create_srq,
 	.dealloc_pd = siw_free_pd,
+	.dealloc_td = siw_dealloc_td,
 	.dereg_mr = siw_dereg_mr,
 	.destroy_ah = siw_destroy_ah,
 	.destroy_cq = siw_destroy_cq,
@@ -849,6 +1437,7 @@ static const struct verbs_context_ops siw_context_ops = {
 	.post_recv = siw_post_recv,
 	.post_send = siw_post_send,
 	.post_srq_recv = siw_post_srq_recv,
+	.post_srq_recv_bulk = siw_post_srq_recv_bulk,
 	.query_device = siw_query_device,
 	.query_port = siw_query_port,
 	.query_qp = siw_query_qp,
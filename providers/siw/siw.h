@@ -8,21 +8,41 @@
 
 #include <pthread.h>
 #include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
 
 #include <infiniband/driver.h>
 #include <infiniband/kern-abi.h>
 
+#define SIW_SEND_FLAGS_MASK                                                    \
+	(IBV_SEND_FENCE | IBV_SEND_SIGNALED | IBV_SEND_SOLICITED |             \
+	 IBV_SEND_INLINE)
+
 struct siw_device {
 	struct verbs_device base_dev;
 };
 
+struct siw_td {
+	struct ibv_td base_td;
+	_Atomic(int) refcount;
+};
+
+struct siw_pd {
+	struct ibv_pd base_pd;
+	/* Only set for parent domains */
+	struct siw_pd *protection_domain;
+	struct siw_td *td;
+	_Atomic(int) refcount;
+};
+
 struct siw_srq {
 	struct ibv_srq base_srq;
 	struct siw_rqe *recvq;
 	uint32_t rq_put;
 	uint32_t num_rqe;
 	pthread_spinlock_t lock;
+	bool single_threaded;
 };
 
 struct siw_mr {
@@ -30,13 +50,18 @@ struct siw_mr {
 };
 
 struct siw_qp {
-	struct ibv_qp base_qp;
+	union {
+		struct ibv_qp base_qp;
+		struct verbs_qp vqp;
+	};
 	struct siw_device *siw_dev;
 
 	uint32_t id;
 
 	pthread_spinlock_t sq_lock;
 	pthread_spinlock_t rq_lock;
+	/* Owned by a thread domain, the post paths run without the locks */
+	bool single_threaded;
 
 	struct ibv_post_send db_req;
 	struct ib_uverbs_post_send_resp db_resp;
@@ -45,6 +70,16 @@ struct siw_qp {
 	uint32_t sq_put;
 	int sq_sig_all;
 	struct siw_sqe *sendq;
+	/*
+	 * SQE flags for every combination of the ibv_send_flags siw looks
+	 * at, with sq_sig_all already folded in.
+	 */
+	uint16_t sqe_flags[SIW_SEND_FLAGS_MASK + 1];
+
+	/* ibv_wr_* state, only valid while sq_lock is held by wr_start */
+	uint32_t wr_put;
+	struct siw_sqe *wr_sqe;
+	int wr_err;
 
 	uint32_t num_rqe;
 	uint32_t rq_put;
@@ -53,7 +88,10 @@ struct siw_qp {
 };
 
 struct siw_cq {
-	struct ibv_cq base_cq;
+	union {
+		struct ibv_cq base_cq;
+		struct ibv_cq_ex base_cq_ex;
+	};
 	struct siw_device *siw_dev;
 	uint32_t id;
 
@@ -66,6 +104,10 @@ struct siw_cq {
 	uint32_t cq_get;
 	struct siw_cqe *queue;
 	pthread_spinlock_t lock;
+	bool single_threaded;
+
+	/* CQE currently exposed through the ibv_cq_ex readers */
+	struct siw_cqe *cur_cqe;
 };
 
 struct siw_context {
@@ -78,16 +120,44 @@ static inline struct siw_context *ctx_ibv2siw(struct ibv_context *base)
 	return container_of(base, struct siw_context, base_ctx.context);
 }
 
+static inline struct siw_td *td_base2siw(struct ibv_td *base)
+{
+	return container_of(base, struct siw_td, base_td);
+}
+
+static inline struct siw_pd *pd_base2siw(struct ibv_pd *base)
+{
+	return container_of(base, struct siw_pd, base_pd);
+}
+
+/* QPs and SRQs created on a parent domain with a thread domain */
+static inline bool siw_pd_single_threaded(struct ibv_pd *base)
+{
+	struct siw_pd *pd = pd_base2siw(base);
+
+	return pd->protection_domain && pd->td;
+}
+
 static inline struct siw_qp *qp_base2siw(struct ibv_qp *base)
 {
 	return container_of(base, struct siw_qp, base_qp);
 }
 
+static inline struct siw_qp *qp_ex2siw(struct ibv_qp_ex *base)
+{
+	return container_of(base, struct siw_qp, vqp.qp_ex);
+}
+
 static inline struct siw_cq *cq_base2siw(struct ibv_cq *base)
 {
 	return container_of(base, struct siw_cq, base_cq);
 }
 
+static inline struct siw_cq *cq_ex2siw(struct ibv_cq_ex *base)
+{
+	return container_of(base, struct siw_cq, base_cq_ex);
+}
+
 static inline struct siw_mr *mr_base2siw(struct verbs_mr *base)
 {
 	return container_of(base, struct siw_mr, base_mr);
@@ -98,6 +168,18 @@ static inline struct siw_srq *srq_base2siw(struct ibv_srq *base)
 	return container_of(base, struct siw_srq, base_srq);
 }
 
+static inline void siw_lock(pthread_spinlock_t *lock, bool single_threaded)
+{
+	if (!single_threaded)
+		pthread_spin_lock(lock);
+}
+
+static inline void siw_unlock(pthread_spinlock_t *lock, bool single_threaded)
+{
+	if (!single_threaded)
+		pthread_spin_unlock(lock);
+}
+
 static inline int siw_db(struct siw_qp *qp)
 {
 	int rv = write(qp->base_qp.context->cmd_fd, &qp->db_req,
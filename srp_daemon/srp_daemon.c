@@ -51,8 +51,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <fcntl.h>
 #include <linux/types.h>
+#include <linux/netlink.h>
 #include <endian.h>
 #include <errno.h>
 #include <getopt.h>
@@ -239,28 +241,6 @@ static void usage(const char *argv0)
 	fprintf(stderr, "\nExample: srp_daemon -e -n -i mthca0 -p 1 -R 60\n");
 }
 
-static int
-check_equal_uint64(char *dir_name, const char *attr, uint64_t val)
-{
-	uint64_t attr_value;
-
-	if (srpd_sys_read_uint64(dir_name, attr, &attr_value))
-		return 0;
-
-	return attr_value == val;
-}
-
-static int
-check_equal_uint16(char *dir_name, const char *attr, uint16_t val)
-{
-	uint64_t attr_value;
-
-	if (srpd_sys_read_uint64(dir_name, attr, &attr_value))
-		return 0;
-
-	return val == (attr_value & 0xffff);
-}
-
 static int recalc(struct resources *res);
 
 static void pr_cmd(char *target_str, int not_connected)
@@ -310,40 +290,6 @@ void pr_err(const char *fmt, ...)
 	va_end(args);
 }
 
-static int check_not_equal_str(const char *dir_name, const char *attr,
-			       const char *value)
-{
-	char attr_value[64];
-	int len = strlen(value);
-
-	if (len > sizeof(attr_value)) {
-		pr_err("string %s is too long\n", value);
-		return 1;
-	}
-
-	if (srpd_sys_read_string(dir_name, attr, attr_value,
-				 sizeof(attr_value)))
-		return 0;
-	if (strncmp(attr_value, value, len))
-		return 1;
-
-	return 0;
-}
-
-static int check_not_equal_int(const char *dir_name, const char *attr,
-			       int value)
-{
-	char attr_value[64];
-
-	if (srpd_sys_read_string(dir_name, attr, attr_value,
-				 sizeof(attr_value)))
-		return 0;
-	if (value != atoi(attr_value))
-		return 1;
-
-	return 0;
-}
-
 static int is_enabled_by_rules_file(struct target_details *target)
 {
 	int rule;
@@ -446,81 +392,354 @@ static bool imm_data_size_gt_send_size(unsigned int send_size)
 	return ret;
 }
 
-static int add_non_exist_target(struct target_details *target)
+static long srp_elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 +
+	       (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/*
+ * Index of the SCSI hosts ib_srp created, so that checking whether a
+ * target is already connected does not read the attributes of every SCSI
+ * host again for every target found by a scan.  The index is built from
+ * sysfs once and then kept up to date from the kernel's scsi_host uevents.
+ * Without uevents (no netlink or a synthetic SYSFS_PATH tree) it is rebuilt
+ * at the start of each scan and after every target that was added.
+ */
+enum {
+	SRP_HOST_HASH_BITS = 8,
+	SRP_HOST_HASH_SIZE = 1 << SRP_HOST_HASH_BITS,
+};
+
+struct srp_host {
+	struct srp_host	       *next;
+	char			name[32];
+	uint64_t		id_ext;
+	uint64_t		ioc_guid;
+	uint64_t		service_id;
+	union umad_gid		dgid;
+	uint16_t		pkey;
+	bool			has_pkey;
+	/* Empty or -1 for old kernel modules that do not export these */
+	char			local_ib_device[64];
+	int			local_ib_port;
+};
+
+static struct {
+	pthread_mutex_t		lock;
+	struct srp_host	       *hash[SRP_HOST_HASH_SIZE];
+	int			num_hosts;
+	int			uevent_fd;
+	bool			uevent_tried;
+	bool			stale;
+} srp_hosts = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.uevent_fd = -1,
+	.stale = true,
+};
+
+static unsigned int srp_host_hash(uint64_t id_ext, uint64_t ioc_guid,
+				  uint64_t service_id,
+				  const union umad_gid *dgid)
+{
+	static const uint64_t mult = 0x9e3779b97f4a7c15ull;
+	uint64_t h;
+
+	h = id_ext * mult;
+	h = (h ^ ioc_guid) * mult;
+	h = (h ^ service_id) * mult;
+	h = (h ^ dgid->global.subnet_prefix) * mult;
+	h = (h ^ dgid->global.interface_id) * mult;
+
+	return h >> (64 - SRP_HOST_HASH_BITS);
+}
+
+static void srp_hosts_remove(const char *name)
+{
+	struct srp_host **p, *host;
+	int i;
+
+	for (i = 0; i < SRP_HOST_HASH_SIZE; ++i)
+		for (p = &srp_hosts.hash[i]; (host = *p); p = &host->next)
+			if (!strcmp(host->name, name)) {
+				*p = host->next;
+				free(host);
+				srp_hosts.num_hosts--;
+				return;
+			}
+}
+
+/* Reads the attributes of an SRP SCSI host, other hosts are skipped */
+static void srp_hosts_add(const char *name)
+{
+	char host_dir[256], val[64];
+	struct srp_host *host;
+	uint64_t pkey = 0;
+	unsigned int i;
+
+	srp_hosts_remove(name);
+
+	if (snprintf(host_dir, sizeof(host_dir), "%s/class/scsi_host/%s",
+		     sysfs_path, name) >= sizeof(host_dir))
+		return;
+
+	host = calloc(1, sizeof(*host));
+	if (!host)
+		return;
+
+	if (srpd_sys_read_uint64(host_dir, "id_ext", &host->id_ext) ||
+	    srpd_sys_read_uint64(host_dir, "service_id", &host->service_id) ||
+	    srpd_sys_read_uint64(host_dir, "ioc_guid", &host->ioc_guid))
+		goto skip;
+
+	/*
+	 * In case this is an old kernel that does not have orig_dgid in
+	 * sysfs, use dgid instead (this is problematic when there is a dgid
+	 * redirection by the CM)
+	 */
+	if (srpd_sys_read_gid(host_dir, "orig_dgid", host->dgid.raw) &&
+	    srpd_sys_read_gid(host_dir, "dgid", host->dgid.raw))
+		goto skip;
+
+	host->has_pkey = !srpd_sys_read_uint64(host_dir, "pkey", &pkey);
+	host->pkey = pkey & 0xffff;
+
+	if (srpd_sys_read_string(host_dir, "local_ib_device",
+				 host->local_ib_device,
+				 sizeof(host->local_ib_device)))
+		host->local_ib_device[0] = '\0';
+
+	host->local_ib_port = -1;
+	if (!srpd_sys_read_string(host_dir, "local_ib_port", val, sizeof(val)))
+		host->local_ib_port = atoi(val);
+
+	strncpy(host->name, name, sizeof(host->name) - 1);
+	i = srp_host_hash(host->id_ext, host->ioc_guid, host->service_id,
+			  &host->dgid);
+	host->next = srp_hosts.hash[i];
+	srp_hosts.hash[i] = host;
+	srp_hosts.num_hosts++;
+	return;
+
+skip:
+	free(host);
+}
+
+static void srp_hosts_clear(void)
+{
+	struct srp_host *host;
+	int i;
+
+	for (i = 0; i < SRP_HOST_HASH_SIZE; ++i)
+		while ((host = srp_hosts.hash[i])) {
+			srp_hosts.hash[i] = host->next;
+			free(host);
+		}
+	srp_hosts.num_hosts = 0;
+}
+
+static int srp_hosts_rebuild(void)
 {
 	char scsi_host_dir[256];
-	DIR *dir;
 	struct dirent *subdir;
-	char *subdir_name_ptr;
-	int prefix_len;
-	union umad_gid dgid_val;
-	char target_config_str[255];
-	int len;
-	int not_connected = 1;
-	unsigned int send_size;
+	struct timespec start;
+	DIR *dir;
 
-	pr_debug("Found an SRP target with id_ext %s - check if it is already connected\n", target->id_ext);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	srp_hosts_clear();
 
-	strcpy(scsi_host_dir, "/sys/class/scsi_host/");
-	dir=opendir(scsi_host_dir);
+	snprintf(scsi_host_dir, sizeof(scsi_host_dir), "%s/class/scsi_host",
+		 sysfs_path);
+	dir = opendir(scsi_host_dir);
 	if (!dir) {
-		perror("opendir - /sys/class/scsi_host/");
+		pr_err("opendir - %s: %m\n", scsi_host_dir);
 		return -1;
 	}
-	prefix_len = strlen(scsi_host_dir);
-	subdir_name_ptr = scsi_host_dir + prefix_len;
 
-	subdir = (void *) 1; /* Dummy value to enter the loop */
-	while (subdir) {
-	        subdir = readdir(dir);
+	while ((subdir = readdir(dir)))
+		if (subdir->d_name[0] != '.')
+			srp_hosts_add(subdir->d_name);
+	closedir(dir);
 
-		if (!subdir)
-			continue;
+	srp_hosts.stale = false;
+	pr_debug("indexed %d SRP SCSI hosts in %ld ms\n", srp_hosts.num_hosts,
+		 srp_elapsed_ms(&start));
+	return 0;
+}
 
-		if (subdir->d_name[0] == '.')
-			continue;
+static void srp_hosts_open_uevents(void)
+{
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = 1,	/* kernel uevents */
+	};
+	int fd;
+
+	srp_hosts.uevent_tried = true;
+
+	/* Events describe the real sysfs, not a tree given by SYSFS_PATH */
+	if (strcmp(sysfs_path, "/sys"))
+		return;
 
-		strncpy(subdir_name_ptr, subdir->d_name,
-			sizeof(scsi_host_dir) - prefix_len);
-		if (!check_equal_uint64(scsi_host_dir, "id_ext",
-				        strtoull(target->id_ext, NULL, 16)))
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		    NETLINK_KOBJECT_UEVENT);
+	if (fd < 0) {
+		pr_debug("no uevent socket (%m), rescanning SCSI hosts instead\n");
+		return;
+	}
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr))) {
+		pr_debug("binding the uevent socket failed (%m), rescanning SCSI hosts instead\n");
+		close(fd);
+		return;
+	}
+
+	srp_hosts.uevent_fd = fd;
+	srp_hosts.stale = true;
+}
+
+static void srp_hosts_read_uevents(void)
+{
+	char buf[8192];
+	struct sockaddr_nl addr;
+	struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) - 1 };
+	struct msghdr msg = {
+		.msg_name = &addr,
+		.msg_namelen = sizeof(addr),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+	const char *action, *subsystem, *devpath, *name;
+	ssize_t len;
+	char *p;
+
+	for (;;) {
+		len = recvmsg(srp_hosts.uevent_fd, &msg, 0);
+		if (len < 0) {
+			/* Events were lost, read everything again */
+			if (errno == ENOBUFS) {
+				srp_hosts.stale = true;
+				continue;
+			}
+			return;
+		}
+		if (addr.nl_pid != 0)
 			continue;
-		if (!check_equal_uint16(scsi_host_dir, "pkey", target->pkey) &&
-		    !config->execute)
+
+		buf[len] = '\0';
+		action = subsystem = devpath = NULL;
+		for (p = buf; p < buf + len; p += strlen(p) + 1) {
+			if (!strncmp(p, "ACTION=", 7))
+				action = p + 7;
+			else if (!strncmp(p, "SUBSYSTEM=", 10))
+				subsystem = p + 10;
+			else if (!strncmp(p, "DEVPATH=", 8))
+				devpath = p + 8;
+		}
+		if (!action || !subsystem || !devpath ||
+		    strcmp(subsystem, "scsi_host"))
 			continue;
 
-		if (!check_equal_uint64(scsi_host_dir, "service_id",
-					target->h_service_id))
+		name = strrchr(devpath, '/');
+		name = name ? name + 1 : devpath;
+		pr_debug("scsi_host %s: %s\n", name, action);
+
+		if (!strcmp(action, "remove"))
+			srp_hosts_remove(name);
+		else if (!srp_hosts.stale)
+			srp_hosts_add(name);
+	}
+}
+
+/* Without uevents the index cannot tell when SCSI hosts come and go */
+static void srp_hosts_invalidate(void)
+{
+	pthread_mutex_lock(&srp_hosts.lock);
+	if (srp_hosts.uevent_fd < 0)
+		srp_hosts.stale = true;
+	pthread_mutex_unlock(&srp_hosts.lock);
+}
+
+static void srp_hosts_cleanup(void)
+{
+	pthread_mutex_lock(&srp_hosts.lock);
+	srp_hosts_clear();
+	if (srp_hosts.uevent_fd >= 0)
+		close(srp_hosts.uevent_fd);
+	srp_hosts.uevent_fd = -1;
+	srp_hosts.uevent_tried = false;
+	srp_hosts.stale = true;
+	pthread_mutex_unlock(&srp_hosts.lock);
+}
+
+/* Returns 1 if ib_srp is already connected to @target, 0 if not */
+static int srp_hosts_find(const struct target_details *target)
+{
+	union umad_gid dgid;
+	struct srp_host *host;
+	uint64_t id_ext = strtoull(target->id_ext, NULL, 16);
+	uint64_t ioc_guid = be64toh(target->ioc_prof.guid);
+	int ret = 0;
+
+	dgid.global.subnet_prefix = htobe64(target->subnet_prefix);
+	dgid.global.interface_id = htobe64(target->h_guid);
+
+	pthread_mutex_lock(&srp_hosts.lock);
+	if (!srp_hosts.uevent_tried)
+		srp_hosts_open_uevents();
+	if (srp_hosts.uevent_fd >= 0)
+		srp_hosts_read_uevents();
+	if (srp_hosts.stale && srp_hosts_rebuild()) {
+		ret = -1;
+		goto out;
+	}
+
+	for (host = srp_hosts.hash[srp_host_hash(id_ext, ioc_guid,
+						 target->h_service_id, &dgid)];
+	     host; host = host->next) {
+		if (host->id_ext != id_ext ||
+		    host->ioc_guid != ioc_guid ||
+		    host->service_id != target->h_service_id ||
+		    memcmp(&host->dgid, &dgid, sizeof(dgid)))
 			continue;
-		if (!check_equal_uint64(scsi_host_dir, "ioc_guid",
-					be64toh(target->ioc_prof.guid)))
+		if ((!host->has_pkey || host->pkey != target->pkey) &&
+		    !config->execute)
 			continue;
-		if (srpd_sys_read_gid(scsi_host_dir, "orig_dgid",
-				      dgid_val.raw)) {
-			/*
-			 * In case this is an old kernel that does not have
-			 * orig_dgid in sysfs, use dgid instead (this is
-			 * problematic when there is a dgid redirection
-			 * by the CM)
-			 */
-			if (srpd_sys_read_gid(scsi_host_dir, "dgid",
-					      dgid_val.raw))
-				continue;
-		}
-		if (htobe64(target->subnet_prefix) !=
-		    dgid_val.global.subnet_prefix)
+		/* A missing local_ib_device or local_ib_port counts as equal */
+		if (host->local_ib_device[0] &&
+		    strncmp(host->local_ib_device, config->dev_name,
+			    strlen(config->dev_name)))
 			continue;
-		if (htobe64(target->h_guid) != dgid_val.global.interface_id)
+		if (host->local_ib_port >= 0 &&
+		    host->local_ib_port != config->port_num)
 			continue;
 
-		/* If there is no local_ib_device in the scsi host dir (old kernel module), assumes it is equal */
-		if (check_not_equal_str(scsi_host_dir, "local_ib_device", config->dev_name))
-			continue;
+		ret = 1;
+		break;
+	}
+out:
+	pthread_mutex_unlock(&srp_hosts.lock);
+	return ret;
+}
 
-		/* If there is no local_ib_port in the scsi host dir (old kernel module), assumes it is equal */
-		if (check_not_equal_int(scsi_host_dir, "local_ib_port", config->port_num))
-			continue;
+static int add_non_exist_target(struct target_details *target)
+{
+	char target_config_str[255];
+	int len;
+	int not_connected = 1;
+	unsigned int send_size;
+	int ret;
+
+	pr_debug("Found an SRP target with id_ext %s - check if it is already connected\n", target->id_ext);
+
+	ret = srp_hosts_find(target);
+	if (ret < 0)
+		return -1;
 
+	if (ret) {
 		/* there is a match - this target is already connected */
 
 		/* There is a rare possibility of a race in the following
@@ -548,14 +767,10 @@ static int add_non_exist_target(struct target_details *target)
 		*/
 		if (config->all) {
 			not_connected = 0;
-			break;
+		} else {
+			pr_debug("This target is already connected - skip\n");
+			return 0;
 		}
-
-		pr_debug("This target is already connected - skip\n");
-		closedir(dir);
-
-		return 0;
-
 	}
 
 	len = snprintf(target_config_str, sizeof(target_config_str), "id_ext=%s,"
@@ -571,7 +786,6 @@ static int add_non_exist_target(struct target_details *target)
 		(unsigned long long) target->h_service_id);
 	if (len >= sizeof(target_config_str)) {
 		pr_err("Target config string is too long, ignoring target\n");
-		closedir(dir);
 		return -1;
 	}
 
@@ -582,7 +796,6 @@ static int add_non_exist_target(struct target_details *target)
 
 		if (len >= sizeof(target_config_str)) {
 			pr_err("Target config string is too long, ignoring target\n");
-			closedir(dir);
 			return -1;
 		}
 	}
@@ -595,7 +808,6 @@ static int add_non_exist_target(struct target_details *target)
 
 		if (len >= sizeof(target_config_str)) {
 			pr_err("Target config string is too long, ignoring target\n");
-			closedir(dir);
 			return -1;
 		}
 	}
@@ -607,7 +819,6 @@ static int add_non_exist_target(struct target_details *target)
 
 		if (len >= sizeof(target_config_str)) {
 			pr_err("Target config string is too long, ignoring target\n");
-			closedir(dir);
 			return -1;
 		}
 	}
@@ -620,7 +831,6 @@ static int add_non_exist_target(struct target_details *target)
 
 		if (len >= sizeof(target_config_str)) {
 			pr_err("Target config string is too long, ignoring target\n");
-			closedir(dir);
 			return -1;
 		}
 	}
@@ -639,7 +849,6 @@ static int add_non_exist_target(struct target_details *target)
 
 		if (len >= sizeof(target_config_str)) {
 			pr_err("Target config string is too long, ignoring target\n");
-			closedir(dir);
 			return -1;
 		}
 	}
@@ -647,12 +856,22 @@ static int add_non_exist_target(struct target_details *target)
 	target_config_str[len] = '\0';
 
 	pr_cmd(target_config_str, not_connected);
-
-	closedir(dir);
+	if (config->execute && not_connected)
+		srp_hosts_invalidate();
 
 	return 1;
 }
 
+static uint32_t srp_next_tid(void)
+{
+	static uint32_t tid;
+
+	/* Skip tid 0 because OpenSM ignores it. */
+	if (++tid == 0)
+		++tid;
+	return tid;
+}
+
 static int send_and_get(int portid, int agent, struct srp_ib_user_mad *out_mad,
 		 struct srp_ib_user_mad *in_mad, int in_mad_size)
 {
@@ -661,13 +880,10 @@ static int send_and_get(int portid, int agent, struct srp_ib_user_mad *out_mad,
 	int i, len;
 	int in_agent;
 	int ret;
-	static uint32_t tid;
-	uint32_t received_tid;
+	uint32_t tid, received_tid;
 
 	for (i = 0; i < config->mad_retries; ++i) {
-		/* Skip tid 0 because OpenSM ignores it. */
-		if (++tid == 0)
-			++tid;
+		tid = srp_next_tid();
 		out_dm_mad->mad_hdr.tid = htobe64(tid);
 
 		ret = umad_send(portid, agent, out_mad, MAD_BLOCK_SIZE,
@@ -882,27 +1098,12 @@ static int pkey_to_pkey_index(struct umad_resources *umad_res, uint16_t h_pkey,
 	return res;
 }
 
-static int set_class_port_info(struct umad_resources *umad_res, uint16_t dlid, uint16_t h_pkey)
+static int fill_class_port_info(struct umad_resources *umad_res,
+				struct umad_class_port_info *cpi)
 {
-	struct srp_ib_user_mad		in_mad, out_mad;
-	struct umad_dm_packet	       *out_dm_mad, *in_dm_mad;
-	struct umad_class_port_info    *cpi;
 	char val[64];
 	int i;
 
-	init_srp_dm_mad(&out_mad, umad_res->agent, dlid, UMAD_ATTR_CLASS_PORT_INFO, 0);
-
-	if (pkey_to_pkey_index(umad_res, h_pkey, &out_mad.hdr.addr.pkey_index)
-	    < 0) {
-		pr_err("set_class_port_info: Unable to find pkey_index for pkey %#x\n", h_pkey);
-		return -1;
-	}
-
-	out_dm_mad = get_data_ptr(out_mad);
-	out_dm_mad->mad_hdr.method = UMAD_METHOD_SET;
-
-	cpi                = (void *) out_dm_mad->data;
-
 	if (srpd_sys_read_string(umad_res->port_sysfs_path, "lid", val, sizeof val) < 0) {
 		pr_err("Couldn't read LID\n");
 		return -1;
@@ -918,221 +1119,435 @@ static int set_class_port_info(struct umad_resources *umad_res, uint16_t dlid, u
 	for (i = 0; i < 8; ++i)
 		cpi->trapgid.raw_be16[i] = htobe16(strtol(val + i * 5, NULL, 16));
 
-	if (send_and_get(umad_res->portid, umad_res->agent, &out_mad, &in_mad, 0) < 0)
-		return -1;
+	return 0;
+}
 
-	in_dm_mad = get_data_ptr(in_mad);
-	if (in_dm_mad->mad_hdr.status) {
-		pr_err("Class Port Info set returned status 0x%04x\n",
-			be16toh(in_dm_mad->mad_hdr.status));
-		return -1;
-	}
+/*
+ * The Device Management queries of a scan are pipelined.  Every DM port is
+ * walked by a small state machine (ClassPortInfo for Topspin targets,
+ * IOUnitInfo, then the profile and the service entries of each present IOC)
+ * that keeps one MAD in flight, and up to SRP_DM_MAX_OUTSTANDING ports are
+ * queried at the same time.  Responses are matched to their port by TID and
+ * per-request timeouts and retries are left to the kernel MAD layer, so an
+ * unreachable target no longer stalls the queries to all the others.
+ */
+enum {
+	SRP_DM_MAX_OUTSTANDING = 64,
+};
 
-	return 0;
+enum srp_dm_state {
+	SRP_DM_START,
+	SRP_DM_CLASS_PORT_INFO,
+	SRP_DM_IOU_INFO,
+	SRP_DM_IOC_PROF,
+	SRP_DM_SVC_ENTRIES,
+};
+
+struct srp_dm_port {
+	struct srp_dm_port     *next;
+	enum srp_dm_state	state;
+	int			slot;
+	uint32_t		tid;
+	uint16_t		dlid;
+	uint16_t		pkey_index;
+	int			ioc;	/* index into the controller list */
+	int			svc;	/* first and last requested entry */
+	int			svc_end;
+	struct srp_dm_iou_info	iou_info;
+	struct target_details	target;
+	/* Human readable output, written out once the port is done */
+	FILE		       *out;
+	char		       *out_buf;
+	size_t			out_len;
+};
+
+struct srp_dm_scan {
+	struct resources       *res;
+	struct srp_dm_port     *pending;
+	struct srp_dm_port    **pending_tail;
+	struct srp_dm_port     *active[SRP_DM_MAX_OUTSTANDING];
+	int			num_active;
+	int			num_ports;
+	int			num_mads;
+	int			num_timeouts;
+	struct timespec		start;
+};
+
+#define pr_dm_human(port, arg...)			\
+	do {						\
+		if ((port)->out)			\
+			fprintf((port)->out, arg);	\
+	} while (0)
+
+static void srp_dm_scan_init(struct srp_dm_scan *scan, struct resources *res)
+{
+	memset(scan, 0, sizeof(*scan));
+	scan->res = res;
+	scan->pending_tail = &scan->pending;
+	clock_gettime(CLOCK_MONOTONIC, &scan->start);
+	srp_hosts_invalidate();
 }
 
-static int get_iou_info(struct umad_resources *umad_res, uint16_t dlid,
-			uint16_t h_pkey, struct srp_dm_iou_info *iou_info)
+static void srp_dm_scan_add(struct srp_dm_scan *scan, uint16_t pkey,
+			    uint16_t dlid, uint64_t subnet_prefix,
+			    uint64_t h_guid)
 {
-	struct srp_ib_user_mad		in_mad, out_mad;
-	struct umad_dm_packet	       *in_dm_mad;
+	struct srp_dm_port *port;
 
-	init_srp_dm_mad(&out_mad, umad_res->agent, dlid, SRP_DM_ATTR_IO_UNIT_INFO, 0);
-	if (pkey_to_pkey_index(umad_res, h_pkey, &out_mad.hdr.addr.pkey_index)
-	    < 0) {
-		pr_err("get_iou_info: Unable to find pkey_index for pkey %#x\n", h_pkey);
-		return -1;
-	}
+	pr_debug("queueing DM queries to lid %#x, pkey %#x\n", dlid, pkey);
 
-	if (send_and_get(umad_res->portid, umad_res->agent, &out_mad, &in_mad, 0) < 0)
-		return -1;
+	port = calloc(1, sizeof(*port));
+	if (!port) {
+		pr_err("out of memory\n");
+		return;
+	}
 
-	in_dm_mad = get_data_ptr(in_mad);
-	if (in_dm_mad->mad_hdr.status) {
-		pr_err("IO Unit Info query returned status 0x%04x\n",
-			be16toh(in_dm_mad->mad_hdr.status));
-		return -1;
+	if (pkey_to_pkey_index(scan->res->umad_res, pkey,
+			       &port->pkey_index) < 0) {
+		pr_err("Unable to find pkey_index for pkey %#x\n", pkey);
+		free(port);
+		return;
 	}
 
-	memcpy(iou_info, in_dm_mad->data, sizeof *iou_info);
-/*
-	pr_debug("iou_info->max_controllers is %d\n", iou_info->max_controllers);
-*/
-	return 0;
+	port->dlid = dlid;
+	port->target.pkey = pkey;
+	port->target.subnet_prefix = subnet_prefix;
+	port->target.h_guid = h_guid;
+
+	*scan->pending_tail = port;
+	scan->pending_tail = &port->next;
+	scan->num_ports++;
 }
 
-static int get_ioc_prof(struct umad_resources *umad_res, uint16_t h_dlid, uint16_t h_pkey, int ioc,
-			struct srp_dm_ioc_prof *ioc_prof)
+static void srp_dm_port_done(struct srp_dm_scan *scan, struct srp_dm_port *port)
 {
-	struct srp_ib_user_mad		in_mad, out_mad;
-	struct umad_dm_packet	       *in_dm_mad;
-
-	init_srp_dm_mad(&out_mad, umad_res->agent, h_dlid, SRP_DM_ATTR_IO_CONTROLLER_PROFILE, ioc);
+	scan->active[port->slot] = NULL;
+	scan->num_active--;
 
-	if (pkey_to_pkey_index(umad_res, h_pkey, &out_mad.hdr.addr.pkey_index)
-	    < 0) {
-		pr_err("get_ioc_prof: Unable to find pkey_index for pkey %#x\n",
-		       h_pkey);
-		return -1;
+	if (port->out) {
+		fclose(port->out);
+		fwrite(port->out_buf, 1, port->out_len, stdout);
+		free(port->out_buf);
 	}
+	free(port);
+}
 
-	if (send_and_get(umad_res->portid, umad_res->agent, &out_mad, &in_mad, 0) < 0)
-		return -1;
+static int srp_dm_send(struct srp_dm_scan *scan, struct srp_dm_port *port,
+		       uint16_t h_attr_id, uint32_t h_attr_mod)
+{
+	struct umad_resources	       *umad_res = scan->res->umad_res;
+	struct srp_ib_user_mad		out_mad;
+	struct umad_dm_packet	       *out_dm_mad;
+	int				ret;
 
-	in_dm_mad = get_data_ptr(in_mad);
-	if (in_dm_mad->mad_hdr.status) {
-		pr_err("IO Controller Profile query returned status 0x%04x for %d\n",
-			be16toh(in_dm_mad->mad_hdr.status), ioc);
-		return -1;
+	init_srp_dm_mad(&out_mad, umad_res->agent, port->dlid, h_attr_id,
+			h_attr_mod);
+	out_mad.hdr.addr.pkey_index = port->pkey_index;
+	out_dm_mad = get_data_ptr(out_mad);
+
+	if (h_attr_id == UMAD_ATTR_CLASS_PORT_INFO) {
+		out_dm_mad->mad_hdr.method = UMAD_METHOD_SET;
+		if (fill_class_port_info(umad_res, (void *) out_dm_mad->data))
+			return -1;
 	}
 
-	memcpy(ioc_prof, in_dm_mad->data, sizeof *ioc_prof);
+	port->tid = srp_next_tid();
+	out_dm_mad->mad_hdr.tid = htobe64(port->tid);
+
+	ret = umad_send(umad_res->portid, umad_res->agent, &out_mad,
+			MAD_BLOCK_SIZE, config->timeout, config->mad_retries - 1);
+	if (ret < 0) {
+		pr_err("umad_send to %u failed\n", port->dlid);
+		return ret;
+	}
 
+	scan->num_mads++;
 	return 0;
 }
 
-static int get_svc_entries(struct umad_resources *umad_res, uint16_t dlid, uint16_t h_pkey, int ioc,
-			   int start, int end, struct srp_dm_svc_entries *svc_entries)
+static int srp_dm_ioc_present(const struct srp_dm_iou_info *iou_info, int i)
+{
+	return ((iou_info->controller_list[i / 2] >> (4 * (1 - i % 2))) & 0xf) ==
+		SRP_DM_IOC_PRESENT;
+}
+
+static void srp_dm_print_iou_info(struct srp_dm_port *port)
 {
-	struct srp_ib_user_mad		in_mad, out_mad;
-	struct umad_dm_packet	       *in_dm_mad;
+	struct srp_dm_iou_info *iou_info = &port->iou_info;
+	int i;
 
-	init_srp_dm_mad(&out_mad, umad_res->agent, dlid, SRP_DM_ATTR_SERVICE_ENTRIES,
-			(ioc << 16) | (end << 8) | start);
+	pr_dm_human(port, "IO Unit Info:\n");
+	pr_dm_human(port, "    port LID:        %04x\n", port->dlid);
+	pr_dm_human(port, "    port GID:        %016llx%016llx\n",
+		    (unsigned long long) port->target.subnet_prefix,
+		    (unsigned long long) port->target.h_guid);
+	pr_dm_human(port, "    change ID:       %04x\n", be16toh(iou_info->change_id));
+	pr_dm_human(port, "    max controllers: 0x%02x\n", iou_info->max_controllers);
 
-	if (pkey_to_pkey_index(umad_res, h_pkey, &out_mad.hdr.addr.pkey_index)
-	    < 0) {
-		pr_err("get_svc_entries: Unable to find pkey_index for pkey %#x\n",
-		       h_pkey);
-		return -1;
-	}
+	if (config->verbose > 0)
+		for (i = 0; i < iou_info->max_controllers; ++i) {
+			pr_dm_human(port, "    controller[%3d]: ", i + 1);
+			switch ((iou_info->controller_list[i / 2] >>
+				 (4 * (1 - i % 2))) & 0xf) {
+			case SRP_DM_NO_IOC:      pr_dm_human(port, "not installed\n"); break;
+			case SRP_DM_IOC_PRESENT: pr_dm_human(port, "present\n");       break;
+			case SRP_DM_NO_SLOT:     pr_dm_human(port, "no slot\n");       break;
+			default:                 pr_dm_human(port, "<unknown>\n");     break;
+			}
+		}
+}
 
-	if (send_and_get(umad_res->portid, umad_res->agent, &out_mad, &in_mad, 0) < 0)
-		return -1;
+static void srp_dm_print_ioc_prof(struct srp_dm_port *port)
+{
+	struct srp_dm_ioc_prof *ioc_prof = &port->target.ioc_prof;
+
+	pr_dm_human(port, "    controller[%3d]\n", port->ioc + 1);
+
+	pr_dm_human(port, "        GUID:      %016llx\n",
+		    (unsigned long long) be64toh(ioc_prof->guid));
+	pr_dm_human(port, "        vendor ID: %06x\n", be32toh(ioc_prof->vendor_id) >> 8);
+	pr_dm_human(port, "        device ID: %06x\n", be32toh(ioc_prof->device_id));
+	pr_dm_human(port, "        IO class : %04hx\n", be16toh(ioc_prof->io_class));
+	pr_dm_human(port, "        Maximum size of Send Messages in bytes: %d\n",
+		    be32toh(ioc_prof->send_size));
+	pr_dm_human(port, "        ID:        %s\n", ioc_prof->id);
+	pr_dm_human(port, "        service entries: %d\n", ioc_prof->service_entries);
+}
 
-	in_dm_mad = get_data_ptr(in_mad);
-	if (in_dm_mad->mad_hdr.status) {
-		pr_err("Service Entries query returned status 0x%04x\n",
-			be16toh(in_dm_mad->mad_hdr.status));
-		return -1;
+static void srp_dm_svc_entries(struct srp_dm_scan *scan, struct srp_dm_port *port,
+			       const struct srp_dm_svc_entries *svc_entries)
+{
+	struct target_details *target = &port->target;
+	int k;
+
+	for (k = 0; k <= port->svc_end - port->svc; ++k) {
+		if (sscanf(svc_entries->service[k].name, "SRP.T10:%16s",
+			   target->id_ext) != 1)
+			continue;
+
+		pr_dm_human(port, "            service[%3d]: %016llx / %s\n",
+			    port->svc + k,
+			    (unsigned long long) be64toh(svc_entries->service[k].id),
+			    svc_entries->service[k].name);
+
+		target->h_service_id = be64toh(svc_entries->service[k].id);
+		if (is_enabled_by_rules_file(target)) {
+			if (!add_non_exist_target(target) && !config->once) {
+				target->retry_time =
+					time(NULL) + config->retry_timeout;
+				push_to_retry_list(scan->res->sync_res, target);
+			}
+		}
 	}
+}
 
-	memcpy(svc_entries, in_dm_mad->data, sizeof *svc_entries);
+/*
+ * Picks the next query of @port after the one in port->state completed.
+ * Returns 0 once there is nothing left to ask.
+ */
+static int srp_dm_next_ioc(struct srp_dm_port *port, uint16_t *h_attr_id,
+			   uint32_t *h_attr_mod)
+{
+	while (++port->ioc < port->iou_info.max_controllers) {
+		if (!srp_dm_ioc_present(&port->iou_info, port->ioc))
+			continue;
+
+		pr_dm_human(port, "\n");
+		port->state = SRP_DM_IOC_PROF;
+		*h_attr_id = SRP_DM_ATTR_IO_CONTROLLER_PROFILE;
+		*h_attr_mod = port->ioc + 1;
+		return 1;
+	}
 
+	pr_dm_human(port, "\n");
 	return 0;
 }
 
-static int do_port(struct resources *res, uint16_t pkey, uint16_t dlid,
-		   uint64_t subnet_prefix, uint64_t h_guid)
+static int srp_dm_next_svc(struct srp_dm_port *port, uint16_t *h_attr_id,
+			   uint32_t *h_attr_mod)
 {
-	struct umad_resources 	       *umad_res = res->umad_res;
-	struct srp_dm_iou_info		iou_info;
-	struct srp_dm_svc_entries	svc_entries;
-	int				i, j, k, ret;
+	int num_entries = port->target.ioc_prof.service_entries;
+
+	if (port->svc >= num_entries)
+		return srp_dm_next_ioc(port, h_attr_id, h_attr_mod);
+
+	port->svc_end = port->svc + 3;
+	if (port->svc_end >= num_entries)
+		port->svc_end = num_entries - 1;
 
+	port->state = SRP_DM_SVC_ENTRIES;
+	*h_attr_id = SRP_DM_ATTR_SERVICE_ENTRIES;
+	*h_attr_mod = (port->ioc + 1) << 16 | port->svc_end << 8 | port->svc;
+	return 1;
+}
+
+/*
+ * Consumes the answer to the outstanding query of @port, NULL if that query
+ * failed, and sends the next one.  Releases @port when it is done.
+ */
+static void srp_dm_step(struct srp_dm_scan *scan, struct srp_dm_port *port,
+			struct umad_dm_packet *in_dm_mad)
+{
 	static const uint64_t topspin_oui = 0x0005ad0000000000ull;
 	static const uint64_t oui_mask    = 0xffffff0000000000ull;
+	struct srp_dm_svc_entries svc_entries;
+	uint16_t h_attr_id;
+	uint32_t h_attr_mod;
+	int more;
 
-	struct target_details *target = (struct target_details *)
-		malloc(sizeof(struct target_details));
+	do {
+		switch (port->state) {
+		case SRP_DM_START:
+			if ((port->target.h_guid & oui_mask) == topspin_oui) {
+				port->state = SRP_DM_CLASS_PORT_INFO;
+				h_attr_id = UMAD_ATTR_CLASS_PORT_INFO;
+			} else {
+				port->state = SRP_DM_IOU_INFO;
+				h_attr_id = SRP_DM_ATTR_IO_UNIT_INFO;
+			}
+			h_attr_mod = 0;
+			more = 1;
+			break;
+		case SRP_DM_CLASS_PORT_INFO:
+			if (!in_dm_mad)
+				pr_err("Warning: set of ClassPortInfo failed\n");
+			port->state = SRP_DM_IOU_INFO;
+			h_attr_id = SRP_DM_ATTR_IO_UNIT_INFO;
+			h_attr_mod = 0;
+			more = 1;
+			break;
+		case SRP_DM_IOU_INFO:
+			if (!in_dm_mad) {
+				pr_err("failed to get iou info for dlid %#x\n",
+				       port->dlid);
+				more = 0;
+				break;
+			}
+			memcpy(&port->iou_info, in_dm_mad->data,
+			       sizeof(port->iou_info));
+			srp_dm_print_iou_info(port);
+			port->ioc = -1;
+			more = srp_dm_next_ioc(port, &h_attr_id, &h_attr_mod);
+			break;
+		case SRP_DM_IOC_PROF:
+			if (!in_dm_mad) {
+				more = srp_dm_next_ioc(port, &h_attr_id,
+						       &h_attr_mod);
+				break;
+			}
+			memcpy(&port->target.ioc_prof, in_dm_mad->data,
+			       sizeof(port->target.ioc_prof));
+			srp_dm_print_ioc_prof(port);
+			port->svc = 0;
+			more = srp_dm_next_svc(port, &h_attr_id, &h_attr_mod);
+			break;
+		case SRP_DM_SVC_ENTRIES:
+			if (in_dm_mad) {
+				memcpy(&svc_entries, in_dm_mad->data,
+				       sizeof(svc_entries));
+				srp_dm_svc_entries(scan, port, &svc_entries);
+			}
+			port->svc += 4;
+			more = srp_dm_next_svc(port, &h_attr_id, &h_attr_mod);
+			break;
+		}
 
-	target->subnet_prefix = subnet_prefix;
-	target->h_guid = h_guid;
-	target->options = NULL;
+		if (!more) {
+			srp_dm_port_done(scan, port);
+			return;
+		}
 
- 	pr_debug("enter do_port\n");
-	if ((target->h_guid & oui_mask) == topspin_oui &&
-	    set_class_port_info(umad_res, dlid, pkey))
-		pr_err("Warning: set of ClassPortInfo failed\n");
+		/* A query that cannot be sent counts as a failed one */
+		in_dm_mad = NULL;
+	} while (srp_dm_send(scan, port, h_attr_id, h_attr_mod));
+}
 
-	ret = get_iou_info(umad_res, dlid, pkey, &iou_info);
-	if (ret < 0) {
-		pr_err("failed to get iou info for dlid %#x\n", dlid);
-		goto out;
-	}
+static void srp_dm_start(struct srp_dm_scan *scan)
+{
+	struct srp_dm_port *port;
+	int slot;
 
-	pr_human("IO Unit Info:\n");
-	pr_human("    port LID:        %04x\n", dlid);
-	pr_human("    port GID:        %016llx%016llx\n",
-		 (unsigned long long) target->subnet_prefix,
-		 (unsigned long long) target->h_guid);
-	pr_human("    change ID:       %04x\n", be16toh(iou_info.change_id));
-	pr_human("    max controllers: 0x%02x\n", iou_info.max_controllers);
+	for (slot = 0; scan->pending && slot < SRP_DM_MAX_OUTSTANDING; ++slot) {
+		if (scan->active[slot])
+			continue;
 
-	if (config->verbose > 0)
-		for (i = 0; i < iou_info.max_controllers; ++i) {
-			pr_human("    controller[%3d]: ", i + 1);
-			switch ((iou_info.controller_list[i / 2] >>
-				 (4 * (1 - i % 2))) & 0xf) {
-			case SRP_DM_NO_IOC:      pr_human("not installed\n"); break;
-			case SRP_DM_IOC_PRESENT: pr_human("present\n");       break;
-			case SRP_DM_NO_SLOT:     pr_human("no slot\n");       break;
-			default:                 pr_human("<unknown>\n");     break;
-			}
-		}
+		port = scan->pending;
+		scan->pending = port->next;
+		if (!scan->pending)
+			scan->pending_tail = &scan->pending;
 
-	for (i = 0; i < iou_info.max_controllers; ++i) {
-		if (((iou_info.controller_list[i / 2] >> (4 * (1 - i % 2))) & 0xf) ==
-		    SRP_DM_IOC_PRESENT) {
-			pr_human("\n");
+		if (!config->cmd && !config->execute)
+			port->out = open_memstream(&port->out_buf,
+						   &port->out_len);
+		port->slot = slot;
+		scan->active[slot] = port;
+		scan->num_active++;
+		srp_dm_step(scan, port, NULL);
+	}
+}
 
-			if (get_ioc_prof(umad_res, dlid, pkey, i + 1, &target->ioc_prof))
-				continue;
+static void srp_dm_recv(struct srp_dm_scan *scan)
+{
+	struct umad_resources	       *umad_res = scan->res->umad_res;
+	struct srp_ib_user_mad		in_mad;
+	struct umad_dm_packet	       *in_dm_mad = get_data_ptr(in_mad);
+	struct srp_dm_port	       *port = NULL;
+	int				len = MAD_BLOCK_SIZE;
+	int				in_agent, ret, i;
+	uint32_t			tid;
+
+	/* The kernel times out every query on its own, this is a backstop */
+	in_agent = umad_recv(umad_res->portid, (struct ib_user_mad *) &in_mad,
+			     &len, config->timeout * (config->mad_retries + 1));
+	if (in_agent < 0) {
+		pr_err("umad_recv failed - %d, abandoning %d DM ports\n",
+		       in_agent, scan->num_active);
+		for (i = 0; i < SRP_DM_MAX_OUTSTANDING; ++i)
+			if (scan->active[i])
+				srp_dm_port_done(scan, scan->active[i]);
+		return;
+	}
+	if (in_agent != umad_res->agent) {
+		pr_debug("umad_recv returned different agent\n");
+		return;
+	}
 
-			pr_human("    controller[%3d]\n", i + 1);
-
-			pr_human("        GUID:      %016llx\n",
-				 (unsigned long long) be64toh(target->ioc_prof.guid));
-			pr_human("        vendor ID: %06x\n", be32toh(target->ioc_prof.vendor_id) >> 8);
-			pr_human("        device ID: %06x\n", be32toh(target->ioc_prof.device_id));
-			pr_human("        IO class : %04hx\n", be16toh(target->ioc_prof.io_class));
-			pr_human("        Maximum size of Send Messages in bytes: %d\n",
-				 be32toh(target->ioc_prof.send_size));
-			pr_human("        ID:        %s\n", target->ioc_prof.id);
-			pr_human("        service entries: %d\n", target->ioc_prof.service_entries);
-
-			for (j = 0; j < target->ioc_prof.service_entries; j += 4) {
-				int n;
-
-				n = j + 3;
-				if (n >= target->ioc_prof.service_entries)
-					n = target->ioc_prof.service_entries - 1;
-
-				if (get_svc_entries(umad_res, dlid, pkey, i + 1,
-						    j, n, &svc_entries))
-					continue;
-
-				for (k = 0; k <= n - j; ++k) {
-
-					if (sscanf(svc_entries.service[k].name,
-						   "SRP.T10:%16s",
-						   target->id_ext) != 1)
-						continue;
-
-					pr_human("            service[%3d]: %016llx / %s\n",
-						 j + k,
-						 (unsigned long long) be64toh(svc_entries.service[k].id),
-						 svc_entries.service[k].name);
-
-					target->h_service_id = be64toh(svc_entries.service[k].id);
-					target->pkey = pkey;
-					if (is_enabled_by_rules_file(target)) {
-						if (!add_non_exist_target(target) && !config->once) {
-							target->retry_time =
-								time(NULL) + config->retry_timeout;
-							push_to_retry_list(res->sync_res, target);
-						}
-					}
-				}
-			}
-		}
+	tid = be64toh(in_dm_mad->mad_hdr.tid);
+	for (i = 0; i < SRP_DM_MAX_OUTSTANDING && !port; ++i)
+		if (scan->active[i] && scan->active[i]->tid == tid)
+			port = scan->active[i];
+	if (!port) {
+		pr_debug("umad_recv returned unknown transaction id %u\n", tid);
+		return;
 	}
 
-	pr_human("\n");
+	ret = umad_status(&in_mad);
+	if (ret) {
+		pr_err("bad MAD status (%u) from lid %#x\n", ret, port->dlid);
+		if (ret == ETIMEDOUT)
+			scan->num_timeouts++;
+		srp_dm_step(scan, port, NULL);
+	} else if (in_dm_mad->mad_hdr.status) {
+		pr_err("DM attribute %#x query returned status 0x%04x for lid %#x\n",
+		       be16toh(in_dm_mad->mad_hdr.attr_id),
+		       be16toh(in_dm_mad->mad_hdr.status), port->dlid);
+		srp_dm_step(scan, port, NULL);
+	} else {
+		srp_dm_step(scan, port, in_dm_mad);
+	}
+}
 
-out:
-	free(target);
-	return ret;
+static void srp_dm_scan_run(struct srp_dm_scan *scan)
+{
+	while (scan->pending || scan->num_active) {
+		srp_dm_start(scan);
+		if (scan->num_active)
+			srp_dm_recv(scan);
+	}
+
+	pr_debug("DM scan of %d ports took %ld ms, %d MADs sent, %d timed out\n",
+		 scan->num_ports, srp_elapsed_ms(&scan->start),
+		 scan->num_mads, scan->num_timeouts);
 }
 
 int get_node(struct umad_resources *umad_res, uint16_t dlid, uint64_t *guid)
@@ -1260,11 +1675,13 @@ static int do_dm_port_list(struct resources *res)
 	struct ib_user_mad	       *in_mad;
 	struct umad_sa_packet	       *out_sa_mad, *in_sa_mad;
 	struct srp_sa_port_info_rec    *port_info;
+	struct srp_dm_scan		scan;
 	ssize_t len;
 	int size;
 	int i, j,num_pkeys;
 	uint16_t pkeys[SRP_MAX_SHARED_PKEYS];
 	uint64_t guid;
+	int ret = 0;
 
 	in_mad_buf = malloc(sizeof(struct ib_user_mad) +
 			    node_table_response_size);
@@ -1302,6 +1719,8 @@ static int do_dm_port_list(struct resources *res)
 		return 0;
 	}
 
+	srp_dm_scan_init(&scan, res);
+
 	for (i = 0; (i + 1) * size <= len - MAD_RMPP_HDR_SIZE; ++i) {
 		port_info = (void *) in_sa_mad->data + i * size;
 		if (get_node(umad_res, be16toh(port_info->endport_lid), &guid))
@@ -1312,33 +1731,46 @@ static int do_dm_port_list(struct resources *res)
 		if (num_pkeys < 0) {
 			pr_err("failed to get shared P_Keys with LID %#x\n",
 			       be16toh(port_info->endport_lid));
-			free(in_mad_buf);
-			return num_pkeys;
+			ret = num_pkeys;
+			break;
 		}
 
 		for (j = 0; j < num_pkeys; ++j)
-			do_port(res, pkeys[j], be16toh(port_info->endport_lid),
-				be64toh(port_info->subnet_prefix), guid);
+			srp_dm_scan_add(&scan, pkeys[j],
+					be16toh(port_info->endport_lid),
+					be64toh(port_info->subnet_prefix), guid);
 	}
 
+	/* Still query the ports found before a failure, as before */
+	srp_dm_scan_run(&scan);
+
 	free(in_mad_buf);
-	return 0;
+	return ret;
 }
 
-void handle_port(struct resources *res, uint16_t pkey, uint16_t lid, uint64_t h_guid)
+static void scan_add_port(struct srp_dm_scan *scan, uint16_t pkey,
+			  uint16_t lid, uint64_t h_guid)
 {
-	struct umad_resources *umad_res = res->umad_res;
 	uint64_t subnet_prefix;
 	int isdm;
 
 	pr_debug("enter handle_port for lid %#x\n", lid);
-	if (get_port_info(umad_res, lid, &subnet_prefix, &isdm))
+	if (get_port_info(scan->res->umad_res, lid, &subnet_prefix, &isdm))
 		return;
 
 	if (!isdm)
 		return;
 
-	do_port(res, pkey, lid, subnet_prefix, h_guid);
+	srp_dm_scan_add(scan, pkey, lid, subnet_prefix, h_guid);
+}
+
+void handle_port(struct resources *res, uint16_t pkey, uint16_t lid, uint64_t h_guid)
+{
+	struct srp_dm_scan scan;
+
+	srp_dm_scan_init(&scan, res);
+	scan_add_port(&scan, pkey, lid, h_guid);
+	srp_dm_scan_run(&scan);
 }
 
 
@@ -1350,10 +1782,12 @@ static int do_full_port_list(struct resources *res)
 	struct ib_user_mad	       *in_mad;
 	struct umad_sa_packet	       *out_sa_mad, *in_sa_mad;
 	struct srp_sa_node_rec	       *node;
+	struct srp_dm_scan		scan;
 	ssize_t len;
 	int size;
 	int i, j, num_pkeys;
 	uint16_t pkeys[SRP_MAX_SHARED_PKEYS];
+	int ret = 0;
 
 	in_mad_buf = malloc(sizeof(struct ib_user_mad) +
 			    node_table_response_size);
@@ -1382,6 +1816,8 @@ static int do_full_port_list(struct resources *res)
 
 	size = be16toh(in_sa_mad->attr_offset) * 8;
 
+	srp_dm_scan_init(&scan, res);
+
 	for (i = 0; (i + 1) * size <= len - MAD_RMPP_HDR_SIZE; ++i) {
 		node = (void *) in_sa_mad->data + i * size;
 
@@ -1390,17 +1826,19 @@ static int do_full_port_list(struct resources *res)
 		if (num_pkeys < 0) {
 			pr_err("failed to get shared P_Keys with LID %#x\n",
 			       be16toh(node->lid));
-			free(in_mad_buf);
-			return num_pkeys;
+			ret = num_pkeys;
+			break;
 		}
 
 		for (j = 0; j < num_pkeys; ++j)
-			(void) handle_port(res, pkeys[j], be16toh(node->lid),
-					   be64toh(node->port_guid));
+			scan_add_port(&scan, pkeys[j], be16toh(node->lid),
+				      be64toh(node->port_guid));
 	}
 
+	srp_dm_scan_run(&scan);
+
 	free(in_mad_buf);
-	return 0;
+	return ret;
 }
 
 struct config_t *config;
@@ -1952,6 +2390,7 @@ static void *run_thread_retry_to_connect(void *res_in)
 			if (sleep_time > 0)
 				srp_sleep(sleep_time, 0);
 
+			srp_hosts_invalidate();
 			add_non_exist_target(target);
 			free(target);
 			pthread_mutex_lock(&res->sync_res->retry_mutex);
@@ -2173,6 +2612,7 @@ static int ibsrpdm(int argc, char *argv[])
 		pr_err("Querying SRP targets failed\n");
 
 	free_res(res);
+	srp_hosts_cleanup();
 umad_done:
 	umad_done();
 out:
@@ -2423,6 +2863,7 @@ close_lockfd:
 		close(lockfd);
 cleanup_wakeup:
 	cleanup_wakeup_fd();
+	srp_hosts_cleanup();
 free_config:
 	free_config(config);
 close_log:
@@ -2434,10 +2875,13 @@ out:
 static int recalc(struct resources *res)
 {
 	struct umad_resources *umad_res = res->umad_res;
+	struct timespec start;
 	int  mask_match;
 	char val[7];
 	int ret;
 
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
 	ret = srpd_sys_read_string(umad_res->port_sysfs_path, "sm_lid", val, sizeof val);
 	if (ret < 0) {
 		pr_err("Couldn't read SM LID\n");
@@ -2462,6 +2906,8 @@ static int recalc(struct resources *res)
 		ret = do_full_port_list(res);
 	}
 
+	pr_debug("rescan took %ld ms\n", srp_elapsed_ms(&start));
+
 	return ret;
 }
 
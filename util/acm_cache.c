@@ -0,0 +1,365 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+#define _GNU_SOURCE
+#include <util/acm_cache.h>
+#include <util/util.h>
+#include <ccan/minmax.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ACM_CACHE_MAGIC		0x4143414d	/* "ACAM" */
+#define ACM_CACHE_VERSION	1
+#define ACM_CACHE_WAYS		4
+/* Only the source/destination flags take part in the key */
+#define ACM_CACHE_KEY_FLAGS	0x3
+
+struct acm_cache_entry {
+	_Atomic(uint32_t)	seq;
+	uint16_t		key_cnt;
+	uint16_t		resp_cnt;
+	uint64_t		generation;
+	/* CLOCK_MONOTONIC, in milliseconds */
+	uint64_t		expires;
+	struct acm_cache_ep	key[ACM_CACHE_MAX_EP];
+	struct acm_cache_ep	resp[ACM_CACHE_MAX_EP];
+};
+
+struct acm_cache_hdr {
+	uint32_t		magic;
+	uint32_t		version;
+	uint32_t		entry_size;
+	/* Number of ACM_CACHE_WAYS sized sets, a power of two */
+	uint32_t		num_sets;
+	/* Cleared when the daemon stops using this file */
+	_Atomic(uint32_t)	valid;
+	uint32_t		reserved;
+	_Atomic(uint64_t)	generation;
+	struct acm_cache_entry	entry[];
+};
+
+struct acm_cache {
+	struct acm_cache_hdr	*hdr;
+	size_t			size;
+	/* Writer side only */
+	pthread_mutex_t		lock;
+	uint32_t		timeout;
+};
+
+static uint64_t acm_cache_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static size_t acm_cache_size(uint32_t num_sets)
+{
+	return sizeof(struct acm_cache_hdr) +
+	       (size_t)num_sets * ACM_CACHE_WAYS *
+	       sizeof(struct acm_cache_entry);
+}
+
+/* Copies the key with everything that does not identify a request cleared */
+static uint32_t acm_cache_key(struct acm_cache_ep *dst,
+			      const struct acm_cache_ep *key, int key_cnt)
+{
+	const uint8_t *p = (const uint8_t *)dst;
+	uint32_t hash = 2166136261U;
+	size_t i;
+
+	memset(dst, 0, sizeof(*dst) * ACM_CACHE_MAX_EP);
+	memcpy(dst, key, sizeof(*dst) * key_cnt);
+	for (i = 0; i < key_cnt; i++) {
+		dst[i].flags &= ACM_CACHE_KEY_FLAGS;
+		dst[i].reserved = 0;
+	}
+
+	/* FNV-1a */
+	for (i = 0; i < sizeof(*dst) * key_cnt; i++) {
+		hash ^= p[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static struct acm_cache_entry *acm_cache_set(struct acm_cache_hdr *hdr,
+					     uint32_t hash)
+{
+	return &hdr->entry[(hash & (hdr->num_sets - 1)) * ACM_CACHE_WAYS];
+}
+
+/* Tell the readers of a file left by an earlier daemon to let go of it */
+static void acm_cache_retire(const char *path)
+{
+	struct acm_cache_hdr *hdr;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	if (fstat(fd, &st) || st.st_size < sizeof(*hdr))
+		goto out;
+
+	hdr = mmap(NULL, sizeof(*hdr), PROT_READ | PROT_WRITE, MAP_SHARED,
+		   fd, 0);
+	if (hdr == MAP_FAILED)
+		goto out;
+
+	if (hdr->magic == ACM_CACHE_MAGIC)
+		atomic_store(&hdr->valid, 0);
+	munmap(hdr, sizeof(*hdr));
+out:
+	close(fd);
+}
+
+struct acm_cache *acm_cache_create(const char *path, uint32_t entries,
+				   uint32_t timeout_ms)
+{
+	struct acm_cache *cache;
+	struct acm_cache_hdr *hdr;
+	char tmp[PATH_MAX];
+	uint32_t num_sets;
+	int fd;
+
+	num_sets = roundup_pow_of_two(max_t(uint32_t,
+					    entries / ACM_CACHE_WAYS, 1));
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	cache->size = acm_cache_size(num_sets);
+	cache->timeout = timeout_ms;
+	pthread_mutex_init(&cache->lock, NULL);
+
+	/* Build the file aside so clients never map a half set up cache */
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		goto err_free;
+	}
+
+	fd = mkostemp(tmp, O_CLOEXEC);
+	if (fd < 0)
+		goto err_free;
+
+	if (fchmod(fd, 0644) || ftruncate(fd, cache->size))
+		goto err_unlink;
+
+	hdr = mmap(NULL, cache->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   fd, 0);
+	if (hdr == MAP_FAILED)
+		goto err_unlink;
+
+	hdr->magic = ACM_CACHE_MAGIC;
+	hdr->version = ACM_CACHE_VERSION;
+	hdr->entry_size = sizeof(struct acm_cache_entry);
+	hdr->num_sets = num_sets;
+	atomic_store(&hdr->generation, 1);
+	atomic_store(&hdr->valid, 1);
+
+	acm_cache_retire(path);
+	if (rename(tmp, path)) {
+		munmap(hdr, cache->size);
+		goto err_unlink;
+	}
+
+	close(fd);
+	cache->hdr = hdr;
+	return cache;
+
+err_unlink:
+	unlink(tmp);
+	close(fd);
+err_free:
+	free(cache);
+	return NULL;
+}
+
+void acm_cache_destroy(struct acm_cache *cache, const char *path)
+{
+	atomic_store(&cache->hdr->valid, 0);
+	unlink(path);
+	munmap(cache->hdr, cache->size);
+	free(cache);
+}
+
+void acm_cache_insert(struct acm_cache *cache,
+		      const struct acm_cache_ep *key, int key_cnt,
+		      const struct acm_cache_ep *resp, int resp_cnt)
+{
+	struct acm_cache_ep nkey[ACM_CACHE_MAX_EP];
+	struct acm_cache_entry *set, *e = NULL;
+	uint64_t now, gen;
+	uint32_t hash, seq;
+	int i;
+
+	if (key_cnt < 1 || key_cnt > ACM_CACHE_MAX_EP ||
+	    resp_cnt < 1 || resp_cnt > ACM_CACHE_MAX_EP)
+		return;
+
+	hash = acm_cache_key(nkey, key, key_cnt);
+	set = acm_cache_set(cache->hdr, hash);
+	now = acm_cache_now();
+
+	pthread_mutex_lock(&cache->lock);
+	gen = atomic_load(&cache->hdr->generation);
+
+	/* Same request, then a free or dead way, then the oldest one */
+	for (i = 0; i < ACM_CACHE_WAYS && !e; i++) {
+		if (set[i].key_cnt == key_cnt &&
+		    !memcmp(set[i].key, nkey, sizeof(*nkey) * key_cnt))
+			e = &set[i];
+	}
+	for (i = 0; i < ACM_CACHE_WAYS && !e; i++) {
+		if (!set[i].key_cnt || set[i].generation != gen ||
+		    set[i].expires <= now)
+			e = &set[i];
+	}
+	if (!e) {
+		e = &set[0];
+		for (i = 1; i < ACM_CACHE_WAYS; i++)
+			if (set[i].expires < e->expires)
+				e = &set[i];
+	}
+
+	seq = atomic_load_explicit(&e->seq, memory_order_relaxed);
+	atomic_store_explicit(&e->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	e->key_cnt = key_cnt;
+	e->resp_cnt = resp_cnt;
+	e->generation = gen;
+	e->expires = now + cache->timeout;
+	memcpy(e->key, nkey, sizeof(e->key));
+	memset(e->resp, 0, sizeof(e->resp));
+	memcpy(e->resp, resp, sizeof(*resp) * resp_cnt);
+
+	atomic_store_explicit(&e->seq, seq + 2, memory_order_release);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+void acm_cache_flush(struct acm_cache *cache)
+{
+	atomic_fetch_add(&cache->hdr->generation, 1);
+}
+
+struct acm_cache *acm_cache_open(const char *path)
+{
+	struct acm_cache *cache;
+	struct acm_cache_hdr *hdr;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) || st.st_size < sizeof(*hdr))
+		goto err_close;
+
+	hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED)
+		goto err_close;
+
+	if (hdr->magic != ACM_CACHE_MAGIC ||
+	    hdr->version != ACM_CACHE_VERSION ||
+	    hdr->entry_size != sizeof(struct acm_cache_entry) ||
+	    !hdr->num_sets || (hdr->num_sets & (hdr->num_sets - 1)) ||
+	    acm_cache_size(hdr->num_sets) != st.st_size ||
+	    !atomic_load(&hdr->valid))
+		goto err_unmap;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		goto err_unmap;
+
+	close(fd);
+	cache->hdr = hdr;
+	cache->size = st.st_size;
+	return cache;
+
+err_unmap:
+	munmap(hdr, st.st_size);
+err_close:
+	close(fd);
+	return NULL;
+}
+
+void acm_cache_close(struct acm_cache *cache)
+{
+	munmap(cache->hdr, cache->size);
+	free(cache);
+}
+
+bool acm_cache_stale(struct acm_cache *cache)
+{
+	return !atomic_load_explicit(&cache->hdr->valid, memory_order_relaxed);
+}
+
+int acm_cache_lookup(struct acm_cache *cache,
+		     const struct acm_cache_ep *key, int key_cnt,
+		     struct acm_cache_ep *resp)
+{
+	struct acm_cache_ep nkey[ACM_CACHE_MAX_EP];
+	struct acm_cache_entry *set, *e, copy;
+	uint32_t hash, seq;
+	uint64_t gen;
+	int i, tries;
+
+	if (key_cnt < 1 || key_cnt > ACM_CACHE_MAX_EP)
+		return 0;
+
+	hash = acm_cache_key(nkey, key, key_cnt);
+	set = acm_cache_set(cache->hdr, hash);
+	gen = atomic_load(&cache->hdr->generation);
+
+	for (i = 0; i < ACM_CACHE_WAYS; i++) {
+		e = &set[i];
+		for (tries = 0; tries < 4; tries++) {
+			seq = atomic_load_explicit(&e->seq,
+						   memory_order_acquire);
+			if (seq & 1)
+				continue;
+
+			copy.key_cnt = e->key_cnt;
+			copy.resp_cnt = e->resp_cnt;
+			copy.generation = e->generation;
+			copy.expires = e->expires;
+			memcpy(copy.key, e->key, sizeof(copy.key));
+			memcpy(copy.resp, e->resp, sizeof(copy.resp));
+
+			atomic_thread_fence(memory_order_acquire);
+			if (atomic_load_explicit(&e->seq,
+						 memory_order_relaxed) == seq)
+				break;
+		}
+		if (tries == 4)
+			continue;
+
+		if (copy.key_cnt != key_cnt ||
+		    memcmp(copy.key, nkey, sizeof(*nkey) * key_cnt))
+			continue;
+
+		if (copy.generation != gen || copy.expires <= acm_cache_now() ||
+		    copy.resp_cnt < 1 || copy.resp_cnt > ACM_CACHE_MAX_EP)
+			return 0;
+
+		memcpy(resp, copy.resp, sizeof(*resp) * copy.resp_cnt);
+		return copy.resp_cnt;
+	}
+
+	return 0;
+}
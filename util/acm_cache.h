@@ -0,0 +1,55 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+#ifndef UTIL_ACM_CACHE_H
+#define UTIL_ACM_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * The resolution cache ibacm publishes to its local clients.  The daemon
+ * maps a file under the run directory read/write and records every
+ * successful resolve as the request's endpoint records and the response's
+ * endpoint records.  libacm and librdmacm map the same file read-only and
+ * look a request up there before going to the daemon socket.
+ *
+ * Each slot is guarded by a sequence count that is odd while ibacm rewrites
+ * it, so readers never block the daemon and retry on a torn read.  Bumping
+ * the header generation drops every entry at once, which is how address and
+ * port changes invalidate the cache.
+ *
+ * libacm and librdmacm keep separate copies of the ACM protocol definitions,
+ * so the endpoint records are described here once more.  They must stay
+ * layout compatible with struct acm_ep_addr_data.
+ */
+
+#define ACM_CACHE_MAX_EP	2
+
+struct acm_cache_ep {
+	uint32_t	flags;
+	uint16_t	type;
+	uint16_t	reserved;
+	uint8_t		info[64];
+};
+
+struct acm_cache;
+
+/* ibacm */
+struct acm_cache *acm_cache_create(const char *path, uint32_t entries,
+				   uint32_t timeout_ms);
+void acm_cache_destroy(struct acm_cache *cache, const char *path);
+void acm_cache_insert(struct acm_cache *cache,
+		      const struct acm_cache_ep *key, int key_cnt,
+		      const struct acm_cache_ep *resp, int resp_cnt);
+void acm_cache_flush(struct acm_cache *cache);
+
+/* Clients */
+struct acm_cache *acm_cache_open(const char *path);
+void acm_cache_close(struct acm_cache *cache);
+/* True once the daemon has replaced or removed the file, reopen it */
+bool acm_cache_stale(struct acm_cache *cache);
+/* Returns the number of response records on a hit, 0 on a miss */
+int acm_cache_lookup(struct acm_cache *cache,
+		     const struct acm_cache_ep *key, int key_cnt,
+		     struct acm_cache_ep *resp);
+
+#endif
@@ -0,0 +1,273 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+#include <util/buf_arena.h>
+#include <util/util.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+#include <infiniband/driver.h>
+
+/* Only ia64 requires this */
+#ifdef __ia64__
+#define ARENA_SHM_ADDR ((void *)0x8000000000000000UL)
+#define ARENA_SHMAT_FLAGS (SHM_RND)
+#else
+#define ARENA_SHM_ADDR NULL
+#define ARENA_SHMAT_FLAGS 0
+#endif
+
+int util_arena_init(struct util_buf_arena *arena, size_t chunk_size,
+		    unsigned int flags)
+{
+	if (!chunk_size || (chunk_size & (chunk_size - 1)) ||
+	    chunk_size > UTIL_ARENA_SEG_SIZE)
+		return EINVAL;
+
+	arena->chunk_size = chunk_size;
+	arena->seg_size = UTIL_ARENA_SEG_SIZE;
+	arena->flags = flags;
+	list_head_init(&arena->segs);
+	return pthread_spin_init(&arena->lock, PTHREAD_PROCESS_PRIVATE);
+}
+
+static void arena_seg_free(struct util_buf_arena *arena,
+			   struct util_arena_seg *seg)
+{
+	if (arena->flags & UTIL_ARENA_DONTFORK)
+		ibv_dofork_range(seg->addr, seg->length);
+	if (seg->shmid != -1)
+		shmdt(seg->addr);
+	else
+		munmap(seg->addr, seg->length);
+	free(seg->table);
+	free(seg);
+}
+
+void util_arena_cleanup(struct util_buf_arena *arena)
+{
+	struct util_arena_seg *seg, *tmp;
+
+	list_for_each_safe(&arena->segs, seg, tmp, entry) {
+		list_del(&seg->entry);
+		arena_seg_free(arena, seg);
+	}
+	pthread_spin_destroy(&arena->lock);
+}
+
+static void *arena_map_hugetlb(struct util_arena_seg *seg)
+{
+	void *addr;
+
+	seg->shmid = shmget(IPC_PRIVATE, seg->length,
+			    SHM_HUGETLB | SHM_R | SHM_W);
+	if (seg->shmid == -1)
+		return NULL;
+
+	addr = shmat(seg->shmid, ARENA_SHM_ADDR, ARENA_SHMAT_FLAGS);
+	/* Destroyed once the last attachment goes away */
+	shmctl(seg->shmid, IPC_RMID, NULL);
+	if (addr == (void *)-1) {
+		seg->shmid = -1;
+		return NULL;
+	}
+	return addr;
+}
+
+static void *arena_map_anon(struct util_buf_arena *arena,
+			    struct util_arena_seg *seg)
+{
+	size_t map_len = seg->length;
+	uintptr_t start, aligned;
+	void *addr;
+
+	/*
+	 * THP can only back naturally aligned ranges, so over-map and trim
+	 * the segment down to a seg_size aligned window.
+	 */
+	if (arena->flags & UTIL_ARENA_THP)
+		map_len += arena->seg_size;
+
+	addr = mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED)
+		return NULL;
+
+	if (!(arena->flags & UTIL_ARENA_THP))
+		return addr;
+
+	start = (uintptr_t)addr;
+	aligned = align(start, arena->seg_size);
+	if (aligned != start)
+		munmap(addr, aligned - start);
+	if (start + map_len != aligned + seg->length)
+		munmap((void *)(aligned + seg->length),
+		       start + map_len - (aligned + seg->length));
+
+	addr = (void *)aligned;
+#ifdef MADV_HUGEPAGE
+	madvise(addr, seg->length, MADV_HUGEPAGE);
+#endif
+	return addr;
+}
+
+static struct util_arena_seg *arena_seg_alloc(struct util_buf_arena *arena,
+					      size_t size)
+{
+	struct util_arena_seg *seg;
+
+	seg = calloc(1, sizeof(*seg));
+	if (!seg)
+		return NULL;
+
+	seg->shmid = -1;
+	seg->length = align(size, arena->seg_size);
+	seg->nchunks = seg->length / arena->chunk_size;
+	seg->avail = seg->nchunks;
+	seg->table = bitmap_alloc0(seg->nchunks);
+	if (!seg->table)
+		goto err_free;
+
+	if (arena->flags & UTIL_ARENA_HUGETLB)
+		seg->addr = arena_map_hugetlb(seg);
+	else
+		seg->addr = arena_map_anon(arena, seg);
+	if (!seg->addr)
+		goto err_table;
+
+	/*
+	 * Done once for the whole segment, doing it per buffer would split
+	 * the mapping into VMAs too small to keep their huge pages.
+	 */
+	if ((arena->flags & UTIL_ARENA_DONTFORK) &&
+	    ibv_dontfork_range(seg->addr, seg->length))
+		goto err_unmap;
+
+	return seg;
+
+err_unmap:
+	if (seg->shmid != -1)
+		shmdt(seg->addr);
+	else
+		munmap(seg->addr, seg->length);
+err_table:
+	free(seg->table);
+err_free:
+	free(seg);
+	return NULL;
+}
+
+static long seg_find_range(struct util_arena_seg *seg, unsigned long start,
+			   unsigned long cnt)
+{
+	unsigned long busy;
+
+	while (start + cnt <= seg->nchunks) {
+		busy = bitmap_ffs(seg->table, start, start + cnt);
+		if (busy == start + cnt)
+			return start;
+		start = busy + 1;
+	}
+	return -1;
+}
+
+static long seg_alloc_range(struct util_arena_seg *seg, unsigned long cnt)
+{
+	long base;
+
+	if (seg->avail < cnt)
+		return -1;
+
+	base = seg_find_range(seg, seg->last, cnt);
+	if (base < 0 && seg->last)
+		base = seg_find_range(seg, 0, cnt);
+	if (base < 0)
+		return -1;
+
+	bitmap_fill_range(seg->table, base, base + cnt);
+	seg->avail -= cnt;
+	seg->last = base + cnt;
+	if (seg->last >= seg->nchunks)
+		seg->last = 0;
+	return base;
+}
+
+static void seg_free_range(struct util_arena_seg *seg, unsigned long base,
+			   unsigned long cnt)
+{
+	bitmap_zero_range(seg->table, base, base + cnt);
+	seg->avail += cnt;
+	if (base < seg->last)
+		seg->last = base;
+}
+
+static void arena_release(struct util_buf_arena *arena,
+			  struct util_arena_buf *buf)
+{
+	struct util_arena_seg *seg = buf->seg;
+
+	pthread_spin_lock(&arena->lock);
+	seg_free_range(seg, buf->base, buf->length / arena->chunk_size);
+	if (seg->avail == seg->nchunks) {
+		list_del(&seg->entry);
+		pthread_spin_unlock(&arena->lock);
+		arena_seg_free(arena, seg);
+	} else {
+		pthread_spin_unlock(&arena->lock);
+	}
+	buf->seg = NULL;
+}
+
+int util_arena_alloc(struct util_buf_arena *arena, struct util_arena_buf *buf,
+		     size_t size)
+{
+	struct util_arena_seg *seg;
+	unsigned long nchunk;
+	long base = -1;
+
+	buf->length = align(size, arena->chunk_size);
+	buf->seg = NULL;
+	buf->buf = NULL;
+	nchunk = buf->length / arena->chunk_size;
+	if (!nchunk)
+		return 0;
+
+	pthread_spin_lock(&arena->lock);
+	list_for_each(&arena->segs, seg, entry) {
+		base = seg_alloc_range(seg, nchunk);
+		if (base >= 0)
+			break;
+	}
+	pthread_spin_unlock(&arena->lock);
+
+	if (base < 0) {
+		seg = arena_seg_alloc(arena, buf->length);
+		if (!seg)
+			return ENOMEM;
+		base = seg_alloc_range(seg, nchunk);
+
+		/* Keep segments with free room at the head of the scan */
+		pthread_spin_lock(&arena->lock);
+		if (seg->avail)
+			list_add(&arena->segs, &seg->entry);
+		else
+			list_add_tail(&arena->segs, &seg->entry);
+		pthread_spin_unlock(&arena->lock);
+	}
+
+	buf->seg = seg;
+	buf->base = base;
+	buf->buf = seg->addr + base * arena->chunk_size;
+
+	return 0;
+}
+
+void util_arena_free(struct util_buf_arena *arena, struct util_arena_buf *buf)
+{
+	if (!buf->seg)
+		return;
+
+	arena_release(arena, buf);
+}
@@ -0,0 +1,62 @@
+/* GPLv2 or OpenIB.org BSD (MIT) See COPYING file */
+#ifndef UTIL_BUF_ARENA_H
+#define UTIL_BUF_ARENA_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <ccan/bitmap.h>
+#include <ccan/list.h>
+
+/*
+ * A per-context sub-allocator for queue buffers. Buffers are carved out of
+ * large segments in chunk_size units so that many small QP/CQ/SRQ rings share
+ * pages (and huge page TLB entries) instead of each getting its own mapping.
+ */
+enum {
+	/* Back segments with SysV SHM_HUGETLB memory */
+	UTIL_ARENA_HUGETLB = 1 << 0,
+	/* Anonymous segments, advised for transparent huge pages */
+	UTIL_ARENA_THP = 1 << 1,
+	/* Apply ibv_dontfork_range() to every segment */
+	UTIL_ARENA_DONTFORK = 1 << 2,
+};
+
+#define UTIL_ARENA_SEG_SIZE (2UL * 1024 * 1024)
+
+struct util_arena_seg {
+	struct list_node entry;
+	void *addr;
+	size_t length;
+	int shmid;
+	unsigned long nchunks;
+	unsigned long avail;
+	/* Hint for the next first-fit scan */
+	unsigned long last;
+	bitmap *table;
+};
+
+struct util_buf_arena {
+	pthread_spinlock_t lock;
+	struct list_head segs;
+	size_t chunk_size;
+	size_t seg_size;
+	unsigned int flags;
+};
+
+struct util_arena_buf {
+	void *buf;
+	size_t length;
+	struct util_arena_seg *seg;
+	unsigned long base;
+};
+
+/* chunk_size must be a power of two and a multiple of the system page size */
+int util_arena_init(struct util_buf_arena *arena, size_t chunk_size,
+		    unsigned int flags);
+void util_arena_cleanup(struct util_buf_arena *arena);
+
+int util_arena_alloc(struct util_buf_arena *arena, struct util_arena_buf *buf,
+		     size_t size);
+void util_arena_free(struct util_buf_arena *arena, struct util_arena_buf *buf);
+
+#endif